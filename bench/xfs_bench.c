@@ -0,0 +1,891 @@
+#include "../include/xfs_io.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_disk.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_ring.h"
+#include "../include/xfs_workq.h"
+#include "../include/xfs_image.h"
+#include "../include/xfs_numa.h"
+#include "../include/xfs_quota.h"
+#include "../include/xfs_types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+// fio-style workload generator for the XFS simulator.
+// Each job runs on its own thread against its own file (or one shared
+// file with -F) and records per-operation latency for the final report.
+// The sync engine keeps iodepth I/Os in flight with iodepth threads per
+// job; the ring engine submits them from one thread through an xfs_ring.
+
+typedef enum {
+    JOB_SEQREAD,
+    JOB_SEQWRITE,
+    JOB_RANDREAD,
+    JOB_RANDWRITE,
+    JOB_APPEND,
+    JOB_CREATE,
+    JOB_MIXED,
+    JOB_CHURN
+} job_type_t;
+
+static const char *job_names[] = {
+    "seqread", "seqwrite", "randread", "randwrite", "append", "create", "mixed", "churn"
+};
+
+// Benchmark configuration (command line knobs)
+typedef struct {
+    job_type_t job;
+    int threads;          // Number of jobs
+    int iodepth;          // I/Os in flight per job
+    size_t block_size;    // Bytes per operation
+    size_t file_size;     // Bytes per file
+    double duration;      // Seconds to run
+    long max_ops;         // Per-submitter op limit (0 = unlimited)
+    int read_pct;         // Read percentage for the mixed job
+    int shared_file;      // All jobs use one file
+    int prealloc;         // Preallocate each file's full size before writing it
+    int no_pools;         // Allocate every block from the AGs, bypassing per-thread pools
+    int ring;             // Submit through an xfs_ring instead of one thread per I/O
+    int ring_workers;     // Worker threads per ring
+    int fsync_every;      // Commit a log barrier after every n writes (0 = never)
+    int bg_threads;       // Background pool threads (0 = one per online CPU)
+    unsigned int log_delay_us;  // Simulated log flush latency
+    uint64_t log_size;          // Log size in bytes
+    uint64_t cil_push;          // CIL size that closes a checkpoint (0 = an eighth of the log)
+    int ail_push_pct;           // Log use that starts an AIL push
+    unsigned int writeback_delay_us;  // Simulated metadata writeback latency per batch
+    const char *ag_policy;      // AG selection policy
+    xfs_mkfs_opts_t geom;       // Filesystem geometry
+    xfs_mount_opts_t mount;     // Mount options
+    const char *load_image;     // Start from this image instead of mkfs+mount
+    const char *save_image;     // Save the laid-out filesystem here before the run
+    double freesp_interval;     // Seconds between free space reports during the run (0 = only at the end)
+    int numa_nodes;             // NUMA affinity: -1 = off, 0 = the machine's nodes, n = emulate n nodes
+    int quota;                  // Quotas on: job j's files belong to user 1000 + j
+    uint64_t quota_limit;       // Hard block limit of each job's user in bytes (0 = accounting only)
+    unsigned long seed;
+} bench_config_t;
+
+// Growable latency sample array
+typedef struct {
+    uint64_t *ns;
+    size_t count;
+    size_t cap;
+} lat_samples_t;
+
+// Per-submitter state
+typedef struct {
+    int id;
+    int job_id;
+    xfs_inode_t *inode;
+    uint64_t rng;
+    uint64_t next_off;
+    long ops;
+    long writes;
+    long errors;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    lat_samples_t read_lat;
+    lat_samples_t write_lat;
+    pthread_t thread;
+} bench_worker_t;
+
+static bench_config_t cfg;
+
+#define BENCH_QUOTA_UID 1000  // With quotas on, job j's files belong to this user + j and this group
+static volatile int bench_stop = 0;
+static int bench_done = 0;  // Submitters that have exited
+static pthread_barrier_t start_barrier;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static int lat_add(lat_samples_t *lat, uint64_t ns) {
+    if (lat->count == lat->cap) {
+        size_t new_cap = lat->cap ? lat->cap * 2 : 4096;
+        uint64_t *p = (uint64_t *)realloc(lat->ns, new_cap * sizeof(uint64_t));
+        if (p == NULL) {
+            return -1;
+        }
+        lat->ns = p;
+        lat->cap = new_cap;
+    }
+    lat->ns[lat->count++] = ns;
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Parse a size with an optional k/m/g/t suffix
+static size_t parse_size(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    switch (*end) {
+        case 'k': case 'K': v *= 1024; break;
+        case 'm': case 'M': v *= 1024 * 1024; break;
+        case 'g': case 'G': v *= 1024.0 * 1024 * 1024; break;
+        case 't': case 'T': v *= 1024.0 * 1024 * 1024 * 1024; break;
+        default: break;
+    }
+    return (size_t)v;
+}
+
+// Pick the offset for the next operation of this submitter
+static off_t next_offset(bench_worker_t *w, int sequential) {
+    uint64_t nblocks = cfg.file_size / cfg.block_size;
+    if (nblocks == 0) {
+        nblocks = 1;
+    }
+
+    if (sequential) {
+        uint64_t off = w->next_off;
+        w->next_off = (w->next_off + cfg.block_size) % (nblocks * cfg.block_size);
+        return (off_t)off;
+    }
+    return (off_t)((xorshift64(&w->rng) % nblocks) * cfg.block_size);
+}
+
+// Run one timed operation, returning -1 on error
+static int do_read(bench_worker_t *w, char *buf, off_t off) {
+    uint64_t t0 = now_ns();
+    int ret = xfs_sim_read(w->inode, buf, cfg.block_size, off);
+    uint64_t t1 = now_ns();
+    if (ret < 0) {
+        w->errors++;
+        return -1;
+    }
+    w->bytes_read += ret;
+    lat_add(&w->read_lat, t1 - t0);
+    return 0;
+}
+
+// Count a write; 1 if it is due an fsync (a log barrier, timed as part of the write)
+static int fsync_due(bench_worker_t *w) {
+    w->writes++;
+    return cfg.fsync_every > 0 && w->writes % cfg.fsync_every == 0;
+}
+
+static int do_write(bench_worker_t *w, xfs_inode_t *inode, char *buf, off_t off) {
+    uint64_t t0 = now_ns();
+    int ret = xfs_sim_write(inode, buf, cfg.block_size, off);
+    if (ret >= 0 && fsync_due(w) && trans_commit_barrier() != 0) {
+        ret = -1;
+    }
+    uint64_t t1 = now_ns();
+    if (ret < 0) {
+        w->errors++;
+        return -1;
+    }
+    w->bytes_written += ret;
+    lat_add(&w->write_lat, t1 - t0);
+    return 0;
+}
+
+// Open a fresh file for append/create jobs
+static xfs_inode_t *bench_new_file(bench_worker_t *w) {
+    char name[64];
+    snprintf(name, sizeof(name), "bench.%d.%ld", w->id, w->ops);
+    int ino = xfs_create_named_file(name);
+    xfs_inode_t *inode = ino > 0 ? get_inode_ptr(ino) : NULL;
+    if (inode != NULL && cfg.quota) {
+        xfs_chown(inode, BENCH_QUOTA_UID + w->job_id, BENCH_QUOTA_UID);
+    }
+    if (inode != NULL && cfg.prealloc) {
+        xfs_fallocate(inode, 0, cfg.file_size, XFS_FALLOC_KEEP_SIZE);
+    }
+    return inode;
+}
+
+// With NUMA affinity on, job j's threads run (and its file is laid out) on node j % nodes
+static void bench_bind_job(int job_id) {
+    if (cfg.numa_nodes >= 0) {
+        xfs_numa_bind_thread(job_id % xfs_numa_nodes());
+    }
+}
+
+static void *bench_worker(void *arg) {
+    bench_worker_t *w = (bench_worker_t *)arg;
+    bench_bind_job(w->job_id);
+    char *buf = (char *)malloc(cfg.block_size);
+    if (buf == NULL) {
+        w->errors++;
+        pthread_barrier_wait(&start_barrier);
+        __atomic_add_fetch(&bench_done, 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    memset(buf, 'a' + (w->id % 26), cfg.block_size);
+
+    pthread_barrier_wait(&start_barrier);
+
+    while (!bench_stop && (cfg.max_ops == 0 || w->ops < cfg.max_ops)) {
+        int ret = 0;
+
+        switch (cfg.job) {
+            case JOB_SEQREAD:
+                ret = do_read(w, buf, next_offset(w, 1));
+                break;
+            case JOB_RANDREAD:
+                ret = do_read(w, buf, next_offset(w, 0));
+                break;
+            case JOB_SEQWRITE:
+                ret = do_write(w, w->inode, buf, next_offset(w, 1));
+                break;
+            case JOB_RANDWRITE:
+                ret = do_write(w, w->inode, buf, next_offset(w, 0));
+                break;
+            case JOB_MIXED:
+                if ((int)(xorshift64(&w->rng) % 100) < cfg.read_pct) {
+                    ret = do_read(w, buf, next_offset(w, 0));
+                } else {
+                    ret = do_write(w, w->inode, buf, next_offset(w, 0));
+                }
+                break;
+            case JOB_APPEND:
+                // Start a new file once the current one reaches the file size
+                if (w->inode == NULL || w->inode->di_size + cfg.block_size > cfg.file_size) {
+                    w->inode = bench_new_file(w);
+                    if (w->inode == NULL) {
+                        w->errors++;
+                        ret = -1;
+                        break;
+                    }
+                }
+                ret = do_write(w, w->inode, buf, (off_t)w->inode->di_size);
+                break;
+            case JOB_CREATE: {
+                uint64_t t0 = now_ns();
+                xfs_inode_t *inode = bench_new_file(w);
+                if (inode == NULL) {
+                    w->errors++;
+                    ret = -1;
+                    break;
+                }
+                int wr = xfs_sim_write(inode, buf, cfg.block_size, 0);
+                if (wr >= 0 && fsync_due(w) && trans_commit_barrier() != 0) {
+                    wr = -1;
+                }
+                uint64_t t1 = now_ns();
+                if (wr < 0) {
+                    w->errors++;
+                    ret = -1;
+                    break;
+                }
+                w->bytes_written += wr;
+                lat_add(&w->write_lat, t1 - t0);
+                break;
+            }
+            case JOB_CHURN: {
+                // Create, fill and remove a file; each cycle is one sample
+                uint64_t t0 = now_ns();
+                xfs_inode_t *inode = bench_new_file(w);
+                if (inode == NULL) {
+                    w->errors++;
+                    ret = -1;
+                    break;
+                }
+                int ino = (int)inode->inode_num;
+                int wr = 0;
+                for (size_t off = 0; off + cfg.block_size <= cfg.file_size && wr >= 0; off += cfg.block_size) {
+                    wr = xfs_sim_write(inode, buf, cfg.block_size, off);
+                    if (wr > 0) {
+                        w->bytes_written += wr;
+                    }
+                }
+                int rm = xfs_unlink(ino);
+                uint64_t t1 = now_ns();
+                if (wr < 0 || rm != 0) {
+                    w->errors++;
+                    ret = -1;
+                    break;
+                }
+                lat_add(&w->write_lat, t1 - t0);
+                break;
+            }
+        }
+
+        // Out of inodes or space: this submitter is done
+        if (ret != 0 && (cfg.job == JOB_APPEND || cfg.job == JOB_CREATE || cfg.job == JOB_CHURN)) {
+            break;
+        }
+        w->ops++;
+    }
+
+    free(buf);
+    __atomic_add_fetch(&bench_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// An I/O in flight on a ring: a chain of entries whose last one carries the slot index
+typedef struct {
+    uint64_t start_ns;
+    int is_read;
+    char *buf;
+    char name[64];        // File a create chain makes
+} ring_slot_t;
+
+#define RING_CHAIN_ENTRY UINT64_MAX  // user_data of entries before the last in a chain
+
+// Queue the next I/O of this job on the ring; -1 if it does not fit
+static int ring_queue(bench_worker_t *w, xfs_ring_t *ring, ring_slot_t *slot, uint64_t tag) {
+    xfs_sqe_t *sqe[3];
+    int n = 0;
+    int create = cfg.job == JOB_CREATE;
+    int is_read = cfg.job == JOB_SEQREAD || cfg.job == JOB_RANDREAD ||
+                  (cfg.job == JOB_MIXED && (int)(xorshift64(&w->rng) % 100) < cfg.read_pct);
+    int chain = 1 + create + (!is_read && cfg.fsync_every > 0 && (w->writes + 1) % cfg.fsync_every == 0);
+
+    for (n = 0; n < chain; n++) {
+        sqe[n] = xfs_ring_get_sqe(ring);
+        if (sqe[n] == NULL) {
+            return -1;  // Not reached: the ring has room for three entries per slot
+        }
+        sqe[n]->flags = n + 1 < chain ? XFS_SQE_LINK : 0;
+        sqe[n]->user_data = n + 1 < chain ? RING_CHAIN_ENTRY : tag;
+    }
+
+    n = 0;
+    if (create) {
+        snprintf(slot->name, sizeof(slot->name), "bench.%d.%ld", w->id, w->ops);
+        sqe[n]->opcode = XFS_RING_OP_CREATE;
+        sqe[n++]->buf = slot->name;
+    }
+    sqe[n]->opcode = is_read ? XFS_RING_OP_READ : XFS_RING_OP_WRITE;
+    sqe[n]->inode_num = create ? XFS_RING_PREV_INODE : (int)w->inode->inode_num;
+    sqe[n]->buf = slot->buf;
+    sqe[n]->len = cfg.block_size;
+    sqe[n++]->offset = create ? 0 : next_offset(w, cfg.job == JOB_SEQREAD || cfg.job == JOB_SEQWRITE);
+    if (!is_read && fsync_due(w)) {
+        sqe[n]->opcode = XFS_RING_OP_FSYNC;
+    }
+
+    slot->is_read = is_read;
+    slot->start_ns = now_ns();
+    return 0;
+}
+
+// Ring engine submitter: one thread keeps iodepth I/Os in flight
+static void *bench_ring_worker(void *arg) {
+    bench_worker_t *w = (bench_worker_t *)arg;
+    bench_bind_job(w->job_id);  // Before the ring starts, so its workers inherit the node
+    xfs_ring_t *ring = xfs_ring_create(cfg.iodepth * 3, cfg.ring_workers);
+    ring_slot_t *slots = (ring_slot_t *)calloc(cfg.iodepth, sizeof(ring_slot_t));
+    int *free_slots = (int *)malloc(cfg.iodepth * sizeof(int));
+    char *bufs = (char *)malloc(cfg.iodepth * cfg.block_size);
+    if (ring == NULL || slots == NULL || free_slots == NULL || bufs == NULL) {
+        w->errors++;
+        pthread_barrier_wait(&start_barrier);
+        xfs_ring_destroy(ring);
+        free(slots);
+        free(free_slots);
+        free(bufs);
+        __atomic_add_fetch(&bench_done, 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    memset(bufs, 'a' + (w->id % 26), cfg.iodepth * cfg.block_size);
+    int nfree = cfg.iodepth;
+    for (int i = 0; i < cfg.iodepth; i++) {
+        slots[i].buf = bufs + (size_t)i * cfg.block_size;
+        free_slots[i] = i;
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    int stopped = 0;  // Out of inodes or space
+    for (;;) {
+        int queued = 0;
+        while (nfree > 0 && !bench_stop && !stopped && (cfg.max_ops == 0 || w->ops < cfg.max_ops)) {
+            int i = free_slots[nfree - 1];
+            if (ring_queue(w, ring, &slots[i], (uint64_t)i) != 0) {
+                break;
+            }
+            nfree--;
+            queued++;
+            w->ops++;
+        }
+        if (queued > 0) {
+            xfs_ring_submit(ring);
+        }
+
+        xfs_cqe_t *cqe;
+        if (xfs_ring_wait_cqe(ring, &cqe) != 0) {
+            break;  // Nothing in flight and nothing more to submit
+        }
+        do {
+            if (cqe->user_data != RING_CHAIN_ENTRY) {
+                ring_slot_t *slot = &slots[cqe->user_data];
+                uint64_t t1 = now_ns();
+                if (cqe->res < 0) {
+                    w->errors++;
+                    stopped |= cfg.job == JOB_CREATE;
+                } else if (slot->is_read) {
+                    w->bytes_read += cfg.block_size;
+                    lat_add(&w->read_lat, t1 - slot->start_ns);
+                } else {
+                    w->bytes_written += cfg.block_size;
+                    lat_add(&w->write_lat, t1 - slot->start_ns);
+                }
+                free_slots[nfree++] = (int)cqe->user_data;
+            }
+            xfs_ring_cqe_seen(ring, cqe);
+        } while ((cqe = xfs_ring_peek_cqe(ring)) != NULL);
+    }
+
+    xfs_ring_destroy(ring);
+    free(slots);
+    free(free_slots);
+    free(bufs);
+    __atomic_add_fetch(&bench_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Lay out a file by writing it sequentially so read/overwrite jobs hit mapped blocks
+static xfs_inode_t *bench_layout_file(const char *name) {
+    // A file from a loaded image that already covers the file size is reused
+    int ino = get_inode_num_by_name(name);
+    if (ino > 0 && get_inode_ptr(ino)->di_size >= cfg.file_size) {
+        return get_inode_ptr(ino);
+    }
+    ino = ino > 0 ? ino : xfs_create_named_file(name);
+    xfs_inode_t *inode = ino > 0 ? get_inode_ptr(ino) : NULL;
+    if (inode == NULL) {
+        return NULL;
+    }
+    if (cfg.prealloc) {
+        xfs_fallocate(inode, 0, cfg.file_size, XFS_FALLOC_KEEP_SIZE);
+    }
+
+    char *buf = (char *)malloc(cfg.block_size);
+    if (buf == NULL) {
+        return NULL;
+    }
+    memset(buf, 'x', cfg.block_size);
+
+    for (size_t off = 0; off + cfg.block_size <= cfg.file_size; off += cfg.block_size) {
+        if (xfs_sim_write(inode, buf, cfg.block_size, off) < 0) {
+            free(buf);
+            return NULL;
+        }
+    }
+
+    free(buf);
+    return inode;
+}
+
+// One line of free space fragmentation and extents per file
+static void print_freesp_line(const char *label) {
+    xfs_freesp_t fs;
+    xfs_extent_hist_t eh;
+    if (xfs_alloc_freesp_all(&fs, NULL) != 0 || xfs_file_extent_hist(&eh) != 0) {
+        return;
+    }
+    uint64_t small = fs.extents[0] + fs.extents[1] + fs.extents[2] + fs.extents[3];
+    printf("  %s: %llu free extents (avg %.1f blocks, longest %llu, %llu under 16 blocks); "
+           "%llu files, avg %.2f extents\n",
+           label, (unsigned long long)fs.total_extents,
+           fs.total_extents ? (double)fs.total_blocks / fs.total_extents : 0.0,
+           (unsigned long long)fs.longest, (unsigned long long)small,
+           (unsigned long long)eh.files, eh.files ? (double)eh.extents / eh.files : 0.0);
+}
+
+static void print_latency(const char *label, lat_samples_t *lat) {
+    if (lat->count == 0) {
+        return;
+    }
+
+    qsort(lat->ns, lat->count, sizeof(uint64_t), cmp_u64);
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < lat->count; i++) {
+        sum += lat->ns[i];
+    }
+
+    size_t p50 = (size_t)(lat->count * 0.50);
+    size_t p99 = (size_t)(lat->count * 0.99);
+    size_t p999 = (size_t)(lat->count * 0.999);
+    if (p99 >= lat->count) p99 = lat->count - 1;
+    if (p999 >= lat->count) p999 = lat->count - 1;
+
+    printf("  %-5s lat (usec): min=%.1f avg=%.1f p50=%.1f p99=%.1f p99.9=%.1f max=%.1f (%zu samples)\n",
+           label,
+           lat->ns[0] / 1000.0,
+           (double)sum / lat->count / 1000.0,
+           lat->ns[p50] / 1000.0,
+           lat->ns[p99] / 1000.0,
+           lat->ns[p999] / 1000.0,
+           lat->ns[lat->count - 1] / 1000.0,
+           lat->count);
+}
+
+// Append src samples to dst
+static void lat_merge(lat_samples_t *dst, lat_samples_t *src) {
+    for (size_t i = 0; i < src->count; i++) {
+        lat_add(dst, src->ns[i]);
+    }
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  -j <job>      seqread|seqwrite|randread|randwrite|append|create|mixed|churn (default randwrite)\n");
+    printf("  -t <threads>  Number of jobs (default 1)\n");
+    printf("  -q <depth>    I/Os in flight per job (default 1)\n");
+    printf("  -e <engine>   sync (a thread per I/O in flight) or ring (one submitter per job) (default sync)\n");
+    printf("  -W <workers>  Worker threads per ring for the ring engine (default 4)\n");
+    printf("  -Y <n>        Commit a log barrier (fsync) after every n writes (default never)\n");
+    printf("  -x <threads>  Background pool threads for log flushes, AG init and frees (default one per CPU, at least 2)\n");
+    printf("  -b <size>     Block size per operation (default 4k)\n");
+    printf("  -s <size>     File size per job (default 64k)\n");
+    printf("  -d <seconds>  Run time (default 5)\n");
+    printf("  -n <ops>      Stop each submitter after this many ops (default unlimited)\n");
+    printf("  -r <percent>  Read percentage for the mixed job (default 50)\n");
+    printf("  -l <usec>     Simulated log flush latency (default 0)\n");
+    printf("  -L <size>     Log size (default 2m)\n");
+    printf("  -c <size>     CIL size that closes a checkpoint (default an eighth of the log)\n");
+    printf("  -a <percent>  Log use that starts writing back metadata to move the tail (default 75)\n");
+    printf("  -w <usec>     Simulated metadata writeback latency per batch (default 1000)\n");
+    printf("  -S <seed>     Random seed (default 1)\n");
+    printf("  -P <policy>   AG selection policy: locality|stripe (default locality)\n");
+    printf("  -F            All jobs share a single file\n");
+    printf("  -p            Preallocate each file's full size (unwritten extents) before writing\n");
+    printf("  -M            Disable per-thread allocation pools\n");
+    printf("  -D <size>     Simulated disk size (default 100m)\n");
+    printf("  -A <count>    Number of AGs (default %d, or derived from -G)\n", XFS_DEFAULT_AGCOUNT);
+    printf("  -G <size>     AG size (default: disk size / AG count)\n");
+    printf("  -B <size>     Filesystem block size (default %d)\n", XFS_BLOCK_SIZE);
+    printf("  -E            Load every AG at mount instead of on first allocation\n");
+    printf("  -I <image>    Start from a saved image instead of mkfs+mount; its bench files are reused\n");
+    printf("  -O <image>    Save the filesystem to an image once the bench files are laid out\n");
+    printf("  -H <seconds>  Report free space fragmentation every n seconds of the run (always reported at the end)\n");
+    printf("  -N <nodes>    NUMA affinity: job j runs on node j %% nodes and allocates from that node's AGs\n");
+    printf("                (0 = the machine's nodes, n = split the CPUs into n emulated nodes; default off)\n");
+    printf("  -Q <size>     Quotas on: job j's files belong to user %d + j, each user limited to size (0 = no limit)\n",
+           BENCH_QUOTA_UID);
+}
+
+int main(int argc, char **argv) {
+    cfg.job = JOB_RANDWRITE;
+    cfg.threads = 1;
+    cfg.iodepth = 1;
+    cfg.ring_workers = 4;
+    cfg.block_size = 4096;
+    cfg.file_size = 64 * 1024;
+    cfg.duration = 5.0;
+    cfg.max_ops = 0;
+    cfg.read_pct = 50;
+    cfg.shared_file = 0;
+    cfg.log_delay_us = 0;
+    cfg.log_size = 2 * 1024 * 1024;
+    cfg.ail_push_pct = 75;
+    cfg.writeback_delay_us = 1000;
+    cfg.seed = 1;
+    cfg.ag_policy = "locality";
+    cfg.numa_nodes = -1;
+    cfg.geom.disk_size = 100 * 1024 * 1024;
+    cfg.geom.blocksize = XFS_BLOCK_SIZE;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:q:e:W:Y:x:b:s:d:n:r:l:L:c:a:w:S:P:FpMD:A:G:B:EI:O:H:N:Q:h")) != -1) {
+        switch (opt) {
+            case 'j': {
+                int found = 0;
+                for (int i = 0; i <= JOB_CHURN; i++) {
+                    if (strcmp(optarg, job_names[i]) == 0) {
+                        cfg.job = (job_type_t)i;
+                        found = 1;
+                    }
+                }
+                if (!found) {
+                    fprintf(stderr, "Unknown job '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 't': cfg.threads = atoi(optarg); break;
+            case 'q': cfg.iodepth = atoi(optarg); break;
+            case 'e':
+                if (strcmp(optarg, "ring") == 0) {
+                    cfg.ring = 1;
+                } else if (strcmp(optarg, "sync") != 0) {
+                    fprintf(stderr, "Unknown engine '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'W': cfg.ring_workers = atoi(optarg); break;
+            case 'Y': cfg.fsync_every = atoi(optarg); break;
+            case 'x': cfg.bg_threads = atoi(optarg); break;
+            case 'b': cfg.block_size = parse_size(optarg); break;
+            case 's': cfg.file_size = parse_size(optarg); break;
+            case 'd': cfg.duration = atof(optarg); break;
+            case 'n': cfg.max_ops = atol(optarg); break;
+            case 'r': cfg.read_pct = atoi(optarg); break;
+            case 'l': cfg.log_delay_us = (unsigned int)atoi(optarg); break;
+            case 'L': cfg.log_size = parse_size(optarg); break;
+            case 'c': cfg.cil_push = parse_size(optarg); break;
+            case 'a': cfg.ail_push_pct = atoi(optarg); break;
+            case 'w': cfg.writeback_delay_us = (unsigned int)atoi(optarg); break;
+            case 'S': cfg.seed = strtoul(optarg, NULL, 10); break;
+            case 'P': cfg.ag_policy = optarg; break;
+            case 'F': cfg.shared_file = 1; break;
+            case 'p': cfg.prealloc = 1; break;
+            case 'M': cfg.no_pools = 1; break;
+            case 'D': cfg.geom.disk_size = parse_size(optarg); break;
+            case 'A': cfg.geom.agcount = (uint32_t)atoi(optarg); break;
+            case 'G': cfg.geom.agsize = parse_size(optarg); break;
+            case 'B': cfg.geom.blocksize = (uint32_t)parse_size(optarg); break;
+            case 'E': cfg.mount.eager_ags = 1; break;
+            case 'I': cfg.load_image = optarg; break;
+            case 'O': cfg.save_image = optarg; break;
+            case 'H': cfg.freesp_interval = atof(optarg); break;
+            case 'N': cfg.numa_nodes = atoi(optarg); break;
+            case 'Q':
+                cfg.quota = 1;
+                cfg.quota_limit = parse_size(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (cfg.threads < 1 || cfg.iodepth < 1 || cfg.block_size == 0 || cfg.file_size < cfg.block_size ||
+        cfg.ring_workers < 1 || cfg.fsync_every < 0 || cfg.freesp_interval < 0 ||
+        (cfg.numa_nodes >= 0 && xfs_numa_set_nodes(cfg.numa_nodes) != 0)) {
+        fprintf(stderr, "Invalid configuration\n");
+        return 1;
+    }
+    if (cfg.ring && (cfg.job == JOB_APPEND || cfg.job == JOB_CHURN)) {
+        fprintf(stderr, "The %s job needs the sync engine\n", job_names[cfg.job]);
+        return 1;
+    }
+
+    if (cfg.numa_nodes >= 0) {
+        xfs_numa_set_affinity(1);
+    }
+    if (xfs_workq_set_threads(cfg.bg_threads) != 0) {
+        fprintf(stderr, "Failed to start background workers\n");
+        return 1;
+    }
+
+    uint64_t setup_start = now_ns();
+    if (cfg.load_image != NULL) {
+        if (xfs_image_load(cfg.load_image, &cfg.mount, NULL) != 0) {
+            fprintf(stderr, "Failed to load image %s\n", cfg.load_image);
+            return 1;
+        }
+    } else if (xfs_mkfs_opts(&cfg.geom) != 0 || xfs_mount_opts(&cfg.mount) != 0) {
+        fprintf(stderr, "Failed to format/mount the simulated filesystem\n");
+        return 1;
+    }
+    uint64_t setup_ns = now_ns() - setup_start;
+    trans_set_flush_delay(cfg.log_delay_us);
+    trans_set_writeback_delay(cfg.writeback_delay_us);
+    if (trans_set_log_size(cfg.log_size) != 0 || trans_set_cil_push(cfg.cil_push) != 0 ||
+        trans_set_ail_push(cfg.ail_push_pct) != 0) {
+        fprintf(stderr, "Invalid log size, checkpoint size or AIL push threshold\n");
+        return 1;
+    }
+    if (xfs_alloc_set_policy(cfg.ag_policy) != 0) {
+        fprintf(stderr, "Unknown AG policy '%s'\n", cfg.ag_policy);
+        return 1;
+    }
+    xfs_alloc_set_pools(!cfg.no_pools);
+
+    // Sync engine: each job keeps iodepth I/Os in flight with iodepth submitters;
+    // ring engine: one submitter per job
+    int per_job = cfg.ring ? 1 : cfg.iodepth;
+    int nworkers = cfg.threads * per_job;
+    bench_worker_t *workers = (bench_worker_t *)calloc(nworkers, sizeof(bench_worker_t));
+    if (workers == NULL) {
+        return 1;
+    }
+
+    int needs_layout = cfg.job != JOB_APPEND && cfg.job != JOB_CREATE && cfg.job != JOB_CHURN;
+    xfs_inode_t *shared = NULL;
+    int layout_failed = 0;
+    for (int j = 0; j < cfg.threads && !layout_failed; j++) {
+        xfs_inode_t *inode = NULL;
+        bench_bind_job(j);
+        if (needs_layout) {
+            if (cfg.shared_file && shared != NULL) {
+                inode = shared;
+            } else {
+                char name[64];
+                snprintf(name, sizeof(name), "bench.file.%d", j);
+                inode = bench_layout_file(name);
+                if (inode == NULL) {
+                    layout_failed = 1;
+                    break;
+                }
+                if (cfg.quota && xfs_chown(inode, BENCH_QUOTA_UID + j, BENCH_QUOTA_UID) != 0) {
+                    layout_failed = 1;
+                    break;
+                }
+                shared = inode;
+            }
+        }
+
+        for (int q = 0; q < per_job; q++) {
+            bench_worker_t *w = &workers[j * per_job + q];
+            w->id = j * per_job + q;
+            w->job_id = j;
+            w->inode = inode;
+            w->rng = (cfg.seed + 1) * 0x9E3779B97F4A7C15ull ^ (uint64_t)(w->id + 1);
+            // Spread sequential submitters of one job across the file
+            w->next_off = ((cfg.file_size / cfg.block_size) * q / per_job) * cfg.block_size;
+        }
+    }
+
+    if (cfg.numa_nodes >= 0) {
+        xfs_numa_bind_thread(-1);
+    }
+    if (layout_failed) {
+        fprintf(stderr, "Failed to lay out benchmark files (file size too large for the simulator?)\n");
+        return 1;
+    }
+    if (cfg.save_image != NULL && xfs_image_save(cfg.save_image, NULL) != 0) {
+        fprintf(stderr, "Failed to save image %s\n", cfg.save_image);
+        return 1;
+    }
+
+    // Quotacheck counts the laid-out files; each job's user gets the same limit
+    if (cfg.quota) {
+        uint64_t limit = (cfg.quota_limit + ag_blocksize() - 1) / ag_blocksize();
+        if (xfs_quota_on() != 0) {
+            fprintf(stderr, "Failed to turn quotas on\n");
+            return 1;
+        }
+        for (int j = 0; j < cfg.threads; j++) {
+            if (xfs_quota_set_limits(XFS_DQ_USER, BENCH_QUOTA_UID + j, 0, limit, 0, 0) != 0) {
+                fprintf(stderr, "Failed to set quota limits\n");
+                return 1;
+            }
+        }
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, nworkers + 1);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_create(&workers[i].thread, NULL, cfg.ring ? bench_ring_worker : bench_worker, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)(cfg.duration * 1e9);
+
+    // Let the workers run until the deadline or until they all finish
+    uint64_t next_freesp = start + (uint64_t)(cfg.freesp_interval * 1e9);
+    while (now_ns() < deadline &&
+           __atomic_load_n(&bench_done, __ATOMIC_ACQUIRE) < nworkers) {
+        usleep(1000);
+        if (cfg.freesp_interval > 0 && now_ns() >= next_freesp) {
+            char label[32];
+            snprintf(label, sizeof(label), "freesp@%.1fs", (now_ns() - start) / 1e9);
+            print_freesp_line(label);
+            next_freesp += (uint64_t)(cfg.freesp_interval * 1e9);
+        }
+    }
+    bench_stop = 1;
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    // Aggregate results
+    long ops = 0, errors = 0;
+    uint64_t rbytes = 0, wbytes = 0;
+    lat_samples_t read_lat = {0}, write_lat = {0}, all_lat = {0};
+    for (int i = 0; i < nworkers; i++) {
+        ops += workers[i].ops;
+        errors += workers[i].errors;
+        rbytes += workers[i].bytes_read;
+        wbytes += workers[i].bytes_written;
+        lat_merge(&read_lat, &workers[i].read_lat);
+        lat_merge(&write_lat, &workers[i].write_lat);
+        free(workers[i].read_lat.ns);
+        free(workers[i].write_lat.ns);
+    }
+    lat_merge(&all_lat, &read_lat);
+    lat_merge(&all_lat, &write_lat);
+
+    double secs = elapsed / 1e9;
+    size_t completed = read_lat.count + write_lat.count;
+    printf("xfs_bench: job=%s threads=%d iodepth=%d bs=%zu filesize=%zu%s%s%s log_delay=%uus agpolicy=%s\n",
+           job_names[cfg.job], cfg.threads, cfg.iodepth, cfg.block_size, cfg.file_size,
+           cfg.shared_file ? " shared" : "", cfg.prealloc ? " prealloc" : "", cfg.no_pools ? " nopools" : "",
+           cfg.log_delay_us, cfg.ag_policy);
+    printf("  engine: %s", cfg.ring ? "ring" : "sync");
+    if (cfg.ring) {
+        printf(" (%d workers per ring)", cfg.ring_workers);
+    }
+    if (cfg.fsync_every > 0) {
+        printf(", fsync every %d writes", cfg.fsync_every);
+    }
+    printf("; %d background threads\n", xfs_workq_threads());
+    if (cfg.numa_nodes >= 0) {
+        printf("  numa: %d node%s%s, jobs and background threads pinned\n",
+               xfs_numa_nodes(), xfs_numa_nodes() == 1 ? "" : "s", xfs_numa_emulated() ? " (emulated)" : "");
+    }
+    if (cfg.quota) {
+        xfs_quota_stats_t qs;
+        xfs_quota_get_stats(&qs);
+        printf("  quota: %d users", cfg.threads);
+        if (cfg.quota_limit > 0) {
+            printf(" limited to %llu blocks each", (unsigned long long)((cfg.quota_limit + ag_blocksize() - 1) / ag_blocksize()));
+        }
+        printf("; %llu slow reservations, %llu denied, %llu checkpoint folds logging %llu records\n",
+               (unsigned long long)qs.slow_reservations, (unsigned long long)qs.denied,
+               (unsigned long long)qs.folds, (unsigned long long)qs.logged);
+    }
+    printf("  geometry: %d AGs x %u blocks, %u-byte blocks; %s %.2fms, %d AGs loaded\n",
+           ag_count(), ag_blocks(), ag_blocksize(), cfg.load_image ? "image load" : "mkfs+mount",
+           setup_ns / 1e6, xfs_alloc_loaded_ags());
+    printf("  runtime=%.3fs ops=%ld (read %zu, write %zu) errors=%ld\n",
+           secs, ops, read_lat.count, write_lat.count, errors);
+    printf("  IOPS=%.1f BW=%.2f MiB/s (read %.2f MiB/s, write %.2f MiB/s)\n",
+           completed / secs,
+           (rbytes + wbytes) / secs / (1024.0 * 1024.0),
+           rbytes / secs / (1024.0 * 1024.0),
+           wbytes / secs / (1024.0 * 1024.0));
+    print_latency("read", &read_lat);
+    print_latency("write", &write_lat);
+    print_latency("all", &all_lat);
+    trans_log_stats_t ls;
+    trans_get_log_stats(&ls);
+    printf("  log: %llu checkpoints (avg %.1f changes, %llu merged in the CIL), %llu objects written back, "
+           "%llu reservations waited for space\n",
+           (unsigned long long)ls.checkpoints,
+           ls.checkpoints ? (double)ls.checkpoint_items / ls.checkpoints : 0.0,
+           (unsigned long long)ls.relogged, (unsigned long long)ls.written_back,
+           (unsigned long long)ls.space_waits);
+    print_freesp_line("freesp");
+
+    free(read_lat.ns);
+    free(write_lat.ns);
+    free(all_lat.ns);
+    free(workers);
+    pthread_barrier_destroy(&start_barrier);
+
+    trans_destroy();
+    disk_destroy();
+
+    return 0;
+}
@@ -0,0 +1,614 @@
+#include "../include/xfs_io.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_btree.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_disk.h"
+#include "../include/xfs_types.h"
+#include "../include/xfs_cksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Component microbenchmarks for the simulator's hot primitives.
+// Each benchmark is timed in batches: warmup, then a number of
+// repetitions of a fixed iteration count. Results carry mean, stddev
+// and a 95% confidence interval per operation, and can be written as
+// JSON and compared against a previous run.
+
+typedef struct {
+    const char *name;
+    size_t bytes_per_op;           // Non-zero for bandwidth benchmarks
+    int (*setup)(void);
+    void (*run)(long iters);       // Run iters operations
+    void (*teardown)(void);
+} microbench_t;
+
+typedef struct {
+    const char *name;
+    long iters;
+    int reps;
+    double mean_ns;
+    double stddev_ns;
+    double ci95_ns;
+    double min_ns;
+    double mean_cycles;
+    size_t bytes_per_op;
+} microbench_result_t;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t xorshift64(void) {
+    uint64_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    rng_state = x;
+    return x;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Cycle counter where the ISA has one; nanoseconds otherwise
+static uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+// Two-sided 95% Student t critical values for 1..30 degrees of freedom
+static double t_critical(int df) {
+    static const double t95[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df < 1) {
+        return 0.0;
+    }
+    return df <= 30 ? t95[df - 1] : 1.960;
+}
+
+// ---------------------------------------------------------------------------
+// Allocator under fragmentation
+// ---------------------------------------------------------------------------
+
+#define FRAG_AG 0
+
+// Fill the AG, then free every other block so only single-block holes remain
+static int alloc_frag_setup(void) {
+    while (xfs_alloc_blocks(FRAG_AG, 1) != 0) {
+        // Allocate until the AG is full
+    }
+    for (uint64_t b = ag_first_data_block() + 1; b < ag_blocks(); b += 2) {
+        xfs_free_blocks(FRAG_AG, b, 1);
+    }
+    return 0;
+}
+
+static void alloc_frag_teardown(void) {
+    xfs_ag_init_alloc(FRAG_AG);
+}
+
+static void alloc_free_1_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        uint64_t blk = xfs_alloc_blocks(FRAG_AG, 1);
+        xfs_free_blocks(FRAG_AG, blk, 1);
+    }
+}
+
+// Two-block requests cannot be satisfied by the single-block holes and
+// fall through to the tail of the AG
+static int alloc_frag2_setup(void) {
+    alloc_frag_setup();
+    // Open a two-block hole at the end of the AG
+    xfs_free_blocks(FRAG_AG, ag_blocks() - 2, 2);
+    return 0;
+}
+
+static void alloc_free_2_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        uint64_t blk = xfs_alloc_blocks(FRAG_AG, 2);
+        if (blk != 0) {
+            xfs_free_blocks(FRAG_AG, blk, 2);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// File allocation with and without per-thread pools
+// ---------------------------------------------------------------------------
+
+static xfs_inode_t alloc_inode;
+
+static int alloc_pool_setup(void) {
+    memset(&alloc_inode, 0, sizeof(alloc_inode));
+    xfs_alloc_set_pools(1);
+    return 0;
+}
+
+static int alloc_nopool_setup(void) {
+    memset(&alloc_inode, 0, sizeof(alloc_inode));
+    xfs_alloc_set_pools(0);
+    return 0;
+}
+
+// Hand pooled blocks back so later benchmarks see an empty AG
+static void alloc_pool_teardown(void) {
+    xfs_alloc_set_pools(0);
+    xfs_alloc_set_pools(1);
+}
+
+static void alloc_file_1_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        uint64_t fsb;
+        if (xfs_alloc_file_blocks(&alloc_inode, 0, 1, &fsb) == 0) {
+            xfs_free_blocks(ag_fsb_to_agno(fsb), ag_fsb_to_agbno(fsb), 1);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// B+tree
+// ---------------------------------------------------------------------------
+
+#define BTREE_KEYS 1000
+
+static xfs_btree_node_t *bench_tree = NULL;
+
+static int btree_empty_setup(void) {
+    bench_tree = btree_init();
+    return bench_tree ? 0 : -1;
+}
+
+static int btree_full_setup(void) {
+    bench_tree = btree_init();
+    if (bench_tree == NULL) {
+        return -1;
+    }
+    for (uint64_t k = 0; k < BTREE_KEYS; k++) {
+        btree_insert(bench_tree, k * 2, (void *)(uintptr_t)(k + 1));
+    }
+    return 0;
+}
+
+static void btree_teardown(void) {
+    btree_destroy(bench_tree);
+    bench_tree = NULL;
+}
+
+// Insert into a tree that is rebuilt every BTREE_KEYS inserts
+static void btree_insert_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        if (i % BTREE_KEYS == BTREE_KEYS - 1) {
+            btree_destroy(bench_tree);
+            bench_tree = btree_init();
+        }
+        btree_insert(bench_tree, xorshift64() % (BTREE_KEYS * 4), (void *)1);
+    }
+}
+
+static void btree_lookup_run(long iters) {
+    volatile void *sink;
+    for (long i = 0; i < iters; i++) {
+        sink = btree_lookup(bench_tree, (xorshift64() % BTREE_KEYS) * 2);
+    }
+    (void)sink;
+}
+
+// ---------------------------------------------------------------------------
+// Log enqueue
+// ---------------------------------------------------------------------------
+
+static void trans_add_item_run(long iters) {
+    char item[64] = {0};
+    for (long i = 0; i < iters; i++) {
+        trans_add_item(item, sizeof(item));
+    }
+}
+
+// Drain the queue so one benchmark's backlog does not leak into the next
+static void trans_teardown(void) {
+    trans_commit_barrier();
+}
+
+// ---------------------------------------------------------------------------
+// Extent lookup
+// ---------------------------------------------------------------------------
+
+static xfs_inode_t bench_inode;
+
+static int extent_setup(void) {
+    memset(&bench_inode, 0, sizeof(bench_inode));
+    for (int i = 0; i < 16; i++) {
+        bench_inode.extents[i].start_off = i * 4;
+        bench_inode.extents[i].start_block = 100 + i * 8;
+        bench_inode.extents[i].block_count = 4;
+    }
+    bench_inode.extent_count = 16;
+    return 0;
+}
+
+static void extent_lookup_run(long iters) {
+    volatile xfs_extent_t *sink;
+    for (long i = 0; i < iters; i++) {
+        sink = find_extent_for_offset(&bench_inode, xorshift64() % 64);
+    }
+    (void)sink;
+}
+
+// ---------------------------------------------------------------------------
+// Disk copy bandwidth
+// ---------------------------------------------------------------------------
+
+#define DISK_BENCH_OFFSET (50ull * 1024 * 1024)
+#define DISK_BENCH_SPAN   (16ull * 1024 * 1024)
+
+static char disk_buf[64 * 1024];
+
+// Write the span once so the copies below hit resident chunks, not the sparse zero path
+static int disk_span_setup(void) {
+    for (uint64_t off = 0; off < DISK_BENCH_SPAN; off += sizeof(disk_buf)) {
+        if (disk_write(DISK_BENCH_OFFSET + off, disk_buf, sizeof(disk_buf)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void disk_read_4k_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        disk_read(DISK_BENCH_OFFSET + (i * 4096) % DISK_BENCH_SPAN, disk_buf, 4096);
+    }
+}
+
+static void disk_write_4k_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        disk_write(DISK_BENCH_OFFSET + (i * 4096) % DISK_BENCH_SPAN, disk_buf, 4096);
+    }
+}
+
+static void disk_read_64k_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        disk_read(DISK_BENCH_OFFSET + (i * 65536) % DISK_BENCH_SPAN, disk_buf, 65536);
+    }
+}
+
+static void disk_write_64k_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        disk_write(DISK_BENCH_OFFSET + (i * 65536) % DISK_BENCH_SPAN, disk_buf, 65536);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Metadata checksums, against a plain copy of the same size
+// ---------------------------------------------------------------------------
+
+static char cksum_buf[4096];
+static char cksum_copy[4096];
+
+static int cksum_hw_setup(void) {
+    for (size_t i = 0; i < sizeof(cksum_buf); i++) {
+        cksum_buf[i] = (char)xorshift64();
+    }
+    return xfs_crc32c_set_hw(1);
+}
+
+static int cksum_sw_setup(void) {
+    cksum_hw_setup();
+    return xfs_crc32c_set_hw(0);
+}
+
+static void cksum_teardown(void) {
+    xfs_crc32c_set_hw(1);
+}
+
+static void cksum_4k_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        xfs_cksum_update(cksum_buf, sizeof(cksum_buf), 4);
+    }
+}
+
+static void memcpy_4k_run(long iters) {
+    for (long i = 0; i < iters; i++) {
+        memcpy(cksum_copy, cksum_buf, sizeof(cksum_buf));
+        __asm__ __volatile__("" : : "r"(cksum_copy) : "memory");
+    }
+}
+
+static const microbench_t benchmarks[] = {
+    { "alloc_free_1blk_frag",  0,     alloc_frag_setup,  alloc_free_1_run,   alloc_frag_teardown },
+    { "alloc_free_2blk_frag",  0,     alloc_frag2_setup, alloc_free_2_run,   alloc_frag_teardown },
+    { "alloc_file_1blk_pool",  0,     alloc_pool_setup,  alloc_file_1_run,   alloc_pool_teardown },
+    { "alloc_file_1blk_nopool", 0,    alloc_nopool_setup, alloc_file_1_run,  alloc_pool_teardown },
+    { "btree_insert",          0,     btree_empty_setup, btree_insert_run,   btree_teardown },
+    { "btree_lookup_1000",     0,     btree_full_setup,  btree_lookup_run,   btree_teardown },
+    { "trans_add_item_64b",    0,     NULL,              trans_add_item_run, trans_teardown },
+    { "extent_lookup_16",      0,     extent_setup,      extent_lookup_run,  NULL },
+    { "disk_read_4k",          4096,  disk_span_setup,   disk_read_4k_run,   NULL },
+    { "disk_write_4k",         4096,  disk_span_setup,   disk_write_4k_run,  NULL },
+    { "disk_read_64k",         65536, disk_span_setup,   disk_read_64k_run,  NULL },
+    { "disk_write_64k",        65536, disk_span_setup,   disk_write_64k_run, NULL },
+    { "crc32c_4k",             4096,  cksum_hw_setup,    cksum_4k_run,       cksum_teardown },
+    { "crc32c_4k_sw",          4096,  cksum_sw_setup,    cksum_4k_run,       cksum_teardown },
+    { "memcpy_4k",             4096,  NULL,              memcpy_4k_run,      NULL },
+};
+
+#define NUM_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+// Run one benchmark: warmup, then reps timed batches of iters operations
+static int run_benchmark(const microbench_t *b, long warmup, int reps, long iters,
+                         microbench_result_t *res) {
+    if (b->setup && b->setup() != 0) {
+        return -1;
+    }
+
+    b->run(warmup);
+
+    double *ns = (double *)malloc(reps * sizeof(double));
+    double *cycles = (double *)malloc(reps * sizeof(double));
+    if (ns == NULL || cycles == NULL) {
+        free(ns);
+        free(cycles);
+        return -1;
+    }
+
+    for (int r = 0; r < reps; r++) {
+        uint64_t t0 = now_ns();
+        uint64_t c0 = read_cycles();
+        b->run(iters);
+        uint64_t c1 = read_cycles();
+        uint64_t t1 = now_ns();
+        ns[r] = (double)(t1 - t0) / iters;
+        cycles[r] = (double)(c1 - c0) / iters;
+    }
+
+    if (b->teardown) {
+        b->teardown();
+    }
+
+    double sum = 0, csum = 0, min = ns[0];
+    for (int r = 0; r < reps; r++) {
+        sum += ns[r];
+        csum += cycles[r];
+        if (ns[r] < min) {
+            min = ns[r];
+        }
+    }
+    double mean = sum / reps;
+    double var = 0;
+    for (int r = 0; r < reps; r++) {
+        var += (ns[r] - mean) * (ns[r] - mean);
+    }
+    double stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0.0;
+
+    res->name = b->name;
+    res->iters = iters;
+    res->reps = reps;
+    res->mean_ns = mean;
+    res->stddev_ns = stddev;
+    res->ci95_ns = reps > 1 ? t_critical(reps - 1) * stddev / sqrt(reps) : 0.0;
+    res->min_ns = min;
+    res->mean_cycles = csum / reps;
+    res->bytes_per_op = b->bytes_per_op;
+
+    free(ns);
+    free(cycles);
+    return 0;
+}
+
+static void print_result(const microbench_result_t *r) {
+    printf("%-24s %12.1f ns/op  +/- %8.1f  (min %10.1f, sd %8.1f) %12.0f cycles/op",
+           r->name, r->mean_ns, r->ci95_ns, r->min_ns, r->stddev_ns, r->mean_cycles);
+    if (r->bytes_per_op > 0) {
+        printf("  %8.2f GiB/s", r->bytes_per_op / r->mean_ns * 1e9 / (1024.0 * 1024 * 1024));
+    }
+    printf("\n");
+}
+
+static int write_json(const char *path, const microbench_result_t *results, int count) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < count; i++) {
+        const microbench_result_t *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"iters\": %ld, \"reps\": %d, "
+                   "\"mean_ns\": %.3f, \"stddev_ns\": %.3f, \"ci95_ns\": %.3f, "
+                   "\"min_ns\": %.3f, \"mean_cycles\": %.1f, \"bytes_per_op\": %zu}%s\n",
+                r->name, r->iters, r->reps, r->mean_ns, r->stddev_ns, r->ci95_ns,
+                r->min_ns, r->mean_cycles, r->bytes_per_op, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Compare mode
+// ---------------------------------------------------------------------------
+
+#define MAX_COMPARE 64
+
+typedef struct {
+    char name[64];
+    double mean_ns;
+    double ci95_ns;
+} compare_entry_t;
+
+// Minimal reader for the JSON this tool writes
+static int read_json(const char *path, compare_entry_t *entries, int max) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    char line[1024];
+    int count = 0;
+    while (fgets(line, sizeof(line), f) && count < max) {
+        char *name = strstr(line, "\"name\": \"");
+        char *mean = strstr(line, "\"mean_ns\": ");
+        char *ci = strstr(line, "\"ci95_ns\": ");
+        if (!name || !mean || !ci) {
+            continue;
+        }
+        name += strlen("\"name\": \"");
+        size_t len = strcspn(name, "\"");
+        if (len >= sizeof(entries[count].name)) {
+            len = sizeof(entries[count].name) - 1;
+        }
+        memcpy(entries[count].name, name, len);
+        entries[count].name[len] = '\0';
+        entries[count].mean_ns = strtod(mean + strlen("\"mean_ns\": "), NULL);
+        entries[count].ci95_ns = strtod(ci + strlen("\"ci95_ns\": "), NULL);
+        count++;
+    }
+
+    fclose(f);
+    return count;
+}
+
+// A benchmark regresses when it is slower by more than the threshold and
+// the two confidence intervals do not overlap
+static int compare_results(const char *base_path, const char *new_path, double threshold_pct) {
+    compare_entry_t base[MAX_COMPARE], cur[MAX_COMPARE];
+    int nbase = read_json(base_path, base, MAX_COMPARE);
+    int ncur = read_json(new_path, cur, MAX_COMPARE);
+    if (nbase < 0 || ncur < 0) {
+        return 2;
+    }
+
+    int regressions = 0;
+    printf("%-24s %12s %12s %9s  %s\n", "benchmark", "base ns/op", "new ns/op", "delta", "verdict");
+    for (int i = 0; i < ncur; i++) {
+        const compare_entry_t *b = NULL;
+        for (int j = 0; j < nbase; j++) {
+            if (strcmp(base[j].name, cur[i].name) == 0) {
+                b = &base[j];
+                break;
+            }
+        }
+        if (b == NULL) {
+            printf("%-24s %12s %12.1f %9s  new\n", cur[i].name, "-", cur[i].mean_ns, "-");
+            continue;
+        }
+
+        double delta = (cur[i].mean_ns - b->mean_ns) / b->mean_ns * 100.0;
+        int overlap = cur[i].mean_ns - cur[i].ci95_ns <= b->mean_ns + b->ci95_ns &&
+                      b->mean_ns - b->ci95_ns <= cur[i].mean_ns + cur[i].ci95_ns;
+        const char *verdict = "ok";
+        if (!overlap && delta > threshold_pct) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (!overlap && delta < -threshold_pct) {
+            verdict = "improved";
+        }
+        printf("%-24s %12.1f %12.1f %+8.1f%%  %s\n", cur[i].name, b->mean_ns, cur[i].mean_ns, delta, verdict);
+    }
+
+    printf("%d regression(s) above %.1f%%\n", regressions, threshold_pct);
+    return regressions > 0 ? 1 : 0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("       %s -c <base.json> <new.json> [-T <percent>]\n", prog);
+    printf("  -w <iters>    Warmup iterations (default 10000)\n");
+    printf("  -r <reps>     Timed repetitions (default 10)\n");
+    printf("  -i <iters>    Iterations per repetition (default 100000)\n");
+    printf("  -f <substr>   Only run benchmarks whose name contains substr\n");
+    printf("  -o <file>     Write results as JSON\n");
+    printf("  -l            List benchmarks\n");
+    printf("  -c            Compare two result files\n");
+    printf("  -T <percent>  Regression threshold for compare mode (default 5)\n");
+}
+
+int main(int argc, char **argv) {
+    long warmup = 10000;
+    int reps = 10;
+    long iters = 100000;
+    const char *filter = NULL;
+    const char *json_path = NULL;
+    int compare = 0;
+    double threshold = 5.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:r:i:f:o:lcT:h")) != -1) {
+        switch (opt) {
+            case 'w': warmup = atol(optarg); break;
+            case 'r': reps = atoi(optarg); break;
+            case 'i': iters = atol(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'o': json_path = optarg; break;
+            case 'c': compare = 1; break;
+            case 'T': threshold = atof(optarg); break;
+            case 'l':
+                for (int i = 0; i < NUM_BENCHMARKS; i++) {
+                    printf("%s\n", benchmarks[i].name);
+                }
+                return 0;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (compare) {
+        if (optind + 2 > argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        return compare_results(argv[optind], argv[optind + 1], threshold);
+    }
+
+    if (reps < 1 || iters < 1) {
+        fprintf(stderr, "Invalid repetition or iteration count\n");
+        return 1;
+    }
+
+    if (xfs_mkfs(100 * 1024 * 1024) != 0 || xfs_mount() != 0) {
+        fprintf(stderr, "Failed to format/mount the simulated filesystem\n");
+        return 1;
+    }
+    trans_set_flush_delay(0);
+    trans_set_writeback_delay(0);
+
+    microbench_result_t results[NUM_BENCHMARKS];
+    int count = 0;
+    for (int i = 0; i < NUM_BENCHMARKS; i++) {
+        if (filter && strstr(benchmarks[i].name, filter) == NULL) {
+            continue;
+        }
+        if (run_benchmark(&benchmarks[i], warmup, reps, iters, &results[count]) != 0) {
+            fprintf(stderr, "%s: setup failed\n", benchmarks[i].name);
+            continue;
+        }
+        print_result(&results[count]);
+        count++;
+    }
+
+    int ret = 0;
+    if (json_path && write_json(json_path, results, count) != 0) {
+        ret = 1;
+    }
+
+    trans_destroy();
+    disk_destroy();
+    return ret;
+}
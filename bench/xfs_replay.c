@@ -0,0 +1,741 @@
+#include "../include/xfs_io.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_disk.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+
+// Replays a recorded I/O trace against the simulator.
+//
+// The trace is text, one operation per line:
+//
+//     <timestamp> <thread> <op> <target> [offset] [length]
+//
+// timestamp is in seconds (any origin, fractions allowed), thread is any
+// integer id, op is create, write, read, unlink or truncate (whose length
+// is the new size), and target is a path or an inode number. Lines
+// starting with # are comments. Captures from blktrace or strace are
+// converted to this format outside the simulator.
+//
+// Every trace thread gets its own replay thread, which issues that
+// thread's operations in order, either at their original times (scaled by
+// -s) or as fast as possible (-a). Operations on one file keep their trace
+// order around create and unlink: a data operation waits for the file's
+// earlier creates and unlinks, and a create or unlink waits for every
+// earlier operation on the file. Files the trace uses without creating
+// them existed before the capture, so they are created and filled up to
+// the furthest byte read before the replay starts.
+
+typedef enum {
+    OP_CREATE,
+    OP_WRITE,
+    OP_READ,
+    OP_UNLINK,
+    OP_TRUNCATE,
+    OP_MAX
+} replay_op_type_t;
+
+static const char *op_names[OP_MAX] = { "create", "write", "read", "unlink", "truncate" };
+
+// One traced operation
+typedef struct {
+    uint64_t ts_ns;          // Time since the first operation
+    size_t order;            // Position in the trace, to keep sorting stable
+    long tid;                // Trace thread id
+    int file;                // Index into replay_files
+    replay_op_type_t op;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t wait_count;     // File operations (or creates/unlinks) that must complete first
+} replay_op_t;
+
+// A file named by the trace
+typedef struct {
+    char *key;               // Path or inode number as written in the trace
+    xfs_inode_t *inode;      // NULL while the file does not exist
+    int precreate;           // Existed before the capture
+    uint64_t layout_size;    // Bytes written before the replay starts
+    uint32_t nops;           // Operations on the file (parse time)
+    uint32_t nns;            // Creates and unlinks of the file (parse time)
+    uint32_t done_ops;       // Operations completed (replay time)
+    uint32_t done_ns;        // Creates and unlinks completed (replay time)
+} replay_file_t;
+
+// Growable latency sample array
+typedef struct {
+    uint64_t *ns;
+    size_t count;
+    size_t cap;
+} lat_samples_t;
+
+// One replay thread: the operations of one trace thread
+typedef struct {
+    long tid;
+    replay_op_t **ops;
+    size_t count;
+    size_t cap;
+    char *buf;
+    size_t buf_size;
+    long errors[OP_MAX];     // Operations the simulator failed
+    long missing;            // Operations on a file that did not exist
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    lat_samples_t lat[OP_MAX];
+    lat_samples_t lag;       // How late operations started against the original timing
+    pthread_t thread;
+} replay_thread_t;
+
+// Replay configuration (command line knobs)
+typedef struct {
+    const char *trace;
+    int afap;                     // Ignore timestamps
+    double speed;                 // Timing scale (2 = twice as fast)
+    unsigned int log_delay_us;    // Simulated log flush latency
+    const char *ag_policy;        // AG selection policy
+    int no_pools;                 // Bypass per-thread allocation pools
+    xfs_mkfs_opts_t geom;         // Filesystem geometry
+    xfs_mount_opts_t mount;       // Mount options
+} replay_config_t;
+
+static replay_config_t cfg;
+
+static replay_op_t *replay_ops = NULL;
+static size_t replay_nops = 0;
+static size_t replay_ops_cap = 0;
+
+static replay_file_t *replay_files = NULL;
+static int replay_nfiles = 0;
+static int replay_files_cap = 0;
+static int *file_hash = NULL;     // Open addressing: index + 1 into replay_files, 0 = empty
+static size_t file_hash_size = 0;
+
+static replay_thread_t *replay_threads = NULL;
+static int replay_nthreads = 0;
+
+static pthread_barrier_t start_barrier;
+static uint64_t replay_start_ns = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int lat_add(lat_samples_t *lat, uint64_t ns) {
+    if (lat->count == lat->cap) {
+        size_t new_cap = lat->cap ? lat->cap * 2 : 4096;
+        uint64_t *p = (uint64_t *)realloc(lat->ns, new_cap * sizeof(uint64_t));
+        if (p == NULL) {
+            return -1;
+        }
+        lat->ns = p;
+        lat->cap = new_cap;
+    }
+    lat->ns[lat->count++] = ns;
+    return 0;
+}
+
+// Append src samples to dst
+static void lat_merge(lat_samples_t *dst, lat_samples_t *src) {
+    for (size_t i = 0; i < src->count; i++) {
+        lat_add(dst, src->ns[i]);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Parse a size with an optional k/m/g/t suffix
+static size_t parse_size(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    switch (*end) {
+        case 'k': case 'K': v *= 1024; break;
+        case 'm': case 'M': v *= 1024 * 1024; break;
+        case 'g': case 'G': v *= 1024.0 * 1024 * 1024; break;
+        case 't': case 'T': v *= 1024.0 * 1024 * 1024 * 1024; break;
+        default: break;
+    }
+    return (size_t)v;
+}
+
+// ---------------------------------------------------------------------------
+// Trace loading
+// ---------------------------------------------------------------------------
+
+static uint64_t hash_key(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ull;  // FNV-1a
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static int file_hash_insert(int index) {
+    size_t mask = file_hash_size - 1;
+    size_t i = hash_key(replay_files[index].key) & mask;
+    while (file_hash[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    file_hash[i] = index + 1;
+    return 0;
+}
+
+// Index of the file named key, adding it on first use; -1 if out of memory
+static int file_lookup(const char *key) {
+    if (file_hash_size > 0) {
+        size_t mask = file_hash_size - 1;
+        for (size_t i = hash_key(key) & mask; file_hash[i] != 0; i = (i + 1) & mask) {
+            if (strcmp(replay_files[file_hash[i] - 1].key, key) == 0) {
+                return file_hash[i] - 1;
+            }
+        }
+    }
+
+    // Keep the table at most half full
+    if ((size_t)(replay_nfiles + 1) * 2 > file_hash_size) {
+        size_t new_size = file_hash_size ? file_hash_size * 2 : 256;
+        int *table = (int *)calloc(new_size, sizeof(int));
+        if (table == NULL) {
+            return -1;
+        }
+        free(file_hash);
+        file_hash = table;
+        file_hash_size = new_size;
+        for (int i = 0; i < replay_nfiles; i++) {
+            file_hash_insert(i);
+        }
+    }
+    if (replay_nfiles == replay_files_cap) {
+        int new_cap = replay_files_cap ? replay_files_cap * 2 : 64;
+        replay_file_t *p = (replay_file_t *)realloc(replay_files, new_cap * sizeof(replay_file_t));
+        if (p == NULL) {
+            return -1;
+        }
+        replay_files = p;
+        replay_files_cap = new_cap;
+    }
+
+    replay_file_t *f = &replay_files[replay_nfiles];
+    memset(f, 0, sizeof(*f));
+    f->key = strdup(key);
+    if (f->key == NULL) {
+        return -1;
+    }
+    file_hash_insert(replay_nfiles);
+    return replay_nfiles++;
+}
+
+static int parse_op(const char *s, replay_op_type_t *op) {
+    for (int i = 0; i < OP_MAX; i++) {
+        if (strcmp(s, op_names[i]) == 0) {
+            *op = (replay_op_type_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Read the trace; returns the number of lines skipped, or -1 on error
+static long load_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    long lineno = 0, skipped = 0;
+    double first_ts = 0;
+    while (getline(&line, &cap, f) >= 0) {
+        lineno++;
+        char *ts_s = strtok(line, " \t\r\n");
+        if (ts_s == NULL || ts_s[0] == '#') {
+            continue;
+        }
+        char *tid_s = strtok(NULL, " \t\r\n");
+        char *op_s = strtok(NULL, " \t\r\n");
+        char *target = strtok(NULL, " \t\r\n");
+        char *off_s = strtok(NULL, " \t\r\n");
+        char *len_s = strtok(NULL, " \t\r\n");
+
+        replay_op_t op;
+        memset(&op, 0, sizeof(op));
+        if (target == NULL || parse_op(op_s, &op.op) != 0 ||
+            ((op.op == OP_WRITE || op.op == OP_READ) && len_s == NULL) ||
+            (op.op == OP_TRUNCATE && len_s == NULL && off_s == NULL)) {
+            if (skipped++ < 10) {
+                fprintf(stderr, "%s:%ld: skipping malformed line\n", path, lineno);
+            }
+            continue;
+        }
+
+        double ts = strtod(ts_s, NULL);
+        if (replay_nops == 0) {
+            first_ts = ts;
+        }
+        op.ts_ns = ts > first_ts ? (uint64_t)((ts - first_ts) * 1e9) : 0;
+        op.order = replay_nops;
+        op.tid = strtol(tid_s, NULL, 10);
+        op.offset = off_s ? parse_size(off_s) : 0;
+        op.length = len_s ? parse_size(len_s) : 0;
+        if (op.op == OP_TRUNCATE && len_s == NULL) {
+            op.length = op.offset;  // truncate <target> <size>
+        }
+        op.file = file_lookup(target);
+        if (op.file < 0) {
+            break;
+        }
+
+        if (replay_nops == replay_ops_cap) {
+            size_t new_cap = replay_ops_cap ? replay_ops_cap * 2 : 4096;
+            replay_op_t *p = (replay_op_t *)realloc(replay_ops, new_cap * sizeof(replay_op_t));
+            if (p == NULL) {
+                break;
+            }
+            replay_ops = p;
+            replay_ops_cap = new_cap;
+        }
+        replay_ops[replay_nops++] = op;
+    }
+    free(line);
+    fclose(f);
+    return skipped;
+}
+
+static int cmp_op_time(const void *a, const void *b) {
+    const replay_op_t *x = (const replay_op_t *)a;
+    const replay_op_t *y = (const replay_op_t *)b;
+    if (x->ts_ns != y->ts_ns) {
+        return (x->ts_ns > y->ts_ns) - (x->ts_ns < y->ts_ns);
+    }
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+static replay_thread_t *thread_lookup(long tid) {
+    for (int i = replay_nthreads - 1; i >= 0; i--) {
+        if (replay_threads[i].tid == tid) {
+            return &replay_threads[i];
+        }
+    }
+    replay_thread_t *p = (replay_thread_t *)realloc(replay_threads, (replay_nthreads + 1) * sizeof(replay_thread_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    replay_threads = p;
+    replay_thread_t *t = &replay_threads[replay_nthreads++];
+    memset(t, 0, sizeof(*t));
+    t->tid = tid;
+    return t;
+}
+
+// Order the operations, work out what each must wait for, and split them by thread
+static int plan_replay(void) {
+    qsort(replay_ops, replay_nops, sizeof(replay_op_t), cmp_op_time);
+
+    for (size_t i = 0; i < replay_nops; i++) {
+        replay_op_t *op = &replay_ops[i];
+        replay_file_t *f = &replay_files[op->file];
+        int ns = op->op == OP_CREATE || op->op == OP_UNLINK;
+
+        // The first operation on a file decides whether it existed before the capture
+        if (f->nops == 0) {
+            f->precreate = op->op != OP_CREATE;
+        }
+        if (f->nns == 0 && op->op == OP_READ && op->offset + op->length > f->layout_size) {
+            f->layout_size = op->offset + op->length;
+        }
+
+        op->wait_count = ns ? f->nops : f->nns;
+        f->nops++;
+        f->nns += ns;
+    }
+    for (int i = 0; i < replay_nfiles; i++) {
+        if (!replay_files[i].precreate) {
+            replay_files[i].layout_size = 0;
+        }
+    }
+
+    // Threads are numbered in order of their first operation
+    for (size_t i = 0; i < replay_nops; i++) {
+        replay_thread_t *t = thread_lookup(replay_ops[i].tid);
+        if (t == NULL) {
+            return -1;
+        }
+        if (t->count == t->cap) {
+            size_t new_cap = t->cap ? t->cap * 2 : 256;
+            replay_op_t **p = (replay_op_t **)realloc(t->ops, new_cap * sizeof(replay_op_t *));
+            if (p == NULL) {
+                return -1;
+            }
+            t->ops = p;
+            t->cap = new_cap;
+        }
+        t->ops[t->count++] = &replay_ops[i];
+        uint64_t need = replay_ops[i].op == OP_WRITE || replay_ops[i].op == OP_READ ? replay_ops[i].length : 0;
+        if (need > t->buf_size) {
+            t->buf_size = need;
+        }
+    }
+    return 0;
+}
+
+// Name of a file in the simulator: the trace's name if it fits
+static void file_sim_name(int index, char *name, size_t size) {
+    if (strlen(replay_files[index].key) < size) {
+        strcpy(name, replay_files[index].key);
+    } else {
+        snprintf(name, size, "replay.%d", index);
+    }
+}
+
+// Create the files that existed before the capture, filled up to the furthest byte read
+static int precreate_files(uint64_t *bytes) {
+    size_t chunk = 1024 * 1024;
+    char *buf = (char *)malloc(chunk);
+    if (buf == NULL) {
+        return -1;
+    }
+    memset(buf, 'r', chunk);
+
+    int failed = 0;
+    *bytes = 0;
+    for (int i = 0; i < replay_nfiles; i++) {
+        replay_file_t *f = &replay_files[i];
+        if (!f->precreate) {
+            continue;
+        }
+        char name[64];
+        file_sim_name(i, name, sizeof(name));
+        int ino = xfs_create_named_file(name);
+        if (ino <= 0) {
+            failed++;
+            continue;
+        }
+        f->inode = get_inode_ptr(ino);
+        for (uint64_t off = 0; off < f->layout_size; off += chunk) {
+            size_t n = f->layout_size - off < chunk ? (size_t)(f->layout_size - off) : chunk;
+            if (xfs_sim_write(f->inode, buf, n, (off_t)off) < 0) {
+                break;
+            }
+            *bytes += n;
+        }
+    }
+    free(buf);
+    return failed;
+}
+
+// ---------------------------------------------------------------------------
+// Replay
+// ---------------------------------------------------------------------------
+
+// Wait until an operation's predecessors on its file have completed
+static void wait_for_file(replay_op_t *op) {
+    replay_file_t *f = &replay_files[op->file];
+    uint32_t *done = op->op == OP_CREATE || op->op == OP_UNLINK ? &f->done_ops : &f->done_ns;
+    while (__atomic_load_n(done, __ATOMIC_ACQUIRE) < op->wait_count) {
+        sched_yield();
+    }
+}
+
+// Run one operation; returns 0, -1 if the simulator failed it, or 1 if its file did not exist
+static int replay_one(replay_thread_t *t, replay_op_t *op) {
+    replay_file_t *f = &replay_files[op->file];
+    xfs_inode_t *inode = __atomic_load_n(&f->inode, __ATOMIC_ACQUIRE);
+    if (op->op != OP_CREATE && inode == NULL) {
+        return 1;
+    }
+
+    switch (op->op) {
+        case OP_CREATE: {
+            if (inode != NULL) {
+                return 0;  // Opening an existing file
+            }
+            char name[64];
+            file_sim_name(op->file, name, sizeof(name));
+            int ino = xfs_create_named_file(name);
+            if (ino <= 0) {
+                return -1;
+            }
+            __atomic_store_n(&f->inode, get_inode_ptr(ino), __ATOMIC_RELEASE);
+            return 0;
+        }
+        case OP_WRITE: {
+            int ret = xfs_sim_write(inode, t->buf, op->length, (off_t)op->offset);
+            if (ret < 0) {
+                return -1;
+            }
+            t->bytes_written += ret;
+            return 0;
+        }
+        case OP_READ: {
+            int ret = xfs_sim_read(inode, t->buf, op->length, (off_t)op->offset);
+            if (ret < 0) {
+                return -1;
+            }
+            t->bytes_read += ret;
+            return 0;
+        }
+        case OP_UNLINK:
+            if (xfs_unlink((int)inode->inode_num) != 0) {
+                return -1;
+            }
+            __atomic_store_n(&f->inode, NULL, __ATOMIC_RELEASE);
+            return 0;
+        case OP_TRUNCATE:
+            return xfs_truncate(inode, op->length) == 0 ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+static void *replay_worker(void *arg) {
+    replay_thread_t *t = (replay_thread_t *)arg;
+    pthread_barrier_wait(&start_barrier);
+
+    for (size_t i = 0; i < t->count; i++) {
+        replay_op_t *op = t->ops[i];
+
+        if (!cfg.afap) {
+            uint64_t target = replay_start_ns + (uint64_t)(op->ts_ns / cfg.speed);
+            uint64_t now = now_ns();
+            if (now < target) {
+                struct timespec ts = { (time_t)(target / 1000000000ull), (long)(target % 1000000000ull) };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+                }
+                now = now_ns();
+            }
+            lat_add(&t->lag, now > target ? now - target : 0);
+        }
+
+        wait_for_file(op);
+        uint64_t t0 = now_ns();
+        int ret = replay_one(t, op);
+        uint64_t t1 = now_ns();
+        if (ret == 0) {
+            lat_add(&t->lat[op->op], t1 - t0);
+        } else if (ret > 0) {
+            t->missing++;
+        } else {
+            t->errors[op->op]++;
+        }
+
+        replay_file_t *f = &replay_files[op->file];
+        if (op->op == OP_CREATE || op->op == OP_UNLINK) {
+            __atomic_add_fetch(&f->done_ns, 1, __ATOMIC_RELEASE);
+        }
+        __atomic_add_fetch(&f->done_ops, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void print_latency(const char *label, lat_samples_t *lat) {
+    if (lat->count == 0) {
+        return;
+    }
+
+    qsort(lat->ns, lat->count, sizeof(uint64_t), cmp_u64);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < lat->count; i++) {
+        sum += lat->ns[i];
+    }
+
+    size_t p50 = (size_t)(lat->count * 0.50);
+    size_t p99 = (size_t)(lat->count * 0.99);
+    size_t p999 = (size_t)(lat->count * 0.999);
+    if (p99 >= lat->count) p99 = lat->count - 1;
+    if (p999 >= lat->count) p999 = lat->count - 1;
+
+    printf("  %-8s lat (usec): min=%.1f avg=%.1f p50=%.1f p99=%.1f p99.9=%.1f max=%.1f (%zu samples)\n",
+           label,
+           lat->ns[0] / 1000.0,
+           (double)sum / lat->count / 1000.0,
+           lat->ns[p50] / 1000.0,
+           lat->ns[p99] / 1000.0,
+           lat->ns[p999] / 1000.0,
+           lat->ns[lat->count - 1] / 1000.0,
+           lat->count);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] <trace>\n", prog);
+    printf("  Trace lines: <timestamp sec> <thread> <create|write|read|unlink|truncate> <path|inode> [offset] [length]\n");
+    printf("  -a            Replay as fast as possible instead of at the original times\n");
+    printf("  -s <factor>   Speed up (>1) or slow down (<1) the original timing (default 1)\n");
+    printf("  -l <usec>     Simulated log flush latency (default 0)\n");
+    printf("  -P <policy>   AG selection policy: locality|stripe (default locality)\n");
+    printf("  -M            Disable per-thread allocation pools\n");
+    printf("  -D <size>     Simulated disk size (default 100m)\n");
+    printf("  -A <count>    Number of AGs (default %d, or derived from -G)\n", XFS_DEFAULT_AGCOUNT);
+    printf("  -G <size>     AG size (default: disk size / AG count)\n");
+    printf("  -B <size>     Filesystem block size (default %d)\n", XFS_BLOCK_SIZE);
+    printf("  -E            Load every AG at mount instead of on first allocation\n");
+}
+
+int main(int argc, char **argv) {
+    cfg.speed = 1.0;
+    cfg.ag_policy = "locality";
+    cfg.geom.disk_size = 100 * 1024 * 1024;
+    cfg.geom.blocksize = XFS_BLOCK_SIZE;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "as:l:P:MD:A:G:B:Eh")) != -1) {
+        switch (opt) {
+            case 'a': cfg.afap = 1; break;
+            case 's': cfg.speed = atof(optarg); break;
+            case 'l': cfg.log_delay_us = (unsigned int)atoi(optarg); break;
+            case 'P': cfg.ag_policy = optarg; break;
+            case 'M': cfg.no_pools = 1; break;
+            case 'D': cfg.geom.disk_size = parse_size(optarg); break;
+            case 'A': cfg.geom.agcount = (uint32_t)atoi(optarg); break;
+            case 'G': cfg.geom.agsize = parse_size(optarg); break;
+            case 'B': cfg.geom.blocksize = (uint32_t)parse_size(optarg); break;
+            case 'E': cfg.mount.eager_ags = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || cfg.speed <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.trace = argv[optind];
+
+    long skipped = load_trace(cfg.trace);
+    if (skipped < 0) {
+        return 1;
+    }
+    if (replay_nops == 0) {
+        fprintf(stderr, "%s: no operations\n", cfg.trace);
+        return 1;
+    }
+    if (plan_replay() != 0) {
+        fprintf(stderr, "Out of memory planning the replay\n");
+        return 1;
+    }
+
+    if (xfs_mkfs_opts(&cfg.geom) != 0 || xfs_mount_opts(&cfg.mount) != 0) {
+        fprintf(stderr, "Failed to format/mount the simulated filesystem\n");
+        return 1;
+    }
+    trans_set_flush_delay(cfg.log_delay_us);
+    if (xfs_alloc_set_policy(cfg.ag_policy) != 0) {
+        fprintf(stderr, "Unknown AG policy '%s'\n", cfg.ag_policy);
+        return 1;
+    }
+    xfs_alloc_set_pools(!cfg.no_pools);
+
+    uint64_t setup_start = now_ns();
+    uint64_t layout_bytes = 0;
+    int precreate_failed = precreate_files(&layout_bytes);
+    uint64_t setup_ns = now_ns() - setup_start;
+
+    for (int i = 0; i < replay_nthreads; i++) {
+        replay_thread_t *t = &replay_threads[i];
+        t->buf = (char *)malloc(t->buf_size ? t->buf_size : 1);
+        if (t->buf == NULL) {
+            fprintf(stderr, "Out of memory for I/O buffers\n");
+            return 1;
+        }
+        memset(t->buf, 'a' + (i % 26), t->buf_size);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, replay_nthreads + 1);
+    for (int i = 0; i < replay_nthreads; i++) {
+        pthread_create(&replay_threads[i].thread, NULL, replay_worker, &replay_threads[i]);
+    }
+    // Give the workers a moment past the barrier so the first operations are not late
+    replay_start_ns = now_ns() + 1000000;
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < replay_nthreads; i++) {
+        pthread_join(replay_threads[i].thread, NULL);
+    }
+    uint64_t elapsed = now_ns() - replay_start_ns;
+
+    // Aggregate results
+    long errors = 0, missing = 0, op_errors[OP_MAX] = {0};
+    uint64_t rbytes = 0, wbytes = 0;
+    lat_samples_t lat[OP_MAX], all_lat = {0}, lag = {0};
+    memset(lat, 0, sizeof(lat));
+    for (int i = 0; i < replay_nthreads; i++) {
+        replay_thread_t *t = &replay_threads[i];
+        for (int o = 0; o < OP_MAX; o++) {
+            op_errors[o] += t->errors[o];
+            errors += t->errors[o];
+        }
+        missing += t->missing;
+        rbytes += t->bytes_read;
+        wbytes += t->bytes_written;
+        for (int o = 0; o < OP_MAX; o++) {
+            lat_merge(&lat[o], &t->lat[o]);
+            lat_merge(&all_lat, &t->lat[o]);
+            free(t->lat[o].ns);
+        }
+        lat_merge(&lag, &t->lag);
+        free(t->lag.ns);
+        free(t->ops);
+        free(t->buf);
+    }
+
+    double secs = elapsed / 1e9;
+    double traced = replay_ops[replay_nops - 1].ts_ns / 1e9;
+    int precreated = 0;
+    for (int i = 0; i < replay_nfiles; i++) {
+        precreated += replay_files[i].precreate;
+    }
+
+    printf("xfs_replay: trace=%s ops=%zu threads=%d files=%d pacing=", cfg.trace, replay_nops,
+           replay_nthreads, replay_nfiles);
+    if (cfg.afap) {
+        printf("afap");
+    } else {
+        printf("original x%.2f", cfg.speed);
+    }
+    printf(" log_delay=%uus agpolicy=%s%s\n", cfg.log_delay_us, cfg.ag_policy, cfg.no_pools ? " nopools" : "");
+    printf("  geometry: %d AGs x %u blocks, %u-byte blocks\n", ag_count(), ag_blocks(), ag_blocksize());
+    printf("  setup: %d files pre-created (%d failed), %.2f MiB laid out in %.2fms; %ld trace lines skipped\n",
+           precreated, precreate_failed, layout_bytes / (1024.0 * 1024.0), setup_ns / 1e6, skipped);
+    printf("  runtime=%.3fs (traced %.3fs) completed=%zu errors=%ld missing=%ld\n",
+           secs, traced, all_lat.count, errors, missing);
+    printf("  IOPS=%.1f BW=%.2f MiB/s (read %.2f MiB/s, write %.2f MiB/s)\n",
+           all_lat.count / secs,
+           (rbytes + wbytes) / secs / (1024.0 * 1024.0),
+           rbytes / secs / (1024.0 * 1024.0),
+           wbytes / secs / (1024.0 * 1024.0));
+    if (errors > 0) {
+        printf("  errors:");
+        for (int o = 0; o < OP_MAX; o++) {
+            if (op_errors[o] > 0) {
+                printf(" %s=%ld", op_names[o], op_errors[o]);
+            }
+        }
+        printf("\n");
+    }
+    for (int o = 0; o < OP_MAX; o++) {
+        print_latency(op_names[o], &lat[o]);
+        free(lat[o].ns);
+    }
+    print_latency("all", &all_lat);
+    if (!cfg.afap) {
+        print_latency("lag", &lag);
+    }
+    free(all_lat.ns);
+    free(lag.ns);
+
+    pthread_barrier_destroy(&start_barrier);
+    trans_destroy();
+    disk_destroy();
+    return 0;
+}
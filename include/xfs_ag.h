@@ -3,22 +3,80 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include "xfs_types.h"
 
-#define NUM_AGS 10  // Number of allocation groups
+#define XFS_DEFAULT_AGCOUNT 10  // AG count when mkfs is given neither a count nor a size
 
-// Initialize allocation groups
-int ag_init_headers(void);
+// Fixed per-AG header blocks; the free space bitmap follows the AGI
+#define XFS_AG_SB_BLOCK     0   // Superblock (primary in AG 0, secondary copies elsewhere)
+#define XFS_AG_AGF_BLOCK    1   // AG free space header
+#define XFS_AG_AGI_BLOCK    2   // AG inode header
+#define XFS_AG_BITMAP_BLOCK 3   // First block of the free space bitmap
+
+// Initialize allocation groups for the given geometry, with a new filesystem UUID
+int ag_init_headers(uint32_t agcount, uint32_t agblocks, uint32_t blocksize);
+
+// Read the geometry from the superblock and initialize the allocation groups
+int ag_mount(void);
+
+// Number of allocation groups
+int ag_count(void);
+
+// Blocks per allocation group
+uint32_t ag_blocks(void);
+
+// Filesystem block size in bytes
+uint32_t ag_blocksize(void);
+
+// Blocks used by each AG's free space bitmap
+uint32_t ag_bitmap_blocks(void);
+
+// First AG-relative block available for data (headers and bitmap come first)
+uint32_t ag_first_data_block(void);
+
+// NUMA node an AG is mapped to: each node gets a contiguous range of AGs
+int ag_node(int ag_id);
+
+// First AG and number of AGs mapped to a node; a node left without AGs shares its neighbour's
+void ag_node_ags(int node, int *first, int *count);
 
 // Lock a specific allocation group
 int ag_lock(int ag_id);
 
+// Try to lock a specific allocation group without blocking (0 = locked)
+int ag_trylock(int ag_id);
+
 // Unlock a specific allocation group
 int ag_unlock(int ag_id);
 
 // Get the offset of a specific AG in the disk
 uint64_t ag_get_offset(int ag_id);
 
-// Write AG headers to disk
-int ag_write_headers(void);
+// Get the disk offset of an AG-relative block
+uint64_t ag_block_offset(int ag_id, uint64_t agbno);
+
+// Convert an AG-relative block number to a filesystem block number
+uint64_t ag_fsb(int ag_id, uint64_t agbno);
+
+// Get the AG that holds a filesystem block
+int ag_fsb_to_agno(uint64_t fsb);
+
+// Get the AG-relative block number of a filesystem block
+uint64_t ag_fsb_to_agbno(uint64_t fsb);
+
+// Filesystem UUID from mkfs or the superblock
+const uint8_t *ag_uuid(void);
+
+// Read an AG's AGF and verify its magic, owner, UUID and CRC
+int ag_read_agf(int ag_id, xfs_agf_t *agf);
+
+// Stamp an AGF's UUID, LSN and CRC and write it to disk
+int ag_write_agf(int ag_id, xfs_agf_t *agf);
+
+// Write one AG's headers (superblock copy, AGF, AGI) to disk
+int ag_write_header(int ag_id);
+
+// Run fn for every AG as up to nthreads background tasks (0 = one per pool thread); -1 if any call failed
+int ag_foreach_parallel(int (*fn)(int ag_id, void *arg), void *arg, int nthreads);
 
-#endif // XFS_AG_H
\ No newline at end of file
+#endif // XFS_AG_H
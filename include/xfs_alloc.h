@@ -4,15 +4,101 @@
 #include <stdint.h>
 #include "xfs_types.h"
 
-#define XFS_BLOCK_SIZE 4096
+#define XFS_BLOCK_SIZE 4096  // Default filesystem block size
 
 // Allocate contiguous blocks in a specific AG
 uint64_t xfs_alloc_blocks(int ag_id, int count);
 
-// Free allocated blocks in a specific AG
+// Free allocated blocks in a specific AG (blocks that were never committed to the log)
 int xfs_free_blocks(int ag_id, uint64_t start_block, int count);
 
+// An extent within one AG
+typedef struct {
+    uint32_t agbno;   // AG-relative start block
+    uint32_t len;     // Number of blocks
+} xfs_agext_t;
+
+// Free a batch of extents in one AG under one AG lock hold and AGF update;
+// shared blocks only lose an owner, and freed blocks stay busy (not
+// reallocated) until that update is flushed
+int xfs_free_extents(int ag_id, const xfs_agext_t *ext, int count);
+
+// Allocate one block for AG metadata in an AG whose lock is held; returns the AG block or 0
+uint64_t xfs_alloc_ag_block(int ag_id);
+
+// Free one AG metadata block in an AG whose lock is held
+int xfs_free_ag_block(int ag_id, uint64_t agbno);
+
+// Get the in-core AGF of an AG whose lock is held, loading it on first use
+xfs_agf_t *xfs_alloc_get_agf(int ag_id);
+
+// Write back and log the in-core AGF of an AG whose lock is held
+int xfs_alloc_log_agf(int ag_id);
+
+// Allocate blocks for a file's logical_block in the AG chosen by the current
+// policy; stores the filesystem block number in *fsbno (caller holds the ILOCK)
+int xfs_alloc_file_blocks(xfs_inode_t *ip, uint64_t logical_block, int count, uint64_t *fsbno);
+
+// Whether some freed extent stays busy until the log is flushed further; a
+// failed allocation may then succeed after trans_commit_barrier()
+int xfs_alloc_busy_pending(void);
+
+// Select the AG selection policy by name ("locality" or "stripe")
+int xfs_alloc_set_policy(const char *name);
+
+// Get the name of the current AG selection policy
+const char *xfs_alloc_get_policy(void);
+
+// Enable or disable per-thread pools for small file allocations (enabled by
+// default); disabling returns every pooled block to its AG
+void xfs_alloc_set_pools(int enable);
+
+// Whether small file allocations are served from per-thread pools
+int xfs_alloc_get_pools(void);
+
+// Blocks reserved in per-thread pools, folded across every thread
+uint64_t xfs_alloc_pool_blocks(void);
+
+// Write an empty free space bitmap for an AG (mkfs)
+int xfs_ag_init_bitmap(int ag_id);
+
 // Initialize the allocator for an AG
 int xfs_ag_init_alloc(int ag_id);
 
+// Set up the in-core free space state; eager loads every AG now, otherwise
+// each AG is loaded from disk on its first allocation
+int xfs_alloc_mount(int eager);
+
+// Return pooled blocks to their AGs and release the in-core free space state
+void xfs_alloc_unmount(void);
+
+// Number of AGs whose in-core free space state is loaded
+int xfs_alloc_loaded_ags(void);
+
+// Count the used blocks in an AG's on-disk bitmap (-1 on error)
+int64_t xfs_alloc_count_used(int ag_id);
+
+#define XFS_FREESP_BUCKETS 32
+
+// Histogram of free extent sizes; bucket b holds extents of 2^b to 2^(b+1)-1 blocks
+typedef struct {
+    uint64_t extents[XFS_FREESP_BUCKETS];
+    uint64_t blocks[XFS_FREESP_BUCKETS];
+    uint64_t total_extents;
+    uint64_t total_blocks;
+    uint64_t longest;
+} xfs_freesp_t;
+
+// Add one free extent of len blocks to a histogram
+void xfs_freesp_add(xfs_freesp_t *fs, uint64_t len);
+
+// Histogram of an AG's free extents, from a word-level scan of its bitmap
+int xfs_alloc_freesp(int ag_id, xfs_freesp_t *fs);
+
+// Histogram of every AG (scanned in parallel) summed into total; per_ag, if given, gets ag_count() entries
+int xfs_alloc_freesp_all(xfs_freesp_t *total, xfs_freesp_t *per_ag);
+
+// Free extents in a loaded AG, kept current by every allocation and free (-1 if not loaded)
+int64_t xfs_alloc_free_extents(int ag_id);
+
 #endif // XFS_ALLOC_H
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef XFS_CKSUM_H
+#define XFS_CKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Seed for metadata checksums, as in XFS
+#define XFS_CRC_SEED 0xffffffffu
+
+// Extend a CRC32C over buf (pass XFS_CRC_SEED to start; the result is not inverted)
+uint32_t xfs_crc32c(uint32_t crc, const void *buf, size_t len);
+
+// Use the hardware CRC32 instruction if the CPU has it (1), or the table-driven code (0); -1 if unsupported
+int xfs_crc32c_set_hw(int enable);
+
+// Name of the CRC32C implementation in use
+const char *xfs_crc32c_impl(void);
+
+// Checksum a metadata buffer whose 32-bit CRC field is at cksum_off, treating that field as zero
+uint32_t xfs_cksum_calc(const void *buf, size_t len, size_t cksum_off);
+
+// Stamp a metadata buffer's CRC field
+void xfs_cksum_update(void *buf, size_t len, size_t cksum_off);
+
+// Check a metadata buffer's CRC field (1 = good, 0 = bad)
+int xfs_cksum_verify(const void *buf, size_t len, size_t cksum_off);
+
+// Count a verification failure found by a caller that checks its own layout
+void xfs_cksum_report_failure(void);
+
+// Metadata verification failures seen since startup
+uint64_t xfs_cksum_failures(void);
+
+#endif // XFS_CKSUM_H
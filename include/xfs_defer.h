@@ -0,0 +1,32 @@
+#ifndef XFS_DEFER_H
+#define XFS_DEFER_H
+
+#include <stdint.h>
+
+// One extent whose freeing has been deferred
+typedef struct {
+    uint64_t fsb;     // Filesystem block
+    uint64_t len;     // Length in blocks
+} xfs_defer_extent_t;
+
+// Extent frees deferred to the end of a transaction
+typedef struct {
+    xfs_defer_extent_t *extents;
+    int count;
+    int cap;
+} xfs_defer_t;
+
+// Start an empty list of deferred frees
+void xfs_defer_init(xfs_defer_t *dfops);
+
+// Queue an extent to be freed when the transaction finishes
+int xfs_defer_add_free(xfs_defer_t *dfops, uint64_t fsb, uint64_t len);
+
+// Log an intent to free every queued extent, free them in one batch per AG,
+// log the matching done item and empty the list
+int xfs_defer_finish(xfs_defer_t *dfops);
+
+// Drop the queued extents without freeing them
+void xfs_defer_cancel(xfs_defer_t *dfops);
+
+#endif // XFS_DEFER_H
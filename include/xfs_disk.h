@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 
-// Initialize the simulated disk with a given size
+// Initialize the simulated disk with a given size (memory is allocated on first write)
 int disk_init(size_t size);
 
 // Read data from the simulated disk
@@ -13,6 +13,27 @@ int disk_read(uint64_t offset, void* buf, size_t len);
 // Write data to the simulated disk
 int disk_write(uint64_t offset, void* buf, size_t len);
 
+// Zero a range of the simulated disk, releasing the memory behind it
+int disk_zero(uint64_t offset, size_t len);
+
+// Logical size of the simulated disk in bytes
+uint64_t disk_size(void);
+
+// Memory actually allocated for the simulated disk, in bytes
+uint64_t disk_resident_bytes(void);
+
+// Granularity in which the simulated disk allocates memory, in bytes
+uint64_t disk_chunk_size(void);
+
+// Initialize an empty disk whose chunks may be adopted from an image mapping (unmapped by disk_destroy)
+int disk_init_mapped(size_t size, void *map, size_t map_len);
+
+// Make a chunk-aligned range of the disk read its contents from data in the image mapping
+int disk_adopt_chunk(uint64_t offset, void *data);
+
+// Call fn for every materialized chunk in offset order, stopping at the first nonzero return
+int disk_foreach_chunk(int (*fn)(uint64_t offset, const void *data, void *arg), void *arg);
+
 // Clean up the simulated disk
 void disk_destroy(void);
 
@@ -0,0 +1,22 @@
+#ifndef XFS_FSR_H
+#define XFS_FSR_H
+
+#include "xfs_types.h"
+
+// Totals from a defragmentation pass
+typedef struct {
+    int files_scanned;        // Inodes examined
+    int files_defragged;      // Inodes whose data was relocated
+    int extents_before;       // Extents of the relocated inodes before the pass
+    int extents_after;        // Extents of the relocated inodes after the pass
+    uint64_t blocks_moved;    // Blocks copied to their new location
+} xfs_fsr_result_t;
+
+// Relocate a fragmented file's data into fewer extents, copying at most
+// rate_bps bytes per second (0 = unlimited); results are added to *res
+int xfs_fsr_inode(xfs_inode_t *ip, uint64_t rate_bps, xfs_fsr_result_t *res);
+
+// Defragment every file in the filesystem
+int xfs_fsr_all(uint64_t rate_bps, xfs_fsr_result_t *res);
+
+#endif // XFS_FSR_H
@@ -0,0 +1,21 @@
+#ifndef XFS_IMAGE_H
+#define XFS_IMAGE_H
+
+#include <stdint.h>
+#include "xfs_io.h"
+
+// What a save or load moved
+typedef struct {
+    uint32_t inodes;      // Files in the inode table
+    uint64_t chunks;      // Disk chunks stored (all-zero chunks are left out)
+    uint64_t bytes;       // Size of the image file
+    int mapped;           // Load only: 1 if disk chunks point into a mapping of the image
+} xfs_image_info_t;
+
+// Save the disk and the inode table of the mounted filesystem to path; info may be NULL
+int xfs_image_save(const char *path, xfs_image_info_t *info);
+
+// Replace the disk and the inode table with an image and mount it; opts and info may be NULL
+int xfs_image_load(const char *path, const xfs_mount_opts_t *opts, xfs_image_info_t *info);
+
+#endif // XFS_IMAGE_H
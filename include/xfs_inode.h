@@ -0,0 +1,29 @@
+#ifndef XFS_INODE_H
+#define XFS_INODE_H
+
+#include "xfs_types.h"
+
+// Inode lock flags (mirrors XFS IOLOCK/ILOCK semantics)
+//   IOLOCK - serializes file I/O: shared for reads and non-extending writes,
+//            exclusive for writes that change the file size
+//   ILOCK  - protects the extent map and inode core: shared for lookups,
+//            exclusive for extent map and di_size changes
+// Lock order: IOLOCK -> ILOCK -> AG lock
+#define XFS_IOLOCK_EXCL    (1 << 0)
+#define XFS_IOLOCK_SHARED  (1 << 1)
+#define XFS_ILOCK_EXCL     (1 << 2)
+#define XFS_ILOCK_SHARED   (1 << 3)
+
+// Initialize the per-inode locks
+int xfs_inode_init_locks(xfs_inode_t *ip);
+
+// Destroy the per-inode locks
+void xfs_inode_destroy_locks(xfs_inode_t *ip);
+
+// Take the inode locks named in lock_flags (IOLOCK before ILOCK)
+void xfs_ilock(xfs_inode_t *ip, int lock_flags);
+
+// Release the inode locks named in lock_flags (ILOCK before IOLOCK)
+void xfs_iunlock(xfs_inode_t *ip, int lock_flags);
+
+#endif // XFS_INODE_H
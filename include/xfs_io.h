@@ -10,6 +10,9 @@ int xfs_sim_read(xfs_inode_t *inode, void *buffer, size_t size, off_t offset);
 // Write data to a file (simulated)
 int xfs_sim_write(xfs_inode_t *inode, void *buffer, size_t size, off_t offset);
 
+// Find the extent mapping a logical block (caller holds the ILOCK)
+xfs_extent_t* find_extent_for_offset(xfs_inode_t *inode, uint64_t logical_block);
+
 // Print detailed inode information
 void print_inode_details(int inode_num);
 
@@ -19,6 +22,12 @@ xfs_inode_t* get_inode_ptr(int inode_num);
 // Helper to get an inode by filename
 xfs_inode_t* get_inode_by_name(const char* filename);
 
+// Helper to get the filename of an inode
+const char* get_inode_name(int inode_num);
+
+// Helper to get the highest inode number in use
+int get_max_inode_num(void);
+
 // Helper to get inode number by filename
 int get_inode_num_by_name(const char* filename);
 
@@ -28,18 +37,68 @@ int xfs_create_file(void);
 // Create a new file with a specific name
 int xfs_create_named_file(const char* filename);
 
+// Remove a file, freeing its blocks and its inode
+int xfs_unlink(int inode_num);
+
+// Give a file a new owner and group (moves its usage between their quotas)
+int xfs_chown(xfs_inode_t *inode, uint32_t uid, uint32_t gid);
+
+// Drop every inode from the in-core table
+void xfs_inode_table_reset(void);
+
+// Install an inode under its own number (src->inode_num) and name
+int xfs_inode_restore(const xfs_inode_t *src, const char *name);
+
+// xfs_fallocate() flags
+#define XFS_FALLOC_KEEP_SIZE 0x1  // Preallocate without changing the file size
+
+// Preallocate a byte range as unwritten extents (read as zeros until written)
+int xfs_fallocate(xfs_inode_t *inode, uint64_t offset, uint64_t len, int flags);
+
+// Change the size of a file, freeing the blocks past a smaller EOF
+int xfs_truncate(xfs_inode_t *inode, uint64_t new_size);
+
+// Deallocate a byte range of a file, leaving a hole (the size is unchanged)
+int xfs_punch_hole(xfs_inode_t *inode, uint64_t offset, uint64_t len);
+
+// Make dst a copy of src that shares src's blocks (copy on write); only metadata changes
+int xfs_reflink_clone(xfs_inode_t *src, xfs_inode_t *dst);
+
 // Print log/journal queue status
 void print_log_queue_status(void);
 
-// Format disk (mkfs equivalent)
+// mkfs geometry; zero fields take defaults
+typedef struct {
+    uint64_t disk_size;   // Disk size in bytes
+    uint32_t agcount;     // Number of AGs (0 = derive from agsize, or the default count)
+    uint64_t agsize;      // AG size in bytes (0 = split the disk evenly across agcount)
+    uint32_t blocksize;   // Block size in bytes (0 = XFS_BLOCK_SIZE)
+    int threads;          // Background tasks formatting AGs in parallel (0 = one per pool thread)
+} xfs_mkfs_opts_t;
+
+// Mount options
+typedef struct {
+    int eager_ags;        // Load every AG's free space state at mount instead of on first use
+} xfs_mount_opts_t;
+
+// Format disk with the given geometry (mkfs equivalent)
+int xfs_mkfs_opts(const xfs_mkfs_opts_t *opts);
+
+// Format disk with the default geometry (mkfs equivalent)
 int xfs_mkfs(size_t disk_size);
 
-// Mount filesystem
+// Mount filesystem with options
+int xfs_mount_opts(const xfs_mount_opts_t *opts);
+
+// Mount filesystem (AGs are loaded lazily)
 int xfs_mount(void);
 
 // Print superblock information
 void print_superblock_info(void);
 
+// Print logical and resident size of the simulated disk
+void print_disk_info(void);
+
 // Print AGF (Allocation Group Free Space) information
 void print_agf_info(int ag_id);
 
@@ -52,4 +111,17 @@ void print_ag_summary(void);
 // List all files in the system
 void list_files(void);
 
+// Distribution of extents per file
+typedef struct {
+    uint64_t files;
+    uint64_t extents;
+    uint64_t by_count[XFS_MAX_EXTENTS + 1];  // Files with n extents
+} xfs_extent_hist_t;
+
+// Count how many files have each number of extents
+int xfs_file_extent_hist(xfs_extent_hist_t *h);
+
+// Print free extent size histograms for one AG (or every AG, if ag_id < 0) and the extents per file
+void print_freesp(int ag_id);
+
 #endif // XFS_IO_H
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef XFS_NUMA_H
+#define XFS_NUMA_H
+
+#include <stddef.h>
+
+// Most nodes tracked; sysfs nodes past this are ignored
+#define XFS_NUMA_MAX_NODES 64
+
+// Number of nodes (the machine's, or the emulated count; 1 if unknown)
+int xfs_numa_nodes(void);
+
+// Split the online CPUs into n emulated nodes (0 = use the machine's topology)
+int xfs_numa_set_nodes(int n);
+
+// Whether the node count is emulated
+int xfs_numa_emulated(void);
+
+// Node of a CPU (0 if unknown)
+int xfs_numa_cpu_node(int cpu);
+
+// CPU the calling thread is running on (0 if unknown)
+int xfs_numa_current_cpu(void);
+
+// Node the calling thread is running on
+int xfs_numa_current_node(void);
+
+// Restrict the calling thread to the CPUs of a node (-1 = every CPU the process may use)
+int xfs_numa_bind_thread(int node);
+
+// Turn AG and worker affinity on or off (off by default)
+void xfs_numa_set_affinity(int enable);
+
+// Whether AG and worker affinity is on
+int xfs_numa_get_affinity(void);
+
+// Changes whenever the node count or the affinity setting changes
+unsigned int xfs_numa_epoch(void);
+
+// Allocate zeroed memory, placed on a node where the kernel allows it (-1 = anywhere); release with free()
+void *xfs_numa_alloc(size_t size, int node);
+
+#endif // XFS_NUMA_H
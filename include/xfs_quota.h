@@ -0,0 +1,86 @@
+#ifndef XFS_QUOTA_H
+#define XFS_QUOTA_H
+
+#include <stdint.h>
+#include "xfs_types.h"
+
+// Kinds of quota
+typedef enum {
+    XFS_DQ_USER,
+    XFS_DQ_GROUP,
+    XFS_DQ_TYPES
+} xfs_dqtype_t;
+
+// Grace period after a soft limit is exceeded when none is set (seconds)
+#define XFS_QUOTA_DEFAULT_GRACE (7 * 24 * 3600)
+
+// Record of one user or group, as logged at checkpoints; limits of 0 mean none
+typedef struct {
+    uint32_t d_id;
+    uint32_t d_type;            // xfs_dqtype_t
+    uint64_t d_blk_softlimit;   // Blocks
+    uint64_t d_blk_hardlimit;
+    uint64_t d_ino_softlimit;   // Inodes
+    uint64_t d_ino_hardlimit;
+    uint64_t d_bcount;          // Blocks in use
+    uint64_t d_icount;          // Inodes in use
+    uint64_t d_btimer;          // When the block soft limit starts to be enforced (0 = not over it)
+    uint64_t d_itimer;          // Same for inodes; seconds since the epoch
+} xfs_disk_dquot_t;
+
+// Quota counters
+typedef struct {
+    uint64_t slow_reservations; // Reservations near a limit, counted exactly under the record's lock
+    uint64_t denied;            // Reservations refused by a hard limit or an expired soft limit
+    uint64_t soft_exceeded;     // Reservations that went over a soft limit
+    uint64_t folds;             // Checkpoints that folded per-CPU deltas
+    uint64_t logged;            // Records logged by those checkpoints
+} xfs_quota_stats_t;
+
+// Count every inode's usage and turn accounting and enforcement on (run while the filesystem is idle)
+int xfs_quota_on(void);
+
+// Turn accounting and enforcement off; limits are kept
+void xfs_quota_off(void);
+
+// Whether quotas are on
+int xfs_quota_enabled(void);
+
+// Turn quotas off and drop every record (a new filesystem)
+void xfs_quota_reset(void);
+
+// Set the limits of a user or group, creating its record
+int xfs_quota_set_limits(xfs_dqtype_t type, uint32_t id, uint64_t blk_soft, uint64_t blk_hard,
+                         uint64_t ino_soft, uint64_t ino_hard);
+
+// Set the grace period after a soft limit is exceeded
+void xfs_quota_set_grace(uint64_t seconds);
+
+// Attach an inode to the records of its owner and group, creating them if needed
+int xfs_quota_attach(xfs_inode_t *ip);
+
+// Charge blocks to an inode's owner and group; -1 (nothing charged) if a limit would be exceeded
+int xfs_quota_reserve_blocks(xfs_inode_t *ip, uint64_t count);
+
+// Give back blocks charged to an inode's owner and group
+void xfs_quota_unreserve_blocks(xfs_inode_t *ip, uint64_t count);
+
+// Charge a new inode to its owner and group; -1 if a limit would be exceeded
+int xfs_quota_reserve_inode(xfs_inode_t *ip);
+
+// Give back a removed inode
+void xfs_quota_unreserve_inode(xfs_inode_t *ip);
+
+// Move an inode and its blocks to a new owner and group (caller holds the ILOCK exclusively)
+int xfs_quota_chown(xfs_inode_t *ip, uint32_t uid, uint32_t gid, uint64_t blocks);
+
+// Current usage and limits of a user or group; -1 if it has no record
+int xfs_quota_get(xfs_dqtype_t type, uint32_t id, xfs_disk_dquot_t *dq);
+
+// Copy the counters
+void xfs_quota_get_stats(xfs_quota_stats_t *stats);
+
+// Print every record of one kind (usage, limits and grace state) and the counters
+void xfs_quota_print_report(xfs_dqtype_t type);
+
+#endif // XFS_QUOTA_H
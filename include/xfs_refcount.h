@@ -0,0 +1,37 @@
+#ifndef XFS_REFCOUNT_H
+#define XFS_REFCOUNT_H
+
+#include <stdint.h>
+#include "xfs_alloc.h"
+
+// A run of blocks in one AG with the same number of owners (at least two)
+typedef struct {
+    uint32_t rc_startblock;  // AG-relative start block
+    uint32_t rc_blockcount;  // Number of blocks
+    uint32_t rc_refcount;    // Number of owners
+} xfs_refcount_rec_t;
+
+// Find the first shared run in [agbno, agbno + len) of an AG whose lock is
+// held; returns 1 with the run in *fbno/*flen, 0 if nothing is shared, -1 on error
+int xfs_refcount_find_shared_locked(int ag_id, uint32_t agbno, uint32_t len, uint32_t *fbno, uint32_t *flen);
+
+// Find the first shared run in [agbno, agbno + len) of an AG (takes the AG lock)
+int xfs_refcount_find_shared(int ag_id, uint32_t agbno, uint32_t len, uint32_t *fbno, uint32_t *flen);
+
+// Add an owner to each extent of one AG under one AG lock hold and one log item
+int xfs_refcount_increase(int ag_id, const xfs_agext_t *ext, int count);
+
+// Drop an owner from each extent of an AG whose lock is held. Blocks that
+// had only one owner are appended to *unshared (grown with realloc,
+// *nunshared entries) for the caller to free.
+int xfs_refcount_decrease_locked(int ag_id, const xfs_agext_t *ext, int count,
+                                 xfs_agext_t **unshared, int *nunshared);
+
+// Drop the owner xfs_refcount_increase added to each extent of one AG, to
+// back out a failed clone; blocks left with one owner stay allocated
+int xfs_refcount_decrease(int ag_id, const xfs_agext_t *ext, int count);
+
+// Count an AG's refcount records and the blocks they cover (takes the AG lock)
+int xfs_refcount_count(int ag_id, uint64_t *records, uint64_t *shared_blocks);
+
+#endif // XFS_REFCOUNT_H
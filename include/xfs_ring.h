@@ -0,0 +1,69 @@
+#ifndef XFS_RING_H
+#define XFS_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>  // For off_t
+
+// Asynchronous file operations
+typedef enum {
+    XFS_RING_OP_NOP,
+    XFS_RING_OP_READ,     // xfs_sim_read(): res is the bytes read
+    XFS_RING_OP_WRITE,    // xfs_sim_write(): res is the bytes written
+    XFS_RING_OP_FSYNC,    // Log barrier: completes once everything logged before it is flushed
+    XFS_RING_OP_CREATE    // xfs_create_named_file(buf), or xfs_create_file() if buf is NULL: res is the inode
+} xfs_ring_op_t;
+
+// Submission entry flags
+#define XFS_SQE_LINK 0x1  // The next entry starts after this one succeeds; if it fails, the rest of the chain is canceled
+
+// In a linked entry: the inode made by the chain's most recent create
+#define XFS_RING_PREV_INODE 0
+
+// Completion result of a linked entry canceled because an earlier entry failed
+#define XFS_RING_CANCELED (-2)
+
+// Submission queue entry
+typedef struct {
+    uint8_t opcode;       // xfs_ring_op_t
+    uint8_t flags;        // XFS_SQE_*
+    int inode_num;        // Target file of read, write and fsync
+    void *buf;            // Data of read and write, name of create
+    size_t len;
+    off_t offset;
+    uint64_t user_data;   // Copied to the completion
+} xfs_sqe_t;
+
+// Completion queue entry
+typedef struct {
+    uint64_t user_data;
+    int res;              // Operation result; negative on failure
+} xfs_cqe_t;
+
+typedef struct xfs_ring xfs_ring_t;
+
+// Create a ring with room for entries submissions and a pool of workers threads to run them
+xfs_ring_t *xfs_ring_create(unsigned int entries, int workers);
+
+// Wait for every submitted entry to complete, stop the workers and free the ring
+void xfs_ring_destroy(xfs_ring_t *ring);
+
+// Next free submission entry, or NULL if the ring is full
+xfs_sqe_t *xfs_ring_get_sqe(xfs_ring_t *ring);
+
+// Hand every entry taken since the last submit to the workers; returns how many
+int xfs_ring_submit(xfs_ring_t *ring);
+
+// Oldest unseen completion, or NULL if there is none
+xfs_cqe_t *xfs_ring_peek_cqe(xfs_ring_t *ring);
+
+// Wait for a completion (0), or return -1 if nothing is in flight
+int xfs_ring_wait_cqe(xfs_ring_t *ring, xfs_cqe_t **cqe);
+
+// Release a completion returned by peek or wait
+void xfs_ring_cqe_seen(xfs_ring_t *ring, xfs_cqe_t *cqe);
+
+// Entries taken from the ring whose completions have not been seen
+unsigned int xfs_ring_inflight(xfs_ring_t *ring);
+
+#endif // XFS_RING_H
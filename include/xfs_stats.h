@@ -0,0 +1,46 @@
+#ifndef XFS_STATS_H
+#define XFS_STATS_H
+
+#include <stdint.h>
+
+// Instrumented hot paths
+typedef enum {
+    XFS_STAT_ALLOC,          // xfs_alloc_blocks()
+    XFS_STAT_FREE,           // xfs_free_blocks()
+    XFS_STAT_LOG_ENQUEUE,    // trans_add_item()
+    XFS_STAT_LOG_FLUSH,      // Log worker write of one checkpoint
+    XFS_STAT_BARRIER_WAIT,   // Time blocked in trans_commit_barrier()
+    XFS_STAT_READ,           // xfs_sim_read()
+    XFS_STAT_WRITE,          // xfs_sim_write()
+    XFS_STAT_AG_LOCK_WAIT,   // Time waiting for ag_lock()
+    XFS_STAT_EXTENT_LOOKUP,  // find_extent_for_offset()
+    XFS_STAT_LOG_SPACE_WAIT, // Time blocked for log space in trans_add_object()
+    XFS_STAT_MAX
+} xfs_stat_id_t;
+
+// Latency histogram buckets: bucket 0 holds 0ns, bucket i holds [2^(i-1), 2^i) ns
+#define XFS_STATS_BUCKETS 40
+
+// Dump formats for xfs_stats_dump()
+#define XFS_STATS_FMT_JSON 0
+#define XFS_STATS_FMT_PROM 1
+
+// Monotonic timestamp in nanoseconds
+uint64_t xfs_stats_now(void);
+
+// Record one event whose latency is (now - start_ns)
+void xfs_stats_record(xfs_stat_id_t id, uint64_t start_ns);
+
+// Record one event with an explicit latency in nanoseconds
+void xfs_stats_record_ns(xfs_stat_id_t id, uint64_t ns);
+
+// Print a summary table of all counters
+void xfs_stats_print(void);
+
+// Write all counters and histograms to a file as JSON or Prometheus text
+int xfs_stats_dump(const char *path, int format);
+
+// Zero all counters and histograms
+void xfs_stats_reset(void);
+
+#endif // XFS_STATS_H
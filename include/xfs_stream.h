@@ -0,0 +1,29 @@
+#ifndef XFS_STREAM_H
+#define XFS_STREAM_H
+
+#include "xfs_types.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>  // For ssize_t
+
+// Chunk size used when a transfer passes 0
+#define XFS_STREAM_CHUNK (4u << 20)
+
+// Largest chunk a transfer accepts
+#define XFS_STREAM_MAX_CHUNK (1u << 30)
+
+// Called once per chunk, in file order. A read hands over len bytes of the
+// file at offset; a write asks for up to len bytes to store at offset.
+// Returns the bytes consumed or produced (fewer than len ends the transfer
+// after this chunk), or -1 to fail it.
+typedef ssize_t (*xfs_stream_fn)(void *buf, size_t len, uint64_t offset, void *arg);
+
+// Pass up to len bytes of a file starting at offset to fn; returns the bytes fn consumed, or -1
+int64_t xfs_stream_read(xfs_inode_t *inode, uint64_t offset, uint64_t len, size_t chunk,
+                        xfs_stream_fn fn, void *arg);
+
+// Write up to len bytes at offset, produced by fn; returns the bytes written, or -1
+int64_t xfs_stream_write(xfs_inode_t *inode, uint64_t offset, uint64_t len, size_t chunk,
+                         xfs_stream_fn fn, void *arg);
+
+#endif // XFS_STREAM_H
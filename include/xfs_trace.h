@@ -0,0 +1,78 @@
+#ifndef XFS_TRACE_H
+#define XFS_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Tracepoint sites compile to nothing when built with XFS_TRACE_ENABLED=0
+// (make TRACE=0). When compiled in, each site costs one predictable branch
+// until tracing is started at runtime.
+#ifndef XFS_TRACE_ENABLED
+#define XFS_TRACE_ENABLED 1
+#endif
+
+// Trace events; arguments are listed as decoded by xfs_trace_dump()
+typedef enum {
+    XFS_TRACE_WRITE_START,       // ino, offset, size, nblocks
+    XFS_TRACE_WRITE_ALLOC,       // ino, ag, logical block, physical block
+    XFS_TRACE_WRITE_ALLOC_FAIL,  // ino, ag, logical block
+    XFS_TRACE_WRITE_BARRIER,     // ino, barrier wait ns
+    XFS_TRACE_WRITE_DONE,        // ino, offset, bytes
+    XFS_TRACE_WRITE_ERROR,       // ino, logical block, disk offset
+    XFS_TRACE_READ_START,        // ino, offset, size
+    XFS_TRACE_READ_DONE,         // ino, offset, bytes
+    XFS_TRACE_READ_ERROR,        // ino, disk offset
+    XFS_TRACE_LOG_FLUSH,         // item length, is barrier
+    XFS_TRACE_LOG_BARRIER,       // flush ns
+    XFS_TRACE_CREATE,            // ino
+    XFS_TRACE_FSR,               // ino, extents before, extents after, blocks moved
+    XFS_TRACE_FREE_BATCH,        // ag, extents, blocks freed, busy until lsn
+    XFS_TRACE_UNMAP,             // ino, first logical block, end logical block, blocks unmapped
+    XFS_TRACE_UNLINK,            // ino
+    XFS_TRACE_FALLOC,            // ino, offset, length, blocks allocated
+    XFS_TRACE_CONVERT,           // ino, first logical block, end logical block, extents converted
+    XFS_TRACE_REFLINK,           // source ino, destination ino, extents shared, blocks shared
+    XFS_TRACE_COW,               // ino, logical block, new physical block, blocks
+    XFS_TRACE_MAX
+} xfs_trace_event_t;
+
+// One binary trace record
+typedef struct {
+    uint64_t ts_ns;
+    uint32_t event;
+    uint32_t tid;
+    uint64_t args[4];
+} xfs_trace_record_t;
+
+// Runtime switch checked by every tracepoint site
+extern volatile int xfs_trace_on;
+
+// Append an event to the calling thread's ring buffer
+void xfs_trace_emit(xfs_trace_event_t event, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3);
+
+#if XFS_TRACE_ENABLED
+#define trace_xfs(event, a0, a1, a2, a3)                                          \
+    do {                                                                          \
+        if (__builtin_expect(xfs_trace_on, 0)) {                                  \
+            xfs_trace_emit((event), (uint64_t)(a0), (uint64_t)(a1),               \
+                           (uint64_t)(a2), (uint64_t)(a3));                       \
+        }                                                                         \
+    } while (0)
+#else
+// Arguments are referenced inside sizeof only, so they are never evaluated
+#define trace_xfs(event, a0, a1, a2, a3)                                          \
+    do {                                                                          \
+        (void)sizeof((event) + (a0) + (a1) + (a2) + (a3));                        \
+    } while (0)
+#endif
+
+// Start a new trace session; events from earlier sessions are discarded
+void xfs_trace_start(void);
+
+// Stop recording events (buffers are kept for dumping)
+void xfs_trace_stop(void);
+
+// Decode all buffered events in timestamp order; returns the number written
+int xfs_trace_dump(FILE *out);
+
+#endif // XFS_TRACE_H
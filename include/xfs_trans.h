@@ -3,19 +3,88 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
 
-// Initialize the transaction system and log flushing thread
+// Kinds of metadata objects; changes to one object in the same checkpoint are logged once
+typedef enum {
+    TRANS_OBJ_ANON,     // Never merged (intents and other one-off items)
+    TRANS_OBJ_AGF,      // id = AG number
+    TRANS_OBJ_INODE,    // id = inode number
+    TRANS_OBJ_DQUOT     // id = quota type << 32 | user or group ID
+} trans_obj_type_t;
+
+// Key of a metadata object for trans_add_object()
+#define TRANS_OBJ_KEY(type, id) (((uint64_t)(type) << 56) | (uint64_t)(id))
+
+// Log space state and counters
+typedef struct {
+    uint64_t log_size;          // Bytes
+    uint64_t cil_push;          // CIL size that closes a checkpoint
+    int ail_push_pct;           // Log use that starts an AIL push
+    uint64_t used;              // Bytes between the tail and the grant head
+    uint64_t cil_items;
+    uint64_t cil_bytes;
+    uint64_t queued_items;      // Changes in checkpoints not yet written
+    uint64_t ail_items;         // Objects written to the log but not back in place
+    uint64_t tail_lsn;          // LSN of the oldest change not written back
+    uint64_t head_lsn;
+    uint64_t checkpoints;       // Checkpoints written
+    uint64_t checkpoint_items;
+    uint64_t relogged;          // Changes merged into one already in the CIL
+    uint64_t written_back;      // Objects written back by AIL pushes
+    uint64_t space_waits;       // Reservations that waited for log space
+} trans_log_stats_t;
+
+// Initialize the transaction system; log flushes and AIL pushes run on the background pool
 int trans_init(void);
 
-// Add a metadata change to the in-memory log queue
+// Set the simulated log flush latency per log write (microseconds, default 100ms)
+void trans_set_flush_delay(unsigned int usec);
+
+// Set the log size in bytes (at least 64 KiB, default 2 MiB)
+int trans_set_log_size(uint64_t bytes);
+
+// Set the CIL size that closes a checkpoint (0 = an eighth of the log; at most half)
+int trans_set_cil_push(uint64_t bytes);
+
+// Set how full the log gets, in percent, before the AIL is pushed (default 75)
+int trans_set_ail_push(int pct);
+
+// Set the simulated metadata writeback latency per AIL push batch (microseconds, default 1ms)
+void trans_set_writeback_delay(unsigned int usec);
+
+// Add a change to a metadata object to the CIL, waiting for log space if the log is full
+int trans_add_object(uint64_t key, void *data, int len);
+
+// Run fn (NULL = nothing) as each non-empty checkpoint closes; it may add changes with trans_hook_add_object()
+void trans_set_checkpoint_hook(void (*fn)(void));
+
+// From a checkpoint hook: add a change to the checkpoint being closed (no wait for log space)
+int trans_hook_add_object(uint64_t key, void *data, int len);
+
+// Add an anonymous metadata change to the CIL
 int trans_add_item(void* data, int len);
 
-// Commit a transaction barrier - blocks until the log is flushed
+// Commit a transaction barrier - checkpoints the CIL and blocks until the log
+// is flushed; fails if the log is shut down first
 int trans_commit_barrier(void);
 
-// Get the status of the log queue (number of pending transactions)
+// Commit a transaction barrier without waiting; done(arg, 0) runs on the log
+// worker once the log is flushed, or done(arg, -1) if it is shut down first
+int trans_commit_barrier_async(void (*done)(void *arg, int error), void *arg);
+
+// LSN of the most recently queued log item
+uint64_t trans_last_lsn(void);
+
+// LSN up to which every log item has been flushed
+uint64_t trans_flushed_lsn(void);
+
+// Get the number of changes not yet written to the log
 int get_log_queue_length(void);
 
+// Copy the log space state and counters
+void trans_get_log_stats(trans_log_stats_t *stats);
+
 // Clean up the transaction system
 void trans_destroy(void);
 
@@ -3,6 +3,13 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <pthread.h>
+
+#define XFS_SB_MAGIC  0x58465342  // "XFSB" in hex
+#define XFS_AGF_MAGIC 0x58414746  // "XAGF" in hex
+#define XFS_AGI_MAGIC 0x58414749  // "XAGI" in hex
+
+#define XFS_UUID_SIZE 16
 
 // XFS Superblock
 typedef struct {
@@ -11,16 +18,27 @@ typedef struct {
     uint64_t sb_dblocks;     // Number of data blocks
     uint64_t sb_agcount;     // Number of allocation groups
     uint32_t sb_versionnum;  // Header version
+    uint32_t sb_agblocks;    // Blocks per allocation group
+    uint8_t sb_uuid[XFS_UUID_SIZE];  // Filesystem UUID, stamped into all other metadata
+    uint64_t sb_lsn;         // LSN of the last log item when written
+    uint32_t sb_crc;         // CRC32C of the superblock
+    uint32_t sb_pad;
 } xfs_sb_t;
 
 // XFS AG Free Space
 typedef struct {
     uint32_t agf_magicnum;   // Magic number
+    uint32_t agf_seqno;      // AG number
     uint32_t agf_length;     // Total length in blocks
     uint32_t agf_freeblks;   // Total free blocks
     uint32_t agf_longest;    // Longest free space
-    // Simple free space tracking - in a real implementation this would be more complex
-    uint8_t free_blocks[2400]; // Array to track free/used blocks (assuming 10MB AG with 4KB blocks = 2560 blocks, but leaving some room)
+    uint32_t agf_bmblocks;   // Blocks in the free space bitmap (one bit per block, 1 = used)
+    uint32_t agf_refcount_root;   // Root block of the refcount btree (0 = no shared blocks)
+    uint32_t agf_refcount_level;  // Levels in the refcount btree
+    uint8_t agf_uuid[XFS_UUID_SIZE];  // Filesystem UUID
+    uint64_t agf_lsn;        // LSN of the last log item when written
+    uint32_t agf_crc;        // CRC32C of the AGF
+    uint32_t agf_pad;
 } xfs_agf_t;
 
 // XFS AG Inode
@@ -29,19 +47,35 @@ typedef struct {
     uint32_t agi_count;      // Number of inodes
     uint32_t agi_root;       // Root of inode btree
     uint32_t agi_freecount;  // Number of free inodes
+    uint32_t agi_seqno;      // AG number
+    uint32_t agi_crc;        // CRC32C of the AGI
+    uint8_t agi_uuid[XFS_UUID_SIZE];  // Filesystem UUID
+    uint64_t agi_lsn;        // LSN of the last log item when written
 } xfs_agi_t;
 
+// Extent states
+#define XFS_EXT_NORM      0  // Written: reads return the blocks' contents
+#define XFS_EXT_UNWRITTEN 1  // Preallocated: blocks are reserved but read as zeros
+
 // Represents a mapping: "Logical Offset 0 maps to Physical Block 100 for 10 blocks"
 typedef struct {
     uint64_t start_off;   // Logical file offset (in blocks)
     uint64_t start_block; // Physical starting block on disk
     uint64_t block_count; // Number of contiguous blocks
+    uint32_t state;       // XFS_EXT_NORM or XFS_EXT_UNWRITTEN
 } xfs_extent_t;
 
+// Extents an inode can hold
+#define XFS_MAX_EXTENTS 16
+
+// Inode flags
+#define XFS_DIFLAG_REFLINK 0x1  // Extents may be shared with other inodes
+
 // XFS Inode
 typedef struct {
     uint32_t inode_num;
     uint16_t di_mode;        // File mode
+    uint32_t di_flags;       // XFS_DIFLAG_* flags
     uint32_t di_uid;         // User ID
     uint32_t di_gid;         // Group ID
     uint32_t di_nlink;       // Link count
@@ -50,7 +84,13 @@ typedef struct {
     // In real XFS, this is a B+ Tree.
     // For simulation, use a fixed array or linked list.
     int extent_count;
-    xfs_extent_t extents[16]; // Hard limit of 16 extents for simplicity
+    xfs_extent_t extents[XFS_MAX_EXTENTS]; // Hard limit of 16 extents for simplicity
+
+    // In-core only: per-inode locks (see xfs_inode.h)
+    pthread_rwlock_t i_iolock; // Serializes file I/O
+    pthread_rwlock_t i_ilock;  // Protects extents, extent_count and di_size
+    struct xfs_dquot *i_udquot; // Quota records charged for the inode (see xfs_quota.h)
+    struct xfs_dquot *i_gdquot;
 } xfs_inode_t;
 
 // XFS Transaction
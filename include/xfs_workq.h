@@ -0,0 +1,70 @@
+#ifndef XFS_WORKQ_H
+#define XFS_WORKQ_H
+
+#include <stdint.h>
+
+// Kinds of background work; each has its own counters
+typedef enum {
+    XFS_WORK_LOG_FLUSH,   // Writing queued log items
+    XFS_WORK_AG_INIT,     // Formatting or loading AGs
+    XFS_WORK_FREE,        // Freeing one AG's share of a deferred free batch
+    XFS_WORK_AIL_PUSH,    // Writing back logged metadata to move the log tail
+    XFS_WORK_MAX
+} xfs_work_type_t;
+
+// Tasks that are waited for together
+typedef struct {
+    int pending;          // Queued or running tasks of the group
+} xfs_work_group_t;
+
+// A task; it must stay valid until fn has been called
+typedef struct {
+    void (*fn)(void *arg);
+    void *arg;
+    xfs_work_type_t type;
+    xfs_work_group_t *group;
+    uint64_t queued_ns;
+} xfs_work_t;
+
+// Counters of one kind of work
+typedef struct {
+    uint64_t queued;
+    uint64_t run;
+    uint64_t stolen;      // Run by a worker other than the one it was queued to
+    uint64_t run_ns;      // Total time in fn
+    uint64_t wait_ns;     // Total time between queueing and running
+    uint64_t max_wait_ns;
+} xfs_workq_stats_t;
+
+// Most worker threads the pool can have
+#define XFS_WORKQ_MAX_THREADS 64
+
+// Resize the pool (0 = one thread per online CPU, at least two); queued work is kept
+int xfs_workq_set_threads(int nthreads);
+
+// Number of worker threads (starting the pool if needed)
+int xfs_workq_threads(void);
+
+// Run fn(arg) on the pool
+int xfs_workq_queue(xfs_work_t *work, xfs_work_type_t type, void (*fn)(void *arg), void *arg);
+
+// Start an empty group
+void xfs_work_group_init(xfs_work_group_t *group);
+
+// Run fn(arg) on the pool as part of group
+int xfs_workq_queue_group(xfs_work_group_t *group, xfs_work_t *work, xfs_work_type_t type,
+                          void (*fn)(void *arg), void *arg);
+
+// Wait for every task of group, running queued tasks meanwhile
+void xfs_work_group_wait(xfs_work_group_t *group);
+
+// Copy the counters of one kind of work
+void xfs_workq_get_stats(xfs_work_type_t type, xfs_workq_stats_t *stats);
+
+// Print the counters of every kind of work
+void xfs_workq_print_stats(void);
+
+// Zero the counters
+void xfs_workq_reset_stats(void);
+
+#endif // XFS_WORKQ_H
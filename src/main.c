@@ -4,241 +4,1493 @@
 #include "../include/xfs_types.h"
 #include "../include/xfs_alloc.h"
 #include "../include/xfs_io.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_trace.h"
+#include "../include/xfs_fsr.h"
+#include "../include/xfs_cksum.h"
+#include "../include/xfs_workq.h"
+#include "../include/xfs_image.h"
+#include "../include/xfs_stream.h"
+#include "../include/xfs_numa.h"
+#include "../include/xfs_quota.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+
+// The shell reads commands interactively, or with -f/-b from a script or
+// stdin. Scripts add variables ($name, set, let) and for loops, so a
+// workload of thousands of operations fits in a few lines. Each command
+// can be timed (-t, -T), and -q discards command output so a run measures
+// the filesystem instead of the terminal.
+
+// Shell options from the command line
+typedef struct {
+    int interactive;     // Prompt for commands
+    int quiet;           // Discard command output
+    int time_each;       // Print each command's wall-clock time
+    int time_summary;    // Print per-command totals at exit
+    int stop_on_error;   // Stop a script at its first failed command
+} shell_opts_t;
+
+static shell_opts_t shell_opts = { 1, 0, 0, 0, 0 };
+static int shell_failures = 0;  // Failed commands and script errors
 
 // Helper to print metadata state
 void inspect_inode(int inode_num) {
     print_inode_details(inode_num);
 }
 
-int main() {
-    char input[256];
-    char *cmd;
-    
-    printf("XFS Simulation Shell. Type 'help' for commands.\n");
-
-    while (1) {
-        printf("XFS_SIM> ");
-        if (!fgets(input, sizeof(input), stdin)) break;
-
-        // Remove newline
-        input[strcspn(input, "\n")] = 0;
-
-        // Split command
-        cmd = strtok(input, " ");
-        if (!cmd) continue;
-
-        if (strcmp(cmd, "help") == 0) {
-            printf("Available commands:\n");
-            printf("  format          - Format the disk (mkfs equivalent)\n");
-            printf("  mount           - Mount the filesystem\n");
-            printf("  create          - Create a new file and allocate an inode\n");
-            printf("  write <inode> <data> - Write data to an inode\n");
-            printf("  read <inode>    - Read data from an inode\n");
-            printf("  inspect <inode> - Show detailed inode metadata\n");
-            printf("  ls/list         - List all files in the system\n");
-            printf("  superblock      - Show superblock information\n");
-            printf("  agf <ag_id>     - Show AG Free Space (AGF) information\n");
-            printf("  agi <ag_id>     - Show AG Inode (AGI) information\n");
-            printf("  ag_summary      - Show summary of all allocation groups\n");
-            printf("  log             - Show transaction log status\n");
-            printf("  barrier_test    - Test the barrier mechanism\n");
-            printf("  exit            - Exit the simulator\n");
-
-        } else if (strcmp(cmd, "format") == 0) {
-            printf("Formatting disk...\n");
-            // Call your format function
-            if (xfs_mkfs(100 * 1024 * 1024) == 0) {
-                printf("Disk formatted. Superblock created.\n");
+// Parse a size with an optional k/m/g/t suffix; returns 0 on invalid input
+static uint64_t parse_size(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) {
+        return 0;
+    }
+    switch (tolower((unsigned char)*end)) {
+        case 't': v <<= 10; // fall through
+        case 'g': v <<= 10; // fall through
+        case 'm': v <<= 10; // fall through
+        case 'k': v <<= 10; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? (uint64_t)v : 0;
+}
+
+// Resolve a command argument that is either an inode number or a filename; -1 if no such file
+static int resolve_inode_arg(const char *arg) {
+    char *endptr;
+    long inode_num = strtol(arg, &endptr, 10);
+    if (*endptr == '\0') {
+        return get_inode_ptr((int)inode_num) != NULL ? (int)inode_num : -1;
+    }
+    return get_inode_num_by_name(arg);
+}
+
+// Arguments of read and write: [-o offset] [-l len] <file> [data]
+typedef struct {
+    uint64_t offset;
+    uint64_t len;    // 0 if not given
+    char *file;
+    char *data;      // Rest of the line, or NULL
+} io_args_t;
+
+// Parse read/write arguments from the rest of the strtok line
+static int parse_io_args(io_args_t *io) {
+    memset(io, 0, sizeof(*io));
+    char *tok;
+    while ((tok = strtok(NULL, " ")) != NULL && (strcmp(tok, "-o") == 0 || strcmp(tok, "-l") == 0)) {
+        char *val = strtok(NULL, " ");
+        uint64_t v = val ? parse_size(val) : 0;
+        if (tok[1] == 'o' && val && (v != 0 || strcmp(val, "0") == 0)) {
+            io->offset = v;
+        } else if (tok[1] == 'l' && v != 0) {
+            io->len = v;
+        } else {
+            return -1;
+        }
+    }
+    if (tok == NULL) {
+        return -1;
+    }
+    io->file = tok;
+    io->data = strtok(NULL, "");
+    return 0;
+}
+
+// Data for a write of len bytes at offset: data repeated, or without data a
+// pattern that depends only on the file offset, so reads can check it
+static char *io_fill_buffer(const char *data, size_t len, uint64_t offset) {
+    char *buf = (char *)malloc(len ? len : 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+    size_t dlen = data ? strlen(data) : 0;
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = dlen ? data[i % dlen] : (char)('a' + (offset + i) % 26);
+    }
+    return buf;
+}
+
+// import: fill a chunk from a host file, short only at its end
+static ssize_t host_fill(void *buf, size_t len, uint64_t offset, void *arg) {
+    (void)offset;
+    int fd = *(int *)arg;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, (char *)buf + got, len - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+// export: write a chunk to a host file
+static ssize_t host_drain(void *buf, size_t len, uint64_t offset, void *arg) {
+    (void)offset;
+    int fd = *(int *)arg;
+    size_t put = 0;
+    while (put < len) {
+        ssize_t n = write(fd, (const char *)buf + put, len - put);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        put += (size_t)n;
+    }
+    return (ssize_t)put;
+}
+
+// Arguments of import and export: [-c chunk] <from> <to>
+static int parse_stream_args(size_t *chunk, char **from, char **to) {
+    *chunk = 0;
+    *from = strtok(NULL, " ");
+    if (*from != NULL && strcmp(*from, "-c") == 0) {
+        char *val = strtok(NULL, " ");
+        uint64_t v = val ? parse_size(val) : 0;
+        if (v == 0 || v > XFS_STREAM_MAX_CHUNK) {
+            return -1;
+        }
+        *chunk = (size_t)v;
+        *from = strtok(NULL, " ");
+    }
+    *to = strtok(NULL, " ");
+    return *from != NULL && *to != NULL ? 0 : -1;
+}
+
+// Run one shell command; returns 0 on success, -1 on failure, 1 for exit
+static int run_command(char *input) {
+    int ret = 0;
+
+    // Split command
+    char *cmd = strtok(input, " \t");
+    if (!cmd) {
+        return 0;
+    }
+
+    if (strcmp(cmd, "help") == 0) {
+        printf("Available commands:\n");
+        printf("  format [-s size] [-a agcount] [-g agsize] [-b blocksize] [-t threads] - Format the disk (mkfs equivalent)\n");
+        printf("  mount [-e]      - Mount the filesystem (-e loads every AG now instead of on first use)\n");
+        printf("  save <path>     - Save the disk and inode table to an image file\n");
+        printf("  load [-e] <path> - Replace the filesystem with an image and mount it\n");
+        printf("  create          - Create a new file and allocate an inode\n");
+        printf("  write [-o offset] [-l len] <file> [data] - Write data (repeated to len, or a pattern if omitted)\n");
+        printf("  read [-o offset] [-l len] <file> - Read from a file (reads over 1023 bytes print only their size)\n");
+        printf("  import [-c chunk] <hostfile> <file> - Copy a host file into a file, streamed in chunks (default 4m)\n");
+        printf("  export [-c chunk] <file> <hostfile> - Copy a file out to a host file, streamed in chunks\n");
+        printf("  inspect <inode> - Show detailed inode metadata\n");
+        printf("  rm <file>       - Remove a file and free its blocks\n");
+        printf("  truncate <file> <size> - Set a file's size, freeing blocks past the new EOF\n");
+        printf("  punch <file> <offset> <len> - Deallocate a byte range, leaving a hole\n");
+        printf("  falloc <file> <offset> <len> [-k] - Preallocate a byte range as unwritten extents (-k keeps the size)\n");
+        printf("  clone <src> <dst> - Copy a file by sharing its blocks (reflink; dst is created if needed)\n");
+        printf("  chown <file> <uid>[:<gid>] - Change a file's owner and group, moving its usage between their quotas\n");
+        printf("  ls/list         - List all files in the system\n");
+        printf("  superblock      - Show superblock information\n");
+        printf("  disk            - Show logical and resident size of the simulated disk\n");
+        printf("  agf <ag_id>     - Show AG Free Space (AGF) information\n");
+        printf("  agi <ag_id>     - Show AG Inode (AGI) information\n");
+        printf("  ag_summary      - Show summary of all allocation groups\n");
+        printf("  freesp [ag_id]  - Show free extent size histograms (per AG and overall) and extents per file\n");
+        printf("  log             - Show transaction log status\n");
+        printf("  barrier_test    - Test the barrier mechanism\n");
+        printf("  logdelay <usec> - Set the simulated log flush latency per log write (default 100000)\n");
+        printf("  logtune size|cil <bytes> | ail <pct> | wbdelay <usec> - Set the log size, checkpoint size, AIL push threshold or metadata writeback latency\n");
+        printf("  stats [reset|json <file>|prom <file>] - Show, reset or dump latency statistics\n");
+        printf("  trace start|stop|dump [file] - Control and decode the event trace\n");
+        printf("  agpolicy [locality|stripe] - Show or set the AG selection policy\n");
+        printf("  pools [on|off]  - Show or toggle per-thread allocation pools\n");
+        printf("  workq [threads <n>|reset] - Show background work statistics, resize the pool or reset its counters\n");
+        printf("  numa [on|off|nodes <n>] - Show or toggle AG and worker NUMA affinity (nodes: 0 = the machine's, n = emulate n)\n");
+        printf("  quota [on|off|report [-g]|grace <seconds>] - Turn quotas on (counting current usage) or off, or show usage and limits\n");
+        printf("  quota limit [-g] <id> [bsoft=<size>] [bhard=<size>] [isoft=<n>] [ihard=<n>] - Set a user's (-g: group's) limits, 0 = none\n");
+        printf("  defrag <file|all> [rate] - Relocate fragmented files into fewer extents (rate in bytes/s, e.g. 10m)\n");
+        printf("  set <var> [value] - Set a shell variable, used as $var or ${var}\n");
+        printf("  let <var> <a> [op <b>] - Set a variable to integer arithmetic (+ - * / %%)\n");
+        printf("  for <var> <count> | for <var> <start> <end> ... end - Repeat commands\n");
+        printf("  exit            - Exit the simulator\n");
+
+    } else if (strcmp(cmd, "format") == 0) {
+        // Default geometry: 100MB disk split into XFS_DEFAULT_AGCOUNT AGs of 4KB blocks
+        xfs_mkfs_opts_t opts = { 100 * 1024 * 1024, 0, 0, XFS_BLOCK_SIZE, 0 };
+        int bad = 0;
+        char *flag;
+        while ((flag = strtok(NULL, " ")) != NULL) {
+            char *val = strtok(NULL, " ");
+            uint64_t v = val ? parse_size(val) : 0;
+            if (v == 0) {
+                bad = 1;
+            } else if (strcmp(flag, "-s") == 0) {
+                opts.disk_size = v;
+            } else if (strcmp(flag, "-a") == 0 && v <= UINT32_MAX) {
+                opts.agcount = (uint32_t)v;
+            } else if (strcmp(flag, "-g") == 0) {
+                opts.agsize = v;
+            } else if (strcmp(flag, "-b") == 0 && v <= UINT32_MAX) {
+                opts.blocksize = (uint32_t)v;
+            } else if (strcmp(flag, "-t") == 0 && v <= 1024) {
+                opts.threads = (int)v;
             } else {
-                printf("Failed to format disk.\n");
+                bad = 1;
             }
-        
-        } else if (strcmp(cmd, "mount") == 0) {
-            if (xfs_mount() == 0) {
-                printf("Filesystem mounted. AGs initialized.\n");
+        }
+        if (bad) {
+            printf("Usage: format [-s size] [-a agcount] [-g agsize] [-b blocksize] [-t threads]\n");
+            return -1;
+        }
+
+        printf("Formatting disk...\n");
+        if (xfs_mkfs_opts(&opts) == 0) {
+            printf("Disk formatted: %d AGs of %u blocks, %u-byte blocks. Superblock created.\n",
+                   ag_count(), ag_blocks(), ag_blocksize());
+        } else {
+            printf("Failed to format disk (invalid geometry or out of memory).\n");
+            ret = -1;
+        }
+    
+    } else if (strcmp(cmd, "mount") == 0) {
+        char *arg1 = strtok(NULL, " ");
+        xfs_mount_opts_t opts = { arg1 != NULL && strcmp(arg1, "-e") == 0 };
+        uint64_t failures = xfs_cksum_failures();
+        if (xfs_mount_opts(&opts) == 0) {
+            printf("Filesystem mounted. %d of %d AGs loaded (the rest load on first use).\n",
+                   xfs_alloc_loaded_ags(), ag_count());
+        } else if (xfs_cksum_failures() != failures) {
+            printf("Failed to mount filesystem: metadata failed verification.\n");
+            ret = -1;
+        } else {
+            printf("Failed to mount filesystem.\n");
+            ret = -1;
+        }
+
+    } else if (strcmp(cmd, "save") == 0) {
+        char *path = strtok(NULL, " ");
+        if (!path) {
+            printf("Usage: save <path>\n");
+            return -1;
+        }
+        xfs_image_info_t info;
+        uint64_t start = xfs_stats_now();
+        if (xfs_image_save(path, &info) != 0) {
+            printf("Failed to save image to %s.\n", path);
+            return -1;
+        }
+        printf("Saved %u files and %llu chunks (%.1f MiB) to %s in %.1f ms\n",
+               info.inodes, (unsigned long long)info.chunks, info.bytes / 1048576.0, path,
+               (xfs_stats_now() - start) / 1e6);
+
+    } else if (strcmp(cmd, "load") == 0) {
+        // Usage: load [-e] <path>
+        char *arg1 = strtok(NULL, " ");
+        xfs_mount_opts_t opts = { arg1 != NULL && strcmp(arg1, "-e") == 0 };
+        char *path = opts.eager_ags ? strtok(NULL, " ") : arg1;
+        if (!path) {
+            printf("Usage: load [-e] <path>\n");
+            return -1;
+        }
+        xfs_image_info_t info;
+        uint64_t failures = xfs_cksum_failures();
+        uint64_t start = xfs_stats_now();
+        if (xfs_image_load(path, &opts, &info) == 0) {
+            printf("Loaded %u files and %llu chunks (%.1f MiB, %s) from %s in %.1f ms\n",
+                   info.inodes, (unsigned long long)info.chunks, info.bytes / 1048576.0,
+                   info.mapped ? "mapped" : "read", path, (xfs_stats_now() - start) / 1e6);
+        } else if (xfs_cksum_failures() != failures) {
+            printf("Failed to load %s: image failed verification.\n", path);
+            ret = -1;
+        } else {
+            printf("Failed to load %s.\n", path);
+            ret = -1;
+        }
+
+    } else if (strcmp(cmd, "create") == 0) {
+        char *filename = strtok(NULL, " ");
+        int inode_num;
+        if (filename) {
+            inode_num = xfs_create_named_file(filename);
+        } else {
+            inode_num = xfs_create_file(); // Create with default name
+        }
+        if (inode_num < 0) {
+            printf("Error: Failed to create file (inode table full or over the inode quota)\n");
+            return -1;
+        }
+        printf("File '%s' created. Allocated Inode #%d\n", get_inode_name(inode_num), inode_num);
+        inspect_inode(inode_num); // SHOW METADATA IMMEDIATELY
+
+    } else if (strcmp(cmd, "write") == 0) {
+        // Usage: write [-o offset] [-l len] <file> [data]
+        io_args_t io;
+        if (parse_io_args(&io) != 0 || (io.data == NULL && io.len == 0)) {
+            printf("Usage: write [-o offset] [-l len] <file> [data] (data is repeated to fill len; without data a pattern is written)\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(io.file);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", io.file);
+            return -1;
+        }
+
+        size_t len = io.len ? (size_t)io.len : strlen(io.data);
+        char *buf = io_fill_buffer(io.data, len, io.offset);
+        if (buf == NULL) {
+            printf("Write failed (out of memory).\n");
+            return -1;
+        }
+        if (io.len == 0 && io.offset == 0) {
+            printf("Writing '%s' to file (Inode %d)...\n", io.data, inode_num);
+        } else {
+            printf("Writing %zu bytes at offset %llu to file (Inode %d)...\n",
+                   len, (unsigned long long)io.offset, inode_num);
+        }
+        if (xfs_sim_write(get_inode_ptr(inode_num), buf, len, (off_t)io.offset) < 0) {
+            printf("Write failed.\n");
+            ret = -1;
+        } else {
+            printf("Write complete.\n");
+        }
+        free(buf);
+        inspect_inode(inode_num); // SHOW CHANGE IN EXTENTS
+
+    } else if (strcmp(cmd, "read") == 0) {
+        // Usage: read [-o offset] [-l len] <file>
+        io_args_t io;
+        if (parse_io_args(&io) != 0 || io.len > INT_MAX) {
+            printf("Usage: read [-o offset] [-l len] <file>\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(io.file);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", io.file);
+            return -1;
+        }
+
+        // Short reads are printed; longer ones only report their size
+        size_t len = io.len ? (size_t)io.len : 1023;
+        char *buf = (char *)malloc(len + 1);
+        if (buf == NULL) {
+            printf("Read operation failed (out of memory)\n");
+            return -1;
+        }
+        int bytes_read = xfs_sim_read(get_inode_ptr(inode_num), buf, len, (off_t)io.offset);
+        if (bytes_read < 0) {
+            printf("Read operation failed\n");
+            ret = -1;
+        } else if (len <= 1023) {
+            buf[bytes_read] = '\0'; // Ensure null termination
+            printf("READ OUTPUT: %s\n", buf);
+        } else {
+            printf("Read %d bytes at offset %llu\n", bytes_read, (unsigned long long)io.offset);
+        }
+        free(buf);
+
+    } else if (strcmp(cmd, "import") == 0) {
+        // Usage: import [-c chunk] <hostfile> <file>
+        size_t chunk;
+        char *host, *file;
+        if (parse_stream_args(&chunk, &host, &file) != 0) {
+            printf("Usage: import [-c chunk] <hostfile> <file>\n");
+            return -1;
+        }
+        int fd = open(host, O_RDONLY);
+        if (fd < 0) {
+            printf("Error: Cannot open '%s'\n", host);
+            return -1;
+        }
+        int inode_num = get_inode_num_by_name(file);
+        if (inode_num < 0) {
+            inode_num = xfs_create_named_file(file);
+        }
+        xfs_inode_t *inode = inode_num > 0 ? get_inode_ptr(inode_num) : NULL;
+        if (inode == NULL || xfs_truncate(inode, 0) != 0) {
+            printf("Error: Cannot create '%s'\n", file);
+            close(fd);
+            return -1;
+        }
+        uint64_t start = xfs_stats_now();
+        int64_t n = xfs_stream_write(inode, 0, UINT64_MAX, chunk, host_fill, &fd);
+        double secs = (xfs_stats_now() - start) / 1e9;
+        close(fd);
+        if (n < 0) {
+            printf("Import failed after %llu bytes (out of space or extents?)\n",
+                   (unsigned long long)inode->di_size);
+            return -1;
+        }
+        printf("Imported %lld bytes from %s into '%s' in %.1f ms (%.1f MiB/s)\n", (long long)n, host, file,
+               secs * 1e3, secs > 0 ? n / secs / 1048576.0 : 0.0);
+
+    } else if (strcmp(cmd, "export") == 0) {
+        // Usage: export [-c chunk] <file> <hostfile>
+        size_t chunk;
+        char *file, *host;
+        if (parse_stream_args(&chunk, &file, &host) != 0) {
+            printf("Usage: export [-c chunk] <file> <hostfile>\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(file);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", file);
+            return -1;
+        }
+        int fd = open(host, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            printf("Error: Cannot open '%s'\n", host);
+            return -1;
+        }
+        uint64_t start = xfs_stats_now();
+        int64_t n = xfs_stream_read(get_inode_ptr(inode_num), 0, UINT64_MAX, chunk, host_drain, &fd);
+        double secs = (xfs_stats_now() - start) / 1e9;
+        if (close(fd) != 0 || n < 0) {
+            printf("Export failed.\n");
+            return -1;
+        }
+        printf("Exported %lld bytes from '%s' to %s in %.1f ms (%.1f MiB/s)\n", (long long)n, file, host,
+               secs * 1e3, secs > 0 ? n / secs / 1048576.0 : 0.0);
+
+    } else if (strcmp(cmd, "inspect") == 0) {
+        // Usage: inspect <filename> OR inspect <inode>
+        char *arg1 = strtok(NULL, " ");
+        if (arg1) {
+            // Try to parse as inode number first
+            char *endptr;
+            long inode_num = strtol(arg1, &endptr, 10);
+
+            int target_inode_num = -1;
+
+            if (*endptr == '\0') {
+                // It's a number (inode number)
+                target_inode_num = (int)inode_num;
             } else {
-                printf("Failed to mount filesystem.\n");
+                // It's a filename
+                target_inode_num = get_inode_num_by_name(arg1);
             }
 
-        } else if (strcmp(cmd, "create") == 0) {
-            char *filename = strtok(NULL, " ");
-            int inode_num;
-            if (filename) {
-                inode_num = xfs_create_named_file(filename);
+            if (target_inode_num != -1) {
+                inspect_inode(target_inode_num);
             } else {
-                inode_num = xfs_create_file(); // Create with default name
+                printf("Error: File '%s' does not exist\n", arg1);
+                ret = -1;
             }
-            inspect_inode(inode_num); // SHOW METADATA IMMEDIATELY
+        } else {
+            printf("Usage: inspect <filename> or inspect <inode_num>\n");
+            ret = -1;
+        }
 
-        } else if (strcmp(cmd, "write") == 0) {
-            // Usage: write <filename> <data> OR write <inode_num> <data>
-            char *arg1 = strtok(NULL, " ");
-            char *data = strtok(NULL, "");
+    } else if (strcmp(cmd, "rm") == 0 || strcmp(cmd, "unlink") == 0) {
+        // Usage: rm <file>
+        char *arg1 = strtok(NULL, " ");
+        if (!arg1) {
+            printf("Usage: rm <filename> or rm <inode_num>\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(arg1);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", arg1);
+            ret = -1;
+        } else if (xfs_unlink(inode_num) == 0) {
+            printf("Removed inode %d.\n", inode_num);
+        } else {
+            printf("Failed to remove '%s'.\n", arg1);
+            ret = -1;
+        }
 
-            if (arg1 && data) {
-                // Try to parse as inode number first
-                char *endptr;
-                long inode_num = strtol(arg1, &endptr, 10);
+    } else if (strcmp(cmd, "truncate") == 0) {
+        // Usage: truncate <file> <size>
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        uint64_t size = arg2 ? parse_size(arg2) : 0;
+        if (!arg1 || !arg2 || (size == 0 && strcmp(arg2, "0") != 0)) {
+            printf("Usage: truncate <file> <size>\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(arg1);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", arg1);
+            ret = -1;
+        } else if (xfs_truncate(get_inode_ptr(inode_num), size) != 0) {
+            printf("Truncate failed.\n");
+            ret = -1;
+        } else {
+            inspect_inode(inode_num);
+        }
 
-                xfs_inode_t *node = NULL;
-                int target_inode_num = -1;
+    } else if (strcmp(cmd, "punch") == 0) {
+        // Usage: punch <file> <offset> <len>
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        char *arg3 = strtok(NULL, " ");
+        uint64_t offset = arg2 ? parse_size(arg2) : 0;
+        uint64_t len = arg3 ? parse_size(arg3) : 0;
+        if (!arg1 || !arg2 || !arg3 || (offset == 0 && strcmp(arg2, "0") != 0) || len == 0) {
+            printf("Usage: punch <file> <offset> <len>\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(arg1);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", arg1);
+            ret = -1;
+        } else if (xfs_punch_hole(get_inode_ptr(inode_num), offset, len) != 0) {
+            printf("Punch failed (a split would exceed the extent limit?).\n");
+            ret = -1;
+        } else {
+            inspect_inode(inode_num);
+        }
 
-                if (*endptr == '\0') {
-                    // It's a number (inode number)
-                    target_inode_num = (int)inode_num;
-                    node = get_inode_ptr(target_inode_num);
-                } else {
-                    // It's a filename
-                    target_inode_num = get_inode_num_by_name(arg1);
-                    if (target_inode_num != -1) {
-                        node = get_inode_ptr(target_inode_num);
-                    }
-                }
+    } else if (strcmp(cmd, "falloc") == 0) {
+        // Usage: falloc <file> <offset> <len> [-k]
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        char *arg3 = strtok(NULL, " ");
+        char *arg4 = strtok(NULL, " ");
+        uint64_t offset = arg2 ? parse_size(arg2) : 0;
+        uint64_t len = arg3 ? parse_size(arg3) : 0;
+        if (!arg1 || !arg2 || !arg3 || (offset == 0 && strcmp(arg2, "0") != 0) || len == 0 ||
+            (arg4 && strcmp(arg4, "-k") != 0)) {
+            printf("Usage: falloc <file> <offset> <len> [-k]\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(arg1);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", arg1);
+            return -1;
+        }
+        if (xfs_fallocate(get_inode_ptr(inode_num), offset, len, arg4 ? XFS_FALLOC_KEEP_SIZE : 0) != 0) {
+            printf("Preallocation failed (out of space or extents); the range may be partly allocated.\n");
+            ret = -1;
+        }
+        inspect_inode(inode_num);
 
-                if (node) {
-                    printf("Writing '%s' to file (Inode %d)...\n", data, target_inode_num);
-                    xfs_sim_write(node, data, strlen(data), 0);
+    } else if (strcmp(cmd, "clone") == 0) {
+        // Usage: clone <src> <dst>
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        if (!arg1 || !arg2) {
+            printf("Usage: clone <src> <dst>\n");
+            return -1;
+        }
+        int src_num = resolve_inode_arg(arg1);
+        if (src_num < 0) {
+            printf("Error: File '%s' does not exist\n", arg1);
+            return -1;
+        }
+        int dst_num = resolve_inode_arg(arg2);
+        if (dst_num < 0) {
+            dst_num = xfs_create_named_file(arg2);
+        }
+        if (dst_num < 0) {
+            printf("Failed to create file '%s'.\n", arg2);
+            return -1;
+        }
+        uint64_t start_ns = xfs_stats_now();
+        if (xfs_reflink_clone(get_inode_ptr(src_num), get_inode_ptr(dst_num)) != 0) {
+            printf("Clone failed.\n");
+            ret = -1;
+        } else {
+            printf("Cloned %s to inode %d in %.1f us\n", arg1, dst_num, (xfs_stats_now() - start_ns) / 1000.0);
+            inspect_inode(dst_num);
+        }
 
-                    printf("Write complete.\n");
-                    inspect_inode(target_inode_num); // SHOW CHANGE IN EXTENTS
-                } else {
-                    printf("Error: File '%s' does not exist\n", arg1);
-                }
-            } else {
-                printf("Usage: write <filename> <string_data> or write <inode_num> <string_data>\n");
+    } else if (strcmp(cmd, "chown") == 0) {
+        // Usage: chown <file> <uid>[:<gid>]
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        char *end = NULL;
+        unsigned long uid = arg2 ? strtoul(arg2, &end, 10) : 0;
+        unsigned long gid = 0;
+        if (arg2 && end != arg2 && *end == ':') {
+            char *gid_str = end + 1;
+            gid = strtoul(gid_str, &end, 10);
+            if (end == gid_str) {
+                end = NULL;
             }
+        }
+        if (!arg1 || !arg2 || end == NULL || end == arg2 || *end != '\0' || uid > UINT32_MAX || gid > UINT32_MAX) {
+            printf("Usage: chown <file> <uid>[:<gid>]\n");
+            return -1;
+        }
+        int inode_num = resolve_inode_arg(arg1);
+        if (inode_num < 0) {
+            printf("Error: File '%s' does not exist\n", arg1);
+            return -1;
+        }
+        xfs_inode_t *ip = get_inode_ptr(inode_num);
+        if (strchr(arg2, ':') == NULL) {
+            gid = ip->di_gid;
+        }
+        if (xfs_chown(ip, (uint32_t)uid, (uint32_t)gid) != 0) {
+            printf("Chown failed.\n");
+            ret = -1;
+        } else {
+            printf("Inode %d now owned by %lu:%lu\n", inode_num, uid, gid);
+        }
 
-        } else if (strcmp(cmd, "read") == 0) {
-            // Usage: read <filename> OR read <inode_num>
-            char *arg1 = strtok(NULL, " ");
-            if (arg1) {
-                // Try to parse as inode number first
-                char *endptr;
-                long inode_num = strtol(arg1, &endptr, 10);
+    } else if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "list") == 0) {
+        // List all files in the system
+        list_files();
 
-                xfs_inode_t *node = NULL;
-                int target_inode_num = -1;
+    } else if (strcmp(cmd, "log") == 0) {
+        // Print the current state of the transaction log
+        print_log_queue_status();
 
-                if (*endptr == '\0') {
-                    // It's a number (inode number)
-                    target_inode_num = (int)inode_num;
-                    node = get_inode_ptr(target_inode_num);
-                } else {
-                    // It's a filename
-                    target_inode_num = get_inode_num_by_name(arg1);
-                    if (target_inode_num != -1) {
-                        node = get_inode_ptr(target_inode_num);
-                    }
-                }
+    } else if (strcmp(cmd, "superblock") == 0) {
+        // Print superblock information
+        print_superblock_info();
 
-                if (node) {
-                    char buffer[1024] = {0};
-                    int bytes_read = xfs_sim_read(node, buffer, 1023, 0);
-                    if (bytes_read >= 0) {
-                        buffer[bytes_read] = '\0'; // Ensure null termination
-                        printf("READ OUTPUT: %s\n", buffer);
-                    } else {
-                        printf("Read operation failed\n");
-                    }
-                } else {
-                    printf("Error: File '%s' does not exist\n", arg1);
-                }
+    } else if (strcmp(cmd, "disk") == 0) {
+        // Print logical vs resident size of the simulated disk
+        print_disk_info();
+
+    } else if (strcmp(cmd, "agf") == 0) {
+        // Print AGF information for a specific AG
+        char *arg1 = strtok(NULL, " ");
+        if (arg1) {
+            int ag_id = atoi(arg1);
+            print_agf_info(ag_id);
+        } else {
+            printf("Usage: agf <ag_id>\n");
+            ret = -1;
+        }
+
+    } else if (strcmp(cmd, "agi") == 0) {
+        // Print AGI information for a specific AG
+        char *arg1 = strtok(NULL, " ");
+        if (arg1) {
+            int ag_id = atoi(arg1);
+            print_agi_info(ag_id);
+        } else {
+            printf("Usage: agi <ag_id>\n");
+            ret = -1;
+        }
+
+    } else if (strcmp(cmd, "ag_summary") == 0) {
+        // Print summary of all AGs
+        print_ag_summary();
+
+    } else if (strcmp(cmd, "freesp") == 0) {
+        // Free extent histograms: one AG, or every AG plus extents per file
+        char *arg1 = strtok(NULL, " ");
+        int ag_id = arg1 ? atoi(arg1) : -1;
+        if (arg1 && (ag_id < 0 || ag_id >= ag_count())) {
+            printf("Error: AG %s does not exist\n", arg1);
+            return -1;
+        }
+        print_freesp(ag_id);
+
+    } else if (strcmp(cmd, "barrier_test") == 0) {
+        printf("[CMD] Initiating Barrier Test...\n");
+        int queue_before = get_log_queue_length();
+        printf("[LOG] Log Queue has %d pending items before barrier.\n", queue_before);
+        
+        printf("[BARRIER] Thread waiting...\n");
+        if (trans_commit_barrier() == 0) {
+            int queue_after = get_log_queue_length();
+            printf("[BARRIER] Barrier complete. Log Queue now has %d items.\n", queue_after);
+        } else {
+            printf("[BARRIER] Barrier failed.\n");
+            ret = -1;
+        }
+
+    } else if (strcmp(cmd, "logdelay") == 0) {
+        // Usage: logdelay <usec>
+        char *arg1 = strtok(NULL, " ");
+        char *endptr;
+        unsigned long usec = arg1 ? strtoul(arg1, &endptr, 10) : 0;
+        if (!arg1 || *endptr != '\0' || usec > UINT_MAX) {
+            printf("Usage: logdelay <usec>\n");
+            return -1;
+        }
+        trans_set_flush_delay((unsigned int)usec);
+        printf("Log flush latency set to %lu us per log write\n", usec);
+
+    } else if (strcmp(cmd, "logtune") == 0) {
+        // Usage: logtune size <bytes> | cil <bytes> | ail <pct> | wbdelay <usec>
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        int rc = -1;
+        if (arg1 && arg2) {
+            if (strcmp(arg1, "size") == 0) {
+                rc = trans_set_log_size(parse_size(arg2));
+            } else if (strcmp(arg1, "cil") == 0 && (parse_size(arg2) > 0 || strcmp(arg2, "0") == 0)) {
+                rc = trans_set_cil_push(parse_size(arg2));
+            } else if (strcmp(arg1, "ail") == 0) {
+                rc = trans_set_ail_push(atoi(arg2));
+            } else if (strcmp(arg1, "wbdelay") == 0) {
+                trans_set_writeback_delay((unsigned int)strtoul(arg2, NULL, 10));
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            printf("Usage: logtune size <bytes> (at least 64k) | cil <bytes> (at most half the log, 0 = auto) | "
+                   "ail <pct> (1-100) | wbdelay <usec>\n");
+            return -1;
+        }
+        print_log_queue_status();
+
+    } else if (strcmp(cmd, "stats") == 0) {
+        // Usage: stats | stats reset | stats json <file> | stats prom <file>
+        char *arg1 = strtok(NULL, " ");
+        if (!arg1) {
+            xfs_stats_print();
+        } else if (strcmp(arg1, "reset") == 0) {
+            xfs_stats_reset();
+            printf("Statistics reset.\n");
+        } else if (strcmp(arg1, "json") == 0 || strcmp(arg1, "prom") == 0) {
+            char *path = strtok(NULL, " ");
+            int format = strcmp(arg1, "prom") == 0 ? XFS_STATS_FMT_PROM : XFS_STATS_FMT_JSON;
+            if (!path) {
+                printf("Usage: stats %s <file>\n", arg1);
+                ret = -1;
+            } else if (xfs_stats_dump(path, format) == 0) {
+                printf("Statistics written to %s\n", path);
             } else {
-                printf("Usage: read <filename> or read <inode_num>\n");
+                printf("Failed to write statistics to %s\n", path);
+                ret = -1;
             }
+        } else {
+            printf("Usage: stats [reset|json <file>|prom <file>]\n");
+            ret = -1;
+        }
 
-        } else if (strcmp(cmd, "inspect") == 0) {
-            // Usage: inspect <filename> OR inspect <inode>
-            char *arg1 = strtok(NULL, " ");
-            if (arg1) {
-                // Try to parse as inode number first
-                char *endptr;
-                long inode_num = strtol(arg1, &endptr, 10);
+    } else if (strcmp(cmd, "trace") == 0) {
+        // Usage: trace start | trace stop | trace dump [file]
+        char *arg1 = strtok(NULL, " ");
+        if (arg1 && strcmp(arg1, "start") == 0) {
+            xfs_trace_start();
+            printf("Tracing started.\n");
+        } else if (arg1 && strcmp(arg1, "stop") == 0) {
+            xfs_trace_stop();
+            printf("Tracing stopped.\n");
+        } else if (arg1 && strcmp(arg1, "dump") == 0) {
+            char *path = strtok(NULL, " ");
+            FILE *out = path ? fopen(path, "w") : stdout;
+            if (out == NULL) {
+                printf("Failed to open %s\n", path);
+                return -1;
+            }
+            int events = xfs_trace_dump(out);
+            if (path) {
+                fclose(out);
+                printf("%d trace events written to %s\n", events, path);
+            }
+        } else {
+            printf("Usage: trace start|stop|dump [file]\n");
+            ret = -1;
+        }
 
-                int target_inode_num = -1;
+    } else if (strcmp(cmd, "agpolicy") == 0) {
+        // Usage: agpolicy [locality|stripe]
+        char *arg1 = strtok(NULL, " ");
+        if (!arg1) {
+            printf("AG selection policy: %s\n", xfs_alloc_get_policy());
+        } else if (xfs_alloc_set_policy(arg1) == 0) {
+            printf("AG selection policy set to %s\n", arg1);
+        } else {
+            printf("Unknown policy '%s'. Available: locality, stripe\n", arg1);
+            ret = -1;
+        }
 
-                if (*endptr == '\0') {
-                    // It's a number (inode number)
-                    target_inode_num = (int)inode_num;
-                } else {
-                    // It's a filename
-                    target_inode_num = get_inode_num_by_name(arg1);
-                }
+    } else if (strcmp(cmd, "pools") == 0) {
+        // Usage: pools [on|off]
+        char *arg1 = strtok(NULL, " ");
+        if (arg1 && strcmp(arg1, "on") == 0) {
+            xfs_alloc_set_pools(1);
+        } else if (arg1 && strcmp(arg1, "off") == 0) {
+            xfs_alloc_set_pools(0);
+        } else if (arg1) {
+            printf("Usage: pools [on|off]\n");
+            return -1;
+        }
+        printf("Per-thread allocation pools: %s, %llu blocks reserved\n",
+               xfs_alloc_get_pools() ? "on" : "off", (unsigned long long)xfs_alloc_pool_blocks());
 
-                if (target_inode_num != -1) {
-                    inspect_inode(target_inode_num);
+    } else if (strcmp(cmd, "workq") == 0) {
+        // Usage: workq | workq threads <n> | workq reset
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        if (arg1 && strcmp(arg1, "threads") == 0 && arg2 && atoi(arg2) >= 0) {
+            if (xfs_workq_set_threads(atoi(arg2)) != 0) {
+                printf("Failed to start background workers\n");
+                return -1;
+            }
+            printf("Background pool: %d threads\n", xfs_workq_threads());
+        } else if (arg1 && strcmp(arg1, "reset") == 0) {
+            xfs_workq_reset_stats();
+        } else if (arg1) {
+            printf("Usage: workq [threads <n>|reset]\n");
+            return -1;
+        } else {
+            xfs_workq_print_stats();
+        }
+
+    } else if (strcmp(cmd, "numa") == 0) {
+        // Usage: numa [on|off|nodes <n>]
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        if (arg1 && strcmp(arg1, "on") == 0) {
+            xfs_numa_set_affinity(1);
+        } else if (arg1 && strcmp(arg1, "off") == 0) {
+            xfs_numa_set_affinity(0);
+        } else if (arg1 && strcmp(arg1, "nodes") == 0 && arg2 && atoi(arg2) >= 0) {
+            if (xfs_numa_set_nodes(atoi(arg2)) != 0) {
+                printf("At most %d nodes\n", XFS_NUMA_MAX_NODES);
+                return -1;
+            }
+        } else if (arg1) {
+            printf("Usage: numa [on|off|nodes <n>]\n");
+            return -1;
+        }
+        printf("NUMA affinity: %s, %d node%s%s, shell on node %d\n",
+               xfs_numa_get_affinity() ? "on" : "off", xfs_numa_nodes(), xfs_numa_nodes() == 1 ? "" : "s",
+               xfs_numa_emulated() ? " (emulated)" : "", xfs_numa_current_node());
+        for (int node = 0; node < xfs_numa_nodes() && ag_count() > 0; node++) {
+            int first, count;
+            ag_node_ags(node, &first, &count);
+            if (count == 1) {
+                printf("  node %d: AG %d\n", node, first);
+            } else {
+                printf("  node %d: AGs %d-%d\n", node, first, first + count - 1);
+            }
+        }
+
+    } else if (strcmp(cmd, "quota") == 0) {
+        // Usage: quota [on|off|report [-g]|grace <seconds>|limit [-g] <id> [bsoft=<size>] [bhard=<size>] [isoft=<n>] [ihard=<n>]]
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        xfs_dqtype_t type = XFS_DQ_USER;
+        if (arg2 && strcmp(arg2, "-g") == 0) {
+            type = XFS_DQ_GROUP;
+            arg2 = strtok(NULL, " ");
+        }
+        if (arg1 && strcmp(arg1, "on") == 0) {
+            if (xfs_quota_on() != 0) {
+                printf("Failed to turn quotas on\n");
+                return -1;
+            }
+            printf("Quotas on\n");
+        } else if (arg1 && strcmp(arg1, "off") == 0) {
+            xfs_quota_off();
+            printf("Quotas off\n");
+        } else if (arg1 && strcmp(arg1, "grace") == 0 && arg2 && isdigit((unsigned char)arg2[0])) {
+            xfs_quota_set_grace(strtoull(arg2, NULL, 10));
+        } else if (arg1 && strcmp(arg1, "limit") == 0 && arg2 && isdigit((unsigned char)arg2[0])) {
+            uint32_t bsize = ag_blocksize();
+            if (bsize == 0) {
+                printf("Error: Filesystem not mounted\n");
+                return -1;
+            }
+            uint32_t id = (uint32_t)strtoul(arg2, NULL, 10);
+            xfs_disk_dquot_t dq;
+            if (xfs_quota_get(type, id, &dq) != 0) {
+                memset(&dq, 0, sizeof(dq));
+            }
+            char *opt;
+            while ((opt = strtok(NULL, " ")) != NULL) {
+                char *val = strchr(opt, '=');
+                uint64_t v = val ? parse_size(val + 1) : 0;
+                if (val == NULL || (v == 0 && strcmp(val + 1, "0") != 0)) {
+                    printf("Bad limit '%s'\n", opt);
+                    return -1;
+                }
+                uint64_t blocks = (v + bsize - 1) / bsize;
+                if (strncmp(opt, "bsoft=", 6) == 0) {
+                    dq.d_blk_softlimit = blocks;
+                } else if (strncmp(opt, "bhard=", 6) == 0) {
+                    dq.d_blk_hardlimit = blocks;
+                } else if (strncmp(opt, "isoft=", 6) == 0) {
+                    dq.d_ino_softlimit = v;
+                } else if (strncmp(opt, "ihard=", 6) == 0) {
+                    dq.d_ino_hardlimit = v;
                 } else {
-                    printf("Error: File '%s' does not exist\n", arg1);
+                    printf("Bad limit '%s'\n", opt);
+                    return -1;
                 }
-            } else {
-                printf("Usage: inspect <filename> or inspect <inode_num>\n");
             }
+            if (xfs_quota_set_limits(type, id, dq.d_blk_softlimit, dq.d_blk_hardlimit,
+                                     dq.d_ino_softlimit, dq.d_ino_hardlimit) != 0) {
+                printf("Failed to set limits\n");
+                return -1;
+            }
+            xfs_quota_print_report(type);
+        } else if (!arg1 || strcmp(arg1, "report") == 0) {
+            xfs_quota_print_report(type);
+        } else {
+            printf("Usage: quota [on|off|report [-g]|grace <seconds>|limit [-g] <id> [bsoft=<size>] [bhard=<size>] [isoft=<n>] [ihard=<n>]]\n");
+            return -1;
+        }
 
-        } else if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "list") == 0) {
-            // List all files in the system
-            list_files();
+    } else if (strcmp(cmd, "defrag") == 0) {
+        // Usage: defrag <file|all> [rate]
+        char *arg1 = strtok(NULL, " ");
+        char *arg2 = strtok(NULL, " ");
+        uint64_t rate = arg2 ? parse_size(arg2) : 0;
+        if (!arg1 || (arg2 && rate == 0)) {
+            printf("Usage: defrag <file|all> [rate]\n");
+            return -1;
+        }
 
-        } else if (strcmp(cmd, "log") == 0) {
-            // Print the current state of the transaction log
-            print_log_queue_status();
+        xfs_fsr_result_t res;
+        memset(&res, 0, sizeof(res));
+        int ret;
+        if (strcmp(arg1, "all") == 0) {
+            ret = xfs_fsr_all(rate, &res);
+        } else {
+            int inode_num = resolve_inode_arg(arg1);
+            if (inode_num < 0) {
+                printf("Error: File '%s' does not exist\n", arg1);
+                return -1;
+            }
+            ret = xfs_fsr_inode(get_inode_ptr(inode_num), rate, &res);
+        }
+        if (ret != 0) {
+            printf("Defragmentation failed.\n");
+            ret = -1;
+        }
+        printf("Defragmented %d of %d files: %d -> %d extents, %llu blocks moved\n",
+               res.files_defragged, res.files_scanned, res.extents_before, res.extents_after,
+               (unsigned long long)res.blocks_moved);
+
+    } else if (strcmp(cmd, "exit") == 0) {
+        return 1;
+    } else {
+        printf("Unknown command. Type 'help' for available commands.\n");
+        ret = -1;
+    }
+    return ret;
+}
 
-        } else if (strcmp(cmd, "superblock") == 0) {
-            // Print superblock information
-            print_superblock_info();
+// ---------------------------------------------------------------------------
+// Script variables
+// ---------------------------------------------------------------------------
 
-        } else if (strcmp(cmd, "agf") == 0) {
-            // Print AGF information for a specific AG
-            char *arg1 = strtok(NULL, " ");
-            if (arg1) {
-                int ag_id = atoi(arg1);
-                print_agf_info(ag_id);
-            } else {
-                printf("Usage: agf <ag_id>\n");
+#define SHELL_MAX_VARS  64
+#define SHELL_VAR_NAME  32
+#define SHELL_VAR_VALUE 256
+
+typedef struct {
+    char name[SHELL_VAR_NAME];
+    char value[SHELL_VAR_VALUE];
+} shell_var_t;
+
+static shell_var_t shell_vars[SHELL_MAX_VARS];
+static int shell_nvars = 0;
+
+static int var_name_char(char c, int first) {
+    return isalpha((unsigned char)c) || c == '_' || (!first && isdigit((unsigned char)c));
+}
+
+static shell_var_t *var_find(const char *name, size_t len) {
+    for (int i = 0; i < shell_nvars; i++) {
+        if (strlen(shell_vars[i].name) == len && strncmp(shell_vars[i].name, name, len) == 0) {
+            return &shell_vars[i];
+        }
+    }
+    return NULL;
+}
+
+// Set a variable, creating it if needed; -1 for a bad name, a full table or a long value
+static int var_set(const char *name, const char *value) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= SHELL_VAR_NAME || strlen(value) >= SHELL_VAR_VALUE) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!var_name_char(name[i], i == 0)) {
+            return -1;
+        }
+    }
+
+    shell_var_t *var = var_find(name, len);
+    if (var == NULL) {
+        if (shell_nvars == SHELL_MAX_VARS) {
+            return -1;
+        }
+        var = &shell_vars[shell_nvars++];
+        memcpy(var->name, name, len + 1);
+    }
+    strcpy(var->value, value);
+    return 0;
+}
+
+// Expand $name, ${name} and $$ in a line; returns a new string, or NULL if a variable is undefined
+static char *expand_vars(const char *line) {
+    size_t cap = strlen(line) + 1;
+    size_t n = 0;
+    char *out = (char *)malloc(cap);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    for (const char *p = line; *p != '\0'; ) {
+        const char *value = NULL;
+        char dollar[2] = { '$', '\0' };
+        if (*p != '$') {
+            dollar[0] = *p++;
+            value = dollar;
+        } else if (p[1] == '$') {
+            value = dollar;
+            p += 2;
+        } else {
+            int braced = p[1] == '{';
+            const char *name = p + 1 + braced;
+            size_t len = 0;
+            while (var_name_char(name[len], len == 0)) {
+                len++;
             }
+            shell_var_t *var = len ? var_find(name, len) : NULL;
+            if (var == NULL || (braced && name[len] != '}')) {
+                fprintf(stderr, "xfs_sim: undefined variable in '%s'\n", line);
+                free(out);
+                return NULL;
+            }
+            value = var->value;
+            p = name + len + braced;
+        }
 
-        } else if (strcmp(cmd, "agi") == 0) {
-            // Print AGI information for a specific AG
-            char *arg1 = strtok(NULL, " ");
-            if (arg1) {
-                int ag_id = atoi(arg1);
-                print_agi_info(ag_id);
-            } else {
-                printf("Usage: agi <ag_id>\n");
-            }
-
-        } else if (strcmp(cmd, "ag_summary") == 0) {
-            // Print summary of all AGs
-            print_ag_summary();
-
-        } else if (strcmp(cmd, "barrier_test") == 0) {
-            printf("[CMD] Initiating Barrier Test...\n");
-            int queue_before = get_log_queue_length();
-            printf("[LOG] Log Queue has %d pending items before barrier.\n", queue_before);
-            
-            printf("[BARRIER] Thread waiting...\n");
-            if (trans_commit_barrier() == 0) {
-                int queue_after = get_log_queue_length();
-                printf("[BARRIER] Barrier complete. Log Queue now has %d items.\n", queue_after);
-            } else {
-                printf("[BARRIER] Barrier failed.\n");
+        size_t vlen = strlen(value);
+        if (n + vlen + 1 > cap) {
+            cap = (n + vlen + 1) * 2;
+            char *grown = (char *)realloc(out, cap);
+            if (grown == NULL) {
+                free(out);
+                return NULL;
             }
+            out = grown;
+        }
+        memcpy(out + n, value, vlen);
+        n += vlen;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+// Parse a non-negative integer with an optional k/m/g/t suffix
+static int parse_number(const char *s, uint64_t *out) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (strcmp(s, "0") == 0) {
+        *out = 0;
+        return 0;
+    }
+    *out = parse_size(s);
+    return *out != 0 ? 0 : -1;
+}
+
+// let <var> <a> [<op> <b>]: integer arithmetic with + - * / %
+static int run_let(void) {
+    char *name = strtok(NULL, " ");
+    char *a = strtok(NULL, " ");
+    char *op = strtok(NULL, " ");
+    char *b = strtok(NULL, " ");
+    uint64_t x, y = 0;
+    if (!name || parse_number(a, &x) != 0 || (op && (strlen(op) != 1 || parse_number(b, &y) != 0))) {
+        fprintf(stderr, "Usage: let <var> <a> [+|-|*|/|%% <b>]\n");
+        return -1;
+    }
+    if (op) {
+        switch (op[0]) {
+            case '+': x += y; break;
+            case '-': x -= y; break;
+            case '*': x *= y; break;
+            case '/': if (y == 0) return -1; x /= y; break;
+            case '%': if (y == 0) return -1; x %= y; break;
+            default: return -1;
+        }
+    }
+    char value[32];
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)x);
+    return var_set(name, value);
+}
+
+// ---------------------------------------------------------------------------
+// Command timing
+// ---------------------------------------------------------------------------
 
-        } else if (strcmp(cmd, "exit") == 0) {
+#define SHELL_MAX_TIMED 64
+
+typedef struct {
+    char name[24];
+    uint64_t count;
+    uint64_t failed;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+} cmd_timing_t;
+
+static cmd_timing_t cmd_timings[SHELL_MAX_TIMED];
+static int cmd_ntimings = 0;
+
+static void timing_record(const char *cmd, uint64_t ns, int failed) {
+    cmd_timing_t *t = NULL;
+    for (int i = 0; i < cmd_ntimings; i++) {
+        if (strcmp(cmd_timings[i].name, cmd) == 0) {
+            t = &cmd_timings[i];
             break;
+        }
+    }
+    if (t == NULL) {
+        if (cmd_ntimings == SHELL_MAX_TIMED) {
+            return;
+        }
+        t = &cmd_timings[cmd_ntimings++];
+        snprintf(t->name, sizeof(t->name), "%s", cmd);
+        t->min_ns = UINT64_MAX;
+    }
+    t->count++;
+    t->failed += failed ? 1 : 0;
+    t->total_ns += ns;
+    t->min_ns = ns < t->min_ns ? ns : t->min_ns;
+    t->max_ns = ns > t->max_ns ? ns : t->max_ns;
+}
+
+// Print per-command totals and the overall command rate
+static void timing_report(FILE *out, uint64_t wall_ns) {
+    uint64_t count = 0, failed = 0, total_ns = 0;
+    fprintf(out, "\n--- COMMAND TIMING ---\n");
+    fprintf(out, "%-12s %9s %7s %12s %10s %10s %10s\n",
+            "command", "count", "failed", "total ms", "mean us", "min us", "max us");
+    for (int i = 0; i < cmd_ntimings; i++) {
+        cmd_timing_t *t = &cmd_timings[i];
+        fprintf(out, "%-12s %9llu %7llu %12.3f %10.1f %10.1f %10.1f\n", t->name,
+                (unsigned long long)t->count, (unsigned long long)t->failed, t->total_ns / 1e6,
+                t->total_ns / 1e3 / t->count, t->min_ns / 1e3, t->max_ns / 1e3);
+        count += t->count;
+        failed += t->failed;
+        total_ns += t->total_ns;
+    }
+    fprintf(out, "%-12s %9llu %7llu %12.3f\n", "all",
+            (unsigned long long)count, (unsigned long long)failed, total_ns / 1e6);
+    fprintf(out, "Wall time %.3f ms, %.0f commands/s\n", wall_ns / 1e6,
+            wall_ns ? count * 1e9 / wall_ns : 0.0);
+    fprintf(out, "----------------------\n");
+}
+
+// ---------------------------------------------------------------------------
+// Scripts
+// ---------------------------------------------------------------------------
+
+// A loaded script: every line is kept so line numbers stay meaningful
+typedef struct {
+    char **lines;
+    int count;
+    int cap;
+} script_t;
+
+static int script_add(script_t *sc, const char *line) {
+    if (sc->count == sc->cap) {
+        int cap = sc->cap ? sc->cap * 2 : 64;
+        char **p = (char **)realloc(sc->lines, cap * sizeof(char *));
+        if (p == NULL) {
+            return -1;
+        }
+        sc->lines = p;
+        sc->cap = cap;
+    }
+    char *copy = strdup(line);
+    if (copy == NULL) {
+        return -1;
+    }
+    copy[strcspn(copy, "\r\n")] = '\0';
+
+    // Indentation may use tabs; commands split on spaces
+    for (char *c = copy; *c; c++) {
+        if (*c == '\t') {
+            *c = ' ';
+        }
+    }
+    sc->lines[sc->count++] = copy;
+    return 0;
+}
+
+static void script_free(script_t *sc) {
+    for (int i = 0; i < sc->count; i++) {
+        free(sc->lines[i]);
+    }
+    free(sc->lines);
+    memset(sc, 0, sizeof(*sc));
+}
+
+// First word of a line, copied into word (empty for blank lines and comments)
+static void first_word(const char *line, char *word, size_t size) {
+    while (*line == ' ') {
+        line++;
+    }
+    size_t n = 0;
+    if (*line != '#') {
+        while (line[n] != '\0' && line[n] != ' ' && n + 1 < size) {
+            n++;
+        }
+    }
+    memcpy(word, line, n);
+    word[n] = '\0';
+}
+
+// Index of the end that closes the for at line first, or -1
+static int script_find_end(const script_t *sc, int first, int last) {
+    int depth = 0;
+    char word[16];
+    for (int i = first; i < last; i++) {
+        first_word(sc->lines[i], word, sizeof(word));
+        if (strcmp(word, "for") == 0) {
+            depth++;
+        } else if (strcmp(word, "end") == 0 && --depth == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void script_error(const script_t *sc, int line, const char *msg) {
+    shell_failures++;
+    if (shell_opts.interactive) {
+        fprintf(stderr, "%s\n", msg);
+    } else {
+        fprintf(stderr, "xfs_sim: line %d: %s: %s\n", line + 1, msg, sc->lines[line]);
+    }
+}
+
+// Run one command line, timing it
+static int script_run_command(const script_t *sc, int line, char *text) {
+    char name[24];
+    first_word(text, name, sizeof(name));
+
+    uint64_t start_ns = xfs_stats_now();
+    int ret = run_command(text);
+    uint64_t ns = xfs_stats_now() - start_ns;
+    if (ret == 1) {
+        return 1;
+    }
+
+    timing_record(name, ns, ret != 0);
+    if (shell_opts.time_each) {
+        fflush(stdout);
+        fprintf(stderr, "[time] %-12s %10.1f us\n", name, ns / 1e3);
+    }
+    // Interactive commands have already printed their own error
+    if (ret != 0 && shell_opts.interactive) {
+        shell_failures++;
+    } else if (ret != 0) {
+        script_error(sc, line, "command failed");
+    }
+    return ret;
+}
+
+// Run lines [first, last) of a script; returns 1 on exit, -1 when stopping on an error, else 0
+static int script_run(const script_t *sc, int first, int last) {
+    for (int i = first; i < last; i++) {
+        char *text = expand_vars(sc->lines[i]);
+        if (text == NULL) {
+            script_error(sc, i, "cannot expand variables");
+            if (shell_opts.stop_on_error) {
+                return -1;
+            }
+            continue;
+        }
+
+        char word[24];
+        first_word(text, word, sizeof(word));
+        int ret = 0;
+        if (word[0] == '\0') {
+            // Blank line or comment
+        } else if (strcmp(word, "for") == 0) {
+            // for <var> <count> | for <var> <start> <end>: the body runs with var = start .. end - 1
+            strtok(text, " ");
+            char *var = strtok(NULL, " ");
+            char *a = strtok(NULL, " ");
+            char *b = strtok(NULL, " ");
+            uint64_t from = 0, to = 0;
+            int end = script_find_end(sc, i, last);
+            if (end < 0) {
+                script_error(sc, i, "for without end");
+                free(text);
+                return -1;
+            }
+            if (!var || parse_number(a, b ? &from : &to) != 0 || (b && parse_number(b, &to) != 0)) {
+                script_error(sc, i, "usage: for <var> <count> | for <var> <start> <end>");
+                ret = -1;
+            } else {
+                char value[32];
+                for (uint64_t v = from; v < to && ret != 1; v++) {
+                    snprintf(value, sizeof(value), "%llu", (unsigned long long)v);
+                    if (var_set(var, value) != 0) {
+                        script_error(sc, i, "bad loop variable");
+                        ret = -1;
+                        break;
+                    }
+                    ret = script_run(sc, i + 1, end);
+                    if (ret < 0) {
+                        break;
+                    }
+                }
+            }
+            i = end;
+        } else if (strcmp(word, "end") == 0) {
+            script_error(sc, i, "end without for");
+            ret = -1;
+        } else if (strcmp(word, "set") == 0) {
+            // set <var> [value...]
+            strtok(text, " ");
+            char *var = strtok(NULL, " ");
+            char *value = strtok(NULL, "");
+            if (!var || var_set(var, value ? value : "") != 0) {
+                script_error(sc, i, "usage: set <var> [value]");
+                ret = -1;
+            }
+        } else if (strcmp(word, "let") == 0) {
+            strtok(text, " ");
+            if (run_let() != 0) {
+                script_error(sc, i, "bad let");
+                ret = -1;
+            }
         } else {
-            printf("Unknown command. Type 'help' for available commands.\n");
+            ret = script_run_command(sc, i, text);
+        }
+        free(text);
+
+        if (ret == 1) {
+            return 1;
+        }
+        if (ret < 0 && shell_opts.stop_on_error) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Read commands from a stream: a whole script, or interactively one line
+// (or one for ... end block) at a time
+static int shell_run_stream(FILE *in) {
+    script_t sc = { NULL, 0, 0 };
+    char *line = NULL;
+    size_t cap = 0;
+    int ret = 0;
+
+    if (!shell_opts.interactive) {
+        while (getline(&line, &cap, in) >= 0) {
+            if (script_add(&sc, line) != 0) {
+                fprintf(stderr, "xfs_sim: out of memory loading script\n");
+                free(line);
+                script_free(&sc);
+                return -1;
+            }
+        }
+        free(line);
+        ret = script_run(&sc, 0, sc.count);
+        script_free(&sc);
+        return ret;
+    }
+
+    while (ret != 1) {
+        printf(sc.count ? "...> " : "XFS_SIM> ");
+        fflush(stdout);
+        if (getline(&line, &cap, in) < 0) {
+            break;
+        }
+        if (script_add(&sc, line) != 0) {
+            break;
+        }
+
+        // An open for loop keeps reading until its end
+        char word[16];
+        first_word(sc.lines[0], word, sizeof(word));
+        if (strcmp(word, "for") == 0 && script_find_end(&sc, 0, sc.count) < 0) {
+            continue;
+        }
+        ret = script_run(&sc, 0, sc.count);
+        script_free(&sc);
+    }
+    free(line);
+    script_free(&sc);
+    return ret;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f script | -b] [-q] [-t] [-T] [-e]\n", prog);
+    fprintf(stderr, "  -f <script>  Run commands from a script file\n");
+    fprintf(stderr, "  -b           Run commands from stdin without prompts (batch mode)\n");
+    fprintf(stderr, "  -q           Discard command output (errors still go to stderr)\n");
+    fprintf(stderr, "  -t           Print each command's wall-clock time and a summary at exit\n");
+    fprintf(stderr, "  -T           Print only the per-command timing summary at exit\n");
+    fprintf(stderr, "  -e           Stop a script at its first failed command\n");
+}
+
+int main(int argc, char **argv) {
+    const char *script = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:bqtTeh")) != -1) {
+        switch (opt) {
+            case 'f': script = optarg; shell_opts.interactive = 0; break;
+            case 'b': shell_opts.interactive = 0; break;
+            case 'q': shell_opts.quiet = 1; break;
+            case 't': shell_opts.time_each = 1; shell_opts.time_summary = 1; break;
+            case 'T': shell_opts.time_summary = 1; break;
+            case 'e': shell_opts.stop_on_error = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    FILE *in = stdin;
+    if (script != NULL && (in = fopen(script, "r")) == NULL) {
+        perror(script);
+        return 2;
+    }
+
+    // Quiet runs send stdout to /dev/null; the timing report goes to stderr
+    int saved_stdout = -1;
+    if (shell_opts.quiet) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            fflush(stdout);
+            saved_stdout = dup(STDOUT_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
         }
     }
+
+    if (shell_opts.interactive) {
+        printf("XFS Simulation Shell. Type 'help' for commands.\n");
+    }
+
+    uint64_t start_ns = xfs_stats_now();
+    shell_run_stream(in);
+    uint64_t wall_ns = xfs_stats_now() - start_ns;
+
+    fflush(stdout);
+    if (saved_stdout >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+    if (shell_opts.time_summary) {
+        timing_report(stderr, wall_ns);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
     
     // Clean up
     trans_destroy();
     disk_destroy();
     
-    return 0;
-}
\ No newline at end of file
+    return !shell_opts.interactive && shell_failures > 0 ? 1 : 0;
+}
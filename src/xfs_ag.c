@@ -1,101 +1,396 @@
 #include "../include/xfs_ag.h"
 #include "../include/xfs_types.h"
 #include "../include/xfs_disk.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_cksum.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_workq.h"
+#include "../include/xfs_numa.h"
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Headers are v5 metadata: each carries the filesystem UUID, the LSN of the
+// last log item when it was written, and a CRC32C. Writers stamp all three;
+// readers reject a header whose CRC, magic, owner or UUID does not match.
+
+// Filesystem geometry, set by mkfs or read from the superblock at mount
+static uint32_t geo_agcount = 0;
+static uint32_t geo_agblocks = 0;
+static uint32_t geo_blocksize = 0;
+static uint32_t geo_bmblocks = 0;
+static uint8_t geo_uuid[XFS_UUID_SIZE];
+
+// Each AG's mutex has a cache line of its own, so threads working in
+// different AGs do not bounce each other's lock lines
+typedef struct {
+    pthread_mutex_t mutex;
+} __attribute__((aligned(64))) ag_mutex_t;
 
 // Array of mutexes for each allocation group
-static pthread_mutex_t ag_mutexes[NUM_AGS];
+static ag_mutex_t *ag_mutexes = NULL;
+
+// Release the per-AG mutexes of the previous geometry
+static void ag_destroy_mutexes(void) {
+    if (ag_mutexes != NULL) {
+        for (uint32_t i = 0; i < geo_agcount; i++) {
+            pthread_mutex_destroy(&ag_mutexes[i].mutex);
+        }
+        free(ag_mutexes);
+        ag_mutexes = NULL;
+    }
+    geo_agcount = 0;
+}
 
-// Initialize allocation groups
-int ag_init_headers(void) {
+// Make a random (version 4) UUID for a new filesystem
+static void ag_generate_uuid(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t x = ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec) ^ ((uint64_t)getpid() << 32);
+    for (int i = 0; i < XFS_UUID_SIZE; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        geo_uuid[i] = (uint8_t)(x >> 24);
+    }
+    geo_uuid[6] = (uint8_t)((geo_uuid[6] & 0x0f) | 0x40);
+    geo_uuid[8] = (uint8_t)((geo_uuid[8] & 0x3f) | 0x80);
+}
+
+// Initialize allocation groups for the given geometry, with a new filesystem UUID
+int ag_init_headers(uint32_t agcount, uint32_t agblocks, uint32_t blocksize) {
+    // Block size must be a power of two between 512 bytes and 64KB
+    if (blocksize < 512 || blocksize > 65536 || (blocksize & (blocksize - 1)) != 0) {
+        return -1;
+    }
+    
+    // Each AG needs its headers, its bitmap and at least one data block
+    uint32_t bmblocks = (uint32_t)(((uint64_t)agblocks + (uint64_t)blocksize * 8 - 1) / ((uint64_t)blocksize * 8));
+    if (agcount == 0 || agblocks <= XFS_AG_BITMAP_BLOCK + bmblocks) {
+        return -1;
+    }
+    
+    ag_destroy_mutexes();
+    
+    void *mutexes;
+    if (posix_memalign(&mutexes, sizeof(ag_mutex_t), (size_t)agcount * sizeof(ag_mutex_t)) != 0) {
+        return -1;
+    }
+    ag_mutexes = (ag_mutex_t *)mutexes;
+    
     // Initialize mutexes for each AG
-    for (int i = 0; i < NUM_AGS; i++) {
-        if (pthread_mutex_init(&ag_mutexes[i], NULL) != 0) {
+    for (uint32_t i = 0; i < agcount; i++) {
+        if (pthread_mutex_init(&ag_mutexes[i].mutex, NULL) != 0) {
             // Clean up already initialized mutexes
-            for (int j = 0; j < i; j++) {
-                pthread_mutex_destroy(&ag_mutexes[j]);
+            for (uint32_t j = 0; j < i; j++) {
+                pthread_mutex_destroy(&ag_mutexes[j].mutex);
             }
+            free(ag_mutexes);
+            ag_mutexes = NULL;
             return -1;
         }
     }
     
+    geo_agcount = agcount;
+    geo_agblocks = agblocks;
+    geo_blocksize = blocksize;
+    geo_bmblocks = bmblocks;
+    ag_generate_uuid();
+    
     return 0;
 }
 
+// Read the geometry from the superblock and initialize the allocation groups
+int ag_mount(void) {
+    xfs_sb_t sb;
+    
+    if (disk_read(0, &sb, sizeof(xfs_sb_t)) != 0) {
+        return -1;
+    }
+    
+    if (sb.sb_magicnum != XFS_SB_MAGIC || !xfs_cksum_verify(&sb, sizeof(sb), offsetof(xfs_sb_t, sb_crc)) ||
+        sb.sb_agcount == 0 || sb.sb_agcount > UINT32_MAX || sb.sb_dblocks != sb.sb_agcount * sb.sb_agblocks) {
+        return -1;
+    }
+    
+    if (ag_init_headers((uint32_t)sb.sb_agcount, sb.sb_agblocks, sb.sb_blocksize) != 0) {
+        return -1;
+    }
+    memcpy(geo_uuid, sb.sb_uuid, XFS_UUID_SIZE);
+    return 0;
+}
+
+// Number of allocation groups
+int ag_count(void) {
+    return (int)geo_agcount;
+}
+
+// Blocks per allocation group
+uint32_t ag_blocks(void) {
+    return geo_agblocks;
+}
+
+// Filesystem block size in bytes
+uint32_t ag_blocksize(void) {
+    return geo_blocksize;
+}
+
+// Blocks used by each AG's free space bitmap
+uint32_t ag_bitmap_blocks(void) {
+    return geo_bmblocks;
+}
+
+// First AG-relative block available for data (headers and bitmap come first)
+uint32_t ag_first_data_block(void) {
+    return XFS_AG_BITMAP_BLOCK + geo_bmblocks;
+}
+
+// NUMA node an AG is mapped to: each node gets a contiguous range of AGs
+int ag_node(int ag_id) {
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount) {
+        return 0;
+    }
+    return (int)((uint64_t)ag_id * (uint64_t)xfs_numa_nodes() / geo_agcount);
+}
+
+// First AG and number of AGs mapped to a node; a node left without AGs shares its neighbour's
+void ag_node_ags(int node, int *first, int *count) {
+    uint64_t nodes = (uint64_t)xfs_numa_nodes();
+    if (node < 0 || (uint64_t)node >= nodes || geo_agcount == 0) {
+        *first = 0;
+        *count = (int)geo_agcount;
+        return;
+    }
+    
+    // AG a is on node a * nodes / agcount, so a node's AGs start at ceil(node * agcount / nodes)
+    uint64_t lo = ((uint64_t)node * geo_agcount + nodes - 1) / nodes;
+    uint64_t hi = ((uint64_t)(node + 1) * geo_agcount + nodes - 1) / nodes;
+    if (hi == lo) {
+        lo = (uint64_t)node * geo_agcount / nodes;
+        hi = lo + 1;
+    }
+    *first = (int)lo;
+    *count = (int)(hi - lo);
+}
+
 // Lock a specific allocation group
 int ag_lock(int ag_id) {
-    if (ag_id < 0 || ag_id >= NUM_AGS) {
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount) {
         return -1;
     }
     
-    return pthread_mutex_lock(&ag_mutexes[ag_id]);
+    // Uncontended acquisitions are counted without reading the clock
+    if (pthread_mutex_trylock(&ag_mutexes[ag_id].mutex) == 0) {
+        xfs_stats_record_ns(XFS_STAT_AG_LOCK_WAIT, 0);
+        return 0;
+    }
+    
+    uint64_t start_ns = xfs_stats_now();
+    int ret = pthread_mutex_lock(&ag_mutexes[ag_id].mutex);
+    xfs_stats_record(XFS_STAT_AG_LOCK_WAIT, start_ns);
+    return ret;
+}
+
+// Try to lock a specific allocation group without blocking (0 = locked)
+int ag_trylock(int ag_id) {
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount) {
+        return -1;
+    }
+    
+    int ret = pthread_mutex_trylock(&ag_mutexes[ag_id].mutex);
+    if (ret == 0) {
+        xfs_stats_record_ns(XFS_STAT_AG_LOCK_WAIT, 0);
+    }
+    return ret;
 }
 
 // Unlock a specific allocation group
 int ag_unlock(int ag_id) {
-    if (ag_id < 0 || ag_id >= NUM_AGS) {
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount) {
         return -1;
     }
     
-    return pthread_mutex_unlock(&ag_mutexes[ag_id]);
+    return pthread_mutex_unlock(&ag_mutexes[ag_id].mutex);
 }
 
 // Get the offset of a specific AG in the disk
 uint64_t ag_get_offset(int ag_id) {
-    if (ag_id < 0 || ag_id >= NUM_AGS) {
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount) {
         return 0;  // Invalid AG ID
     }
     
-    // Assuming each AG starts at regular intervals (e.g., every 10MB)
-    // For this simulation, let's say each AG is 10MB (10 * 1024 * 1024 bytes)
-    return (uint64_t)ag_id * (10 * 1024 * 1024);
+    return (uint64_t)ag_id * geo_agblocks * geo_blocksize;
+}
+
+// Get the disk offset of an AG-relative block
+uint64_t ag_block_offset(int ag_id, uint64_t agbno) {
+    return ag_get_offset(ag_id) + agbno * geo_blocksize;
+}
+
+// Convert an AG-relative block number to a filesystem block number
+uint64_t ag_fsb(int ag_id, uint64_t agbno) {
+    return (uint64_t)ag_id * geo_agblocks + agbno;
+}
+
+// Get the AG that holds a filesystem block
+int ag_fsb_to_agno(uint64_t fsb) {
+    if (geo_agblocks == 0) {
+        return 0;  // No geometry yet
+    }
+    return (int)(fsb / geo_agblocks);
+}
+
+// Get the AG-relative block number of a filesystem block
+uint64_t ag_fsb_to_agbno(uint64_t fsb) {
+    if (geo_agblocks == 0) {
+        return 0;  // No geometry yet
+    }
+    return fsb % geo_agblocks;
+}
+
+// Filesystem UUID from mkfs or the superblock
+const uint8_t *ag_uuid(void) {
+    return geo_uuid;
+}
+
+// Read an AG's AGF and verify its magic, owner, UUID and CRC
+int ag_read_agf(int ag_id, xfs_agf_t *agf) {
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount ||
+        disk_read(ag_block_offset(ag_id, XFS_AG_AGF_BLOCK), agf, sizeof(xfs_agf_t)) != 0) {
+        return -1;
+    }
+    
+    if (!xfs_cksum_verify(agf, sizeof(xfs_agf_t), offsetof(xfs_agf_t, agf_crc))) {
+        return -1;
+    }
+    if (agf->agf_magicnum != XFS_AGF_MAGIC || agf->agf_seqno != (uint32_t)ag_id ||
+        memcmp(agf->agf_uuid, geo_uuid, XFS_UUID_SIZE) != 0) {
+        xfs_cksum_report_failure();
+        return -1;
+    }
+    return 0;
 }
 
-// Write AG headers to disk
-int ag_write_headers(void) {
+// Stamp an AGF's UUID, LSN and CRC and write it to disk
+int ag_write_agf(int ag_id, xfs_agf_t *agf) {
+    memcpy(agf->agf_uuid, geo_uuid, XFS_UUID_SIZE);
+    agf->agf_lsn = trans_last_lsn();
+    xfs_cksum_update(agf, sizeof(xfs_agf_t), offsetof(xfs_agf_t, agf_crc));
+    return disk_write(ag_block_offset(ag_id, XFS_AG_AGF_BLOCK), agf, sizeof(xfs_agf_t));
+}
+
+// Write one AG's headers (superblock copy, AGF, AGI) to disk
+int ag_write_header(int ag_id) {
     xfs_sb_t sb;
     xfs_agf_t agf;
     xfs_agi_t agi;
     
+    if (ag_id < 0 || (uint32_t)ag_id >= geo_agcount) {
+        return -1;
+    }
+    
     // Initialize superblock
-    sb.sb_magicnum = 0x58465342;  // "XFSB" in hex
-    sb.sb_blocksize = 4096;       // 4KB blocks
-    sb.sb_dblocks = 100 * 1024 * 1024 / 4096;  // Assuming 100MB total size
-    sb.sb_agcount = NUM_AGS;
+    memset(&sb, 0, sizeof(sb));
+    sb.sb_magicnum = XFS_SB_MAGIC;
+    sb.sb_blocksize = geo_blocksize;
+    sb.sb_dblocks = (uint64_t)geo_agcount * geo_agblocks;
+    sb.sb_agcount = geo_agcount;
     sb.sb_versionnum = 5;
+    sb.sb_agblocks = geo_agblocks;
+    memcpy(sb.sb_uuid, geo_uuid, XFS_UUID_SIZE);
+    sb.sb_lsn = trans_last_lsn();
+    xfs_cksum_update(&sb, sizeof(sb), offsetof(xfs_sb_t, sb_crc));
     
-    // Write superblock at offset 0
-    if (disk_write(0, &sb, sizeof(xfs_sb_t)) != 0) {
+    // Primary superblock at offset 0, secondary copies at the start of every other AG
+    if (disk_write(ag_block_offset(ag_id, XFS_AG_SB_BLOCK), &sb, sizeof(xfs_sb_t)) != 0) {
         return -1;
     }
     
-    // Write AG headers for each AG
-    for (int i = 0; i < NUM_AGS; i++) {
-        uint64_t ag_offset = ag_get_offset(i);
-        
-        // Initialize AGF
-        agf.agf_magicnum = 0x58414746;  // "XAGF" in hex
-        agf.agf_length = 10 * 1024 * 1024 / 4096;  // Size in blocks
-        agf.agf_freeblks = 10 * 1024 * 1024 / 4096 - 2;  // Subtract AGF and AGI blocks
-        agf.agf_longest = 10 * 1024 * 1024 / 4096 - 2;
-        
-        // Write AGF at AG start
-        if (disk_write(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
-            return -1;
+    // Initialize AGF
+    memset(&agf, 0, sizeof(agf));
+    agf.agf_magicnum = XFS_AGF_MAGIC;
+    agf.agf_seqno = (uint32_t)ag_id;
+    agf.agf_length = geo_agblocks;  // Size in blocks
+    agf.agf_freeblks = geo_agblocks - ag_first_data_block();  // Subtract header and bitmap blocks
+    agf.agf_longest = agf.agf_freeblks;
+    agf.agf_bmblocks = geo_bmblocks;
+    
+    if (ag_write_agf(ag_id, &agf) != 0) {
+        return -1;
+    }
+    
+    // Initialize AGI
+    memset(&agi, 0, sizeof(agi));
+    agi.agi_magicnum = XFS_AGI_MAGIC;
+    agi.agi_count = 0;              // Initially no inodes
+    agi.agi_root = 0;               // Root block of inode btree
+    agi.agi_freecount = 0;          // Initially no free inodes
+    agi.agi_seqno = (uint32_t)ag_id;
+    memcpy(agi.agi_uuid, geo_uuid, XFS_UUID_SIZE);
+    agi.agi_lsn = trans_last_lsn();
+    xfs_cksum_update(&agi, sizeof(agi), offsetof(xfs_agi_t, agi_crc));
+    
+    if (disk_write(ag_block_offset(ag_id, XFS_AG_AGI_BLOCK), &agi, sizeof(xfs_agi_t)) != 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Shared state of one ag_foreach_parallel() call
+typedef struct {
+    int (*fn)(int ag_id, void *arg);
+    void *arg;
+    int next_ag;   // Next AG to hand out
+    int failed;    // Set when any call fails
+} ag_foreach_t;
+
+static void ag_foreach_worker(void *arg) {
+    ag_foreach_t *work = (ag_foreach_t *)arg;
+    int agcount = (int)geo_agcount;
+    
+    // Take AGs one at a time so uneven per-AG costs balance out
+    for (;;) {
+        int ag_id = __atomic_fetch_add(&work->next_ag, 1, __ATOMIC_RELAXED);
+        if (ag_id >= agcount || __atomic_load_n(&work->failed, __ATOMIC_RELAXED)) {
+            break;
         }
-        
-        // Initialize AGI
-        agi.agi_magicnum = 0x58414749;  // "XAGI" in hex
-        agi.agi_count = 0;              // Initially no inodes
-        agi.agi_root = 0;               // Root block of inode btree
-        agi.agi_freecount = 0;          // Initially no free inodes
-        
-        // Write AGI at AG start + 1 block
-        if (disk_write(ag_offset + 4096, &agi, sizeof(xfs_agi_t)) != 0) {
-            return -1;
+        if (work->fn(ag_id, work->arg) != 0) {
+            __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
         }
     }
+}
+
+// Run fn for every AG as up to nthreads background tasks (0 = one per pool thread)
+int ag_foreach_parallel(int (*fn)(int ag_id, void *arg), void *arg, int nthreads) {
+    ag_foreach_t work = { fn, arg, 0, 0 };
     
-    return 0;
+    if (nthreads <= 0) {
+        nthreads = xfs_workq_threads();
+    }
+    if ((uint32_t)nthreads > geo_agcount) {
+        nthreads = (int)geo_agcount;
+    }
+    
+    // The calling thread takes AGs too, and runs queued tasks while it waits
+    xfs_work_group_t group;
+    xfs_work_group_init(&group);
+    xfs_work_t *tasks = NULL;
+    if (nthreads > 1) {
+        tasks = (xfs_work_t *)malloc((nthreads - 1) * sizeof(xfs_work_t));
+        for (int i = 0; tasks != NULL && i < nthreads - 1; i++) {
+            if (xfs_workq_queue_group(&group, &tasks[i], XFS_WORK_AG_INIT, ag_foreach_worker, &work) != 0) {
+                break;
+            }
+        }
+    }
+    
+    ag_foreach_worker(&work);
+    xfs_work_group_wait(&group);
+    free(tasks);
+    
+    return work.failed ? -1 : 0;
 }
\ No newline at end of file
@@ -2,169 +2,1201 @@
 #include "../include/xfs_ag.h"
 #include "../include/xfs_trans.h"
 #include "../include/xfs_disk.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_trace.h"
+#include "../include/xfs_refcount.h"
+#include "../include/xfs_numa.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-// Allocate contiguous blocks in a specific AG
-uint64_t xfs_alloc_blocks(int ag_id, int count) {
-    // Lock the allocation group
-    if (ag_lock(ag_id) != 0) {
-        return 0; // Allocation failed
+// A freed extent that must not be reallocated until the log item that
+// freed it has been flushed; reusing it earlier could let new data land in
+// blocks that the on-disk log still shows as owned by the old file.
+typedef struct {
+    uint32_t agbno;
+    uint32_t len;
+    uint64_t lsn;        // Log item that freed the extent
+} xfs_busy_extent_t;
+
+// In-core copy of each AG's free space state, loaded from the AGF and bitmap
+// (at mount, or on the AG's first allocation when mounted lazily) and written
+// through on every change. The AG lock protects it; 'loaded' and
+// agf_freeblks are also read without the lock so AG selection can skip full
+// AGs cheaply. Each AG's state has cache lines of its own, and with NUMA
+// affinity on its bitmap is allocated on the AG's node.
+typedef struct {
+    xfs_agf_t agf;       // In-core AGF
+    uint64_t *bitmap;    // One bit per block, 1 = used
+    int loaded;          // agf and bitmap are valid
+    xfs_busy_extent_t *busy;  // Freed but not yet committed extents
+    int busy_count;
+    int busy_cap;
+    uint64_t free_extents;    // Free runs in the bitmap, kept in step with every change
+} __attribute__((aligned(64))) xfs_perag_t;
+
+static xfs_perag_t *perag = NULL;
+static int perag_count = 0;
+
+// LSN of the newest busy extent in any AG; once the log is flushed past it,
+// nothing is busy, however many stale entries unsearched AGs still hold
+static uint64_t busy_lsn = 0;
+
+// Rotor that spreads fallback allocations across AGs
+static unsigned int ag_rotor = 0;
+
+// Number of 64-bit bitmap words covering an AG
+static size_t bm_words(void) {
+    return (size_t)ag_bitmap_blocks() * ag_blocksize() / sizeof(uint64_t);
+}
+
+// Set (used) or clear (free) bits [start, start + len)
+static void bm_set_range(uint64_t *bm, uint64_t start, uint64_t len, int used) {
+    uint64_t end = start + len;
+    while (start < end) {
+        uint64_t bit = start % 64;
+        uint64_t n = 64 - bit < end - start ? 64 - bit : end - start;
+        uint64_t mask = (n == 64 ? ~0ull : ((1ull << n) - 1)) << bit;
+        if (used) {
+            bm[start / 64] |= mask;
+        } else {
+            bm[start / 64] &= ~mask;
+        }
+        start += n;
     }
+}
+
+// Count the used bits in [start, start + len)
+static uint64_t bm_count_used(const uint64_t *bm, uint64_t start, uint64_t len) {
+    uint64_t end = start + len;
+    uint64_t used = 0;
+    while (start < end) {
+        uint64_t bit = start % 64;
+        uint64_t n = 64 - bit < end - start ? 64 - bit : end - start;
+        uint64_t mask = (n == 64 ? ~0ull : ((1ull << n) - 1)) << bit;
+        used += __builtin_popcountll(bm[start / 64] & mask);
+        start += n;
+    }
+    return used;
+}
+
+// Count the free runs that start in [start, end): free blocks whose
+// predecessor is used. Block 0 always holds the AG header, so it never starts one.
+static uint64_t bm_count_run_starts(const uint64_t *bm, uint64_t start, uint64_t end) {
+    uint64_t starts = 0;
+    while (start < end) {
+        uint64_t bit = start % 64;
+        uint64_t n = 64 - bit < end - start ? 64 - bit : end - start;
+        uint64_t mask = (n == 64 ? ~0ull : ((1ull << n) - 1)) << bit;
+        uint64_t w = bm[start / 64];
+        uint64_t prev_used = (w << 1) | (start >= 64 ? bm[start / 64 - 1] >> 63 : 1);
+        starts += __builtin_popcountll(~w & prev_used & mask);
+        start += n;
+    }
+    return starts;
+}
+
+// Add every free run of a bitmap covering agblocks blocks to fs. Works a
+// word at a time: all-free words extend the current run, and mixed words
+// are split into free and used stretches with count-trailing-zeros.
+static void bm_freesp(const uint64_t *bm, uint64_t agblocks, xfs_freesp_t *fs) {
+    uint64_t run = 0;
+    uint64_t nwords = (agblocks + 63) / 64;
+    for (uint64_t i = 0; i < nwords; i++) {
+        uint64_t used = bm[i];
+        if (i == nwords - 1 && agblocks % 64 != 0) {
+            used |= ~0ull << (agblocks % 64);  // Bits past the end of the AG
+        }
+        if (used == 0) {
+            run += 64;
+            continue;
+        }
+        uint64_t pos = 0;
+        while (pos < 64) {
+            uint64_t rest = used >> pos;
+            if (rest == 0) {
+                run += 64 - pos;  // Free to the end of the word
+                break;
+            }
+            uint64_t nfree = (uint64_t)__builtin_ctzll(rest);
+            if (run + nfree > 0) {
+                xfs_freesp_add(fs, run + nfree);
+            }
+            run = 0;
+            pos += nfree;
+            uint64_t after = ~(used >> pos);
+            if (after == 0) {
+                break;  // Used to the end of the word
+            }
+            pos += (uint64_t)__builtin_ctzll(after);
+        }
+    }
+    if (run > 0) {
+        xfs_freesp_add(fs, run);
+    }
+}
+
+// Find 'count' contiguous free blocks in [from, to) (first fit); returns 0 if none.
+// Works a word at a time: free bits at the bottom of a word extend the run
+// carried in from the previous word, runs inside a word are found by
+// shift-and-AND, and free bits at the top are carried into the next word.
+static uint64_t bm_find_free(const uint64_t *bm, uint64_t from, uint64_t to, uint64_t count) {
+    uint64_t run = 0;          // Free bits carried in from previous words
+    uint64_t run_start = from;
+    uint64_t pos = from;
     
-    // Get the AG's free space information
-    xfs_agf_t agf;
-    uint64_t ag_offset = ag_get_offset(ag_id);
-    
-    // Read the current AGF from disk
-    if (disk_read(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
-        ag_unlock(ag_id);
+    if (count == 0) {
         return 0;
     }
     
-    // Find contiguous free blocks
-    uint64_t start_block = 0;
-    int found = 0;
-    
-    // Simplified allocation: Find the first available contiguous space
-    for (int i = 2; i < 2400 - count; i++) { // Skip first 2 blocks (AGF and AGI)
-        int is_free = 1;
+    while (pos < to) {
+        uint64_t nbits = 64 - pos % 64;
+        if (nbits > to - pos) {
+            nbits = to - pos;
+        }
+        uint64_t f = ~bm[pos / 64] >> (pos % 64);  // 1 = free, bit 0 is 'pos'
+        if (nbits < 64) {
+            f &= (1ull << nbits) - 1;
+        }
+        if (run == 0) {
+            run_start = pos;
+        }
         
-        // Check if 'count' number of blocks starting at 'i' are free
-        for (int j = 0; j < count; j++) {
-            if (agf.free_blocks[i+j] == 1) { // 1 = used, 0 = free
-                is_free = 0;
-                i = i + j; // Skip to the next potentially free block
-                break;
+        // Free bits at the bottom of the word continue the carried run
+        uint64_t low = f == ~0ull ? 64 : (uint64_t)__builtin_ctzll(~f);
+        if (run + low >= count) {
+            return run_start;
+        }
+        if (low == nbits) {
+            run += low;
+            pos += nbits;
+            continue;
+        }
+        
+        // Runs wholly inside this word: bit i of m is set when bits i..i+count-1 are free
+        if (count <= 64) {
+            uint64_t m = f;
+            for (uint64_t k = 1; k < count && m != 0; ) {
+                uint64_t shift = k < count - k ? k : count - k;
+                m &= m >> shift;
+                k += shift;
+            }
+            if (m != 0) {
+                return pos + __builtin_ctzll(m);
             }
         }
         
-        if (is_free) {
-            start_block = i;
-            found = 1;
-            break;
+        // Carry the free bits at the top of the word into the next one
+        uint64_t used = ~f & (nbits < 64 ? (1ull << nbits) - 1 : ~0ull);
+        run = nbits - 1 - (63 - __builtin_clzll(used));
+        run_start = pos + nbits - run;
+        pos += nbits;
+    }
+    return 0;
+}
+
+// Mark [start, start + len) used or free, keeping the AG's free run count current
+static void perag_set_range(xfs_perag_t *pag, uint64_t start, uint64_t len, int used) {
+    // Only runs starting in the range, or right after it, can appear or vanish
+    uint64_t end = start + len < ag_blocks() ? start + len + 1 : ag_blocks();
+    uint64_t before = bm_count_run_starts(pag->bitmap, start, end);
+    bm_set_range(pag->bitmap, start, len, used);
+    pag->free_extents += bm_count_run_starts(pag->bitmap, start, end) - before;
+}
+
+// Write the bitmap words covering [start, start + len) back to disk
+static int perag_write_bitmap(int ag_id, uint64_t start, uint64_t len) {
+    xfs_perag_t *pag = &perag[ag_id];
+    uint64_t first_word = start / 64;
+    uint64_t last_word = (start + len - 1) / 64;
+    uint64_t bm_offset = ag_block_offset(ag_id, XFS_AG_BITMAP_BLOCK);
+    
+    return disk_write(bm_offset + first_word * sizeof(uint64_t), &pag->bitmap[first_word],
+                      (last_word - first_word + 1) * sizeof(uint64_t));
+}
+
+// Write the AGF back to disk, then log it
+static int perag_write_agf(int ag_id) {
+    xfs_perag_t *pag = &perag[ag_id];
+    
+    if (ag_write_agf(ag_id, &pag->agf) != 0) {
+        return -1;
+    }
+    
+    // Log this operation
+    trans_add_object(TRANS_OBJ_KEY(TRANS_OBJ_AGF, ag_id), &pag->agf, sizeof(xfs_agf_t));
+    return 0;
+}
+
+// Write the AGF and the bitmap words covering [start, start + len) back to disk, then log the AGF
+static int perag_write(int ag_id, uint64_t start, uint64_t len) {
+    if (perag_write_bitmap(ag_id, start, len) != 0) {
+        return -1;
+    }
+    return perag_write_agf(ag_id);
+}
+
+// Drop busy extents whose freeing log item has been flushed (caller holds the AG lock)
+static void perag_busy_trim(xfs_perag_t *pag) {
+    if (pag->busy_count == 0) {
+        return;
+    }
+    
+    uint64_t flushed = trans_flushed_lsn();
+    int kept = 0;
+    for (int i = 0; i < pag->busy_count; i++) {
+        if (pag->busy[i].lsn > flushed) {
+            pag->busy[kept++] = pag->busy[i];
+        }
+    }
+    pag->busy_count = kept;
+}
+
+// Mark [agbno, agbno + len) busy until lsn is flushed (caller holds the AG lock)
+static int perag_busy_insert(xfs_perag_t *pag, uint32_t agbno, uint32_t len, uint64_t lsn) {
+    if (pag->busy_count == pag->busy_cap) {
+        int new_cap = pag->busy_cap ? pag->busy_cap * 2 : 16;
+        xfs_busy_extent_t *p = (xfs_busy_extent_t *)realloc(pag->busy, new_cap * sizeof(xfs_busy_extent_t));
+        if (p == NULL) {
+            return -1;
         }
+        pag->busy = p;
+        pag->busy_cap = new_cap;
     }
     
-    if (!found) {
-        ag_unlock(ag_id);
+    pag->busy[pag->busy_count].agbno = agbno;
+    pag->busy[pag->busy_count].len = len;
+    pag->busy[pag->busy_count].lsn = lsn;
+    pag->busy_count++;
+    uint64_t newest = __atomic_load_n(&busy_lsn, __ATOMIC_RELAXED);
+    while (newest < lsn && !__atomic_compare_exchange_n(&busy_lsn, &newest, lsn, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return 0;
+}
+
+// Find 'count' free blocks in [from, to) that overlap no busy extent; returns 0 if none
+static uint64_t perag_find_free(xfs_perag_t *pag, uint64_t from, uint64_t to, uint64_t count) {
+    perag_busy_trim(pag);
+    
+    while (from < to) {
+        uint64_t start = bm_find_free(pag->bitmap, from, to, count);
+        if (start == 0 || pag->busy_count == 0) {
+            return start;
+        }
+        
+        // Restart the search past the furthest busy extent this candidate overlaps
+        uint64_t skip_to = 0;
+        for (int i = 0; i < pag->busy_count; i++) {
+            uint64_t b_start = pag->busy[i].agbno;
+            uint64_t b_end = b_start + pag->busy[i].len;
+            if (b_start < start + count && start < b_end && b_end > skip_to) {
+                skip_to = b_end;
+            }
+        }
+        if (skip_to == 0) {
+            return start;
+        }
+        from = skip_to;
+    }
+    return 0;
+}
+
+// Read one AG's AGF and bitmap into its in-core state (caller holds the AG lock)
+static int perag_load(int ag_id) {
+    xfs_perag_t *pag = &perag[ag_id];
+    
+    if (pag->bitmap == NULL) {
+        int node = xfs_numa_get_affinity() ? ag_node(ag_id) : -1;
+        pag->bitmap = (uint64_t *)xfs_numa_alloc(bm_words() * sizeof(uint64_t), node);
+        if (pag->bitmap == NULL) {
+            return -1;
+        }
+    }
+    
+    if (ag_read_agf(ag_id, &pag->agf) != 0) {
+        return -1;
+    }
+    if (pag->agf.agf_length != ag_blocks() || pag->agf.agf_bmblocks != ag_bitmap_blocks()) {
+        return -1; // AGF does not match the superblock geometry
+    }
+    if (disk_read(ag_block_offset(ag_id, XFS_AG_BITMAP_BLOCK), pag->bitmap, bm_words() * sizeof(uint64_t)) != 0) {
+        return -1;
+    }
+    pag->free_extents = bm_count_run_starts(pag->bitmap, 0, ag_blocks());
+    
+    __atomic_store_n(&pag->loaded, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Get an AG's in-core state, loading it on first use (caller holds the AG lock)
+static xfs_perag_t *perag_get(int ag_id) {
+    if (ag_id < 0 || ag_id >= perag_count) {
+        return NULL;
+    }
+    if (!perag[ag_id].loaded && perag_load(ag_id) != 0) {
+        return NULL;
+    }
+    return &perag[ag_id];
+}
+
+// Allocate contiguous blocks in an AG whose lock is held, searching from agbno_hint first
+static uint64_t xfs_alloc_blocks_locked(int ag_id, int count, uint64_t agbno_hint) {
+    xfs_perag_t *pag = perag_get(ag_id);
+    if (pag == NULL || count <= 0) {
+        return 0;
+    }
+    
+    uint64_t first = ag_first_data_block();
+    uint64_t agblocks = ag_blocks();
+    
+    // Skip the header and bitmap blocks
+    if (agbno_hint < first || agbno_hint >= agblocks) {
+        agbno_hint = first;
+    }
+    
+    // First fit at or after the hint, then wrap around to the start of the AG
+    uint64_t start_block = perag_find_free(pag, agbno_hint, agblocks, count);
+    if (start_block == 0 && agbno_hint > first) {
+        uint64_t wrap_end = agbno_hint + count - 1;
+        start_block = perag_find_free(pag, first, wrap_end < agblocks ? wrap_end : agblocks, count);
+    }
+    
+    if (start_block == 0) {
         return 0; // No suitable space found
     }
     
     // Mark blocks as used
-    for (int i = 0; i < count; i++) {
-        agf.free_blocks[start_block + i] = 1; // Mark as used
-    }
+    perag_set_range(pag, start_block, count, 1);
     
     // Update AGF metadata
-    agf.agf_freeblks -= count;
+    __atomic_store_n(&pag->agf.agf_freeblks, pag->agf.agf_freeblks - count, __ATOMIC_RELAXED);
     
     // Calculate the longest free space (simplified)
-    agf.agf_longest = agf.agf_freeblks > 0 ? agf.agf_freeblks : 0;
+    pag->agf.agf_longest = pag->agf.agf_freeblks;
     
-    // Write the updated AGF back to disk
-    if (disk_write(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
+    // Write the updated AGF and bitmap back to disk
+    if (perag_write(ag_id, start_block, count) != 0) {
         // If write failed, we should try to revert changes but for simulation purposes, 
         // we'll just return failure
-        ag_unlock(ag_id);
         return 0;
     }
     
-    // Log this allocation operation
-    trans_add_item(&agf, sizeof(xfs_agf_t));
+    // Return the starting block number within this AG
+    return start_block;
+}
+
+// Allocate contiguous blocks in a specific AG
+static uint64_t xfs_alloc_blocks_internal(int ag_id, int count) {
+    // Lock the allocation group
+    if (ag_lock(ag_id) != 0) {
+        return 0; // Allocation failed
+    }
+    
+    uint64_t start_block = xfs_alloc_blocks_locked(ag_id, count, ag_first_data_block());
     
     // Unlock the allocation group
     ag_unlock(ag_id);
     
-    // Return the starting block number within this AG
     return start_block;
 }
 
 // Free allocated blocks in a specific AG
-int xfs_free_blocks(int ag_id, uint64_t start_block, int count) {
+static int xfs_free_blocks_internal(int ag_id, uint64_t start_block, int count) {
+    if (ag_id < 0 || ag_id >= perag_count || count <= 0 ||
+        start_block < ag_first_data_block() || start_block + count > ag_blocks()) {
+        return -1;
+    }
+    
     // Lock the allocation group
     if (ag_lock(ag_id) != 0) {
         return -1;
     }
     
-    // Get the AG's free space information
-    xfs_agf_t agf;
-    uint64_t ag_offset = ag_get_offset(ag_id);
+    xfs_perag_t *pag = perag_get(ag_id);
+    if (pag == NULL) {
+        ag_unlock(ag_id);
+        return -1;
+    }
     
-    // Read the current AGF from disk
-    if (disk_read(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
+    // Mark blocks as free, counting only blocks that were in use
+    uint32_t freed = (uint32_t)bm_count_used(pag->bitmap, start_block, count);
+    perag_set_range(pag, start_block, count, 0);
+    
+    // Update AGF metadata
+    __atomic_store_n(&pag->agf.agf_freeblks, pag->agf.agf_freeblks + freed, __ATOMIC_RELAXED);
+    
+    // Calculate the longest free space (simplified)
+    if (pag->agf.agf_longest < (uint32_t)count) {
+        pag->agf.agf_longest = count;
+    }
+    
+    // Write the updated AGF and bitmap back to disk
+    if (perag_write(ag_id, start_block, count) != 0) {
         ag_unlock(ag_id);
         return -1;
     }
     
-    // Mark blocks as free
+    // Unlock the allocation group
+    ag_unlock(ag_id);
+    
+    return 0; // Success
+}
+
+// Allocate contiguous blocks in a specific AG
+uint64_t xfs_alloc_blocks(int ag_id, int count) {
+    uint64_t start_ns = xfs_stats_now();
+    uint64_t block = xfs_alloc_blocks_internal(ag_id, count);
+    xfs_stats_record(XFS_STAT_ALLOC, start_ns);
+    return block;
+}
+
+// Free allocated blocks in a specific AG
+int xfs_free_blocks(int ag_id, uint64_t start_block, int count) {
+    uint64_t start_ns = xfs_stats_now();
+    int ret = xfs_free_blocks_internal(ag_id, start_block, count);
+    xfs_stats_record(XFS_STAT_FREE, start_ns);
+    return ret;
+}
+
+// Free a batch of extents in one AG under a single AG lock hold and one
+// logged AGF update. The extents stay busy until that update is flushed.
+static int xfs_free_extents_internal(int ag_id, const xfs_agext_t *ext, int count) {
+    if (ag_id < 0 || ag_id >= perag_count || count <= 0) {
+        return -1;
+    }
+    
+    uint64_t first = ag_first_data_block();
+    uint64_t agblocks = ag_blocks();
     for (int i = 0; i < count; i++) {
-        if (start_block + i < 2400) {
-            agf.free_blocks[start_block + i] = 0; // Mark as free
+        if (ext[i].len == 0 || ext[i].agbno < first || (uint64_t)ext[i].agbno + ext[i].len > agblocks) {
+            return -1;
         }
     }
     
-    // Update AGF metadata
-    agf.agf_freeblks += count;
-    
-    // Calculate the longest free space (simplified)
-    if (agf.agf_longest < count) {
-        agf.agf_longest = count;
+    // Lock the allocation group
+    if (ag_lock(ag_id) != 0) {
+        return -1;
     }
     
-    // Write the updated AGF back to disk
-    if (disk_write(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
+    xfs_perag_t *pag = perag_get(ag_id);
+    if (pag == NULL) {
         ag_unlock(ag_id);
         return -1;
     }
     
-    // Log this operation
-    trans_add_item(&agf, sizeof(xfs_agf_t));
+    // Shared blocks only lose an owner; the rest are freed
+    xfs_agext_t *unshared = NULL;
+    if (pag->agf.agf_refcount_root != 0) {
+        int nunshared = 0;
+        if (xfs_refcount_decrease_locked(ag_id, ext, count, &unshared, &nunshared) != 0) {
+            free(unshared);
+            ag_unlock(ag_id);
+            return -1;
+        }
+        ext = unshared;
+        count = nunshared;
+    }
+    
+    // Clear every extent's bits, counting only blocks that were in use
+    uint64_t freed = 0;
+    int ret = 0;
+    for (int i = 0; i < count && ret == 0; i++) {
+        freed += bm_count_used(pag->bitmap, ext[i].agbno, ext[i].len);
+        perag_set_range(pag, ext[i].agbno, ext[i].len, 0);
+        ret = perag_write_bitmap(ag_id, ext[i].agbno, ext[i].len);
+        if (pag->agf.agf_longest < ext[i].len) {
+            pag->agf.agf_longest = ext[i].len;
+        }
+    }
+    __atomic_store_n(&pag->agf.agf_freeblks, pag->agf.agf_freeblks + (uint32_t)freed, __ATOMIC_RELAXED);
+    
+    // One AGF update covers the whole batch; its LSN is when the blocks become reusable
+    if (ret == 0 && count > 0) {
+        ret = perag_write_agf(ag_id);
+    }
+    uint64_t lsn = trans_last_lsn();
+    for (int i = 0; i < count && ret == 0; i++) {
+        ret = perag_busy_insert(pag, ext[i].agbno, ext[i].len, lsn);
+    }
     
     // Unlock the allocation group
     ag_unlock(ag_id);
     
-    return 0; // Success
+    free(unshared);
+    
+    trace_xfs(XFS_TRACE_FREE_BATCH, ag_id, count, freed, lsn);
+    return ret;
+}
+
+// Free a batch of extents in one AG; the blocks stay busy until the free is on the log
+int xfs_free_extents(int ag_id, const xfs_agext_t *ext, int count) {
+    uint64_t start_ns = xfs_stats_now();
+    int ret = xfs_free_extents_internal(ag_id, ext, count);
+    xfs_stats_record(XFS_STAT_FREE, start_ns);
+    return ret;
+}
+
+// Allocate one block for AG metadata in an AG whose lock is held; returns the AG block or 0
+uint64_t xfs_alloc_ag_block(int ag_id) {
+    return xfs_alloc_blocks_locked(ag_id, 1, ag_first_data_block());
+}
+
+// Free one AG metadata block in an AG whose lock is held; it stays busy until the free is logged
+int xfs_free_ag_block(int ag_id, uint64_t agbno) {
+    xfs_perag_t *pag = perag_get(ag_id);
+    if (pag == NULL || agbno < ag_first_data_block() || agbno >= ag_blocks()) {
+        return -1;
+    }
+    
+    perag_set_range(pag, agbno, 1, 0);
+    __atomic_store_n(&pag->agf.agf_freeblks, pag->agf.agf_freeblks + 1, __ATOMIC_RELAXED);
+    if (perag_write(ag_id, agbno, 1) != 0) {
+        return -1;
+    }
+    return perag_busy_insert(pag, (uint32_t)agbno, 1, trans_last_lsn());
+}
+
+// Get the in-core AGF of an AG whose lock is held, loading it on first use
+xfs_agf_t *xfs_alloc_get_agf(int ag_id) {
+    xfs_perag_t *pag = perag_get(ag_id);
+    return pag != NULL ? &pag->agf : NULL;
+}
+
+// Write back and log the in-core AGF of an AG whose lock is held
+int xfs_alloc_log_agf(int ag_id) {
+    return perag_get(ag_id) != NULL ? perag_write_agf(ag_id) : -1;
+}
+
+// Write an empty free space bitmap for an AG (only the header and bitmap blocks in use)
+int xfs_ag_init_bitmap(int ag_id) {
+    uint64_t bm_offset = ag_block_offset(ag_id, XFS_AG_BITMAP_BLOCK);
+    size_t resv_words = (ag_first_data_block() + 63) / 64;
+    
+    // Zeroing the bitmap releases its disk memory, so only the words holding reserved bits are written
+    if (disk_zero(bm_offset, bm_words() * sizeof(uint64_t)) != 0) {
+        return -1;
+    }
+    
+    uint64_t *resv = (uint64_t *)calloc(resv_words, sizeof(uint64_t));
+    if (resv == NULL) {
+        return -1;
+    }
+    
+    // Reserve the header and bitmap blocks (0 = free, 1 = used)
+    bm_set_range(resv, 0, ag_first_data_block(), 1);
+    int ret = disk_write(bm_offset, resv, resv_words * sizeof(uint64_t));
+    free(resv);
+    
+    return ret;
 }
 
-// Initialize the allocator for an AG - mark all blocks as free initially
+// Initialize the allocator for an AG - mark all blocks but the headers and bitmap free
 int xfs_ag_init_alloc(int ag_id) {
     // Lock the allocation group
     if (ag_lock(ag_id) != 0) {
         return -1;
     }
     
-    // Get the AG's free space information
     xfs_agf_t agf;
-    uint64_t ag_offset = ag_get_offset(ag_id);
     
     // Read the current AGF from disk
-    if (disk_read(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
+    if (ag_read_agf(ag_id, &agf) != 0) {
         ag_unlock(ag_id);
         return -1;
     }
     
-    // Initialize all blocks as free (0 = free, 1 = used)
-    // Reserve first 2 blocks for AGF and AGI
-    for (int i = 0; i < 2; i++) {
-        agf.free_blocks[i] = 1; // Mark as used (reserved)
-    }
-    for (int i = 2; i < 2400; i++) {
-        agf.free_blocks[i] = 0; // Mark as free
-    }
-    
     // Update AGF metadata
-    agf.agf_freeblks = 2400 - 2; // All blocks except reserved ones
+    agf.agf_freeblks = ag_blocks() - ag_first_data_block(); // All blocks except reserved ones
     agf.agf_longest = agf.agf_freeblks;
+    agf.agf_refcount_root = 0;  // An empty AG shares nothing
+    agf.agf_refcount_level = 0;
     
-    // Write the updated AGF back to disk
-    if (disk_write(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
+    // Write the bitmap and the updated AGF back to disk
+    if (xfs_ag_init_bitmap(ag_id) != 0 ||
+        ag_write_agf(ag_id, &agf) != 0) {
         ag_unlock(ag_id);
         return -1;
     }
     
+    // Reload the in-core state if this AG was already loaded; nothing is busy in an empty AG
+    int ret = 0;
+    if (ag_id < perag_count && perag[ag_id].loaded) {
+        perag[ag_id].busy_count = 0;
+        ret = perag_load(ag_id);
+    }
+    
     // Unlock the allocation group
     ag_unlock(ag_id);
     
-    return 0; // Success
+    return ret;
+}
+
+// Load one AG's in-core state under its lock
+static int perag_load_locked(int ag_id, void *arg) {
+    (void)arg;
+    if (ag_lock(ag_id) != 0) {
+        return -1;
+    }
+    int ret = perag_get(ag_id) != NULL ? 0 : -1;
+    ag_unlock(ag_id);
+    return ret;
+}
+
+// Set up the in-core free space state; with eager set every AG is loaded
+// now (in parallel), otherwise each AG is loaded on its first allocation
+int xfs_alloc_mount(int eager) {
+    xfs_alloc_unmount();
+    
+    int agcount = ag_count();
+    void *pags;
+    if (posix_memalign(&pags, sizeof(xfs_perag_t), (size_t)agcount * sizeof(xfs_perag_t)) != 0) {
+        return -1;
+    }
+    memset(pags, 0, (size_t)agcount * sizeof(xfs_perag_t));
+    perag = (xfs_perag_t *)pags;
+    perag_count = agcount;
+    
+    if (eager && ag_foreach_parallel(perag_load_locked, NULL, 0) != 0) {
+        xfs_alloc_unmount();
+        return -1;
+    }
+    
+    return 0;
+}
+
+static void pool_drain_all(void);
+
+// Release the in-core free space state, returning pooled blocks to their AGs first
+void xfs_alloc_unmount(void) {
+    pool_drain_all();
+    for (int i = 0; i < perag_count; i++) {
+        free(perag[i].bitmap);
+        free(perag[i].busy);
+    }
+    free(perag);
+    perag = NULL;
+    perag_count = 0;
+    busy_lsn = 0;
+}
+
+// Number of AGs whose in-core free space state is loaded
+int xfs_alloc_loaded_ags(void) {
+    int loaded = 0;
+    for (int i = 0; i < perag_count; i++) {
+        loaded += __atomic_load_n(&perag[i].loaded, __ATOMIC_ACQUIRE);
+    }
+    return loaded;
+}
+
+// Count the used blocks in an AG's on-disk bitmap
+int64_t xfs_alloc_count_used(int ag_id) {
+    if (ag_id < 0 || ag_id >= ag_count()) {
+        return -1;
+    }
+    
+    size_t bm_bytes = bm_words() * sizeof(uint64_t);
+    uint64_t *bm = (uint64_t *)malloc(bm_bytes);
+    if (bm == NULL) {
+        return -1;
+    }
+    
+    int64_t used = -1;
+    if (disk_read(ag_block_offset(ag_id, XFS_AG_BITMAP_BLOCK), bm, bm_bytes) == 0) {
+        used = (int64_t)bm_count_used(bm, 0, ag_blocks());
+    }
+    free(bm);
+    return used;
+}
+
+// Add one free extent of len blocks to a histogram
+void xfs_freesp_add(xfs_freesp_t *fs, uint64_t len) {
+    int b = 63 - __builtin_clzll(len);
+    if (b >= XFS_FREESP_BUCKETS) {
+        b = XFS_FREESP_BUCKETS - 1;
+    }
+    fs->extents[b]++;
+    fs->blocks[b] += len;
+    fs->total_extents++;
+    fs->total_blocks += len;
+    if (len > fs->longest) {
+        fs->longest = len;
+    }
+}
+
+// Histogram of an AG's free extents. A loaded AG's bitmap is copied under
+// the AG lock and scanned after it is dropped; otherwise the on-disk bitmap
+// is scanned without loading the AG.
+int xfs_alloc_freesp(int ag_id, xfs_freesp_t *fs) {
+    if (ag_id < 0 || ag_id >= perag_count || fs == NULL) {
+        return -1;
+    }
+    memset(fs, 0, sizeof(*fs));
+    
+    size_t bm_bytes = bm_words() * sizeof(uint64_t);
+    uint64_t *bm = (uint64_t *)malloc(bm_bytes);
+    if (bm == NULL) {
+        return -1;
+    }
+    
+    int ret = 0;
+    if (ag_lock(ag_id) != 0) {
+        free(bm);
+        return -1;
+    }
+    if (perag[ag_id].loaded) {
+        memcpy(bm, perag[ag_id].bitmap, bm_bytes);
+        ag_unlock(ag_id);
+    } else {
+        ag_unlock(ag_id);
+        ret = disk_read(ag_block_offset(ag_id, XFS_AG_BITMAP_BLOCK), bm, bm_bytes);
+    }
+    if (ret == 0) {
+        bm_freesp(bm, ag_blocks(), fs);
+    }
+    free(bm);
+    return ret;
+}
+
+static int freesp_ag_task(int ag_id, void *arg) {
+    return xfs_alloc_freesp(ag_id, &((xfs_freesp_t *)arg)[ag_id]);
+}
+
+// Histogram of every AG, scanned in parallel and summed into total; per_ag may be NULL
+int xfs_alloc_freesp_all(xfs_freesp_t *total, xfs_freesp_t *per_ag) {
+    if (total == NULL || perag_count == 0) {
+        return -1;
+    }
+    xfs_freesp_t *ags = per_ag != NULL ? per_ag : (xfs_freesp_t *)calloc(perag_count, sizeof(xfs_freesp_t));
+    if (ags == NULL) {
+        return -1;
+    }
+    
+    int ret = ag_foreach_parallel(freesp_ag_task, ags, 0);
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < perag_count && ret == 0; i++) {
+        for (int b = 0; b < XFS_FREESP_BUCKETS; b++) {
+            total->extents[b] += ags[i].extents[b];
+            total->blocks[b] += ags[i].blocks[b];
+        }
+        total->total_extents += ags[i].total_extents;
+        total->total_blocks += ags[i].total_blocks;
+        if (ags[i].longest > total->longest) {
+            total->longest = ags[i].longest;
+        }
+    }
+    
+    if (per_ag == NULL) {
+        free(ags);
+    }
+    return ret;
+}
+
+// Free extents in a loaded AG, from the count kept on every allocation and free
+int64_t xfs_alloc_free_extents(int ag_id) {
+    if (ag_id < 0 || ag_id >= perag_count || ag_lock(ag_id) != 0) {
+        return -1;
+    }
+    int64_t count = perag[ag_id].loaded ? (int64_t)perag[ag_id].free_extents : -1;
+    ag_unlock(ag_id);
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// AG selection policies for file data
+// ---------------------------------------------------------------------------
+
+// A policy names the AG a file's next blocks should come from. 'sticky' asks
+// the allocator to wait for that AG's lock rather than fall back to another AG.
+// 'pooled' policies let small allocations come from per-thread pools.
+typedef struct {
+    const char *name;
+    int (*pick_ag)(xfs_inode_t *ip, uint64_t logical_block, uint64_t *agbno_hint, int *sticky);
+    int pooled;
+} xfs_ag_policy_t;
+
+// Legacy policy: stripe logical blocks across AGs
+static int ag_policy_stripe(xfs_inode_t *ip, uint64_t logical_block, uint64_t *agbno_hint, int *sticky) {
+    (void)ip;
+    *agbno_hint = ag_first_data_block();
+    *sticky = 1;
+    return (int)(logical_block % ag_count());
+}
+
+// Locality policy: continue the extent that ends at logical_block, else the
+// file's most recent extent, else the inode's home AG. Files with data stay
+// in their AG; new files fall back to whichever AG is free and uncontended.
+// With NUMA affinity on, the home AG is one of the calling thread's node.
+static int ag_policy_locality(xfs_inode_t *ip, uint64_t logical_block, uint64_t *agbno_hint, int *sticky) {
+    xfs_extent_t *prev = NULL;
+    for (int i = 0; i < ip->extent_count; i++) {
+        if (ip->extents[i].start_off + ip->extents[i].block_count == logical_block) {
+            prev = &ip->extents[i];
+            break;
+        }
+    }
+    if (prev == NULL && ip->extent_count > 0) {
+        prev = &ip->extents[ip->extent_count - 1];
+    }
+
+    if (prev != NULL) {
+        uint64_t next_fsb = prev->start_block + prev->block_count;
+        *agbno_hint = ag_fsb_to_agbno(next_fsb);
+        *sticky = 1;
+        return ag_fsb_to_agno(prev->start_block);
+    }
+
+    *agbno_hint = ag_first_data_block();
+    *sticky = 0;
+    if (xfs_numa_get_affinity()) {
+        int first, count;
+        ag_node_ags(xfs_numa_current_node(), &first, &count);
+        return first + (int)(ip->inode_num % (uint32_t)count);
+    }
+    return (int)(ip->inode_num % ag_count());
+}
+
+static const xfs_ag_policy_t ag_policies[] = {
+    { "locality", ag_policy_locality, 1 },
+    { "stripe",   ag_policy_stripe,   0 },  // Striping would cycle a pool through every AG
+};
+
+#define NUM_AG_POLICIES (int)(sizeof(ag_policies) / sizeof(ag_policies[0]))
+
+static const xfs_ag_policy_t *ag_policy = &ag_policies[0];
+
+// Select the AG selection policy by name
+int xfs_alloc_set_policy(const char *name) {
+    for (int i = 0; i < NUM_AG_POLICIES; i++) {
+        if (strcmp(ag_policies[i].name, name) == 0) {
+            ag_policy = &ag_policies[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Get the name of the current AG selection policy
+const char *xfs_alloc_get_policy(void) {
+    return ag_policy->name;
+}
+
+// Try one AG; returns the AG-relative block or 0. With trylock set, a contended AG is skipped.
+static uint64_t alloc_try_ag(int ag_id, int count, uint64_t agbno_hint, int trylock) {
+    // AGs that are not loaded yet have no cached free count; they are tried anyway
+    if (ag_id < 0 || ag_id >= perag_count ||
+        (__atomic_load_n(&perag[ag_id].loaded, __ATOMIC_ACQUIRE) &&
+         __atomic_load_n(&perag[ag_id].agf.agf_freeblks, __ATOMIC_RELAXED) < (uint32_t)count)) {
+        return 0;
+    }
+
+    if (trylock) {
+        if (ag_trylock(ag_id) != 0) {
+            return 0;
+        }
+    } else if (ag_lock(ag_id) != 0) {
+        return 0;
+    }
+
+    uint64_t agbno = xfs_alloc_blocks_locked(ag_id, count, agbno_hint);
+    ag_unlock(ag_id);
+    return agbno;
+}
+
+// ---------------------------------------------------------------------------
+// Per-thread allocation pools
+// ---------------------------------------------------------------------------
+
+// Each thread keeps a small magazine of free runs carved out of AGs in bulk,
+// so small file allocations are served without taking an AG lock or touching
+// the AGF. Pooled blocks are marked used on disk, so nothing else can take
+// them; they go back to their AG when the pool evicts a run, when an
+// allocation would otherwise fail for lack of space, at thread exit and at
+// unmount. Each pool's 'held' count is its per-thread share of the free
+// space; xfs_alloc_pool_blocks() folds them on demand.
+#define XFS_POOL_RUNS      4    // Runs cached per thread
+#define XFS_POOL_REFILL    256  // Blocks carved from an AG per refill
+#define XFS_POOL_MAX_ALLOC 16   // Larger requests go straight to the AGs
+
+typedef struct {
+    int ag;
+    uint32_t agbno;
+    uint32_t len;
+} xfs_pool_run_t;
+
+// The lock is only contended when another thread drains every pool
+typedef struct xfs_pool {
+    pthread_mutex_t lock;
+    xfs_pool_run_t runs[XFS_POOL_RUNS];
+    int nruns;
+    uint64_t held;                 // Blocks in runs (read without the lock when folding)
+    int active;                    // Owned by a live thread
+    struct xfs_pool *next;         // Registry link
+} __attribute__((aligned(64))) xfs_pool_t;
+
+static int pools_enabled = 1;
+static xfs_pool_t *pools = NULL;
+static pthread_mutex_t pool_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static __thread xfs_pool_t *pool = NULL;
+
+// Hand a run back to its AG; the blocks were never given to a file, so they are not busy
+static void pool_return_run(xfs_pool_t *p, int i) {
+    xfs_pool_run_t *r = &p->runs[i];
+    
+    if (r->ag < perag_count && ag_lock(r->ag) == 0) {
+        xfs_perag_t *pag = perag_get(r->ag);
+        if (pag != NULL) {
+            perag_set_range(pag, r->agbno, r->len, 0);
+            __atomic_store_n(&pag->agf.agf_freeblks, pag->agf.agf_freeblks + r->len, __ATOMIC_RELAXED);
+            if (pag->agf.agf_longest < r->len) {
+                pag->agf.agf_longest = r->len;
+            }
+            perag_write(r->ag, r->agbno, r->len);
+        }
+        ag_unlock(r->ag);
+    }
+    
+    __atomic_store_n(&p->held, p->held - r->len, __ATOMIC_RELAXED);
+    p->runs[i] = p->runs[--p->nruns];
+}
+
+// Return every run in a pool (caller holds the pool lock)
+static void pool_drain(xfs_pool_t *p) {
+    while (p->nruns > 0) {
+        pool_return_run(p, p->nruns - 1);
+    }
+}
+
+// Return every thread's pooled blocks to their AGs
+static void pool_drain_all(void) {
+    pthread_mutex_lock(&pool_registry_lock);
+    for (xfs_pool_t *p = pools; p != NULL; p = p->next) {
+        pthread_mutex_lock(&p->lock);
+        pool_drain(p);
+        pthread_mutex_unlock(&p->lock);
+    }
+    pthread_mutex_unlock(&pool_registry_lock);
+}
+
+// Drain the pool and hand it back to the registry when its thread exits
+static void pool_release(void *arg) {
+    xfs_pool_t *p = (xfs_pool_t *)arg;
+    pthread_mutex_lock(&p->lock);
+    pool_drain(p);
+    pthread_mutex_unlock(&p->lock);
+    __atomic_store_n(&p->active, 0, __ATOMIC_RELEASE);
+}
+
+static void pool_key_init(void) {
+    pthread_key_create(&pool_key, pool_release);
+}
+
+// Attach a pool to the calling thread, reusing one left by an exited thread
+static xfs_pool_t *pool_get(void) {
+    if (pool != NULL) {
+        return pool;
+    }
+    pthread_once(&pool_key_once, pool_key_init);
+    
+    pthread_mutex_lock(&pool_registry_lock);
+    xfs_pool_t *p = pools;
+    while (p != NULL && __atomic_load_n(&p->active, __ATOMIC_ACQUIRE)) {
+        p = p->next;
+    }
+    
+    if (p == NULL) {
+        void *mem = NULL;
+        if (posix_memalign(&mem, 64, sizeof(xfs_pool_t)) != 0) {
+            pthread_mutex_unlock(&pool_registry_lock);
+            return NULL;
+        }
+        p = (xfs_pool_t *)mem;
+        memset(p, 0, sizeof(xfs_pool_t));
+        pthread_mutex_init(&p->lock, NULL);
+        p->next = pools;
+        pools = p;
+    }
+    
+    p->active = 1;
+    pthread_mutex_unlock(&pool_registry_lock);
+    
+    pthread_setspecific(pool_key, p);
+    return pool = p;
+}
+
+// Carve a run for the pool out of an AG under one lock hold; returns the run index or -1
+static int pool_refill(xfs_pool_t *p, int ag_id, uint64_t agbno_hint) {
+    // Evict the smallest run to make room
+    if (p->nruns == XFS_POOL_RUNS) {
+        int victim = 0;
+        for (int i = 1; i < p->nruns; i++) {
+            if (p->runs[i].len < p->runs[victim].len) {
+                victim = i;
+            }
+        }
+        pool_return_run(p, victim);
+    }
+    
+    uint64_t agbno = alloc_try_ag(ag_id, XFS_POOL_REFILL, agbno_hint, 0);
+    if (agbno == 0) {
+        return -1;
+    }
+    
+    xfs_pool_run_t *r = &p->runs[p->nruns];
+    r->ag = ag_id;
+    r->agbno = (uint32_t)agbno;
+    r->len = XFS_POOL_REFILL;
+    __atomic_store_n(&p->held, p->held + XFS_POOL_REFILL, __ATOMIC_RELAXED);
+    return p->nruns++;
+}
+
+// Serve a small allocation in ag_id from the calling thread's pool, preferring
+// the run that continues at agbno_hint; returns the AG-relative block or 0
+static uint64_t pool_alloc(int ag_id, int count, uint64_t agbno_hint) {
+    xfs_pool_t *p = pool_get();
+    if (p == NULL) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&p->lock);
+    int best = -1;
+    for (int i = 0; i < p->nruns; i++) {
+        xfs_pool_run_t *r = &p->runs[i];
+        if (r->ag != ag_id || r->len < (uint32_t)count) {
+            continue;
+        }
+        if (r->agbno == agbno_hint) {
+            best = i;
+            break;
+        }
+        if (best < 0) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        best = pool_refill(p, ag_id, agbno_hint);
+    }
+    
+    uint64_t agbno = 0;
+    if (best >= 0) {
+        xfs_pool_run_t *r = &p->runs[best];
+        agbno = r->agbno;
+        r->agbno += count;
+        r->len -= count;
+        __atomic_store_n(&p->held, p->held - count, __ATOMIC_RELAXED);
+        if (r->len == 0) {
+            p->runs[best] = p->runs[--p->nruns];
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return agbno;
+}
+
+// Enable or disable the per-thread allocation pools; disabling drains them
+void xfs_alloc_set_pools(int enable) {
+    __atomic_store_n(&pools_enabled, enable != 0, __ATOMIC_RELAXED);
+    if (!enable) {
+        pool_drain_all();
+    }
+}
+
+// Whether small file allocations are served from per-thread pools
+int xfs_alloc_get_pools(void) {
+    return __atomic_load_n(&pools_enabled, __ATOMIC_RELAXED);
+}
+
+// Blocks held in per-thread pools, folded across every thread
+uint64_t xfs_alloc_pool_blocks(void) {
+    uint64_t held = 0;
+    pthread_mutex_lock(&pool_registry_lock);
+    for (xfs_pool_t *p = pools; p != NULL; p = p->next) {
+        held += __atomic_load_n(&p->held, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pool_registry_lock);
+    return held;
+}
+
+// Whether some freed extent stays busy until the log is flushed further
+int xfs_alloc_busy_pending(void) {
+    return __atomic_load_n(&busy_lsn, __ATOMIC_RELAXED) > trans_flushed_lsn();
+}
+
+// One pass over the AGs for a file allocation: the policy's AG first, then the rest
+static int alloc_file_blocks_pass(xfs_inode_t *ip, uint64_t logical_block, int count, uint64_t *fsbno) {
+    uint64_t agbno_hint;
+    int sticky;
+    int pref = ag_policy->pick_ag(ip, logical_block, &agbno_hint, &sticky);
+    int ret = -1;
+
+    // Small allocations in the preferred AG come from this thread's pool
+    if (count <= XFS_POOL_MAX_ALLOC && ag_policy->pooled && __atomic_load_n(&pools_enabled, __ATOMIC_RELAXED)) {
+        uint64_t agbno = pool_alloc(pref, count, agbno_hint);
+        if (agbno != 0) {
+            *fsbno = ag_fsb(pref, agbno);
+            return 0;
+        }
+    }
+
+    // Preferred AG first: wait for it if the policy asks, otherwise only if it is free
+    uint64_t agbno = alloc_try_ag(pref, count, agbno_hint, !sticky);
+    if (agbno != 0) {
+        *fsbno = ag_fsb(pref, agbno);
+        ret = 0;
+    }
+
+    // Fall back through the other AGs from the rotor: uncontended AGs first, then any AG.
+    // With NUMA affinity on, uncontended AGs of the caller's node come before all of those.
+    unsigned int rotor = __atomic_fetch_add(&ag_rotor, 1, __ATOMIC_RELAXED);
+    if (ret != 0 && xfs_numa_get_affinity()) {
+        int node_first, node_ags;
+        ag_node_ags(xfs_numa_current_node(), &node_first, &node_ags);
+        for (int i = 0; i < node_ags && ret != 0; i++) {
+            int ag_id = node_first + (int)((rotor + i) % (unsigned int)node_ags);
+            if (ag_id == pref) {
+                continue;
+            }
+            agbno = alloc_try_ag(ag_id, count, ag_first_data_block(), 1);
+            if (agbno != 0) {
+                *fsbno = ag_fsb(ag_id, agbno);
+                ret = 0;
+            }
+        }
+    }
+    for (int pass = 0; pass < 2 && ret != 0; pass++) {
+        for (int i = 0; i < perag_count && ret != 0; i++) {
+            int ag_id = (int)((rotor + i) % perag_count);
+            if (ag_id == pref && (sticky || pass == 0)) {
+                continue;
+            }
+            agbno = alloc_try_ag(ag_id, count, ag_first_data_block(), pass == 0);
+            if (agbno != 0) {
+                *fsbno = ag_fsb(ag_id, agbno);
+                ret = 0;
+            }
+        }
+    }
+    return ret;
+}
+
+// Allocate blocks for a file's logical_block using the current policy (caller holds the ILOCK)
+int xfs_alloc_file_blocks(xfs_inode_t *ip, uint64_t logical_block, int count, uint64_t *fsbno) {
+    if (perag_count == 0) {
+        return -1; // Not mounted
+    }
+    
+    uint64_t start_ns = xfs_stats_now();
+    int ret = alloc_file_blocks_pass(ip, logical_block, count, fsbno);
+    
+    // Space may only be pooled: return every pool's blocks and retry once.
+    // Busy space is left to the caller, which can force the log without
+    // holding the ILOCK (see xfs_alloc_busy_pending)
+    if (ret != 0 && xfs_alloc_pool_blocks() > 0) {
+        pool_drain_all();
+        ret = alloc_file_blocks_pass(ip, logical_block, count, fsbno);
+    }
+
+    xfs_stats_record(XFS_STAT_ALLOC, start_ns);
+    return ret;
 }
\ No newline at end of file
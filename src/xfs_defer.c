@@ -0,0 +1,168 @@
+#include "../include/xfs_defer.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_workq.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Freeing blocks is split from the change that unmapped them, as in XFS:
+// the unmap logs an extent free intent (EFI) naming every extent, the
+// extents are then freed in one batch per AG (one AG lock hold and one AGF
+// update each; batches of different AGs run in parallel on the background
+// pool), and an extent free done item (EFD) closes the intent. Log
+// recovery would replay any EFI without an EFD. The freed blocks stay busy
+// in the allocator until their AGF update is on the log.
+
+#define XFS_LI_EFI 0x1236  // Extent free intent log item
+#define XFS_LI_EFD 0x1237  // Extent free done log item
+
+// Log item header shared by the EFI and the EFD; an EFI is followed by its extents
+typedef struct {
+    uint16_t type;
+    uint16_t pad;
+    uint32_t nextents;
+    uint64_t id;       // Pairs an EFD with its EFI
+} xfs_efi_log_t;
+
+static uint64_t efi_next_id = 0;
+
+// Start an empty list of deferred frees
+void xfs_defer_init(xfs_defer_t *dfops) {
+    dfops->extents = NULL;
+    dfops->count = 0;
+    dfops->cap = 0;
+}
+
+// Queue an extent to be freed when the transaction finishes
+int xfs_defer_add_free(xfs_defer_t *dfops, uint64_t fsb, uint64_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+    if (dfops->count == dfops->cap) {
+        int new_cap = dfops->cap ? dfops->cap * 2 : 16;
+        xfs_defer_extent_t *p = (xfs_defer_extent_t *)realloc(dfops->extents, new_cap * sizeof(xfs_defer_extent_t));
+        if (p == NULL) {
+            return -1;
+        }
+        dfops->extents = p;
+        dfops->cap = new_cap;
+    }
+
+    dfops->extents[dfops->count].fsb = fsb;
+    dfops->extents[dfops->count].len = len;
+    dfops->count++;
+    return 0;
+}
+
+static int defer_cmp_fsb(const void *a, const void *b) {
+    const xfs_defer_extent_t *x = (const xfs_defer_extent_t *)a;
+    const xfs_defer_extent_t *y = (const xfs_defer_extent_t *)b;
+    return (x->fsb > y->fsb) - (x->fsb < y->fsb);
+}
+
+// Log an EFI or EFD item
+static int defer_log_item(uint16_t type, uint64_t id, const xfs_defer_extent_t *extents, int count) {
+    size_t ext_bytes = extents != NULL ? count * sizeof(xfs_defer_extent_t) : 0;
+    size_t len = sizeof(xfs_efi_log_t) + ext_bytes;
+    char *item = (char *)malloc(len);
+    if (item == NULL) {
+        return -1;
+    }
+
+    xfs_efi_log_t hdr = { type, 0, (uint32_t)count, id };
+    memcpy(item, &hdr, sizeof(hdr));
+    if (ext_bytes > 0) {
+        memcpy(item + sizeof(hdr), extents, ext_bytes);
+    }
+    int ret = trans_add_item(item, (int)len);
+    free(item);
+    return ret;
+}
+
+// One AG's share of a finished list
+typedef struct {
+    xfs_work_t work;
+    int ag_id;
+    xfs_agext_t *ext;
+    int count;
+    int *failed;
+} defer_batch_t;
+
+static void defer_free_batch(void *arg) {
+    defer_batch_t *b = (defer_batch_t *)arg;
+    if (xfs_free_extents(b->ag_id, b->ext, b->count) != 0) {
+        __atomic_store_n(b->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Log the intent, free the extents in one batch per AG, then log the done item
+int xfs_defer_finish(xfs_defer_t *dfops) {
+    if (dfops->count == 0) {
+        xfs_defer_cancel(dfops);
+        return 0;
+    }
+
+    uint64_t id = __atomic_add_fetch(&efi_next_id, 1, __ATOMIC_RELAXED);
+    if (defer_log_item(XFS_LI_EFI, id, dfops->extents, dfops->count) != 0) {
+        xfs_defer_cancel(dfops);
+        return -1;
+    }
+
+    // Sorting groups each AG's extents together, in AG block order
+    qsort(dfops->extents, dfops->count, sizeof(xfs_defer_extent_t), defer_cmp_fsb);
+
+    xfs_agext_t *ext = (xfs_agext_t *)malloc(dfops->count * sizeof(xfs_agext_t));
+    defer_batch_t *batches = (defer_batch_t *)malloc(dfops->count * sizeof(defer_batch_t));
+    if (ext == NULL || batches == NULL) {
+        free(ext);
+        free(batches);
+        xfs_defer_cancel(dfops);
+        return -1;
+    }
+
+    int failed = 0;
+    int nbatches = 0;
+    for (int i = 0; i < dfops->count; ) {
+        defer_batch_t *b = &batches[nbatches++];
+        b->ag_id = ag_fsb_to_agno(dfops->extents[i].fsb);
+        b->ext = &ext[i];
+        b->count = 0;
+        b->failed = &failed;
+        while (i < dfops->count && ag_fsb_to_agno(dfops->extents[i].fsb) == b->ag_id) {
+            ext[i].agbno = ag_fsb_to_agbno(dfops->extents[i].fsb);
+            ext[i].len = (uint32_t)dfops->extents[i].len;
+            b->count++;
+            i++;
+        }
+    }
+
+    // Every batch but the first goes to the pool; the caller frees the first and then helps
+    xfs_work_group_t group;
+    xfs_work_group_init(&group);
+    for (int i = 1; i < nbatches; i++) {
+        if (xfs_workq_queue_group(&group, &batches[i].work, XFS_WORK_FREE, defer_free_batch, &batches[i]) != 0) {
+            defer_free_batch(&batches[i]);
+        }
+    }
+    defer_free_batch(&batches[0]);
+    xfs_work_group_wait(&group);
+    free(batches);
+    free(ext);
+    int ret = failed ? -1 : 0;
+
+    // Without the done item the intent stays open in the log and would be replayed
+    if (ret == 0) {
+        ret = defer_log_item(XFS_LI_EFD, id, NULL, dfops->count);
+    }
+
+    xfs_defer_cancel(dfops);
+    return ret;
+}
+
+// Drop the queued extents without freeing them
+void xfs_defer_cancel(xfs_defer_t *dfops) {
+    free(dfops->extents);
+    xfs_defer_init(dfops);
+}
@@ -2,28 +2,97 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
-static uint8_t *DISK_MEMORY = NULL;
+// The disk is sparse: it is split into fixed-size chunks that are allocated
+// on first write and found through a two-level table (directory -> chunk
+// table -> chunk). Reads of chunks that were never written return zeros, so
+// a freshly formatted disk only costs the memory its metadata touches.
+// Tables and chunks are published with compare-and-swap; concurrent writers
+// racing to materialize the same slot keep the winner's allocation.
+// A disk loaded from an image may instead point its chunks into a private
+// mapping of the image file; writes then copy only the pages they touch.
+#define DISK_CHUNK_SHIFT 16                          // 64KB chunks
+#define DISK_CHUNK_SIZE  (1ull << DISK_CHUNK_SHIFT)
+#define DISK_TABLE_SHIFT 9                           // 512 chunks (32MB) per table
+#define DISK_TABLE_SIZE  (1ull << DISK_TABLE_SHIFT)
+
+typedef struct {
+    uint8_t *chunks[DISK_TABLE_SIZE];
+} disk_table_t;
+
+static disk_table_t **DISK_DIR = NULL;  // Top level: one slot per chunk table
+static size_t DISK_DIR_SIZE = 0;
 static size_t DISK_SIZE = 0;
+static uint64_t disk_chunk_count = 0;   // Materialized chunks
+static uint64_t disk_table_count = 0;   // Materialized chunk tables
+static uint8_t *disk_map = NULL;        // Image mapping that adopted chunks live in
+static size_t disk_map_len = 0;
+
+// Whether a chunk lives in the image mapping rather than its own allocation
+static int disk_chunk_mapped(const uint8_t *data) {
+    return disk_map != NULL && data >= disk_map && data < disk_map + disk_map_len;
+}
 
 int disk_init(size_t size) {
-    if (DISK_MEMORY != NULL) {
-        free(DISK_MEMORY);
-    }
+    disk_destroy();
+    
+    uint64_t nchunks = (size + DISK_CHUNK_SIZE - 1) >> DISK_CHUNK_SHIFT;
+    size_t dir_size = (size_t)((nchunks + DISK_TABLE_SIZE - 1) >> DISK_TABLE_SHIFT);
     
-    DISK_MEMORY = (uint8_t *)malloc(size);
-    if (DISK_MEMORY == NULL) {
+    DISK_DIR = (disk_table_t **)calloc(dir_size ? dir_size : 1, sizeof(disk_table_t *));
+    if (DISK_DIR == NULL) {
         return -1;
     }
     
+    DISK_DIR_SIZE = dir_size;
     DISK_SIZE = size;
-    memset(DISK_MEMORY, 0, size);
     
     return 0;
 }
 
+// Look up the chunk holding a disk offset; with create set, materialize it (and its table)
+static uint8_t *disk_chunk(uint64_t offset, int create) {
+    uint64_t chunk = offset >> DISK_CHUNK_SHIFT;
+    disk_table_t **tslot = &DISK_DIR[chunk >> DISK_TABLE_SHIFT];
+    
+    disk_table_t *table = __atomic_load_n(tslot, __ATOMIC_ACQUIRE);
+    if (table == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        disk_table_t *fresh = (disk_table_t *)calloc(1, sizeof(disk_table_t));
+        if (fresh == NULL) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(tslot, &table, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            table = fresh;
+            __atomic_fetch_add(&disk_table_count, 1, __ATOMIC_RELAXED);
+        } else {
+            free(fresh);  // Another writer installed the table first
+        }
+    }
+    
+    uint8_t **cslot = &table->chunks[chunk & (DISK_TABLE_SIZE - 1)];
+    uint8_t *data = __atomic_load_n(cslot, __ATOMIC_ACQUIRE);
+    if (data == NULL && create) {
+        uint8_t *fresh = (uint8_t *)calloc(1, DISK_CHUNK_SIZE);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(cslot, &data, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            data = fresh;
+            __atomic_fetch_add(&disk_chunk_count, 1, __ATOMIC_RELAXED);
+        } else {
+            free(fresh);  // Another writer installed the chunk first
+        }
+    }
+    
+    return data;
+}
+
 int disk_read(uint64_t offset, void* buf, size_t len) {
-    if (DISK_MEMORY == NULL) {
+    if (DISK_DIR == NULL) {
         return -1;
     }
     
@@ -31,12 +100,27 @@ int disk_read(uint64_t offset, void* buf, size_t len) {
         return -1;  // Out of bounds
     }
     
-    memcpy(buf, DISK_MEMORY + offset, len);
+    uint8_t *dst = (uint8_t *)buf;
+    while (len > 0) {
+        uint64_t in_chunk = offset & (DISK_CHUNK_SIZE - 1);
+        size_t n = DISK_CHUNK_SIZE - in_chunk < len ? (size_t)(DISK_CHUNK_SIZE - in_chunk) : len;
+        
+        uint8_t *data = disk_chunk(offset, 0);
+        if (data != NULL) {
+            memcpy(dst, data + in_chunk, n);
+        } else {
+            memset(dst, 0, n);  // Never written
+        }
+        
+        dst += n;
+        offset += n;
+        len -= n;
+    }
     return 0;
 }
 
 int disk_write(uint64_t offset, void* buf, size_t len) {
-    if (DISK_MEMORY == NULL) {
+    if (DISK_DIR == NULL) {
         return -1;
     }
     
@@ -44,14 +128,163 @@ int disk_write(uint64_t offset, void* buf, size_t len) {
         return -1;  // Out of bounds
     }
     
-    memcpy(DISK_MEMORY + offset, buf, len);
+    const uint8_t *src = (const uint8_t *)buf;
+    while (len > 0) {
+        uint64_t in_chunk = offset & (DISK_CHUNK_SIZE - 1);
+        size_t n = DISK_CHUNK_SIZE - in_chunk < len ? (size_t)(DISK_CHUNK_SIZE - in_chunk) : len;
+        
+        uint8_t *data = disk_chunk(offset, 1);
+        if (data == NULL) {
+            return -1;  // Out of memory
+        }
+        memcpy(data + in_chunk, src, n);
+        
+        src += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Zero a range of the disk; chunks it covers completely are released
+int disk_zero(uint64_t offset, size_t len) {
+    if (DISK_DIR == NULL) {
+        return -1;
+    }
+    
+    if (offset + len > DISK_SIZE) {
+        return -1;  // Out of bounds
+    }
+    
+    while (len > 0) {
+        uint64_t in_chunk = offset & (DISK_CHUNK_SIZE - 1);
+        size_t n = DISK_CHUNK_SIZE - in_chunk < len ? (size_t)(DISK_CHUNK_SIZE - in_chunk) : len;
+        
+        uint8_t *data = disk_chunk(offset, 0);
+        if (data != NULL) {
+            if (n == DISK_CHUNK_SIZE) {
+                // Caller must not have I/O in flight to this range
+                uint64_t chunk = offset >> DISK_CHUNK_SHIFT;
+                DISK_DIR[chunk >> DISK_TABLE_SHIFT]->chunks[chunk & (DISK_TABLE_SIZE - 1)] = NULL;
+                __atomic_fetch_sub(&disk_chunk_count, 1, __ATOMIC_RELAXED);
+                if (!disk_chunk_mapped(data)) {
+                    free(data);
+                }
+            } else {
+                memset(data + in_chunk, 0, n);
+            }
+        }
+        
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Logical size of the disk in bytes
+uint64_t disk_size(void) {
+    return DISK_SIZE;
+}
+
+// Memory allocated (or mapped) for disk contents and chunk tables, in bytes
+uint64_t disk_resident_bytes(void) {
+    if (DISK_DIR == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(&disk_chunk_count, __ATOMIC_RELAXED) * DISK_CHUNK_SIZE +
+           __atomic_load_n(&disk_table_count, __ATOMIC_RELAXED) * sizeof(disk_table_t) +
+           DISK_DIR_SIZE * sizeof(disk_table_t *);
+}
+
+// Size of the chunks the disk is materialized in, in bytes
+uint64_t disk_chunk_size(void) {
+    return DISK_CHUNK_SIZE;
+}
+
+// Initialize an empty disk whose chunks may be adopted from an image mapping
+int disk_init_mapped(size_t size, void *map, size_t map_len) {
+    if (disk_init(size) != 0) {
+        return -1;
+    }
+    disk_map = (uint8_t *)map;
+    disk_map_len = map_len;
+    return 0;
+}
+
+// Make a chunk-aligned range of the disk read its contents from data in the image mapping
+int disk_adopt_chunk(uint64_t offset, void *data) {
+    if (DISK_DIR == NULL || (offset & (DISK_CHUNK_SIZE - 1)) != 0 || offset >= DISK_SIZE ||
+        !disk_chunk_mapped((uint8_t *)data) ||
+        (uint8_t *)data + DISK_CHUNK_SIZE > disk_map + disk_map_len) {
+        return -1;
+    }
+
+    uint64_t chunk = offset >> DISK_CHUNK_SHIFT;
+    disk_table_t **tslot = &DISK_DIR[chunk >> DISK_TABLE_SHIFT];
+    if (*tslot == NULL) {
+        *tslot = (disk_table_t *)calloc(1, sizeof(disk_table_t));
+        if (*tslot == NULL) {
+            return -1;
+        }
+        disk_table_count++;
+    }
+    uint8_t **cslot = &(*tslot)->chunks[chunk & (DISK_TABLE_SIZE - 1)];
+    if (*cslot != NULL) {
+        return -1;
+    }
+    *cslot = (uint8_t *)data;
+    disk_chunk_count++;
+    return 0;
+}
+
+// Call fn for every materialized chunk in offset order, stopping at the first nonzero return
+int disk_foreach_chunk(int (*fn)(uint64_t offset, const void *data, void *arg), void *arg) {
+    if (DISK_DIR == NULL) {
+        return -1;
+    }
+    for (size_t t = 0; t < DISK_DIR_SIZE; t++) {
+        disk_table_t *table = __atomic_load_n(&DISK_DIR[t], __ATOMIC_ACQUIRE);
+        if (table == NULL) {
+            continue;
+        }
+        for (size_t c = 0; c < DISK_TABLE_SIZE; c++) {
+            uint8_t *data = __atomic_load_n(&table->chunks[c], __ATOMIC_ACQUIRE);
+            if (data != NULL) {
+                int ret = fn(((uint64_t)t << (DISK_TABLE_SHIFT + DISK_CHUNK_SHIFT)) |
+                             ((uint64_t)c << DISK_CHUNK_SHIFT), data, arg);
+                if (ret != 0) {
+                    return ret;
+                }
+            }
+        }
+    }
     return 0;
 }
 
 void disk_destroy(void) {
-    if (DISK_MEMORY != NULL) {
-        free(DISK_MEMORY);
-        DISK_MEMORY = NULL;
+    if (DISK_DIR != NULL) {
+        for (size_t t = 0; t < DISK_DIR_SIZE; t++) {
+            disk_table_t *table = DISK_DIR[t];
+            if (table == NULL) {
+                continue;
+            }
+            for (size_t c = 0; c < DISK_TABLE_SIZE; c++) {
+                if (!disk_chunk_mapped(table->chunks[c])) {
+                    free(table->chunks[c]);
+                }
+            }
+            free(table);
+        }
+        free(DISK_DIR);
+        DISK_DIR = NULL;
+        DISK_DIR_SIZE = 0;
         DISK_SIZE = 0;
+        disk_chunk_count = 0;
+        disk_table_count = 0;
+    }
+    if (disk_map != NULL) {
+        munmap(disk_map, disk_map_len);
+        disk_map = NULL;
+        disk_map_len = 0;
     }
-}
\ No newline at end of file
+}
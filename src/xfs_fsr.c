@@ -0,0 +1,253 @@
+#include "../include/xfs_fsr.h"
+#include "../include/xfs_io.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_inode.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_disk.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_trace.h"
+#include "../include/xfs_defer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The reorganizer works one file at a time, like xfs_fsr. It allocates a new
+// home for each logically contiguous region of the file, copies the data
+// through the block layer, swaps the extent maps under the ILOCK as one
+// logged change and only then frees the old blocks as deferred frees, which
+// keeps them busy until the swap is on the log. The IOLOCK is held
+// exclusively for the whole file, so no read or write can touch the old
+// blocks while they are being copied.
+
+#define FSR_COPY_BLOCKS 16  // Blocks moved per disk read/write
+
+// Copy budget shared by every file of one pass
+typedef struct {
+    uint64_t rate_bps;   // Bytes per second (0 = unlimited)
+    uint64_t start_ns;
+    uint64_t copied;     // Bytes copied so far
+} fsr_throttle_t;
+
+static int fsr_cmp_extent(const void *a, const void *b) {
+    const xfs_extent_t *x = (const xfs_extent_t *)a;
+    const xfs_extent_t *y = (const xfs_extent_t *)b;
+    return (x->start_off > y->start_off) - (x->start_off < y->start_off);
+}
+
+// Sleep until the bytes copied so far fit within the rate
+static void fsr_throttle(fsr_throttle_t *th) {
+    if (th->rate_bps == 0) {
+        return;
+    }
+    uint64_t due_ns = (uint64_t)((double)th->copied * 1e9 / th->rate_bps);
+    uint64_t elapsed = xfs_stats_now() - th->start_ns;
+    if (elapsed < due_ns) {
+        struct timespec ts;
+        ts.tv_sec = (due_ns - elapsed) / 1000000000ull;
+        ts.tv_nsec = (due_ns - elapsed) % 1000000000ull;
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Copy count blocks from src_fsb to dst_fsb through the block layer
+static int fsr_copy(uint64_t src_fsb, uint64_t dst_fsb, uint64_t count, char *buf, fsr_throttle_t *th) {
+    uint32_t bsize = ag_blocksize();
+    while (count > 0) {
+        uint64_t n = count < FSR_COPY_BLOCKS ? count : FSR_COPY_BLOCKS;
+        if (disk_read(src_fsb * bsize, buf, n * bsize) != 0 ||
+            disk_write(dst_fsb * bsize, buf, n * bsize) != 0) {
+            return -1;
+        }
+        src_fsb += n;
+        dst_fsb += n;
+        count -= n;
+        th->copied += n * bsize;
+        fsr_throttle(th);
+    }
+    return 0;
+}
+
+// Return the blocks of a partially built (never logged) map to the allocator
+static void fsr_free_map(const xfs_extent_t *map, int count) {
+    for (int i = 0; i < count; i++) {
+        xfs_free_blocks(ag_fsb_to_agno(map[i].start_block), ag_fsb_to_agbno(map[i].start_block),
+                        (int)map[i].block_count);
+    }
+}
+
+static int fsr_inode(xfs_inode_t *ip, fsr_throttle_t *th, xfs_fsr_result_t *res) {
+    xfs_extent_t old_map[XFS_MAX_EXTENTS];
+    xfs_extent_t new_map[XFS_MAX_EXTENTS];
+    int new_count = 0;
+    
+    xfs_ilock(ip, XFS_IOLOCK_EXCL | XFS_ILOCK_SHARED);
+    res->files_scanned++;
+    
+    // Moving a reflinked file would give it private copies of its shared blocks
+    if (ip->di_flags & XFS_DIFLAG_REFLINK) {
+        xfs_iunlock(ip, XFS_IOLOCK_EXCL | XFS_ILOCK_SHARED);
+        return 0;
+    }
+    
+    int old_count = ip->extent_count;
+    memcpy(old_map, ip->extents, old_count * sizeof(xfs_extent_t));
+    qsort(old_map, old_count, sizeof(xfs_extent_t), fsr_cmp_extent);
+    
+    // A file cannot have fewer extents than logically contiguous regions of one state
+    int regions = old_count > 0 ? 1 : 0;
+    for (int i = 1; i < old_count; i++) {
+        if (old_map[i - 1].start_off + old_map[i - 1].block_count != old_map[i].start_off ||
+            old_map[i - 1].state != old_map[i].state) {
+            regions++;
+        }
+    }
+    if (old_count <= regions) {
+        xfs_iunlock(ip, XFS_IOLOCK_EXCL | XFS_ILOCK_SHARED);
+        return 0; // Already as contiguous as it can be
+    }
+    
+    // Allocate a new home for each region, halving requests that do not fit;
+    // give up as soon as the new layout would not have fewer extents
+    uint64_t max_run = ag_blocks() - ag_first_data_block();
+    int ok = 1;
+    for (int i = 0; i < old_count && ok; ) {
+        uint64_t lblk = old_map[i].start_off;
+        uint32_t state = old_map[i].state;
+        uint64_t left = 0;
+        do {
+            left += old_map[i].block_count;
+            i++;
+        } while (i < old_count && old_map[i - 1].start_off + old_map[i - 1].block_count == old_map[i].start_off &&
+                 old_map[i].state == state);
+        
+        while (left > 0) {
+            int count = (int)(left > max_run ? max_run : left);
+            uint64_t fsb = 0;
+            while (count > 0 && xfs_alloc_file_blocks(ip, lblk, count, &fsb) != 0) {
+                count /= 2;
+            }
+            if (count == 0) {
+                ok = 0;
+                break;
+            }
+            
+            xfs_extent_t *prev = new_count > 0 ? &new_map[new_count - 1] : NULL;
+            if (prev != NULL && prev->start_off + prev->block_count == lblk &&
+                prev->start_block + prev->block_count == fsb && prev->state == state) {
+                prev->block_count += count;
+            } else if (new_count + 1 < old_count) {
+                new_map[new_count].start_off = lblk;
+                new_map[new_count].start_block = fsb;
+                new_map[new_count].block_count = count;
+                new_map[new_count].state = state;
+                new_count++;
+            } else {
+                xfs_free_blocks(ag_fsb_to_agno(fsb), ag_fsb_to_agbno(fsb), count);
+                ok = 0;
+                break;
+            }
+            lblk += count;
+            left -= count;
+        }
+    }
+    xfs_iunlock(ip, XFS_ILOCK_SHARED);
+    
+    if (!ok) {
+        fsr_free_map(new_map, new_count);
+        xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+        return 0; // Not enough contiguous free space to improve this file
+    }
+    
+    // Copy the data; the old map is stable because we hold the IOLOCK exclusively
+    char *buf = (char *)malloc((size_t)FSR_COPY_BLOCKS * ag_blocksize());
+    if (buf == NULL) {
+        fsr_free_map(new_map, new_count);
+        xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+        return -1;
+    }
+    uint64_t moved = 0;
+    for (int n = 0; n < new_count; n++) {
+        // Unwritten extents read as zeros, so there is nothing to copy
+        if (new_map[n].state == XFS_EXT_UNWRITTEN) {
+            continue;
+        }
+        for (uint64_t done = 0; done < new_map[n].block_count; ) {
+            uint64_t lblk = new_map[n].start_off + done;
+            xfs_extent_t *src = find_extent_for_offset(ip, lblk);
+            uint64_t in_src = lblk - src->start_off;
+            uint64_t run = src->block_count - in_src;
+            if (run > new_map[n].block_count - done) {
+                run = new_map[n].block_count - done;
+            }
+            if (fsr_copy(src->start_block + in_src, new_map[n].start_block + done, run, buf, th) != 0) {
+                free(buf);
+                fsr_free_map(new_map, new_count);
+                xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+                return -1;
+            }
+            done += run;
+            moved += run;
+        }
+    }
+    free(buf);
+    
+    // Queue the old blocks' frees before the swap, so a failure leaves the
+    // file on its old blocks
+    xfs_defer_t dfops;
+    xfs_defer_init(&dfops);
+    for (int i = 0; i < old_count; i++) {
+        if (xfs_defer_add_free(&dfops, old_map[i].start_block, old_map[i].block_count) != 0) {
+            xfs_defer_cancel(&dfops);
+            fsr_free_map(new_map, new_count);
+            xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+            return -1;
+        }
+    }
+    
+    // Swap the extent maps as one logged change
+    xfs_ilock(ip, XFS_ILOCK_EXCL);
+    trans_add_object(TRANS_OBJ_KEY(TRANS_OBJ_INODE, ip->inode_num), new_map, new_count * sizeof(xfs_extent_t));
+    memcpy(ip->extents, new_map, new_count * sizeof(xfs_extent_t));
+    ip->extent_count = new_count;
+    xfs_iunlock(ip, XFS_ILOCK_EXCL);
+    
+    // The old blocks stay busy until their free, logged after the swap, is flushed
+    int ret = xfs_defer_finish(&dfops);
+    xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+    
+    trace_xfs(XFS_TRACE_FSR, ip->inode_num, old_count, new_count, moved);
+    res->files_defragged++;
+    res->extents_before += old_count;
+    res->extents_after += new_count;
+    res->blocks_moved += moved;
+    return ret;
+}
+
+// Relocate a fragmented file's data into fewer extents
+int xfs_fsr_inode(xfs_inode_t *ip, uint64_t rate_bps, xfs_fsr_result_t *res) {
+    if (ip == NULL || res == NULL || ag_blocksize() == 0) {
+        return -1;
+    }
+    
+    fsr_throttle_t th = { rate_bps, xfs_stats_now(), 0 };
+    return fsr_inode(ip, &th, res);
+}
+
+// Defragment every file in the filesystem
+int xfs_fsr_all(uint64_t rate_bps, xfs_fsr_result_t *res) {
+    if (res == NULL || ag_blocksize() == 0) {
+        return -1;
+    }
+    
+    fsr_throttle_t th = { rate_bps, xfs_stats_now(), 0 };
+    int ret = 0;
+    int max_ino = get_max_inode_num();
+    for (int ino = 1; ino <= max_ino; ino++) {
+        xfs_inode_t *ip = get_inode_ptr(ino);
+        if (ip != NULL && ip->inode_num > 0 && fsr_inode(ip, &th, res) != 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
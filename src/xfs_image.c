@@ -0,0 +1,409 @@
+#include "../include/xfs_image.h"
+#include "../include/xfs_io.h"
+#include "../include/xfs_disk.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_cksum.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An image is written front to back in one pass, so it can go to a pipe:
+//   header | inode records | chunk index | zero padding | chunk data
+// The index lists the disk offset of each stored chunk in ascending order.
+// Chunk data starts on a chunk boundary of the file, so a loader can map the
+// file and point the disk's chunks straight into the mapping instead of
+// reading them. Fields are in host byte order. The header, and the inode
+// records plus index, carry CRC32Cs; chunk contents are not checksummed
+// here, because the metadata inside them has its own v5 CRCs, checked when
+// it is read.
+
+#define XFS_IMAGE_MAGIC   "XFSSIMG"
+#define XFS_IMAGE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t hdr_size;
+    uint64_t disk_size;
+    uint64_t chunk_size;
+    uint64_t chunk_count;
+    uint32_t inode_count;
+    uint32_t inode_size;      // Size of one inode record
+    uint64_t inode_off;
+    uint64_t index_off;
+    uint64_t data_off;
+    uint32_t meta_crc;        // CRC32C of the inode records and the chunk index
+    uint32_t hdr_crc;         // CRC32C of the header with this field zero
+} xfs_image_hdr_t;
+
+typedef struct {
+    uint32_t inode_num;
+    uint16_t di_mode;
+    uint16_t pad;
+    uint32_t di_flags;
+    uint32_t di_uid;
+    uint32_t di_gid;
+    uint32_t di_nlink;
+    uint64_t di_size;
+    uint32_t extent_count;
+    uint32_t pad2;
+    xfs_extent_t extents[XFS_MAX_EXTENTS];
+    char name[64];
+} xfs_image_inode_t;
+
+// Chunks to save, in disk order
+typedef struct {
+    uint64_t *offsets;
+    const void **data;
+    uint64_t count;
+    uint64_t cap;
+    uint64_t chunk_size;
+} image_chunks_t;
+
+static int image_collect_chunk(uint64_t offset, const void *data, void *arg) {
+    image_chunks_t *c = (image_chunks_t *)arg;
+    const uint8_t *p = (const uint8_t *)data;
+
+    // A chunk that was written back to zeros reads the same when left out
+    if (p[0] == 0 && memcmp(p, p + 1, c->chunk_size - 1) == 0) {
+        return 0;
+    }
+
+    if (c->count == c->cap) {
+        uint64_t cap = c->cap ? c->cap * 2 : 256;
+        uint64_t *offsets = (uint64_t *)realloc(c->offsets, cap * sizeof(uint64_t));
+        if (offsets == NULL) {
+            return -1;
+        }
+        c->offsets = offsets;
+        const void **ptrs = (const void **)realloc((void *)c->data, cap * sizeof(void *));
+        if (ptrs == NULL) {
+            return -1;
+        }
+        c->data = ptrs;
+        c->cap = cap;
+    }
+    c->offsets[c->count] = offset;
+    c->data[c->count] = data;
+    c->count++;
+    return 0;
+}
+
+static uint32_t image_hdr_crc(const xfs_image_hdr_t *hdr) {
+    return xfs_cksum_calc(hdr, sizeof(*hdr), offsetof(xfs_image_hdr_t, hdr_crc));
+}
+
+static uint32_t image_meta_crc(const xfs_image_inode_t *recs, uint32_t nrecs,
+                               const uint64_t *index, uint64_t count) {
+    uint32_t crc = xfs_crc32c(XFS_CRC_SEED, recs, nrecs * sizeof(xfs_image_inode_t));
+    return ~xfs_crc32c(crc, index, count * sizeof(uint64_t));
+}
+
+// Write the image to f front to back
+static int image_write(FILE *f, const xfs_image_hdr_t *hdr, const xfs_image_inode_t *recs,
+                       const image_chunks_t *chunks) {
+    if (fwrite(hdr, sizeof(*hdr), 1, f) != 1 ||
+        (hdr->inode_count > 0 && fwrite(recs, sizeof(*recs), hdr->inode_count, f) != hdr->inode_count) ||
+        (chunks->count > 0 && fwrite(chunks->offsets, sizeof(uint64_t), chunks->count, f) != chunks->count)) {
+        return -1;
+    }
+
+    uint64_t pad = hdr->data_off - (hdr->index_off + chunks->count * sizeof(uint64_t));
+    if (pad > 0) {
+        char *zeros = (char *)calloc(1, pad);
+        if (zeros == NULL || fwrite(zeros, 1, pad, f) != pad) {
+            free(zeros);
+            return -1;
+        }
+        free(zeros);
+    }
+
+    for (uint64_t i = 0; i < chunks->count; i++) {
+        if (fwrite(chunks->data[i], hdr->chunk_size, 1, f) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Save the disk and the inode table of the mounted filesystem to path
+int xfs_image_save(const char *path, xfs_image_info_t *info) {
+    if (ag_count() == 0 || disk_size() == 0) {
+        return -1;
+    }
+
+    // Quiesce: flush the log and return pooled blocks to their AGs, so the
+    // on-disk bitmaps account for every block a file does not own
+    if (trans_commit_barrier() != 0) {
+        return -1;
+    }
+    int pools = xfs_alloc_get_pools();
+    xfs_alloc_set_pools(0);
+
+    int ret = -1;
+    FILE *f = NULL;
+    char *tmp = NULL;
+    image_chunks_t chunks = { NULL, NULL, 0, 0, disk_chunk_size() };
+    int max_ino = get_max_inode_num();
+    xfs_image_inode_t *recs = (xfs_image_inode_t *)calloc(max_ino > 0 ? max_ino : 1, sizeof(xfs_image_inode_t));
+    if (recs == NULL) {
+        goto out;
+    }
+
+    uint32_t nrecs = 0;
+    for (int ino = 1; ino <= max_ino; ino++) {
+        xfs_inode_t *ip = get_inode_ptr(ino);
+        const char *name = get_inode_name(ino);
+        if (ip == NULL || name == NULL || name[0] == '\0') {
+            continue;  // Free, or being unlinked
+        }
+        xfs_image_inode_t *r = &recs[nrecs++];
+        r->inode_num = ip->inode_num;
+        r->di_mode = ip->di_mode;
+        r->di_flags = ip->di_flags;
+        r->di_uid = ip->di_uid;
+        r->di_gid = ip->di_gid;
+        r->di_nlink = ip->di_nlink;
+        r->di_size = ip->di_size;
+        r->extent_count = (uint32_t)ip->extent_count;
+        memcpy(r->extents, ip->extents, sizeof(r->extents));
+        strncpy(r->name, name, sizeof(r->name) - 1);
+    }
+
+    if (disk_foreach_chunk(image_collect_chunk, &chunks) != 0) {
+        goto out;
+    }
+
+    xfs_image_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, XFS_IMAGE_MAGIC, sizeof(XFS_IMAGE_MAGIC));
+    hdr.version = XFS_IMAGE_VERSION;
+    hdr.hdr_size = sizeof(hdr);
+    hdr.disk_size = disk_size();
+    hdr.chunk_size = chunks.chunk_size;
+    hdr.chunk_count = chunks.count;
+    hdr.inode_count = nrecs;
+    hdr.inode_size = sizeof(xfs_image_inode_t);
+    hdr.inode_off = sizeof(hdr);
+    hdr.index_off = hdr.inode_off + (uint64_t)nrecs * sizeof(xfs_image_inode_t);
+    hdr.data_off = (hdr.index_off + chunks.count * sizeof(uint64_t) + hdr.chunk_size - 1) /
+                   hdr.chunk_size * hdr.chunk_size;
+    hdr.meta_crc = image_meta_crc(recs, nrecs, chunks.offsets, chunks.count);
+    hdr.hdr_crc = image_hdr_crc(&hdr);
+
+    // A regular file is replaced by rename, so a disk still mapped from the
+    // old image keeps reading the old file
+    struct stat st;
+    const char *target = path;
+    if (stat(path, &st) != 0 || S_ISREG(st.st_mode)) {
+        tmp = (char *)malloc(strlen(path) + 5);
+        if (tmp == NULL) {
+            goto out;
+        }
+        sprintf(tmp, "%s.tmp", path);
+        target = tmp;
+    }
+
+    f = fopen(target, "wb");
+    if (f == NULL) {
+        goto out;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    int werr = image_write(f, &hdr, recs, &chunks);
+    if (fclose(f) != 0) {
+        werr = -1;
+    }
+    f = NULL;
+    if (werr != 0 || (tmp != NULL && rename(tmp, path) != 0)) {
+        if (tmp != NULL) {
+            unlink(tmp);
+        }
+        goto out;
+    }
+
+    if (info != NULL) {
+        info->inodes = nrecs;
+        info->chunks = chunks.count;
+        info->bytes = hdr.data_off + chunks.count * hdr.chunk_size;
+        info->mapped = 0;
+    }
+    ret = 0;
+
+out:
+    free(tmp);
+    free(recs);
+    free(chunks.offsets);
+    free((void *)chunks.data);
+    xfs_alloc_set_pools(pools);
+    return ret;
+}
+
+// Read exactly len bytes (works on pipes)
+static int read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = (uint8_t *)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Check a header's identity, CRC and layout
+static int image_check_hdr(const xfs_image_hdr_t *hdr) {
+    if (memcmp(hdr->magic, XFS_IMAGE_MAGIC, sizeof(XFS_IMAGE_MAGIC)) != 0 ||
+        hdr->version != XFS_IMAGE_VERSION || hdr->hdr_size != sizeof(*hdr) ||
+        hdr->inode_size != sizeof(xfs_image_inode_t)) {
+        return -1;
+    }
+    if (image_hdr_crc(hdr) != hdr->hdr_crc) {
+        xfs_cksum_report_failure();
+        return -1;
+    }
+    if (hdr->disk_size == 0 || hdr->chunk_size < 4096 || (hdr->chunk_size & (hdr->chunk_size - 1)) != 0 ||
+        hdr->chunk_count > hdr->disk_size / hdr->chunk_size + 1 ||
+        hdr->inode_count > (1u << 20) ||
+        hdr->inode_off != sizeof(*hdr) ||
+        hdr->index_off != hdr->inode_off + (uint64_t)hdr->inode_count * hdr->inode_size ||
+        hdr->data_off < hdr->index_off + hdr->chunk_count * sizeof(uint64_t) ||
+        hdr->data_off % hdr->chunk_size != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Replace the disk and the inode table with an image and mount it. Once the
+// old disk is dropped a failure leaves no filesystem; format or load again.
+int xfs_image_load(const char *path, const xfs_mount_opts_t *opts, xfs_image_info_t *info) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int ret = -1;
+    xfs_image_inode_t *recs = NULL;
+    uint64_t *index = NULL;
+    uint8_t *buf = NULL;
+    void *map = MAP_FAILED;
+    size_t map_len = 0;
+
+    xfs_image_hdr_t hdr;
+    if (read_full(fd, &hdr, sizeof(hdr)) != 0 || image_check_hdr(&hdr) != 0) {
+        goto out;
+    }
+
+    recs = (xfs_image_inode_t *)malloc((hdr.inode_count ? hdr.inode_count : 1) * sizeof(xfs_image_inode_t));
+    index = (uint64_t *)malloc((hdr.chunk_count ? hdr.chunk_count : 1) * sizeof(uint64_t));
+    if (recs == NULL || index == NULL ||
+        read_full(fd, recs, hdr.inode_count * sizeof(xfs_image_inode_t)) != 0 ||
+        read_full(fd, index, hdr.chunk_count * sizeof(uint64_t)) != 0) {
+        goto out;
+    }
+    if (image_meta_crc(recs, hdr.inode_count, index, hdr.chunk_count) != hdr.meta_crc) {
+        xfs_cksum_report_failure();
+        goto out;
+    }
+    for (uint64_t i = 0; i < hdr.chunk_count; i++) {
+        if (index[i] % hdr.chunk_size != 0 || index[i] >= hdr.disk_size ||
+            (i > 0 && index[i] <= index[i - 1])) {
+            goto out;
+        }
+    }
+
+    // Map a regular file whose chunks match the disk's; read anything else
+    struct stat st;
+    uint64_t end = hdr.data_off + hdr.chunk_count * hdr.chunk_size;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if ((uint64_t)st.st_size < end) {
+            goto out;  // Truncated
+        }
+        if (hdr.chunk_size == disk_chunk_size()) {
+            map_len = (size_t)st.st_size;
+            map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+    }
+
+    // From here on the old filesystem is gone
+    xfs_alloc_unmount();
+    if (map != MAP_FAILED) {
+        if (disk_init_mapped(hdr.disk_size, map, map_len) != 0) {
+            munmap(map, map_len);
+            goto out;
+        }
+        for (uint64_t i = 0; i < hdr.chunk_count; i++) {
+            if (disk_adopt_chunk(index[i], (uint8_t *)map + hdr.data_off + i * hdr.chunk_size) != 0) {
+                goto out;
+            }
+        }
+    } else {
+        buf = (uint8_t *)malloc(hdr.chunk_size);
+        if (buf == NULL || disk_init(hdr.disk_size) != 0) {
+            goto out;
+        }
+        uint64_t pos = hdr.index_off + hdr.chunk_count * sizeof(uint64_t);
+        uint64_t pad = hdr.data_off - pos;
+        if (pad > 0 && read_full(fd, buf, pad) != 0) {
+            goto out;
+        }
+        for (uint64_t i = 0; i < hdr.chunk_count; i++) {
+            uint64_t len = hdr.disk_size - index[i] < hdr.chunk_size ? hdr.disk_size - index[i] : hdr.chunk_size;
+            if (read_full(fd, buf, hdr.chunk_size) != 0 || disk_write(index[i], buf, len) != 0) {
+                goto out;
+            }
+        }
+    }
+
+    xfs_inode_table_reset();
+    for (uint32_t i = 0; i < hdr.inode_count; i++) {
+        xfs_image_inode_t *r = &recs[i];
+        xfs_inode_t ip;
+        memset(&ip, 0, sizeof(ip));
+        ip.inode_num = r->inode_num;
+        ip.di_mode = r->di_mode;
+        ip.di_flags = r->di_flags;
+        ip.di_uid = r->di_uid;
+        ip.di_gid = r->di_gid;
+        ip.di_nlink = r->di_nlink;
+        ip.di_size = r->di_size;
+        ip.extent_count = (int)r->extent_count;
+        memcpy(ip.extents, r->extents, sizeof(ip.extents));
+        r->name[sizeof(r->name) - 1] = '\0';
+        if (xfs_inode_restore(&ip, r->name) != 0) {
+            goto out;
+        }
+    }
+
+    xfs_mount_opts_t defaults = { 0 };
+    if (xfs_mount_opts(opts != NULL ? opts : &defaults) != 0) {
+        goto out;
+    }
+
+    if (info != NULL) {
+        info->inodes = hdr.inode_count;
+        info->chunks = hdr.chunk_count;
+        info->bytes = end;
+        info->mapped = map != MAP_FAILED;
+    }
+    ret = 0;
+
+out:
+    close(fd);
+    free(recs);
+    free(index);
+    free(buf);
+    return ret;
+}
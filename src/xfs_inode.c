@@ -0,0 +1,56 @@
+#include "../include/xfs_inode.h"
+#include <pthread.h>
+
+// Initialize the per-inode locks
+int xfs_inode_init_locks(xfs_inode_t *ip) {
+    if (ip == NULL) {
+        return -1;
+    }
+
+    if (pthread_rwlock_init(&ip->i_iolock, NULL) != 0) {
+        return -1;
+    }
+
+    if (pthread_rwlock_init(&ip->i_ilock, NULL) != 0) {
+        pthread_rwlock_destroy(&ip->i_iolock);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Destroy the per-inode locks
+void xfs_inode_destroy_locks(xfs_inode_t *ip) {
+    if (ip == NULL) {
+        return;
+    }
+
+    pthread_rwlock_destroy(&ip->i_ilock);
+    pthread_rwlock_destroy(&ip->i_iolock);
+}
+
+// Take the inode locks named in lock_flags (IOLOCK before ILOCK)
+void xfs_ilock(xfs_inode_t *ip, int lock_flags) {
+    if (lock_flags & XFS_IOLOCK_EXCL) {
+        pthread_rwlock_wrlock(&ip->i_iolock);
+    } else if (lock_flags & XFS_IOLOCK_SHARED) {
+        pthread_rwlock_rdlock(&ip->i_iolock);
+    }
+
+    if (lock_flags & XFS_ILOCK_EXCL) {
+        pthread_rwlock_wrlock(&ip->i_ilock);
+    } else if (lock_flags & XFS_ILOCK_SHARED) {
+        pthread_rwlock_rdlock(&ip->i_ilock);
+    }
+}
+
+// Release the inode locks named in lock_flags (ILOCK before IOLOCK)
+void xfs_iunlock(xfs_inode_t *ip, int lock_flags) {
+    if (lock_flags & (XFS_ILOCK_EXCL | XFS_ILOCK_SHARED)) {
+        pthread_rwlock_unlock(&ip->i_ilock);
+    }
+
+    if (lock_flags & (XFS_IOLOCK_EXCL | XFS_IOLOCK_SHARED)) {
+        pthread_rwlock_unlock(&ip->i_iolock);
+    }
+}
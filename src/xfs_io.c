@@ -3,145 +3,988 @@
 #include "../include/xfs_trans.h"
 #include "../include/xfs_disk.h"
 #include "../include/xfs_ag.h"
+#include "../include/xfs_inode.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_trace.h"
+#include "../include/xfs_defer.h"
+#include "../include/xfs_refcount.h"
+#include "../include/xfs_cksum.h"
+#include "../include/xfs_quota.h"
 #include "../include/xfs_types.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 // Helper function to find which extent contains a given logical block
-static xfs_extent_t* find_extent_for_offset(xfs_inode_t *inode, uint64_t logical_block) {
+xfs_extent_t* find_extent_for_offset(xfs_inode_t *inode, uint64_t logical_block) {
+    uint64_t start_ns = xfs_stats_now();
+    xfs_extent_t *found = NULL; // No extent found for this logical block
+    
     for (int i = 0; i < inode->extent_count; i++) {
         if (logical_block >= inode->extents[i].start_off && 
             logical_block < (inode->extents[i].start_off + inode->extents[i].block_count)) {
-            return &inode->extents[i];
+            found = &inode->extents[i];
+            break;
         }
     }
-    return NULL; // No extent found for this logical block
+    
+    xfs_stats_record(XFS_STAT_EXTENT_LOOKUP, start_ns);
+    return found;
 }
 
 // Helper function to add a new extent to the inode
-static int add_extent_to_inode(xfs_inode_t *inode, uint64_t logical_start, uint64_t physical_start, uint64_t block_count) {
-    if (inode->extent_count >= 16) { // Maximum number of extents reached
+static int add_extent_to_inode(xfs_inode_t *inode, uint64_t logical_start, uint64_t physical_start,
+                               uint64_t block_count, uint32_t state) {
+    // Extend an existing extent when the new range continues it logically and physically in the same state
+    for (int i = 0; i < inode->extent_count; i++) {
+        xfs_extent_t *ext = &inode->extents[i];
+        if (ext->start_off + ext->block_count == logical_start &&
+            ext->start_block + ext->block_count == physical_start && ext->state == state) {
+            ext->block_count += block_count;
+            return 0;
+        }
+    }
+    
+    if (inode->extent_count >= XFS_MAX_EXTENTS) { // Maximum number of extents reached
         return -1;
     }
     
     inode->extents[inode->extent_count].start_off = logical_start;
     inode->extents[inode->extent_count].start_block = physical_start;
     inode->extents[inode->extent_count].block_count = block_count;
+    inode->extents[inode->extent_count].state = state;
     inode->extent_count++;
     
     return 0;
 }
 
+// Log an inode's extent map; changes to one inode in the same checkpoint are logged once
+static void log_inode_extents(xfs_inode_t *inode) {
+    trans_add_object(TRANS_OBJ_KEY(TRANS_OBJ_INODE, inode->inode_num),
+                     inode->extents, inode->extent_count * sizeof(xfs_extent_t));
+}
+
+// Merge extents that continue each other logically and physically in the same state
+static void merge_extents(xfs_inode_t *inode) {
+    for (int i = 0; i < inode->extent_count; i++) {
+        for (int j = 0; j < inode->extent_count; j++) {
+            xfs_extent_t *a = &inode->extents[i];
+            xfs_extent_t *b = &inode->extents[j];
+            if (i != j && a->start_off + a->block_count == b->start_off &&
+                a->start_block + a->block_count == b->start_block && a->state == b->state) {
+                a->block_count += b->block_count;
+                memmove(b, b + 1, (inode->extent_count - j - 1) * sizeof(xfs_extent_t));
+                inode->extent_count--;
+                if (j < i) {
+                    i--;
+                }
+                j = -1; // Rescan: the grown extent may now continue into another
+            }
+        }
+    }
+}
+
+// Mark the unwritten blocks of [start, end) written. An extent that has no
+// free slots to split into has its unwritten remainder zeroed on disk and
+// is converted whole (caller holds the ILOCK exclusively).
+static int convert_unwritten(xfs_inode_t *inode, uint64_t start, uint64_t end, uint32_t bsize) {
+    int converted = 0;
+    for (int i = 0; i < inode->extent_count; i++) {
+        xfs_extent_t *ext = &inode->extents[i];
+        uint64_t ext_end = ext->start_off + ext->block_count;
+        if (ext->state != XFS_EXT_UNWRITTEN || ext_end <= start || ext->start_off >= end) {
+            continue;
+        }
+        
+        uint64_t us = ext->start_off > start ? ext->start_off : start;
+        uint64_t ue = ext_end < end ? ext_end : end;
+        int pieces = (us > ext->start_off) + (ue < ext_end);
+        converted++;
+        
+        if (inode->extent_count + pieces > XFS_MAX_EXTENTS) {
+            if (disk_zero(ext->start_block * bsize, (us - ext->start_off) * bsize) != 0 ||
+                disk_zero((ext->start_block + (ue - ext->start_off)) * bsize, (ext_end - ue) * bsize) != 0) {
+                return -1;
+            }
+            ext->state = XFS_EXT_NORM;
+            continue;
+        }
+        
+        // Split into unwritten head, written middle and unwritten tail; new pieces go at the end
+        if (ue < ext_end) {
+            xfs_extent_t *tail = &inode->extents[inode->extent_count++];
+            tail->start_off = ue;
+            tail->start_block = ext->start_block + (ue - ext->start_off);
+            tail->block_count = ext_end - ue;
+            tail->state = XFS_EXT_UNWRITTEN;
+        }
+        if (us > ext->start_off) {
+            xfs_extent_t *mid = &inode->extents[inode->extent_count++];
+            mid->start_off = us;
+            mid->start_block = ext->start_block + (us - ext->start_off);
+            mid->block_count = ue - us;
+            mid->state = XFS_EXT_NORM;
+            ext->block_count = us - ext->start_off;
+        } else {
+            ext->block_count = ue - ext->start_off;
+            ext->state = XFS_EXT_NORM;
+        }
+    }
+    
+    if (converted > 0) {
+        merge_extents(inode);
+        trace_xfs(XFS_TRACE_CONVERT, inode->inode_num, start, end, converted);
+    }
+    return 0;
+}
+
+// Whether any of num_blocks blocks from block_start is unmapped (caller
+// holds the ILOCK)
+static int range_has_hole(xfs_inode_t *inode, uint64_t block_start, uint64_t num_blocks) {
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        if (find_extent_for_offset(inode, block_start + i) == NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether the partial first or last block of a write lies in an unwritten
+// extent and must be zeroed around the data (caller holds the ILOCK)
+static int write_needs_zeroing(xfs_inode_t *inode, uint64_t offset, uint64_t size, uint32_t bsize) {
+    uint64_t end = offset + size;
+    if (offset % bsize != 0) {
+        xfs_extent_t *ext = find_extent_for_offset(inode, offset / bsize);
+        if (ext != NULL && ext->state == XFS_EXT_UNWRITTEN) {
+            return 1;
+        }
+    }
+    if (end % bsize != 0) {
+        xfs_extent_t *ext = find_extent_for_offset(inode, end / bsize);
+        if (ext != NULL && ext->state == XFS_EXT_UNWRITTEN) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Unmap logical blocks [start, end) from an inode and queue the physical
+// blocks on dfops; fails without changing anything if splitting an extent
+// would need more than XFS_MAX_EXTENTS extents (caller holds the ILOCK exclusively)
+static int unmap_range(xfs_inode_t *inode, uint64_t start, uint64_t end, xfs_defer_t *dfops) {
+    if (start >= end) {
+        return 0;
+    }
+    
+    // Only an extent that straddles both ends of the range is split in two
+    for (int i = 0; i < inode->extent_count; i++) {
+        xfs_extent_t *ext = &inode->extents[i];
+        if (ext->start_off < start && ext->start_off + ext->block_count > end && inode->extent_count >= XFS_MAX_EXTENTS) {
+            return -1;
+        }
+    }
+    
+    uint64_t unmapped = 0;
+    for (int i = 0; i < inode->extent_count; i++) {
+        xfs_extent_t *ext = &inode->extents[i];
+        uint64_t ext_end = ext->start_off + ext->block_count;
+        if (ext_end <= start || ext->start_off >= end) {
+            continue;
+        }
+        
+        uint64_t us = ext->start_off > start ? ext->start_off : start;
+        uint64_t ue = ext_end < end ? ext_end : end;
+        if (xfs_defer_add_free(dfops, ext->start_block + (us - ext->start_off), ue - us) != 0) {
+            xfs_quota_unreserve_blocks(inode, unmapped);
+            return -1;
+        }
+        unmapped += ue - us;
+        
+        if (us == ext->start_off && ue == ext_end) {
+            // Whole extent: remove it, keeping the others in order
+            memmove(ext, ext + 1, (inode->extent_count - i - 1) * sizeof(xfs_extent_t));
+            inode->extent_count--;
+            i--;
+        } else if (us == ext->start_off) {
+            // Head of the extent
+            ext->start_block += ue - ext->start_off;
+            ext->block_count = ext_end - ue;
+            ext->start_off = ue;
+        } else if (ue == ext_end) {
+            // Tail of the extent
+            ext->block_count = us - ext->start_off;
+        } else {
+            // Middle of the extent: the tail becomes a new extent
+            xfs_extent_t *tail = &inode->extents[inode->extent_count++];
+            tail->start_off = ue;
+            tail->start_block = ext->start_block + (ue - ext->start_off);
+            tail->block_count = ext_end - ue;
+            tail->state = ext->state;
+            ext->block_count = us - ext->start_off;
+        }
+    }
+    
+    xfs_quota_unreserve_blocks(inode, unmapped);
+    trace_xfs(XFS_TRACE_UNMAP, inode->inode_num, start, end, unmapped);
+    return 0;
+}
+
+// Allocate up to count blocks for logical_block onwards, charged to the
+// inode's quotas, halving the run until an AG has that much contiguous
+// space. If nothing fits while recent frees are still busy, the log is
+// forced once with the ILOCK dropped and the allocation retried. Returns the
+// blocks allocated, 0 if none could be (caller holds the IOLOCK and ILOCK
+// exclusively, so the extent map cannot change while the ILOCK is dropped).
+static int alloc_file_run(xfs_inode_t *inode, uint64_t logical_block, int count, uint64_t *fsbno) {
+    if (xfs_quota_reserve_blocks(inode, (uint64_t)count) != 0) {
+        return 0;
+    }
+    int got = count;
+    int forced = 0;
+    for (;;) {
+        while (got > 0 && xfs_alloc_file_blocks(inode, logical_block, got, fsbno) != 0) {
+            got /= 2;
+        }
+        if (got > 0 || forced || !xfs_alloc_busy_pending()) {
+            break;
+        }
+        xfs_iunlock(inode, XFS_ILOCK_EXCL);
+        forced = trans_commit_barrier() == 0;
+        xfs_ilock(inode, XFS_ILOCK_EXCL);
+        if (!forced) {
+            break;
+        }
+        got = count;
+    }
+    xfs_quota_unreserve_blocks(inode, (uint64_t)(count - got));
+    return got;
+}
+
+// Give back a run from alloc_file_run() that could not be mapped
+static void free_file_run(xfs_inode_t *inode, uint64_t fsbno, int count) {
+    xfs_free_blocks(ag_fsb_to_agno(fsbno), ag_fsb_to_agbno(fsbno), count);
+    xfs_quota_unreserve_blocks(inode, (uint64_t)count);
+}
+
+// Logical runs a write mapped to newly allocated blocks its data has not
+// reached yet. Runs are separated by blocks that were already mapped, so
+// there are at most one more than there are extents.
+typedef struct {
+    uint64_t start[XFS_MAX_EXTENTS + 1];
+    uint64_t count[XFS_MAX_EXTENTS + 1];
+    int n;
+} write_runs_t;
+
+// Record a newly mapped run, joining it to a run it continues; 0 if the
+// run is full and the blocks were zeroed instead
+static int write_runs_add(write_runs_t *runs, uint64_t lblk, uint64_t fsbno, uint64_t count, uint32_t bsize) {
+    for (int r = 0; r < runs->n; r++) {
+        if (runs->start[r] + runs->count[r] == lblk) {
+            runs->count[r] += count;
+            return 1;
+        }
+        if (lblk + count == runs->start[r]) {
+            runs->start[r] = lblk;
+            runs->count[r] += count;
+            return 1;
+        }
+    }
+    if (runs->n == XFS_MAX_EXTENTS + 1) {
+        disk_zero(fsbno * bsize, count * bsize);
+        return 0;
+    }
+    runs->start[runs->n] = lblk;
+    runs->count[runs->n] = count;
+    runs->n++;
+    return 1;
+}
+
+// Unmap the runs of a failed write and queue their blocks on dfops, so a
+// deleted file's data left on them never becomes readable. A run that
+// cannot be unmapped (splitting would need a free extent slot) is zeroed
+// instead (caller holds the ILOCK exclusively).
+static void write_runs_undo(xfs_inode_t *inode, const write_runs_t *runs, uint32_t bsize, xfs_defer_t *dfops) {
+    for (int r = 0; r < runs->n; r++) {
+        uint64_t end = runs->start[r] + runs->count[r];
+        if (unmap_range(inode, runs->start[r], end, dfops) == 0) {
+            continue;
+        }
+        for (uint64_t lblk = runs->start[r]; lblk < end; lblk++) {
+            xfs_extent_t *ext = find_extent_for_offset(inode, lblk);
+            if (ext != NULL) {
+                disk_zero((ext->start_block + (lblk - ext->start_off)) * bsize, bsize);
+            }
+        }
+    }
+    if (runs->n > 0) {
+        log_inode_extents(inode);
+    }
+}
+
+// Fail a write: undo its runs, finish dfops and drop the IOLOCK (caller
+// holds only the IOLOCK)
+static int write_fail(xfs_inode_t *inode, const write_runs_t *runs, uint32_t bsize, xfs_defer_t *dfops, int iolock) {
+    if (runs->n > 0) {
+        xfs_ilock(inode, XFS_ILOCK_EXCL);
+        write_runs_undo(inode, runs, bsize, dfops);
+        xfs_iunlock(inode, XFS_ILOCK_EXCL);
+    }
+    xfs_defer_finish(dfops);
+    xfs_iunlock(inode, iolock);
+    return -1;
+}
+
+// Whether any written block under [offset, offset + size) is shared with
+// another file (caller holds the ILOCK)
+static int range_is_shared(xfs_inode_t *inode, uint64_t offset, uint64_t size, uint32_t bsize) {
+    if (!(inode->di_flags & XFS_DIFLAG_REFLINK) || size == 0) {
+        return 0;
+    }
+    
+    uint64_t start = offset / bsize;
+    uint64_t end = (offset + size - 1) / bsize + 1;
+    for (int i = 0; i < inode->extent_count; i++) {
+        xfs_extent_t *ext = &inode->extents[i];
+        uint64_t ext_end = ext->start_off + ext->block_count;
+        if (ext->state != XFS_EXT_NORM || ext_end <= start || ext->start_off >= end) {
+            continue;
+        }
+        uint64_t us = ext->start_off > start ? ext->start_off : start;
+        uint64_t ue = ext_end < end ? ext_end : end;
+        uint64_t fsb = ext->start_block + (us - ext->start_off);
+        uint32_t fbno, flen;
+        if (xfs_refcount_find_shared(ag_fsb_to_agno(fsb), (uint32_t)ag_fsb_to_agbno(fsb), (uint32_t)(ue - us),
+                                     &fbno, &flen) != 0) {
+            return 1; // Shared, or unknown: take the careful path
+        }
+    }
+    return 0;
+}
+
+// Copy on write: move every shared written block under [offset, offset + len)
+// to newly allocated blocks and queue the old blocks on dfops, which drops
+// this file's reference to them. Blocks the range covers completely are about
+// to be overwritten and are not copied; they are recorded in runs, if given,
+// for a failed write to unmap (caller holds the IOLOCK and ILOCK
+// exclusively).
+static int unshare_range(xfs_inode_t *inode, uint64_t offset, uint64_t len, uint32_t bsize, xfs_defer_t *dfops, write_runs_t *runs) {
+    if (!(inode->di_flags & XFS_DIFLAG_REFLINK) || len == 0) {
+        return 0;
+    }
+    
+    uint64_t start = offset / bsize;
+    uint64_t end = (offset + len - 1) / bsize + 1;
+    uint64_t max_run = ag_blocks() - ag_first_data_block();
+    char *buf = NULL;
+    int ret = 0;
+    
+    for (uint64_t lblk = start; lblk < end && ret == 0; ) {
+        xfs_extent_t *ext = find_extent_for_offset(inode, lblk);
+        if (ext == NULL || ext->state != XFS_EXT_NORM) {
+            lblk++;
+            continue;
+        }
+        
+        uint64_t ext_end = ext->start_off + ext->block_count;
+        uint64_t piece_end = ext_end < end ? ext_end : end;
+        uint64_t fsb = ext->start_block + (lblk - ext->start_off);
+        int ag_id = ag_fsb_to_agno(fsb);
+        uint32_t agbno = (uint32_t)ag_fsb_to_agbno(fsb);
+        uint32_t fbno, flen;
+        int shared = xfs_refcount_find_shared(ag_id, agbno, (uint32_t)(piece_end - lblk), &fbno, &flen);
+        if (shared <= 0) {
+            ret = shared;
+            lblk = piece_end;
+            continue;
+        }
+        
+        // Remapping splits at most one extent and adds one
+        if (inode->extent_count + 2 > XFS_MAX_EXTENTS) {
+            ret = -1;
+            break;
+        }
+        
+        uint64_t cow_start = lblk + (fbno - agbno);
+        uint64_t old_fsb = fsb + (fbno - agbno);
+        uint64_t new_fsb = 0;
+        int count = alloc_file_run(inode, cow_start, (int)(flen > max_run ? max_run : flen), &new_fsb);
+        if (count == 0) {
+            ret = -1;
+            break;
+        }
+        
+        // Preserve the old contents of blocks the caller only partly overwrites
+        for (int b = 0; b < count && ret == 0; b++) {
+            uint64_t blk_off = (cow_start + b) * bsize;
+            if (blk_off >= offset && blk_off + bsize <= offset + len) {
+                continue;
+            }
+            if (buf == NULL && (buf = (char *)malloc(bsize)) == NULL) {
+                ret = -1;
+                break;
+            }
+            ret = disk_read((old_fsb + b) * bsize, buf, bsize);
+            if (ret == 0) {
+                ret = disk_write((new_fsb + b) * bsize, buf, bsize);
+            }
+        }
+        
+        if (ret == 0) {
+            ret = unmap_range(inode, cow_start, cow_start + count, dfops);
+        }
+        if (ret == 0) {
+            ret = add_extent_to_inode(inode, cow_start, new_fsb, count, XFS_EXT_NORM);
+        }
+        if (ret != 0) {
+            free_file_run(inode, new_fsb, count);
+            break;
+        }
+        
+        // The blocks left uncopied are contiguous
+        uint64_t first_full = (offset + bsize - 1) / bsize;
+        uint64_t end_full = (offset + len) / bsize;
+        uint64_t skip_start = cow_start > first_full ? cow_start : first_full;
+        uint64_t skip_end = cow_start + count < end_full ? cow_start + count : end_full;
+        if (runs != NULL && skip_start < skip_end) {
+            write_runs_add(runs, skip_start, new_fsb + (skip_start - cow_start), skip_end - skip_start, bsize);
+        }
+        
+        trace_xfs(XFS_TRACE_COW, inode->inode_num, cow_start, new_fsb, count);
+        lblk = cow_start + count;
+    }
+    
+    free(buf);
+    merge_extents(inode);
+    return ret;
+}
+
+// Zero the mapped bytes of [offset, offset + len) on disk, unsharing shared
+// blocks first (caller holds the IOLOCK and ILOCK exclusively)
+static int zero_range(xfs_inode_t *inode, uint64_t offset, uint64_t len, uint32_t bsize, xfs_defer_t *dfops) {
+    char *zeros = NULL;
+    uint64_t end = offset + len;
+    
+    if (unshare_range(inode, offset, len, bsize, dfops, NULL) != 0) {
+        return -1;
+    }
+    
+    while (offset < end) {
+        uint64_t in_block = offset % bsize;
+        uint64_t n = bsize - in_block < end - offset ? bsize - in_block : end - offset;
+        xfs_extent_t *extent = find_extent_for_offset(inode, offset / bsize);
+        if (extent != NULL) {
+            if (zeros == NULL && (zeros = (char *)calloc(1, bsize)) == NULL) {
+                return -1;
+            }
+            uint64_t physical_block = extent->start_block + (offset / bsize - extent->start_off);
+            if (disk_write(physical_block * bsize + in_block, zeros, n) != 0) {
+                free(zeros);
+                return -1;
+            }
+        }
+        offset += n;
+    }
+    
+    free(zeros);
+    return 0;
+}
+
 // Write data to a file (simulated)
-int xfs_sim_write(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
+static int xfs_sim_write_internal(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
     if (!inode || !buffer || size == 0) {
         return -1;
     }
     
+    // Filesystem block size (0 until the filesystem is formatted or mounted)
+    uint32_t bsize = ag_blocksize();
+    if (bsize == 0) {
+        return -1;
+    }
+    
     // Calculate number of blocks needed
-    uint64_t block_start = offset / XFS_BLOCK_SIZE;
-    uint64_t block_end = (offset + size - 1) / XFS_BLOCK_SIZE;
+    uint64_t block_start = offset / bsize;
+    uint64_t block_end = (offset + size - 1) / bsize;
     uint64_t num_blocks = block_end - block_start + 1;
     
-    printf("[XFS Write] Requested to write %zu bytes at offset %ld (%lu blocks)\n", size, offset, num_blocks);
+    // Non-extending writes share the IOLOCK; writes past EOF, writes into
+    // holes (whose new blocks hold stale data until this write reaches them),
+    // partial block writes into unwritten extents (which zero the whole block)
+    // and writes into shared blocks (which are remapped) take it exclusively
+    int iolock = XFS_IOLOCK_SHARED;
+    xfs_ilock(inode, iolock);
+    int excl = (uint64_t)offset + size > inode->di_size;
+    if (!excl) {
+        xfs_ilock(inode, XFS_ILOCK_SHARED);
+        excl = range_has_hole(inode, block_start, num_blocks) || write_needs_zeroing(inode, offset, size, bsize) ||
+               range_is_shared(inode, offset, size, bsize);
+        xfs_iunlock(inode, XFS_ILOCK_SHARED);
+    }
+    if (excl) {
+        xfs_iunlock(inode, iolock);
+        iolock = XFS_IOLOCK_EXCL;
+        xfs_ilock(inode, iolock);
+    }
     
-    // Check each required block to see if it has a physical mapping
-    for (uint64_t i = 0; i < num_blocks; i++) {
-        uint64_t logical_block = block_start + i;
+    // The file may have been unlinked while this thread waited for the IOLOCK
+    if (inode->di_nlink == 0) {
+        xfs_iunlock(inode, iolock);
+        return -1;
+    }
+    
+    trace_xfs(XFS_TRACE_WRITE_START, inode->inode_num, offset, size, num_blocks);
+    
+    // Check under the shared ILOCK whether any block still needs a mapping
+    // or a private copy; only a write holding the IOLOCK exclusively finds
+    // either, so no reader sees a new block before its data is written
+    xfs_ilock(inode, XFS_ILOCK_SHARED);
+    int needs_alloc = iolock == XFS_IOLOCK_EXCL && range_has_hole(inode, block_start, num_blocks);
+    int needs_cow = iolock == XFS_IOLOCK_EXCL && range_is_shared(inode, offset, size, bsize);
+    xfs_iunlock(inode, XFS_ILOCK_SHARED);
+    
+    xfs_defer_t dfops;
+    xfs_defer_init(&dfops);
+    write_runs_t runs;
+    runs.n = 0;
+    
+    if (needs_alloc || needs_cow) {
+        // Extent map changes require the ILOCK exclusively
+        xfs_ilock(inode, XFS_ILOCK_EXCL);
         
-        // Check if this logical block is already mapped
-        xfs_extent_t *extent = find_extent_for_offset(inode, logical_block);
-        if (extent == NULL) {
-            // Need to allocate physical blocks for this region
-            // For simplicity, we'll allocate one block at a time but could optimize to allocate more
-            uint64_t ag_id = logical_block % NUM_AGS; // Distribute across AGs based on block number
-            printf("[XFS Write] Allocating 1 block in AG %d for logical block %lu\n", ag_id, logical_block);
+        // Copy on write: shared blocks are remapped in one batch, and the old
+        // blocks lose this file's reference once the new map is logged
+        if (needs_cow) {
+            int ret = unshare_range(inode, offset, size, bsize, &dfops, &runs);
+            if (dfops.count > 0) {
+                log_inode_extents(inode);
+            }
+            if (ret != 0) {
+                xfs_iunlock(inode, XFS_ILOCK_EXCL);
+                return write_fail(inode, &runs, bsize, &dfops, iolock);
+            }
+        }
+        
+        // Walk the range and allocate each run of unmapped blocks as one extent
+        uint64_t i = 0;
+        while (i < num_blocks) {
+            uint64_t logical_block = block_start + i;
+            
+            // Check if this logical block is already mapped
+            if (find_extent_for_offset(inode, logical_block) != NULL) {
+                i++;
+                continue;
+            }
             
-            uint64_t physical_block = xfs_alloc_blocks(ag_id, 1);
-            if (physical_block == 0) {
-                printf("[XFS Write] Failed to allocate block in AG %d\n", ag_id);
-                return -1; // Allocation failed
+            // Measure the hole starting here
+            uint64_t run = 1;
+            while (i + run < num_blocks && find_extent_for_offset(inode, logical_block + run) == NULL) {
+                run++;
+            }
+            
+            // Ask the AG selection policy for the whole run (at most one AG's worth), halving it if no AG has that much contiguous space
+            uint64_t max_run = ag_blocks() - ag_first_data_block();
+            uint64_t physical_block = 0;
+            int count = alloc_file_run(inode, logical_block, (int)(run > max_run ? max_run : run), &physical_block);
+            int ag_id = ag_fsb_to_agno(physical_block);
+            if (count == 0) {
+                trace_xfs(XFS_TRACE_WRITE_ALLOC_FAIL, inode->inode_num, ag_id, logical_block, 0);
+                xfs_iunlock(inode, XFS_ILOCK_EXCL);
+                return write_fail(inode, &runs, bsize, &dfops, iolock); // Allocation failed
             }
             
             // Add the new extent to the inode
-            if (add_extent_to_inode(inode, logical_block, physical_block, 1) != 0) {
-                // If can't add to inode, free the allocated block
-                xfs_free_blocks(ag_id, physical_block, 1);
-                return -1;
+            if (add_extent_to_inode(inode, logical_block, physical_block, count, XFS_EXT_NORM) != 0) {
+                // If can't add to inode, free the allocated blocks
+                free_file_run(inode, physical_block, count);
+                xfs_iunlock(inode, XFS_ILOCK_EXCL);
+                return write_fail(inode, &runs, bsize, &dfops, iolock);
             }
+            write_runs_add(&runs, logical_block, physical_block, count, bsize);
             
-            printf("[XFS Write] Allocated physical block %lu for logical block %lu\n", physical_block, logical_block);
+            // Freed blocks keep their old contents: zero a new block the write only
+            // partly covers before the extent is visible to other I/O
+            uint64_t run_end = logical_block + count;
+            int zero_head = offset % bsize != 0 && block_start >= logical_block && block_start < run_end;
+            int zero_tail = (offset + size) % bsize != 0 && block_end >= logical_block && block_end < run_end;
+            if ((zero_head && disk_zero((physical_block + block_start - logical_block) * bsize, bsize) != 0) ||
+                (zero_tail && disk_zero((physical_block + block_end - logical_block) * bsize, bsize) != 0)) {
+                xfs_iunlock(inode, XFS_ILOCK_EXCL);
+                return write_fail(inode, &runs, bsize, &dfops, iolock);
+            }
+            
+            trace_xfs(XFS_TRACE_WRITE_ALLOC, inode->inode_num, ag_id, logical_block, physical_block);
+            i += count;
         }
+        
+        xfs_iunlock(inode, XFS_ILOCK_EXCL);
+    }
+    
+    // Drop the references to the blocks copy on write replaced
+    if (xfs_defer_finish(&dfops) != 0) {
+        return write_fail(inode, &runs, bsize, &dfops, iolock);
     }
     
     // At this point, we have all necessary blocks allocated
     // Commit a transaction barrier before writing actual data
-    printf("[XFS Write] Barrier: Waiting for log flush...\n");
+    uint64_t barrier_start = xfs_stats_now();
     if (trans_commit_barrier() != 0) {
-        printf("[XFS Write] Failed to commit barrier\n");
-        return -1;
+        return write_fail(inode, &runs, bsize, &dfops, iolock);
     }
-    printf("[XFS Write] Barrier: Log flushed. Proceeding with data write.\n");
+    trace_xfs(XFS_TRACE_WRITE_BARRIER, inode->inode_num, xfs_stats_now() - barrier_start, 0, 0);
     
-    // Now perform the actual writes to disk
+    // Now perform the actual writes to disk; the extent map is stable under the shared ILOCK
+    xfs_ilock(inode, XFS_ILOCK_SHARED);
     size_t bytes_written = 0;
+    int wrote_unwritten = 0;
+    char *zeros = NULL;
     while (bytes_written < size) {
         // Calculate the current logical block and offset within that block
-        uint64_t current_logical_block = (offset + bytes_written) / XFS_BLOCK_SIZE;
-        size_t offset_in_block = (offset + bytes_written) % XFS_BLOCK_SIZE;
+        uint64_t current_logical_block = (offset + bytes_written) / bsize;
+        size_t offset_in_block = (offset + bytes_written) % bsize;
         
         // Find the physical extent for this logical block
         xfs_extent_t *extent = find_extent_for_offset(inode, current_logical_block);
         if (extent == NULL) {
-            printf("[XFS Write] Error: No extent found for logical block %lu during write\n", current_logical_block);
-            return -1;
+            trace_xfs(XFS_TRACE_WRITE_ERROR, inode->inode_num, current_logical_block, 0, 0);
+            free(zeros);
+            xfs_iunlock(inode, XFS_ILOCK_SHARED);
+            return write_fail(inode, &runs, bsize, &dfops, iolock);
         }
         
         // Calculate the physical block for this logical block
         uint64_t logical_block_offset = current_logical_block - extent->start_off;
         uint64_t physical_block = extent->start_block + logical_block_offset;
         
-        // Calculate how much data to write in this block (either remaining in block or remaining in buffer)
-        size_t bytes_to_write_in_block = XFS_BLOCK_SIZE - offset_in_block;
+        // Write the rest of a written extent in one copy; unwritten blocks go one at a time
+        uint64_t blocks = extent->state == XFS_EXT_UNWRITTEN ? 1 : extent->block_count - logical_block_offset;
+        size_t bytes_to_write_in_block = blocks * bsize - offset_in_block;
         if (bytes_to_write_in_block > (size - bytes_written)) {
             bytes_to_write_in_block = size - bytes_written;
         }
         
         // Calculate the disk offset for this physical block
-        uint64_t disk_offset = physical_block * XFS_BLOCK_SIZE;
+        uint64_t disk_offset = physical_block * bsize;
+        
+        // An unwritten block only partly covered by this write is zeroed first, so
+        // stale bytes around the data cannot become visible once it is converted
+        int zero_first = 0;
+        if (extent->state == XFS_EXT_UNWRITTEN) {
+            wrote_unwritten = 1;
+            zero_first = bytes_to_write_in_block < bsize;
+            if (zero_first && zeros == NULL && (zeros = (char *)calloc(1, bsize)) == NULL) {
+                xfs_iunlock(inode, XFS_ILOCK_SHARED);
+                return write_fail(inode, &runs, bsize, &dfops, iolock);
+            }
+        }
         
         // Write the data to the disk
-        if (disk_write(disk_offset + offset_in_block, 
+        if ((zero_first && disk_write(disk_offset, zeros, bsize) != 0) ||
+            disk_write(disk_offset + offset_in_block, 
                       (char*)buffer + bytes_written, 
                       bytes_to_write_in_block) != 0) {
-            printf("[XFS Write] Failed to write to disk at offset %lu\n", disk_offset + offset_in_block);
-            return -1;
+            trace_xfs(XFS_TRACE_WRITE_ERROR, inode->inode_num, current_logical_block, disk_offset + offset_in_block, 0);
+            free(zeros);
+            xfs_iunlock(inode, XFS_ILOCK_SHARED);
+            return write_fail(inode, &runs, bsize, &dfops, iolock);
         }
         
         bytes_written += bytes_to_write_in_block;
     }
+    xfs_iunlock(inode, XFS_ILOCK_SHARED);
+    free(zeros);
+    
+    // I/O completion: convert every unwritten block the write covered in one logged change
+    if (wrote_unwritten) {
+        xfs_ilock(inode, XFS_ILOCK_EXCL);
+        int ret = convert_unwritten(inode, block_start, block_end + 1, bsize);
+        log_inode_extents(inode);
+        xfs_iunlock(inode, XFS_ILOCK_EXCL);
+        if (ret != 0) {
+            xfs_iunlock(inode, iolock);
+            return -1;
+        }
+    }
     
-    // Update the file size if necessary
-    off_t new_size = offset + size;
+    // Update the file size if necessary (only extending writes, which hold the IOLOCK exclusively)
+    uint64_t new_size = offset + size;
     if (new_size > inode->di_size) {
+        xfs_ilock(inode, XFS_ILOCK_EXCL);
         inode->di_size = new_size;
+        xfs_iunlock(inode, XFS_ILOCK_EXCL);
     }
     
-    printf("[XFS Write] Successfully wrote %zu bytes at offset %ld\n", size, offset);
+    xfs_iunlock(inode, iolock);
+    
+    trace_xfs(XFS_TRACE_WRITE_DONE, inode->inode_num, offset, bytes_written, 0);
     return bytes_written;
 }
 
+// Write data to a file (simulated)
+int xfs_sim_write(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
+    uint64_t start_ns = xfs_stats_now();
+    int ret = xfs_sim_write_internal(inode, buffer, size, offset);
+    xfs_stats_record(XFS_STAT_WRITE, start_ns);
+    return ret;
+}
+
+// Preallocate [offset, offset + len) as unwritten extents; unless
+// XFS_FALLOC_KEEP_SIZE is set the file grows to cover the range
+int xfs_fallocate(xfs_inode_t *inode, uint64_t offset, uint64_t len, int flags) {
+    uint32_t bsize = ag_blocksize();
+    if (!inode || bsize == 0 || len == 0 || offset + len < offset) {
+        return -1;
+    }
+    
+    uint64_t block_start = offset / bsize;
+    uint64_t block_end = (offset + len - 1) / bsize + 1;
+    uint64_t allocated = 0;
+    
+    xfs_ilock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    int ret = inode->di_nlink == 0 ? -1 : 0; // Unlinked while waiting for the locks
+    
+    // Allocate each hole in the range as large a contiguous run as the AGs allow
+    uint64_t max_run = ag_blocks() - ag_first_data_block();
+    for (uint64_t lblk = block_start; lblk < block_end && ret == 0; ) {
+        xfs_extent_t *ext = find_extent_for_offset(inode, lblk);
+        if (ext != NULL) {
+            lblk = ext->start_off + ext->block_count;
+            continue;
+        }
+        
+        uint64_t run = 1;
+        while (lblk + run < block_end && find_extent_for_offset(inode, lblk + run) == NULL) {
+            run++;
+        }
+        
+        uint64_t physical_block = 0;
+        int count = alloc_file_run(inode, lblk, (int)(run > max_run ? max_run : run), &physical_block);
+        if (count == 0) {
+            ret = -1; // Out of space or over quota; what was preallocated so far is kept
+            break;
+        }
+        if (add_extent_to_inode(inode, lblk, physical_block, count, XFS_EXT_UNWRITTEN) != 0) {
+            free_file_run(inode, physical_block, count);
+            ret = -1;
+            break;
+        }
+        allocated += count;
+        lblk += count;
+    }
+    
+    if (!(flags & XFS_FALLOC_KEEP_SIZE) && offset + len > inode->di_size && ret == 0) {
+        inode->di_size = offset + len;
+    }
+    log_inode_extents(inode);
+    xfs_iunlock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    
+    trace_xfs(XFS_TRACE_FALLOC, inode->inode_num, offset, len, allocated);
+    return ret;
+}
+
+// Change the size of a file, unmapping and freeing the blocks past a new, smaller EOF
+int xfs_truncate(xfs_inode_t *inode, uint64_t new_size) {
+    uint32_t bsize = ag_blocksize();
+    if (!inode || bsize == 0) {
+        return -1;
+    }
+    
+    xfs_defer_t dfops;
+    xfs_defer_init(&dfops);
+    
+    // Size changes take both locks exclusively, like an extending write
+    xfs_ilock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    int ret = 0;
+    if (new_size < inode->di_size) {
+        // Zero the tail of the new last block so a later extension reads zeros
+        uint64_t first_gone = (new_size + bsize - 1) / bsize;
+        ret = unmap_range(inode, first_gone, UINT64_MAX, &dfops);
+        if (ret == 0 && new_size % bsize != 0) {
+            ret = zero_range(inode, new_size, bsize - new_size % bsize, bsize, &dfops);
+        }
+    }
+    if (ret == 0) {
+        inode->di_size = new_size;
+        log_inode_extents(inode);
+    }
+    xfs_iunlock(inode, XFS_ILOCK_EXCL);
+    
+    // The blocks are freed after the map change is logged, in one batch per AG
+    if (xfs_defer_finish(&dfops) != 0) {
+        ret = -1;
+    }
+    xfs_iunlock(inode, XFS_IOLOCK_EXCL);
+    return ret;
+}
+
+// Deallocate [offset, offset + len) of a file, leaving a hole; the file size is unchanged
+int xfs_punch_hole(xfs_inode_t *inode, uint64_t offset, uint64_t len) {
+    uint32_t bsize = ag_blocksize();
+    if (!inode || bsize == 0 || offset + len < offset) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    
+    xfs_defer_t dfops;
+    xfs_defer_init(&dfops);
+    
+    xfs_ilock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    
+    // Whole blocks are unmapped; partial blocks at either edge are zeroed in place
+    uint64_t end = offset + len;
+    uint64_t first_full = (offset + bsize - 1) / bsize;
+    uint64_t end_full = end / bsize;
+    int ret;
+    if (first_full < end_full) {
+        ret = unmap_range(inode, first_full, end_full, &dfops);
+        if (ret == 0 && offset < first_full * bsize) {
+            ret = zero_range(inode, offset, first_full * bsize - offset, bsize, &dfops);
+        }
+        if (ret == 0 && end > end_full * bsize) {
+            ret = zero_range(inode, end_full * bsize, end - end_full * bsize, bsize, &dfops);
+        }
+    } else {
+        ret = zero_range(inode, offset, len, bsize, &dfops);
+    }
+    if (ret == 0 && dfops.count > 0) {
+        log_inode_extents(inode);
+    }
+    xfs_iunlock(inode, XFS_ILOCK_EXCL);
+    
+    if (xfs_defer_finish(&dfops) != 0) {
+        ret = -1;
+    }
+    xfs_iunlock(inode, XFS_IOLOCK_EXCL);
+    return ret;
+}
+
+static int reflink_cmp_fsb(const void *a, const void *b) {
+    const xfs_extent_t *x = (const xfs_extent_t *)a;
+    const xfs_extent_t *y = (const xfs_extent_t *)b;
+    return (x->start_block > y->start_block) - (x->start_block < y->start_block);
+}
+
+// Gather the extents of shared[*i..] that lie in one AG into batch,
+// advancing *i past them; returns the AG
+static int reflink_ag_batch(const xfs_extent_t *shared, int nshared, int *i, xfs_agext_t *batch, int *n) {
+    int ag_id = ag_fsb_to_agno(shared[*i].start_block);
+    *n = 0;
+    while (*i < nshared && ag_fsb_to_agno(shared[*i].start_block) == ag_id) {
+        batch[*n].agbno = (uint32_t)ag_fsb_to_agbno(shared[*i].start_block);
+        batch[*n].len = (uint32_t)shared[*i].block_count;
+        (*n)++;
+        (*i)++;
+    }
+    return ag_id;
+}
+
+// Make dst a copy of src that shares src's written blocks: each AG's shared
+// extents gain an owner in one refcount update, dst's old blocks are
+// released and dst gets src's map. Everything that can fail is done before
+// dst's map is touched, so a failed clone leaves dst as it was. No data is
+// copied; unwritten extents read as zeros either way, so they become holes
+// in dst.
+int xfs_reflink_clone(xfs_inode_t *src, xfs_inode_t *dst) {
+    if (!src || !dst || src == dst || ag_blocksize() == 0) {
+        return -1;
+    }
+    
+    // Both inodes are locked exclusively, lower inode number first
+    xfs_inode_t *first = src->inode_num < dst->inode_num ? src : dst;
+    xfs_inode_t *second = first == src ? dst : src;
+    xfs_ilock(first, XFS_IOLOCK_EXCL);
+    xfs_ilock(second, XFS_IOLOCK_EXCL);
+    xfs_ilock(first, XFS_ILOCK_EXCL);
+    xfs_ilock(second, XFS_ILOCK_EXCL);
+    if (src->di_nlink == 0 || dst->di_nlink == 0) {
+        // Unlinked while waiting for the locks
+        xfs_iunlock(second, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+        xfs_iunlock(first, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+        return -1;
+    }
+    
+    // Written extents in block order, so each AG's share is contiguous
+    xfs_extent_t shared[XFS_MAX_EXTENTS];
+    int nshared = 0;
+    uint64_t blocks = 0;
+    for (int i = 0; i < src->extent_count; i++) {
+        if (src->extents[i].state == XFS_EXT_NORM) {
+            shared[nshared++] = src->extents[i];
+            blocks += src->extents[i].block_count;
+        }
+    }
+    qsort(shared, nshared, sizeof(xfs_extent_t), reflink_cmp_fsb);
+    
+    // Shared blocks count against dst's quotas as well as src's
+    int charged = xfs_quota_reserve_blocks(dst, blocks) == 0;
+    int ret = charged ? 0 : -1;
+    
+    // On failure, AGs before the failing one drop the owner they gained
+    int done = 0;
+    for (int i = 0; i < nshared && ret == 0; ) {
+        xfs_agext_t batch[XFS_MAX_EXTENTS];
+        int n;
+        int ag_id = reflink_ag_batch(shared, nshared, &i, batch, &n);
+        if (xfs_refcount_increase(ag_id, batch, n) != 0) {
+            ret = -1;
+        } else {
+            done = i;
+        }
+    }
+    
+    // dst's whole map goes, so no extent is split and only the first queued
+    // free can fail, before anything is unmapped
+    xfs_defer_t dfops;
+    xfs_defer_init(&dfops);
+    if (ret == 0 && unmap_range(dst, 0, UINT64_MAX, &dfops) != 0) {
+        ret = -1;
+    }
+    
+    if (ret == 0) {
+        memcpy(dst->extents, shared, nshared * sizeof(xfs_extent_t));
+        dst->extent_count = nshared;
+        dst->di_size = src->di_size;
+        src->di_flags |= XFS_DIFLAG_REFLINK;
+        dst->di_flags |= XFS_DIFLAG_REFLINK;
+        log_inode_extents(dst);
+    } else {
+        for (int i = 0; i < done; ) {
+            xfs_agext_t batch[XFS_MAX_EXTENTS];
+            int n;
+            int ag_id = reflink_ag_batch(shared, done, &i, batch, &n);
+            xfs_refcount_decrease(ag_id, batch, n);
+        }
+        if (charged) {
+            xfs_quota_unreserve_blocks(dst, blocks);
+        }
+    }
+    xfs_iunlock(second, XFS_ILOCK_EXCL);
+    xfs_iunlock(first, XFS_ILOCK_EXCL);
+    
+    if (xfs_defer_finish(&dfops) != 0) {
+        ret = -1;
+    }
+    xfs_iunlock(second, XFS_IOLOCK_EXCL);
+    xfs_iunlock(first, XFS_IOLOCK_EXCL);
+    
+    trace_xfs(XFS_TRACE_REFLINK, src->inode_num, dst->inode_num, nshared, blocks);
+    return ret;
+}
+
 // Global inode storage for simulation
-static xfs_inode_t inodes[100]; // Simulate storing up to 100 inodes
-static char inode_names[100][64]; // Store names for up to 100 inodes (max 63 chars + null terminator)
+#define XFS_MAX_INODES 100
+static xfs_inode_t inodes[XFS_MAX_INODES]; // Simulate storing up to 100 inodes
+static char inode_names[XFS_MAX_INODES][64]; // Store names for up to 100 inodes (max 63 chars + null terminator)
 static int max_inode_num = 0;
 static int initialized = 0;
+static int free_inodes = 0; // Unlinked slots below max_inode_num, reused before the table grows
+static pthread_mutex_t inode_table_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes inode creation
 
 // Helper to initialize inodes
 static void initialize_inodes(void) {
     if (!initialized) {
-        for (int i = 0; i < 100; i++) {
+        for (int i = 0; i < XFS_MAX_INODES; i++) {
             inodes[i].inode_num = 0;
             inodes[i].di_size = 0;
             inodes[i].extent_count = 0;
@@ -150,35 +993,83 @@ static void initialize_inodes(void) {
     }
 }
 
-// Format the disk (mkfs equivalent)
-int xfs_mkfs(size_t disk_size) {
-    // Initialize the disk
-    if (disk_init(disk_size) != 0) {
-        return -1;
-    }
-
-    // Initialize allocation groups
-    if (ag_init_headers() != 0) {
+// Format one AG: headers plus an empty free space bitmap
+static int mkfs_init_ag(int ag_id, void *arg) {
+    (void)arg;
+    if (ag_write_header(ag_id) != 0) {
         return -1;
     }
+    return xfs_ag_init_bitmap(ag_id);
+}
 
-    // Format the disk (write AG headers)
-    if (ag_write_headers() != 0) {
+// Format the disk with the given geometry (mkfs equivalent)
+int xfs_mkfs_opts(const xfs_mkfs_opts_t *opts) {
+    uint32_t blocksize = opts->blocksize ? opts->blocksize : XFS_BLOCK_SIZE;
+    if (blocksize == 0 || opts->disk_size < blocksize) {
         return -1;
     }
-
-    // Initialize the allocator for each AG
-    for (int i = 0; i < NUM_AGS; i++) {
-        if (xfs_ag_init_alloc(i) != 0) {
+    uint64_t disk_blocks = opts->disk_size / blocksize;
+    
+    // Derive whichever of AG count and AG size was not given
+    uint64_t agcount = opts->agcount;
+    uint64_t agblocks;
+    if (opts->agsize != 0) {
+        agblocks = opts->agsize / blocksize;
+        if (agblocks == 0) {
             return -1;
         }
+        if (agcount == 0) {
+            agcount = disk_blocks / agblocks;
+        }
+    } else {
+        if (agcount == 0) {
+            agcount = XFS_DEFAULT_AGCOUNT;
+        }
+        agblocks = disk_blocks / agcount;
+    }
+    
+    // The AGs must fit on the disk and be addressable by 32-bit AG block numbers
+    if (agcount == 0 || agcount > UINT32_MAX || agblocks > UINT32_MAX ||
+        agcount * agblocks > disk_blocks) {
+        return -1;
+    }
+    
+    // Drop any in-core state from a previous mount while its disk still exists
+    xfs_alloc_unmount();
+    xfs_quota_reset();
+    
+    // Initialize the disk
+    if (disk_init(opts->disk_size) != 0) {
+        return -1;
     }
+    
+    // Initialize allocation groups
+    if (ag_init_headers((uint32_t)agcount, (uint32_t)agblocks, blocksize) != 0) {
+        return -1;
+    }
+    
+    // Format the disk: AGs are independent, so their headers and bitmaps are written in parallel
+    return ag_foreach_parallel(mkfs_init_ag, NULL, opts->threads);
+}
 
-    return 0;
+// Format the disk with the default geometry (mkfs equivalent)
+int xfs_mkfs(size_t disk_size) {
+    xfs_mkfs_opts_t opts = { disk_size, 0, 0, 0, 0 };
+    return xfs_mkfs_opts(&opts);
 }
 
-// Mount the filesystem
-int xfs_mount(void) {
+// Mount the filesystem with options
+int xfs_mount_opts(const xfs_mount_opts_t *opts) {
+    // Read the geometry back from the superblock
+    if (ag_mount() != 0) {
+        return -1;
+    }
+    
+    // Set up the free space state of every AG (loaded on first use unless eager)
+    if (xfs_alloc_mount(opts->eager_ags) != 0) {
+        return -1;
+    }
+    
     // Initialize transaction system
     if (trans_init() != 0) {
         return -1;
@@ -187,31 +1078,76 @@ int xfs_mount(void) {
     return 0;
 }
 
+// Mount the filesystem
+int xfs_mount(void) {
+    xfs_mount_opts_t opts = { 0 };
+    return xfs_mount_opts(&opts);
+}
+
 // Create a new file with a specific name (allocate an inode)
 int xfs_create_named_file(const char* filename) {
+    pthread_mutex_lock(&inode_table_lock);
     initialize_inodes();
 
-    max_inode_num++;
+    // Reuse an unlinked slot (its locks are still initialized), else grow the table
+    int ino = max_inode_num + 1;
+    if (free_inodes > 0) {
+        for (int i = 1; i <= max_inode_num; i++) {
+            if (__atomic_load_n(&inodes[i].inode_num, __ATOMIC_ACQUIRE) == 0) {
+                ino = i;
+                free_inodes--;
+                break;
+            }
+        }
+    }
+    if (ino >= XFS_MAX_INODES) {
+        pthread_mutex_unlock(&inode_table_lock);
+        return -1; // Inode table full
+    }
 
     // Initialize the new inode
-    inodes[max_inode_num].inode_num = max_inode_num;
-    inodes[max_inode_num].di_mode = 0x1FF;  // -rw-rw-rw- permissions
-    inodes[max_inode_num].di_uid = 1000;
-    inodes[max_inode_num].di_gid = 1000;
-    inodes[max_inode_num].di_nlink = 1;
-    inodes[max_inode_num].di_size = 0;
-    inodes[max_inode_num].extent_count = 0;
+    if (ino > max_inode_num && xfs_inode_init_locks(&inodes[ino]) != 0) {
+        pthread_mutex_unlock(&inode_table_lock);
+        return -1;
+    }
+    inodes[ino].di_mode = 0x1FF;  // -rw-rw-rw- permissions
+    inodes[ino].di_uid = 1000;
+    inodes[ino].di_gid = 1000;
+    inodes[ino].di_nlink = 1;
+    inodes[ino].di_flags = 0;
+    inodes[ino].di_size = 0;
+    inodes[ino].extent_count = 0;
+    inodes[ino].i_udquot = NULL;
+    inodes[ino].i_gdquot = NULL;
+
+    // Charge the inode to its owner and group
+    if (xfs_quota_attach(&inodes[ino]) != 0 || xfs_quota_reserve_inode(&inodes[ino]) != 0) {
+        if (ino <= max_inode_num) {
+            free_inodes++;
+        } else {
+            xfs_inode_destroy_locks(&inodes[ino]);
+        }
+        pthread_mutex_unlock(&inode_table_lock);
+        return -1;
+    }
 
     // Copy the filename
     if (filename != NULL) {
-        strncpy(inode_names[max_inode_num], filename, 63);
-        inode_names[max_inode_num][63] = '\0'; // Ensure null termination
+        strncpy(inode_names[ino], filename, 63);
+        inode_names[ino][63] = '\0'; // Ensure null termination
     } else {
-        snprintf(inode_names[max_inode_num], 64, "unnamed_%d", max_inode_num);
+        snprintf(inode_names[ino], 64, "unnamed_%d", ino);
+    }
+
+    // Publish the fully initialized inode
+    __atomic_store_n(&inodes[ino].inode_num, ino, __ATOMIC_RELEASE);
+    if (ino > max_inode_num) {
+        max_inode_num = ino;
     }
+    pthread_mutex_unlock(&inode_table_lock);
 
-    printf("File '%s' created. Allocated Inode #%d\n", inode_names[max_inode_num], max_inode_num);
-    return max_inode_num;
+    trace_xfs(XFS_TRACE_CREATE, ino, 0, 0, 0);
+    return ino;
 }
 
 // Create a new file (allocate an inode) - creates with a default name
@@ -219,16 +1155,160 @@ int xfs_create_file(void) {
     return xfs_create_named_file(NULL);
 }
 
+// Remove a file: free all of its blocks and release its inode for reuse
+int xfs_unlink(int inode_num) {
+    uint32_t bsize = ag_blocksize();
+    xfs_inode_t *inode = get_inode_ptr(inode_num);
+    if (inode == NULL || bsize == 0) {
+        return -1;
+    }
+
+    // Drop the name first so no new lookup can find the file
+    pthread_mutex_lock(&inode_table_lock);
+    char name0 = inode_names[inode_num][0];
+    if (name0 == '\0') {
+        pthread_mutex_unlock(&inode_table_lock);
+        return -1; // Already being unlinked
+    }
+    inode_names[inode_num][0] = '\0';
+    pthread_mutex_unlock(&inode_table_lock);
+
+    xfs_defer_t dfops;
+    xfs_defer_init(&dfops);
+
+    // Wait out I/O already in flight, then unmap everything. The whole map
+    // goes, so no extent is split and only the first queued free can fail,
+    // before anything is unmapped: the file is then left as it was.
+    xfs_ilock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    if (unmap_range(inode, 0, UINT64_MAX, &dfops) != 0) {
+        xfs_iunlock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+        pthread_mutex_lock(&inode_table_lock);
+        inode_names[inode_num][0] = name0;
+        pthread_mutex_unlock(&inode_table_lock);
+        return -1;
+    }
+
+    // A zero link count marks the inode dead: I/O that looked it up before
+    // the unlink and gets the IOLOCK after it fails instead of allocating
+    int ret = 0;
+    inode->di_size = 0;
+    inode->di_nlink = 0;
+    xfs_quota_unreserve_inode(inode);
+    trans_add_object(TRANS_OBJ_KEY(TRANS_OBJ_INODE, inode->inode_num), &inode->inode_num, sizeof(inode->inode_num));
+    xfs_iunlock(inode, XFS_ILOCK_EXCL);
+
+    if (xfs_defer_finish(&dfops) != 0) {
+        ret = -1;
+    }
+    xfs_iunlock(inode, XFS_IOLOCK_EXCL);
+
+    // Only now may the slot be handed out again
+    pthread_mutex_lock(&inode_table_lock);
+    __atomic_store_n(&inode->inode_num, 0, __ATOMIC_RELEASE);
+    free_inodes++;
+    pthread_mutex_unlock(&inode_table_lock);
+
+    trace_xfs(XFS_TRACE_UNLINK, inode_num, 0, 0, 0);
+    return ret;
+}
+
+// Give a file a new owner and group, moving its usage between their quotas
+int xfs_chown(xfs_inode_t *inode, uint32_t uid, uint32_t gid) {
+    if (!inode) {
+        return -1;
+    }
+
+    xfs_ilock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    uint64_t blocks = 0;
+    for (int i = 0; i < inode->extent_count; i++) {
+        blocks += inode->extents[i].block_count;
+    }
+    int ret = xfs_quota_chown(inode, uid, gid, blocks);
+    if (ret == 0) {
+        inode->di_uid = uid;
+        inode->di_gid = gid;
+        uint32_t owner[2] = { uid, gid };
+        trans_add_object(TRANS_OBJ_KEY(TRANS_OBJ_INODE, inode->inode_num), owner, sizeof(owner));
+    }
+    xfs_iunlock(inode, XFS_IOLOCK_EXCL | XFS_ILOCK_EXCL);
+    return ret;
+}
+
+// Drop every inode from the in-core table; slots keep their locks for reuse
+void xfs_inode_table_reset(void) {
+    xfs_quota_reset();
+    pthread_mutex_lock(&inode_table_lock);
+    initialize_inodes();
+    for (int i = 1; i <= max_inode_num; i++) {
+        __atomic_store_n(&inodes[i].inode_num, 0, __ATOMIC_RELEASE);
+        inode_names[i][0] = '\0';
+    }
+    free_inodes = max_inode_num;
+    pthread_mutex_unlock(&inode_table_lock);
+}
+
+// Install an inode under its own number and name (loading an image)
+int xfs_inode_restore(const xfs_inode_t *src, const char *name) {
+    int ino = (int)src->inode_num;
+    if (ino <= 0 || ino >= XFS_MAX_INODES || src->extent_count < 0 || src->extent_count > XFS_MAX_EXTENTS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&inode_table_lock);
+    initialize_inodes();
+
+    // Slots the table grows over become free slots with initialized locks
+    while (max_inode_num < ino) {
+        if (xfs_inode_init_locks(&inodes[max_inode_num + 1]) != 0) {
+            pthread_mutex_unlock(&inode_table_lock);
+            return -1;
+        }
+        inodes[max_inode_num + 1].inode_num = 0;
+        inode_names[max_inode_num + 1][0] = '\0';
+        free_inodes++;
+        __atomic_store_n(&max_inode_num, max_inode_num + 1, __ATOMIC_RELEASE);
+    }
+    if (inodes[ino].inode_num != 0) {
+        pthread_mutex_unlock(&inode_table_lock);
+        return -1;  // Already in use
+    }
+
+    xfs_inode_t *ip = &inodes[ino];
+    ip->di_mode = src->di_mode;
+    ip->di_flags = src->di_flags;
+    ip->di_uid = src->di_uid;
+    ip->di_gid = src->di_gid;
+    ip->di_nlink = src->di_nlink;
+    ip->di_size = src->di_size;
+    ip->extent_count = src->extent_count;
+    memcpy(ip->extents, src->extents, sizeof(ip->extents));
+    ip->i_udquot = NULL;
+    ip->i_gdquot = NULL;
+    strncpy(inode_names[ino], name, 63);
+    inode_names[ino][63] = '\0';
+
+    __atomic_store_n(&ip->inode_num, (uint32_t)ino, __ATOMIC_RELEASE);
+    free_inodes--;
+    pthread_mutex_unlock(&inode_table_lock);
+    return 0;
+}
+
 // Helper to get an inode by number
 xfs_inode_t* get_inode_ptr(int inode_num) {
     initialize_inodes();
 
-    if (inode_num <= 0 || inode_num > max_inode_num) {
-        return NULL; // Invalid inode number
+    if (inode_num <= 0 || inode_num > get_max_inode_num() ||
+        __atomic_load_n(&inodes[inode_num].inode_num, __ATOMIC_ACQUIRE) == 0) {
+        return NULL; // Invalid or unlinked inode number
     }
     return &inodes[inode_num];
 }
 
+// Helper to get the highest inode number in use
+int get_max_inode_num(void) {
+    return __atomic_load_n(&max_inode_num, __ATOMIC_ACQUIRE);
+}
+
 // Helper to get an inode by filename
 xfs_inode_t* get_inode_by_name(const char* filename) {
     initialize_inodes();
@@ -243,6 +1323,14 @@ xfs_inode_t* get_inode_by_name(const char* filename) {
     return NULL; // File not found
 }
 
+// Helper to get the filename of an inode
+const char* get_inode_name(int inode_num) {
+    if (get_inode_ptr(inode_num) == NULL) {
+        return NULL;
+    }
+    return inode_names[inode_num];
+}
+
 // Helper to get inode number by filename
 int get_inode_num_by_name(const char* filename) {
     initialize_inodes();
@@ -265,27 +1353,65 @@ void print_inode_details(int inode_num) {
         return;
     }
 
+    xfs_ilock(node, XFS_ILOCK_SHARED);
     printf("\n--- INODE %d METADATA ---\n", inode_num);
     printf("Size: %llu bytes\n", (unsigned long long)node->di_size);
+    if (node->di_flags & XFS_DIFLAG_REFLINK) {
+        printf("Flags: reflink\n");
+    }
     printf("Extents: %d\n", node->extent_count);
     for(int i = 0; i < node->extent_count; i++) {
-        printf("  [%d] Logical: %llu -> PhysBlock: %llu (Len: %llu)\n",
+        printf("  [%d] Logical: %llu -> PhysBlock: %llu (AG %d, Len: %llu)%s\n",
                i,
                (unsigned long long)node->extents[i].start_off,
                (unsigned long long)node->extents[i].start_block,
-               (unsigned long long)node->extents[i].block_count);
+               ag_fsb_to_agno(node->extents[i].start_block),
+               (unsigned long long)node->extents[i].block_count,
+               node->extents[i].state == XFS_EXT_UNWRITTEN ? " unwritten" : "");
     }
     printf("--------------------------\n");
+    xfs_iunlock(node, XFS_ILOCK_SHARED);
 }
 
 // Print log/journal queue status
 void print_log_queue_status(void) {
     int queue_length = get_log_queue_length();
+    trans_log_stats_t ls;
+    trans_get_log_stats(&ls);
     printf("\n--- LOG/JOURNAL QUEUE STATUS ---\n");
     printf("Pending transactions in queue: %d\n", queue_length);
+    printf("Log space: %llu of %llu bytes used (%.1f%%), AIL push at %d%%\n",
+           (unsigned long long)ls.used, (unsigned long long)ls.log_size,
+           ls.used * 100.0 / ls.log_size, ls.ail_push_pct);
+    printf("CIL: %llu changes, %llu bytes (checkpoint at %llu)\n",
+           (unsigned long long)ls.cil_items, (unsigned long long)ls.cil_bytes,
+           (unsigned long long)ls.cil_push);
+    printf("AIL: %llu objects, tail LSN %llu, head LSN %llu\n",
+           (unsigned long long)ls.ail_items, (unsigned long long)ls.tail_lsn,
+           (unsigned long long)ls.head_lsn);
+    printf("Checkpoints written: %llu (%llu changes, %llu merged in the CIL)\n",
+           (unsigned long long)ls.checkpoints, (unsigned long long)ls.checkpoint_items,
+           (unsigned long long)ls.relogged);
+    printf("Written back: %llu objects; reservations that waited for space: %llu\n",
+           (unsigned long long)ls.written_back, (unsigned long long)ls.space_waits);
     printf("-------------------------------\n");
 }
 
+// Print a UUID in the usual 8-4-4-4-12 form
+static void print_uuid(const char *label, const uint8_t *uuid) {
+    printf("%s: ", label);
+    for (int i = 0; i < XFS_UUID_SIZE; i++) {
+        printf("%02x%s", uuid[i], (i == 3 || i == 5 || i == 7 || i == 9) ? "-" : "");
+    }
+    printf("\n");
+}
+
+// Print a header's LSN and whether its CRC matches its contents
+static void print_v5_fields(uint64_t lsn, uint32_t crc, int crc_ok) {
+    printf("LSN: %llu\n", (unsigned long long)lsn);
+    printf("CRC: 0x%08x (%s)\n", crc, crc_ok ? "good" : "BAD");
+}
+
 // Print superblock information
 void print_superblock_info(void) {
     xfs_sb_t sb;
@@ -301,22 +1427,42 @@ void print_superblock_info(void) {
     printf("Block Size: %u bytes\n", sb.sb_blocksize);
     printf("Total Data Blocks: %llu\n", (unsigned long long)sb.sb_dblocks);
     printf("Number of AGs: %llu\n", (unsigned long long)sb.sb_agcount);
+    printf("AG Size: %u blocks\n", sb.sb_agblocks);
     printf("Version: %u\n", sb.sb_versionnum);
+    print_uuid("UUID", sb.sb_uuid);
+    print_v5_fields(sb.sb_lsn, sb.sb_crc, xfs_cksum_verify(&sb, sizeof(sb), offsetof(xfs_sb_t, sb_crc)));
+    printf("CRC32C: %s, %llu verification failures\n", xfs_crc32c_impl(),
+           (unsigned long long)xfs_cksum_failures());
+    printf("--------------------------\n");
+}
+
+// Print logical and resident size of the simulated disk
+void print_disk_info(void) {
+    uint64_t logical = disk_size();
+    uint64_t resident = disk_resident_bytes();
+
+    printf("\n--- SIMULATED DISK ---\n");
+    printf("Logical Size: %llu bytes (%.1f MiB)\n", (unsigned long long)logical, logical / (1024.0 * 1024.0));
+    printf("Resident Size: %llu bytes (%.1f MiB)\n", (unsigned long long)resident, resident / (1024.0 * 1024.0));
+    printf("Chunk Size: %llu bytes\n", (unsigned long long)disk_chunk_size());
+    if (logical > 0) {
+        printf("Resident: %.4f%% of logical\n", 100.0 * resident / logical);
+    }
     printf("--------------------------\n");
 }
 
 // Print AGF (Allocation Group Free Space) information
 void print_agf_info(int ag_id) {
-    if (ag_id < 0 || ag_id >= NUM_AGS) {
+    if (ag_id < 0 || ag_id >= ag_count()) {
         printf("Invalid AG ID: %d\n", ag_id);
         return;
     }
 
     xfs_agf_t agf;
-    uint64_t ag_offset = ag_get_offset(ag_id);
+    uint64_t agf_offset = ag_block_offset(ag_id, XFS_AG_AGF_BLOCK);
 
     // Read the AGF from disk
-    if (disk_read(ag_offset, &agf, sizeof(xfs_agf_t)) != 0) {
+    if (disk_read(agf_offset, &agf, sizeof(xfs_agf_t)) != 0) {
         printf("Error reading AGF for AG %d from disk.\n", ag_id);
         return;
     }
@@ -327,30 +1473,40 @@ void print_agf_info(int ag_id) {
     printf("Free Blocks: %u\n", agf.agf_freeblks);
     printf("Longest Free Space: %u blocks\n", agf.agf_longest);
 
-    // Count number of used vs free blocks
-    int used_blocks = 0;
-    int free_blocks = 0;
-    for (int i = 0; i < 2400; i++) {
-        if (agf.free_blocks[i] == 1) {
-            used_blocks++;
-        } else if (agf.free_blocks[i] == 0) {
-            free_blocks++;
-        }
+    printf("Bitmap Blocks: %u\n", agf.agf_bmblocks);
+    print_v5_fields(agf.agf_lsn, agf.agf_crc, xfs_cksum_verify(&agf, sizeof(agf), offsetof(xfs_agf_t, agf_crc)));
+
+    uint64_t records, shared_blocks;
+    if (agf.agf_refcount_root == 0) {
+        printf("Refcount Btree: empty\n");
+    } else if (xfs_refcount_count(ag_id, &records, &shared_blocks) == 0) {
+        printf("Refcount Btree: root %u, %u levels, %llu records, %llu shared blocks\n",
+               agf.agf_refcount_root, agf.agf_refcount_level,
+               (unsigned long long)records, (unsigned long long)shared_blocks);
+    }
+
+    // Count number of used vs free blocks from the on-disk bitmap
+    int64_t used_blocks = xfs_alloc_count_used(ag_id);
+    if (used_blocks < 0) {
+        printf("Error reading free space bitmap for AG %d from disk.\n", ag_id);
+        printf("--------------------------\n");
+        return;
     }
-    printf("Blocks in use: %d\n", used_blocks);
-    printf("Blocks free: %d\n", free_blocks);
+    long long free_blocks = (long long)agf.agf_length - used_blocks;
+    printf("Blocks in use: %lld\n", (long long)used_blocks);
+    printf("Blocks free: %lld\n", free_blocks);
     printf("--------------------------\n");
 }
 
 // Print AGI (Allocation Group Inode) information
 void print_agi_info(int ag_id) {
-    if (ag_id < 0 || ag_id >= NUM_AGS) {
+    if (ag_id < 0 || ag_id >= ag_count()) {
         printf("Invalid AG ID: %d\n", ag_id);
         return;
     }
 
     xfs_agi_t agi;
-    uint64_t ag_offset = ag_get_offset(ag_id) + 4096; // AGI is at offset 1 block from start of AG
+    uint64_t ag_offset = ag_block_offset(ag_id, XFS_AG_AGI_BLOCK);
 
     // Read the AGI from disk
     if (disk_read(ag_offset, &agi, sizeof(xfs_agi_t)) != 0) {
@@ -363,23 +1519,115 @@ void print_agi_info(int ag_id) {
     printf("Total Inodes: %u\n", agi.agi_count);
     printf("Root of Inode Btree: %u\n", agi.agi_root);
     printf("Free Inodes: %u\n", agi.agi_freecount);
+    print_v5_fields(agi.agi_lsn, agi.agi_crc, xfs_cksum_verify(&agi, sizeof(agi), offsetof(xfs_agi_t, agi_crc)));
     printf("--------------------------\n");
 }
 
 // Print summary of all AGs
 void print_ag_summary(void) {
     printf("\n--- ALLOCATION GROUP SUMMARY ---\n");
-    for (int i = 0; i < NUM_AGS; i++) {
+    for (int i = 0; i < ag_count(); i++) {
         xfs_agf_t agf;
-        uint64_t ag_offset = ag_get_offset(i);
 
-        if (disk_read(ag_offset, &agf, sizeof(xfs_agf_t)) == 0) {
-            printf("AG %d: %u free blocks of %u total\n", i, agf.agf_freeblks, agf.agf_length);
+        if (ag_read_agf(i, &agf) == 0) {
+            int64_t free_extents = xfs_alloc_free_extents(i);
+            printf("AG %d: %u free blocks of %u total", i, agf.agf_freeblks, agf.agf_length);
+            if (free_extents >= 0) {
+                printf(" in %lld free extents", (long long)free_extents);
+            }
+            printf("\n");
+        } else {
+            printf("AG %d: AGF failed verification\n", i);
         }
     }
+    printf("Per-thread pools: %llu blocks reserved\n", (unsigned long long)xfs_alloc_pool_blocks());
     printf("--------------------------------\n");
 }
 
+// Distribution of extents per file
+int xfs_file_extent_hist(xfs_extent_hist_t *h) {
+    if (h == NULL) {
+        return -1;
+    }
+    memset(h, 0, sizeof(*h));
+    for (int i = 1; i <= max_inode_num; i++) {
+        xfs_inode_t *ip = &inodes[i];
+        if (__atomic_load_n(&ip->inode_num, __ATOMIC_ACQUIRE) == 0) {
+            continue;
+        }
+        xfs_ilock(ip, XFS_ILOCK_SHARED);
+        int n = ip->extent_count;
+        xfs_iunlock(ip, XFS_ILOCK_SHARED);
+        h->files++;
+        h->by_count[n]++;
+        h->extents += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Print free extent histograms (one AG, or every AG) and the extents-per-file distribution
+void print_freesp(int ag_id) {
+    if (ag_count() == 0) {
+        printf("Filesystem not mounted.\n");
+        return;
+    }
+    
+    xfs_freesp_t fs;
+    xfs_freesp_t *per_ag = NULL;
+    if (ag_id >= 0) {
+        if (xfs_alloc_freesp(ag_id, &fs) != 0) {
+            printf("Error: Cannot scan AG %d\n", ag_id);
+            return;
+        }
+        printf("\n--- FREE SPACE: AG %d ---\n", ag_id);
+    } else {
+        per_ag = (xfs_freesp_t *)calloc(ag_count(), sizeof(xfs_freesp_t));
+        if (per_ag == NULL || xfs_alloc_freesp_all(&fs, per_ag) != 0) {
+            printf("Error: Cannot scan the AGs\n");
+            free(per_ag);
+            return;
+        }
+        printf("\n--- FREE SPACE ---\n");
+    }
+    
+    printf("%10s %10s %10s %12s %7s\n", "from", "to", "extents", "blocks", "pct");
+    for (int b = 0; b < XFS_FREESP_BUCKETS; b++) {
+        if (fs.extents[b] == 0) {
+            continue;
+        }
+        printf("%10llu %10llu %10llu %12llu %7.2f\n",
+               1ull << b, (2ull << b) - 1,
+               (unsigned long long)fs.extents[b], (unsigned long long)fs.blocks[b],
+               fs.total_blocks ? 100.0 * fs.blocks[b] / fs.total_blocks : 0.0);
+    }
+    printf("total free extents %llu, free blocks %llu, average extent %.1f blocks, longest %llu\n",
+           (unsigned long long)fs.total_extents, (unsigned long long)fs.total_blocks,
+           fs.total_extents ? (double)fs.total_blocks / fs.total_extents : 0.0,
+           (unsigned long long)fs.longest);
+    
+    if (per_ag != NULL) {
+        printf("\n%4s %12s %10s %10s %10s\n", "AG", "free", "extents", "average", "longest");
+        for (int i = 0; i < ag_count(); i++) {
+            printf("%4d %12llu %10llu %10.1f %10llu\n", i,
+                   (unsigned long long)per_ag[i].total_blocks, (unsigned long long)per_ag[i].total_extents,
+                   per_ag[i].total_extents ? (double)per_ag[i].total_blocks / per_ag[i].total_extents : 0.0,
+                   (unsigned long long)per_ag[i].longest);
+        }
+        free(per_ag);
+        
+        xfs_extent_hist_t eh;
+        xfs_file_extent_hist(&eh);
+        printf("\nExtents per file (%llu files, %llu extents):\n",
+               (unsigned long long)eh.files, (unsigned long long)eh.extents);
+        for (int n = 0; n <= XFS_MAX_EXTENTS; n++) {
+            if (eh.by_count[n] > 0) {
+                printf("%4d: %llu\n", n, (unsigned long long)eh.by_count[n]);
+            }
+        }
+    }
+    printf("--------------------------\n");
+}
+
 // List all files (inodes) in the system
 void list_files(void) {
     if (!initialized) {
@@ -409,13 +1657,23 @@ void list_files(void) {
 }
 
 // Read data from a file (simulated)
-int xfs_sim_read(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
+static int xfs_sim_read_internal(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
     if (!inode || !buffer || size == 0) {
         return -1;
     }
     
+    // Filesystem block size (0 until the filesystem is formatted or mounted)
+    uint32_t bsize = ag_blocksize();
+    if (bsize == 0) {
+        return -1;
+    }
+    
+    // Readers share both locks: the size and extent map cannot change underneath us
+    xfs_ilock(inode, XFS_IOLOCK_SHARED | XFS_ILOCK_SHARED);
+    
     // Check if the read would go beyond the file size
-    if (offset >= inode->di_size) {
+    if ((uint64_t)offset >= inode->di_size) {
+        xfs_iunlock(inode, XFS_IOLOCK_SHARED | XFS_ILOCK_SHARED);
         return 0; // At or beyond end of file
     }
     
@@ -425,20 +1683,21 @@ int xfs_sim_read(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
         size_to_read = inode->di_size - offset;
     }
     
-    printf("[XFS Read] Requested to read %zu bytes at offset %ld\n", size_to_read, offset);
+    trace_xfs(XFS_TRACE_READ_START, inode->inode_num, offset, size_to_read, 0);
     
     // Perform the actual reads from disk
     size_t bytes_read = 0;
     while (bytes_read < size_to_read) {
         // Calculate the current logical block and offset within that block
-        uint64_t current_logical_block = (offset + bytes_read) / XFS_BLOCK_SIZE;
-        size_t offset_in_block = (offset + bytes_read) % XFS_BLOCK_SIZE;
+        uint64_t current_logical_block = (offset + bytes_read) / bsize;
+        size_t offset_in_block = (offset + bytes_read) % bsize;
         
         // Find the physical extent for this logical block
         xfs_extent_t *extent = find_extent_for_offset(inode, current_logical_block);
-        if (extent == NULL) {
-            // No extent for this block - it's a "hole" in the file, return zeros
-            size_t bytes_to_zero = XFS_BLOCK_SIZE - offset_in_block;
+        if (extent == NULL || extent->state == XFS_EXT_UNWRITTEN) {
+            // A "hole" or a preallocated block not yet written - return zeros without touching the disk
+            uint64_t blocks = extent != NULL ? extent->start_off + extent->block_count - current_logical_block : 1;
+            size_t bytes_to_zero = blocks * bsize - offset_in_block;
             if (bytes_to_zero > (size_to_read - bytes_read)) {
                 bytes_to_zero = size_to_read - bytes_read;
             }
@@ -453,26 +1712,37 @@ int xfs_sim_read(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
         uint64_t logical_block_offset = current_logical_block - extent->start_off;
         uint64_t physical_block = extent->start_block + logical_block_offset;
         
-        // Calculate how much data to read in this block (either remaining in block or remaining in buffer)
-        size_t bytes_to_read_in_block = XFS_BLOCK_SIZE - offset_in_block;
+        // Read the rest of the extent in one copy (or up to the end of the buffer)
+        size_t bytes_to_read_in_block = (extent->block_count - logical_block_offset) * bsize - offset_in_block;
         if (bytes_to_read_in_block > (size_to_read - bytes_read)) {
             bytes_to_read_in_block = size_to_read - bytes_read;
         }
         
         // Calculate the disk offset for this physical block
-        uint64_t disk_offset = physical_block * XFS_BLOCK_SIZE;
+        uint64_t disk_offset = physical_block * bsize;
         
         // Read the data from the disk
         if (disk_read(disk_offset + offset_in_block, 
                      (char*)buffer + bytes_read, 
                      bytes_to_read_in_block) != 0) {
-            printf("[XFS Read] Failed to read from disk at offset %lu\n", disk_offset + offset_in_block);
+            trace_xfs(XFS_TRACE_READ_ERROR, inode->inode_num, disk_offset + offset_in_block, 0, 0);
+            xfs_iunlock(inode, XFS_IOLOCK_SHARED | XFS_ILOCK_SHARED);
             return -1;
         }
         
         bytes_read += bytes_to_read_in_block;
     }
     
-    printf("[XFS Read] Successfully read %zu bytes at offset %ld\n", bytes_read, offset);
+    xfs_iunlock(inode, XFS_IOLOCK_SHARED | XFS_ILOCK_SHARED);
+    
+    trace_xfs(XFS_TRACE_READ_DONE, inode->inode_num, offset, bytes_read, 0);
     return bytes_read;
+}
+
+// Read data from a file (simulated)
+int xfs_sim_read(xfs_inode_t *inode, void *buffer, size_t size, off_t offset) {
+    uint64_t start_ns = xfs_stats_now();
+    int ret = xfs_sim_read_internal(inode, buffer, size, offset);
+    xfs_stats_record(XFS_STAT_READ, start_ns);
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE  // sched_getcpu, the CPU_* macros and pthread_setaffinity_np
+#include "../include/xfs_numa.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Node topology for AG and worker affinity. Nodes and their CPUs come from
+// /sys/devices/system/node (nodes without CPUs are left out); without sysfs
+// the machine is one node. To try affinity on a small machine the CPUs can
+// be split into emulated nodes instead, which place threads but not memory.
+// Memory placement calls mbind() directly, so there is no libnuma
+// dependency, and it is only a preference: the kernel may place pages
+// elsewhere, and without mbind() the pages land wherever they are first
+// touched.
+
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+#define NUMA_LONG_BITS (8 * sizeof(unsigned long))
+#define NUMA_MASK_WORDS (XFS_NUMA_MAX_NODES / NUMA_LONG_BITS + 1)
+
+static cpu_set_t node_cpus[XFS_NUMA_MAX_NODES];   // CPUs of each node
+static int node_ids[XFS_NUMA_MAX_NODES];          // sysfs node number of each node
+static int cpu_nodes[CPU_SETSIZE];                // Node of each CPU
+static cpu_set_t all_cpus;                        // CPUs the process could use at startup
+static int numa_node_count = 1;
+static int numa_emulated = 0;
+static int numa_affinity = 0;
+static unsigned int numa_epoch_count = 0;
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t numa_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Parse a CPU list such as "0-3,8-11"
+static int parse_cpulist(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s != '\0' && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10);
+        if (end == s || lo < 0) {
+            return -1;
+        }
+        long hi = lo;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) {
+                return -1;
+            }
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+            CPU_SET((int)c, set);
+        }
+        s = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+// Read the machine's nodes; 0 if sysfs has none with CPUs
+static int numa_read_sysfs(void) {
+    int nodes = 0;
+    for (int id = 0; id < XFS_NUMA_MAX_NODES; id++) {
+        char path[64];
+        char line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        if (fgets(line, sizeof(line), f) != NULL && parse_cpulist(line, &node_cpus[nodes]) == 0 &&
+            CPU_COUNT(&node_cpus[nodes]) > 0) {
+            node_ids[nodes++] = id;
+        }
+        fclose(f);
+    }
+    return nodes;
+}
+
+// Split the startup CPUs into n nodes of consecutive CPUs; with more nodes than CPUs, nodes share
+static void numa_emulate(int n) {
+    int cpus[CPU_SETSIZE];
+    int ncpu = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &all_cpus)) {
+            cpus[ncpu++] = c;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        int lo = k * ncpu / n;
+        int hi = (k + 1) * ncpu / n;
+        if (hi == lo) {
+            hi = lo + 1;
+        }
+        CPU_ZERO(&node_cpus[k]);
+        for (int i = lo; i < hi && i < ncpu; i++) {
+            CPU_SET(cpus[i], &node_cpus[k]);
+        }
+        node_ids[k] = k;
+    }
+}
+
+// Build the node tables (caller holds numa_lock); emulate > 0 splits the CPUs into that many nodes
+static void numa_build(int emulate) {
+    int nodes = emulate > 0 ? 0 : numa_read_sysfs();
+    if (emulate > 0) {
+        numa_emulate(emulate);
+        nodes = emulate;
+    } else if (nodes == 0) {
+        node_cpus[0] = all_cpus;
+        node_ids[0] = 0;
+        nodes = 1;
+    }
+
+    // A CPU in several nodes (only when emulating) belongs to the lowest
+    memset(cpu_nodes, 0, sizeof(cpu_nodes));
+    for (int k = nodes - 1; k >= 0; k--) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &node_cpus[k])) {
+                cpu_nodes[c] = k;
+            }
+        }
+    }
+    numa_emulated = emulate > 0;
+    __atomic_store_n(&numa_node_count, nodes, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&numa_epoch_count, 1, __ATOMIC_RELEASE);
+}
+
+static void numa_init(void) {
+    if (sched_getaffinity(0, sizeof(all_cpus), &all_cpus) != 0 || CPU_COUNT(&all_cpus) == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        CPU_ZERO(&all_cpus);
+        for (long c = 0; c < (ncpu > 0 ? ncpu : 1) && c < CPU_SETSIZE; c++) {
+            CPU_SET((int)c, &all_cpus);
+        }
+    }
+    pthread_mutex_lock(&numa_lock);
+    numa_build(0);
+    pthread_mutex_unlock(&numa_lock);
+}
+
+// Number of nodes (the machine's, or the emulated count; 1 if unknown)
+int xfs_numa_nodes(void) {
+    pthread_once(&numa_once, numa_init);
+    return __atomic_load_n(&numa_node_count, __ATOMIC_ACQUIRE);
+}
+
+// Split the online CPUs into n emulated nodes (0 = use the machine's topology)
+int xfs_numa_set_nodes(int n) {
+    if (n < 0 || n > XFS_NUMA_MAX_NODES) {
+        return -1;
+    }
+    pthread_once(&numa_once, numa_init);
+    pthread_mutex_lock(&numa_lock);
+    numa_build(n);
+    pthread_mutex_unlock(&numa_lock);
+    return 0;
+}
+
+// Whether the node count is emulated
+int xfs_numa_emulated(void) {
+    pthread_once(&numa_once, numa_init);
+    return numa_emulated;
+}
+
+// Node of a CPU (0 if unknown)
+int xfs_numa_cpu_node(int cpu) {
+    pthread_once(&numa_once, numa_init);
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return 0;
+    }
+    return cpu_nodes[cpu];
+}
+
+// CPU the calling thread is running on (0 if unknown)
+int xfs_numa_current_cpu(void) {
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+// Node the calling thread is running on
+int xfs_numa_current_node(void) {
+    if (xfs_numa_nodes() == 1) {
+        return 0;
+    }
+    return xfs_numa_cpu_node(xfs_numa_current_cpu());
+}
+
+// Restrict the calling thread to the CPUs of a node (-1 = every CPU the process may use)
+int xfs_numa_bind_thread(int node) {
+    int nodes = xfs_numa_nodes();
+    if (node >= nodes) {
+        return -1;
+    }
+    const cpu_set_t *set = node < 0 ? &all_cpus : &node_cpus[node];
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set) == 0 ? 0 : -1;
+}
+
+// Turn AG and worker affinity on or off (off by default)
+void xfs_numa_set_affinity(int enable) {
+    pthread_once(&numa_once, numa_init);
+    __atomic_store_n(&numa_affinity, enable ? 1 : 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&numa_epoch_count, 1, __ATOMIC_RELEASE);
+}
+
+// Whether AG and worker affinity is on
+int xfs_numa_get_affinity(void) {
+    return __atomic_load_n(&numa_affinity, __ATOMIC_ACQUIRE);
+}
+
+// Changes whenever the node count or the affinity setting changes
+unsigned int xfs_numa_epoch(void) {
+    return __atomic_load_n(&numa_epoch_count, __ATOMIC_ACQUIRE);
+}
+
+// Allocate zeroed memory, placed on a node where the kernel allows it (-1 = anywhere); release with free()
+void *xfs_numa_alloc(size_t size, int node) {
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) {
+        page = 4096;
+    }
+    size_t len = size == 0 ? (size_t)page : (size + (size_t)page - 1) / (size_t)page * (size_t)page;
+    void *p;
+    if (posix_memalign(&p, (size_t)page, len) != 0) {
+        return NULL;
+    }
+
+#ifdef SYS_mbind
+    // Prefer the node before the pages are touched; MOVE covers pages reused from an earlier allocation
+    int nodes = xfs_numa_nodes();
+    if (node >= 0 && node < nodes && nodes > 1 && !numa_emulated) {
+        unsigned long mask[NUMA_MASK_WORDS] = { 0 };
+        int id = node_ids[node];
+        mask[id / NUMA_LONG_BITS] |= 1ul << (id % NUMA_LONG_BITS);
+        (void)syscall(SYS_mbind, p, len, NUMA_MPOL_PREFERRED, mask,
+                      (unsigned long)(NUMA_MASK_WORDS * NUMA_LONG_BITS), NUMA_MPOL_MF_MOVE);
+    }
+#else
+    (void)node;
+#endif
+
+    memset(p, 0, len);
+    return p;
+}
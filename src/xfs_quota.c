@@ -0,0 +1,623 @@
+#include "../include/xfs_quota.h"
+#include "../include/xfs_inode.h"
+#include "../include/xfs_io.h"
+#include "../include/xfs_numa.h"
+#include "../include/xfs_trans.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// User and group quotas. Each inode points at the records (dquots) of its
+// owner and group, so charging an allocation needs no lookup. A record's
+// usage is a folded count plus per-CPU deltas: allocating threads add to
+// their CPU's delta, on a cache line of its own, and move it into the folded
+// count once it grows past a batch. Every checkpoint folds all deltas and
+// logs the records that changed, so the log holds each record's usage as of
+// that checkpoint.
+//
+// A reservation well under its limits only adds to a delta, since the folded
+// count plus a bound on every CPU's delta bounds the real usage. Threads may
+// share a CPU's slot, so the bound is kept with compare-and-swap: a charge
+// that would take a delta past two batches goes to the folded count instead,
+// and folding never raises a delta. Near a limit
+// it takes the record's own lock and sums the deltas, so limits are exact
+// where it matters and no global lock is taken on the allocation path. Both
+// paths charge before they look, so of two racing reservations at least one
+// sees the other; moving a delta into the folded count adds before it
+// subtracts, so a sum may briefly count it twice but never misses it.
+//
+// Lock order: inode ILOCK -> quota_lock -> dquot lock. Checkpoints fold
+// under the log's lock, so quota_lock is never held while logging.
+
+#define QUOTA_BATCH     32   // Largest per-CPU delta before it is folded
+#define QUOTA_MAX_SLOTS 64
+
+enum { QUOTA_BLOCKS, QUOTA_INODES, QUOTA_RES };
+
+// One CPU's deltas of one record
+typedef struct {
+    int64_t delta[QUOTA_RES];
+} __attribute__((aligned(64))) quota_slot_t;
+
+typedef struct xfs_dquot {
+    pthread_mutex_t lock;          // Serializes reservations near a limit, limit changes and folds
+    xfs_disk_dquot_t rec;          // Limits and timers; usage as of the last fold
+    int64_t count[QUOTA_RES];      // Folded usage
+    int dirty;                     // Record changed since it was last logged
+    quota_slot_t slots[QUOTA_MAX_SLOTS];
+} xfs_dquot_t;
+
+static xfs_dquot_t **dquots[XFS_DQ_TYPES];
+static int dquot_count[XFS_DQ_TYPES];
+static int dquot_cap[XFS_DQ_TYPES];
+static int quota_active = 0;
+static uint64_t quota_grace = XFS_QUOTA_DEFAULT_GRACE;
+static int quota_slots = 1;
+static xfs_quota_stats_t quota_stats;
+static pthread_once_t quota_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t quota_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void quota_init(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    quota_slots = ncpu < 1 ? 1 : ncpu > QUOTA_MAX_SLOTS ? QUOTA_MAX_SLOTS : (int)ncpu;
+}
+
+static uint64_t quota_now(void) {
+    return (uint64_t)time(NULL);
+}
+
+static uint64_t *dquot_soft(xfs_dquot_t *dq, int res) {
+    return res == QUOTA_BLOCKS ? &dq->rec.d_blk_softlimit : &dq->rec.d_ino_softlimit;
+}
+
+static uint64_t *dquot_hard(xfs_dquot_t *dq, int res) {
+    return res == QUOTA_BLOCKS ? &dq->rec.d_blk_hardlimit : &dq->rec.d_ino_hardlimit;
+}
+
+static uint64_t *dquot_timer(xfs_dquot_t *dq, int res) {
+    return res == QUOTA_BLOCKS ? &dq->rec.d_btimer : &dq->rec.d_itimer;
+}
+
+// Find a record (caller holds quota_lock)
+static xfs_dquot_t *dquot_lookup_locked(xfs_dqtype_t type, uint32_t id) {
+    for (int i = 0; i < dquot_count[type]; i++) {
+        if (dquots[type][i]->rec.d_id == id) {
+            return dquots[type][i];
+        }
+    }
+    return NULL;
+}
+
+// Find a record, creating it without limits if needed (caller holds quota_lock)
+static xfs_dquot_t *dquot_get_locked(xfs_dqtype_t type, uint32_t id) {
+    xfs_dquot_t *dq = dquot_lookup_locked(type, id);
+    if (dq != NULL) {
+        return dq;
+    }
+    if (dquot_count[type] == dquot_cap[type]) {
+        int cap = dquot_cap[type] == 0 ? 16 : dquot_cap[type] * 2;
+        xfs_dquot_t **grown = realloc(dquots[type], cap * sizeof(*grown));
+        if (grown == NULL) {
+            return NULL;
+        }
+        dquots[type] = grown;
+        dquot_cap[type] = cap;
+    }
+    void *p;
+    if (posix_memalign(&p, 64, sizeof(xfs_dquot_t)) != 0) {
+        return NULL;
+    }
+    dq = p;
+    memset(dq, 0, sizeof(*dq));
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->rec.d_id = id;
+    dq->rec.d_type = type;
+    dq->dirty = 1;
+    dquots[type][dquot_count[type]++] = dq;
+    return dq;
+}
+
+// Usage now: the folded count plus every CPU's delta
+static int64_t dquot_sum(xfs_dquot_t *dq, int res) {
+    int64_t sum = __atomic_load_n(&dq->count[res], __ATOMIC_SEQ_CST);
+    for (int i = 0; i < quota_slots; i++) {
+        sum += __atomic_load_n(&dq->slots[i].delta[res], __ATOMIC_SEQ_CST);
+    }
+    return sum;
+}
+
+// Move one CPU's delta into the folded count, adding to one before subtracting
+// from the other. A negative delta is swapped for zero rather than having its
+// value added back, so charges made meanwhile cannot lift it past its bound.
+static void dquot_fold_slot(xfs_dquot_t *dq, int slot, int res) {
+    int64_t *delta = &dq->slots[slot].delta[res];
+    int64_t taken = __atomic_load_n(delta, __ATOMIC_SEQ_CST);
+    if (taken > 0) {
+        __atomic_add_fetch(&dq->count[res], taken, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(delta, taken, __ATOMIC_SEQ_CST);
+    } else if (taken < 0) {
+        while (taken < 0 && !__atomic_compare_exchange_n(delta, &taken, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        }
+        if (taken < 0) {
+            __atomic_add_fetch(&dq->count[res], taken, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+// Add to the calling CPU's delta; returns the delta's new value
+static int64_t dquot_add_delta(xfs_dquot_t *dq, int slot, int res, int64_t n) {
+    return __atomic_add_fetch(&dq->slots[slot].delta[res], n, __ATOMIC_SEQ_CST);
+}
+
+// Add n > 0 to a CPU's delta unless that would take it past two batches;
+// returns 1 with the delta's new value in *delta if it was added
+static int dquot_try_add_delta(xfs_dquot_t *dq, int slot, int res, int64_t n, int64_t *delta) {
+    int64_t *d = &dq->slots[slot].delta[res];
+    int64_t cur = __atomic_load_n(d, __ATOMIC_SEQ_CST);
+    do {
+        if (cur + n > 2 * QUOTA_BATCH) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(d, &cur, cur + n, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    *delta = cur + n;
+    return 1;
+}
+
+// Add to the calling CPU's delta, folding it once it grows past a batch; a
+// charge the delta has no room for goes straight to the folded count
+static void dquot_add(xfs_dquot_t *dq, int res, int64_t n) {
+    int slot = xfs_numa_current_cpu() % quota_slots;
+    int64_t delta;
+    if (n > 0) {
+        if (!dquot_try_add_delta(dq, slot, res, n, &delta)) {
+            __atomic_add_fetch(&dq->count[res], n, __ATOMIC_SEQ_CST);
+            return;
+        }
+    } else {
+        delta = dquot_add_delta(dq, slot, res, n);
+    }
+    if (delta > QUOTA_BATCH || delta < -QUOTA_BATCH) {
+        dquot_fold_slot(dq, slot, res);
+    }
+}
+
+// Limit a reservation may not pass: the hard limit, or the soft limit once its grace period ran out
+static uint64_t dquot_limit(xfs_dquot_t *dq, int res) {
+    uint64_t soft = *dquot_soft(dq, res);
+    uint64_t hard = *dquot_hard(dq, res);
+    uint64_t timer = *dquot_timer(dq, res);
+    if (soft != 0 && timer != 0 && quota_now() >= timer && (hard == 0 || soft < hard)) {
+        return soft;
+    }
+    return hard;
+}
+
+// Start or clear the grace timer for the usage (caller holds the dquot lock)
+static void dquot_update_timer(xfs_dquot_t *dq, int res, int64_t used) {
+    uint64_t soft = *dquot_soft(dq, res);
+    uint64_t *timer = dquot_timer(dq, res);
+    uint64_t want = *timer;
+    if (soft != 0 && used > (int64_t)soft) {
+        if (want == 0) {
+            want = quota_now() + __atomic_load_n(&quota_grace, __ATOMIC_ACQUIRE);
+        }
+    } else {
+        want = 0;
+    }
+    if (want != *timer) {
+        __atomic_store_n(timer, want, __ATOMIC_RELEASE);
+        dq->dirty = 1;
+    }
+}
+
+// Charge n of a resource to one record; -1 if it would pass a limit
+static int dquot_reserve(xfs_dquot_t *dq, int res, int64_t n) {
+    uint64_t soft = __atomic_load_n(dquot_soft(dq, res), __ATOMIC_ACQUIRE);
+    uint64_t hard = __atomic_load_n(dquot_hard(dq, res), __ATOMIC_ACQUIRE);
+    uint64_t bound = hard;
+    if (soft != 0 && (bound == 0 || soft < bound)) {
+        bound = soft;
+    }
+
+    if (bound == 0) {
+        dquot_add(dq, res, n);
+        return 0;
+    }
+
+    // Far enough under every limit that no mix of deltas (each at most two
+    // batches, however many threads share a slot) could reach one
+    int64_t slack = (int64_t)quota_slots * 2 * QUOTA_BATCH;
+    int slot = xfs_numa_current_cpu() % quota_slots;
+    int64_t delta;
+    if (n <= QUOTA_BATCH && dquot_try_add_delta(dq, slot, res, n, &delta)) {
+        if (__atomic_load_n(&dq->count[res], __ATOMIC_SEQ_CST) + slack <= (int64_t)bound) {
+            if (delta > QUOTA_BATCH) {
+                dquot_fold_slot(dq, slot, res);
+            }
+            return 0;
+        }
+        dquot_add_delta(dq, slot, res, -n);
+    } else {
+        if (__atomic_add_fetch(&dq->count[res], n, __ATOMIC_SEQ_CST) + slack <= (int64_t)bound) {
+            return 0;
+        }
+        __atomic_sub_fetch(&dq->count[res], n, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_lock(&dq->lock);
+    __atomic_add_fetch(&quota_stats.slow_reservations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dq->count[res], n, __ATOMIC_SEQ_CST);
+    int64_t used = dquot_sum(dq, res);
+    uint64_t limit = dquot_limit(dq, res);
+    if (limit != 0 && used > (int64_t)limit) {
+        __atomic_sub_fetch(&dq->count[res], n, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&dq->lock);
+        __atomic_add_fetch(&quota_stats.denied, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    if (soft != 0 && used - n <= (int64_t)soft && used > (int64_t)soft) {
+        __atomic_add_fetch(&quota_stats.soft_exceeded, 1, __ATOMIC_RELAXED);
+    }
+    dquot_update_timer(dq, res, used);
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+// Charge n of a resource to an inode's owner and group; nothing is charged on failure
+static int quota_reserve(xfs_inode_t *ip, int res, int64_t n) {
+    if (!xfs_quota_enabled() || n == 0) {
+        return 0;
+    }
+    xfs_dquot_t *u = __atomic_load_n(&ip->i_udquot, __ATOMIC_ACQUIRE);
+    xfs_dquot_t *g = __atomic_load_n(&ip->i_gdquot, __ATOMIC_ACQUIRE);
+    if (u != NULL && dquot_reserve(u, res, n) != 0) {
+        return -1;
+    }
+    if (g != NULL && dquot_reserve(g, res, n) != 0) {
+        if (u != NULL) {
+            dquot_add(u, res, -n);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Give back n of a resource charged to an inode's owner and group
+static void quota_unreserve(xfs_inode_t *ip, int res, int64_t n) {
+    if (!xfs_quota_enabled() || n == 0) {
+        return;
+    }
+    xfs_dquot_t *u = __atomic_load_n(&ip->i_udquot, __ATOMIC_ACQUIRE);
+    xfs_dquot_t *g = __atomic_load_n(&ip->i_gdquot, __ATOMIC_ACQUIRE);
+    if (u != NULL) {
+        dquot_add(u, res, -n);
+    }
+    if (g != NULL) {
+        dquot_add(g, res, -n);
+    }
+}
+
+// Fold every delta and log the records that changed; runs as each non-empty checkpoint closes
+static void quota_checkpoint(void) {
+    if (!xfs_quota_enabled()) {
+        return;
+    }
+    uint64_t logged = 0;
+    pthread_mutex_lock(&quota_lock);
+    for (int t = 0; t < XFS_DQ_TYPES; t++) {
+        for (int i = 0; i < dquot_count[t]; i++) {
+            xfs_dquot_t *dq = dquots[t][i];
+            pthread_mutex_lock(&dq->lock);
+            for (int res = 0; res < QUOTA_RES; res++) {
+                for (int s = 0; s < quota_slots; s++) {
+                    dquot_fold_slot(dq, s, res);
+                }
+                int64_t used = __atomic_load_n(&dq->count[res], __ATOMIC_ACQUIRE);
+                uint64_t *rec_count = res == QUOTA_BLOCKS ? &dq->rec.d_bcount : &dq->rec.d_icount;
+                uint64_t now = used < 0 ? 0 : (uint64_t)used;
+                if (now != *rec_count) {
+                    *rec_count = now;
+                    dq->dirty = 1;
+                }
+                dquot_update_timer(dq, res, used);
+            }
+            if (dq->dirty) {
+                uint64_t id = ((uint64_t)t << 32) | dq->rec.d_id;
+                if (trans_hook_add_object(TRANS_OBJ_KEY(TRANS_OBJ_DQUOT, id), &dq->rec, sizeof(dq->rec)) == 0) {
+                    dq->dirty = 0;
+                    logged++;
+                }
+            }
+            pthread_mutex_unlock(&dq->lock);
+        }
+    }
+    pthread_mutex_unlock(&quota_lock);
+    __atomic_add_fetch(&quota_stats.folds, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&quota_stats.logged, logged, __ATOMIC_RELAXED);
+}
+
+// Count every inode's usage and turn accounting and enforcement on (run while the filesystem is idle)
+int xfs_quota_on(void) {
+    pthread_once(&quota_once, quota_init);
+    if (xfs_quota_enabled()) {
+        return 0;
+    }
+
+    // Quotacheck: forget the old usage, then charge every inode to its owner and group
+    pthread_mutex_lock(&quota_lock);
+    for (int t = 0; t < XFS_DQ_TYPES; t++) {
+        for (int i = 0; i < dquot_count[t]; i++) {
+            xfs_dquot_t *dq = dquots[t][i];
+            memset(dq->count, 0, sizeof(dq->count));
+            memset(dq->slots, 0, sizeof(dq->slots));
+            dq->dirty = 1;
+        }
+    }
+    pthread_mutex_unlock(&quota_lock);
+
+    int max_inode = get_max_inode_num();
+    for (int ino = 1; ino <= max_inode; ino++) {
+        xfs_inode_t *ip = get_inode_ptr(ino);
+        if (ip == NULL) {
+            continue;
+        }
+        xfs_ilock(ip, XFS_ILOCK_SHARED);
+        uint64_t blocks = 0;
+        for (int e = 0; e < ip->extent_count; e++) {
+            blocks += ip->extents[e].block_count;
+        }
+        pthread_mutex_lock(&quota_lock);
+        xfs_dquot_t *u = dquot_get_locked(XFS_DQ_USER, ip->di_uid);
+        xfs_dquot_t *g = dquot_get_locked(XFS_DQ_GROUP, ip->di_gid);
+        pthread_mutex_unlock(&quota_lock);
+        if (u == NULL || g == NULL) {
+            xfs_iunlock(ip, XFS_ILOCK_SHARED);
+            return -1;
+        }
+        u->count[QUOTA_BLOCKS] += (int64_t)blocks;
+        u->count[QUOTA_INODES] += 1;
+        g->count[QUOTA_BLOCKS] += (int64_t)blocks;
+        g->count[QUOTA_INODES] += 1;
+        __atomic_store_n(&ip->i_udquot, u, __ATOMIC_RELEASE);
+        __atomic_store_n(&ip->i_gdquot, g, __ATOMIC_RELEASE);
+        xfs_iunlock(ip, XFS_ILOCK_SHARED);
+    }
+
+    // Timers follow the counted usage
+    pthread_mutex_lock(&quota_lock);
+    for (int t = 0; t < XFS_DQ_TYPES; t++) {
+        for (int i = 0; i < dquot_count[t]; i++) {
+            xfs_dquot_t *dq = dquots[t][i];
+            pthread_mutex_lock(&dq->lock);
+            dq->rec.d_bcount = (uint64_t)dq->count[QUOTA_BLOCKS];
+            dq->rec.d_icount = (uint64_t)dq->count[QUOTA_INODES];
+            dquot_update_timer(dq, QUOTA_BLOCKS, dq->count[QUOTA_BLOCKS]);
+            dquot_update_timer(dq, QUOTA_INODES, dq->count[QUOTA_INODES]);
+            pthread_mutex_unlock(&dq->lock);
+        }
+    }
+    pthread_mutex_unlock(&quota_lock);
+
+    __atomic_store_n(&quota_active, 1, __ATOMIC_RELEASE);
+    trans_set_checkpoint_hook(quota_checkpoint);
+    return 0;
+}
+
+// Turn accounting and enforcement off; limits are kept
+void xfs_quota_off(void) {
+    __atomic_store_n(&quota_active, 0, __ATOMIC_RELEASE);
+    trans_set_checkpoint_hook(NULL);
+}
+
+// Whether quotas are on
+int xfs_quota_enabled(void) {
+    return __atomic_load_n(&quota_active, __ATOMIC_ACQUIRE);
+}
+
+// Turn quotas off and drop every record (a new filesystem)
+void xfs_quota_reset(void) {
+    xfs_quota_off();
+    pthread_mutex_lock(&quota_lock);
+    for (int t = 0; t < XFS_DQ_TYPES; t++) {
+        for (int i = 0; i < dquot_count[t]; i++) {
+            pthread_mutex_destroy(&dquots[t][i]->lock);
+            free(dquots[t][i]);
+        }
+        free(dquots[t]);
+        dquots[t] = NULL;
+        dquot_count[t] = 0;
+        dquot_cap[t] = 0;
+    }
+    memset(&quota_stats, 0, sizeof(quota_stats));
+    pthread_mutex_unlock(&quota_lock);
+}
+
+// Set the limits of a user or group, creating its record
+int xfs_quota_set_limits(xfs_dqtype_t type, uint32_t id, uint64_t blk_soft, uint64_t blk_hard,
+                         uint64_t ino_soft, uint64_t ino_hard) {
+    if ((int)type < 0 || type >= XFS_DQ_TYPES) {
+        return -1;
+    }
+    pthread_once(&quota_once, quota_init);
+    pthread_mutex_lock(&quota_lock);
+    xfs_dquot_t *dq = dquot_get_locked(type, id);
+    pthread_mutex_unlock(&quota_lock);
+    if (dq == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dq->lock);
+    __atomic_store_n(&dq->rec.d_blk_softlimit, blk_soft, __ATOMIC_RELEASE);
+    __atomic_store_n(&dq->rec.d_blk_hardlimit, blk_hard, __ATOMIC_RELEASE);
+    __atomic_store_n(&dq->rec.d_ino_softlimit, ino_soft, __ATOMIC_RELEASE);
+    __atomic_store_n(&dq->rec.d_ino_hardlimit, ino_hard, __ATOMIC_RELEASE);
+    dquot_update_timer(dq, QUOTA_BLOCKS, dquot_sum(dq, QUOTA_BLOCKS));
+    dquot_update_timer(dq, QUOTA_INODES, dquot_sum(dq, QUOTA_INODES));
+    dq->dirty = 1;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+// Set the grace period after a soft limit is exceeded
+void xfs_quota_set_grace(uint64_t seconds) {
+    __atomic_store_n(&quota_grace, seconds, __ATOMIC_RELEASE);
+}
+
+// Attach an inode to the records of its owner and group, creating them if needed
+int xfs_quota_attach(xfs_inode_t *ip) {
+    if (!xfs_quota_enabled()) {
+        return 0;
+    }
+    pthread_mutex_lock(&quota_lock);
+    xfs_dquot_t *u = dquot_get_locked(XFS_DQ_USER, ip->di_uid);
+    xfs_dquot_t *g = dquot_get_locked(XFS_DQ_GROUP, ip->di_gid);
+    pthread_mutex_unlock(&quota_lock);
+    if (u == NULL || g == NULL) {
+        return -1;
+    }
+    __atomic_store_n(&ip->i_udquot, u, __ATOMIC_RELEASE);
+    __atomic_store_n(&ip->i_gdquot, g, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Charge blocks to an inode's owner and group; -1 (nothing charged) if a limit would be exceeded
+int xfs_quota_reserve_blocks(xfs_inode_t *ip, uint64_t count) {
+    return quota_reserve(ip, QUOTA_BLOCKS, (int64_t)count);
+}
+
+// Give back blocks charged to an inode's owner and group
+void xfs_quota_unreserve_blocks(xfs_inode_t *ip, uint64_t count) {
+    quota_unreserve(ip, QUOTA_BLOCKS, (int64_t)count);
+}
+
+// Charge a new inode to its owner and group; -1 if a limit would be exceeded
+int xfs_quota_reserve_inode(xfs_inode_t *ip) {
+    return quota_reserve(ip, QUOTA_INODES, 1);
+}
+
+// Give back a removed inode
+void xfs_quota_unreserve_inode(xfs_inode_t *ip) {
+    quota_unreserve(ip, QUOTA_INODES, 1);
+}
+
+// Move an inode and its blocks to a new owner and group (caller holds the ILOCK exclusively)
+int xfs_quota_chown(xfs_inode_t *ip, uint32_t uid, uint32_t gid, uint64_t blocks) {
+    if (!xfs_quota_enabled()) {
+        return 0;
+    }
+    pthread_mutex_lock(&quota_lock);
+    xfs_dquot_t *u = dquot_get_locked(XFS_DQ_USER, uid);
+    xfs_dquot_t *g = dquot_get_locked(XFS_DQ_GROUP, gid);
+    pthread_mutex_unlock(&quota_lock);
+    if (u == NULL || g == NULL) {
+        return -1;
+    }
+
+    // As in XFS, changing owners is not refused by the new owner's limits
+    quota_unreserve(ip, QUOTA_BLOCKS, (int64_t)blocks);
+    quota_unreserve(ip, QUOTA_INODES, 1);
+    dquot_add(u, QUOTA_BLOCKS, (int64_t)blocks);
+    dquot_add(u, QUOTA_INODES, 1);
+    dquot_add(g, QUOTA_BLOCKS, (int64_t)blocks);
+    dquot_add(g, QUOTA_INODES, 1);
+    __atomic_store_n(&ip->i_udquot, u, __ATOMIC_RELEASE);
+    __atomic_store_n(&ip->i_gdquot, g, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Current usage and limits of a user or group; -1 if it has no record
+int xfs_quota_get(xfs_dqtype_t type, uint32_t id, xfs_disk_dquot_t *dq) {
+    if ((int)type < 0 || type >= XFS_DQ_TYPES) {
+        return -1;
+    }
+    pthread_mutex_lock(&quota_lock);
+    xfs_dquot_t *d = dquot_lookup_locked(type, id);
+    if (d == NULL) {
+        pthread_mutex_unlock(&quota_lock);
+        return -1;
+    }
+    pthread_mutex_lock(&d->lock);
+    *dq = d->rec;
+    int64_t blocks = dquot_sum(d, QUOTA_BLOCKS);
+    int64_t inodes = dquot_sum(d, QUOTA_INODES);
+    dq->d_bcount = blocks < 0 ? 0 : (uint64_t)blocks;
+    dq->d_icount = inodes < 0 ? 0 : (uint64_t)inodes;
+    pthread_mutex_unlock(&d->lock);
+    pthread_mutex_unlock(&quota_lock);
+    return 0;
+}
+
+// Copy the counters
+void xfs_quota_get_stats(xfs_quota_stats_t *stats) {
+    stats->slow_reservations = __atomic_load_n(&quota_stats.slow_reservations, __ATOMIC_RELAXED);
+    stats->denied = __atomic_load_n(&quota_stats.denied, __ATOMIC_RELAXED);
+    stats->soft_exceeded = __atomic_load_n(&quota_stats.soft_exceeded, __ATOMIC_RELAXED);
+    stats->folds = __atomic_load_n(&quota_stats.folds, __ATOMIC_RELAXED);
+    stats->logged = __atomic_load_n(&quota_stats.logged, __ATOMIC_RELAXED);
+}
+
+// Format a limit ("-" for none)
+static void format_limit(char *buf, size_t len, uint64_t limit) {
+    if (limit == 0) {
+        snprintf(buf, len, "-");
+    } else {
+        snprintf(buf, len, "%llu", (unsigned long long)limit);
+    }
+}
+
+// Format the grace state of a soft limit: time left, "expired", or "-" when under it
+static void format_grace(char *buf, size_t len, int64_t used, uint64_t soft, uint64_t timer, uint64_t now) {
+    if (soft == 0 || used <= (int64_t)soft || timer == 0) {
+        snprintf(buf, len, "-");
+    } else if (now >= timer) {
+        snprintf(buf, len, "expired");
+    } else {
+        snprintf(buf, len, "%llus", (unsigned long long)(timer - now));
+    }
+}
+
+// Print every record of one kind (usage, limits and grace state) and the counters
+void xfs_quota_print_report(xfs_dqtype_t type) {
+    if ((int)type < 0 || type >= XFS_DQ_TYPES) {
+        return;
+    }
+    const char *name = type == XFS_DQ_USER ? "user" : "group";
+    uint64_t now = quota_now();
+    printf("\n--- %s QUOTAS (%s, grace %llus) ---\n", type == XFS_DQ_USER ? "USER" : "GROUP",
+           xfs_quota_enabled() ? "on" : "off",
+           (unsigned long long)__atomic_load_n(&quota_grace, __ATOMIC_ACQUIRE));
+    printf("%-10s %10s %10s %10s %10s %10s %10s %10s %10s\n", name,
+           "blocks", "soft", "hard", "grace", "inodes", "soft", "hard", "grace");
+
+    pthread_mutex_lock(&quota_lock);
+    for (int i = 0; i < dquot_count[type]; i++) {
+        xfs_dquot_t *dq = dquots[type][i];
+        pthread_mutex_lock(&dq->lock);
+        xfs_disk_dquot_t rec = dq->rec;
+        int64_t blocks = dquot_sum(dq, QUOTA_BLOCKS);
+        int64_t inodes = dquot_sum(dq, QUOTA_INODES);
+        pthread_mutex_unlock(&dq->lock);
+
+        char bsoft[24], bhard[24], bgrace[24], isoft[24], ihard[24], igrace[24];
+        format_limit(bsoft, sizeof(bsoft), rec.d_blk_softlimit);
+        format_limit(bhard, sizeof(bhard), rec.d_blk_hardlimit);
+        format_grace(bgrace, sizeof(bgrace), blocks, rec.d_blk_softlimit, rec.d_btimer, now);
+        format_limit(isoft, sizeof(isoft), rec.d_ino_softlimit);
+        format_limit(ihard, sizeof(ihard), rec.d_ino_hardlimit);
+        format_grace(igrace, sizeof(igrace), inodes, rec.d_ino_softlimit, rec.d_itimer, now);
+        printf("%-10u %10lld %10s %10s %10s %10lld %10s %10s %10s\n", rec.d_id,
+               (long long)blocks, bsoft, bhard, bgrace, (long long)inodes, isoft, ihard, igrace);
+    }
+    pthread_mutex_unlock(&quota_lock);
+
+    xfs_quota_stats_t stats;
+    xfs_quota_get_stats(&stats);
+    printf("slow reservations: %llu, denied: %llu, soft limit crossings: %llu\n",
+           (unsigned long long)stats.slow_reservations, (unsigned long long)stats.denied,
+           (unsigned long long)stats.soft_exceeded);
+    printf("checkpoint folds: %llu, records logged: %llu\n",
+           (unsigned long long)stats.folds, (unsigned long long)stats.logged);
+}
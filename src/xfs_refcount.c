@@ -0,0 +1,693 @@
+#include "../include/xfs_refcount.h"
+#include "../include/xfs_alloc.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_disk.h"
+#include "../include/xfs_trans.h"
+#include "../include/xfs_cksum.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each AG tracks shared blocks in a B+tree of reference counts, as in XFS.
+// Only blocks with two or more owners have a record, so unshared space
+// costs nothing and an AG that never saw a clone has no tree at all. Leaves
+// hold records sorted by start block; nodes hold, for each child, the
+// lowest start block it may contain and its AG block number. A node's
+// first key is only a lower bound, and keys are not raised when records
+// are deleted. Blocks are read and written through to disk under the AG
+// lock; like other v5 metadata each names its AG, its own block number and
+// the filesystem UUID and carries a CRC32C, checked on every read. Emptied
+// blocks are freed, but underfull blocks are not merged with their siblings.
+
+#define XFS_REFC_MAGIC 0x52334643  // "R3FC"
+#define XFS_LI_CUI     0x1242      // Refcount update log item
+
+// Header at the start of every refcount btree block
+typedef struct {
+    uint32_t bb_magic;
+    uint16_t bb_level;      // 0 for leaves
+    uint16_t bb_numrecs;
+    uint32_t bb_crc;        // CRC32C of the whole block
+    uint32_t bb_owner;      // AG number
+    uint64_t bb_blkno;      // AG block number of this block
+    uint64_t bb_lsn;        // LSN of the last log item when written
+    uint8_t bb_uuid[XFS_UUID_SIZE];
+} xfs_refc_block_t;
+
+// Node entry: the lowest start block under the child, and the child's AG block
+typedef struct {
+    uint32_t startblock;
+    uint32_t ptr;
+} xfs_refc_key_t;
+
+// Refcount update log item header; followed by the extents
+typedef struct {
+    uint16_t type;
+    uint16_t pad;
+    int32_t delta;          // +1 or -1 owner
+    uint32_t agno;
+    uint32_t nextents;
+} xfs_cui_log_t;
+
+static xfs_refcount_rec_t *refc_recs(xfs_refc_block_t *b) {
+    return (xfs_refcount_rec_t *)(b + 1);
+}
+
+static xfs_refc_key_t *refc_keys(xfs_refc_block_t *b) {
+    return (xfs_refc_key_t *)(b + 1);
+}
+
+// Entries that fit in a block at a level
+static int refc_maxrecs(int level) {
+    size_t esz = level ? sizeof(xfs_refc_key_t) : sizeof(xfs_refcount_rec_t);
+    return (int)((ag_blocksize() - sizeof(xfs_refc_block_t)) / esz);
+}
+
+// Block buffers have room for one entry past a full block, so an insert can overflow before splitting
+static xfs_refc_block_t *refc_alloc_buf(void) {
+    return (xfs_refc_block_t *)calloc(1, ag_blocksize() + sizeof(xfs_refcount_rec_t));
+}
+
+static xfs_refc_block_t *refc_read(int ag_id, uint32_t bno) {
+    xfs_refc_block_t *b = refc_alloc_buf();
+    if (b == NULL) {
+        return NULL;
+    }
+    if (disk_read(ag_block_offset(ag_id, bno), b, ag_blocksize()) != 0) {
+        free(b);
+        return NULL;
+    }
+    if (!xfs_cksum_verify(b, ag_blocksize(), offsetof(xfs_refc_block_t, bb_crc))) {
+        free(b);
+        return NULL;
+    }
+    if (b->bb_magic != XFS_REFC_MAGIC || b->bb_owner != (uint32_t)ag_id || b->bb_blkno != bno ||
+        memcmp(b->bb_uuid, ag_uuid(), XFS_UUID_SIZE) != 0) {
+        xfs_cksum_report_failure();
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+static int refc_write(int ag_id, uint32_t bno, xfs_refc_block_t *b) {
+    b->bb_owner = (uint32_t)ag_id;
+    b->bb_blkno = bno;
+    b->bb_lsn = trans_last_lsn();
+    memcpy(b->bb_uuid, ag_uuid(), XFS_UUID_SIZE);
+    xfs_cksum_update(b, ag_blocksize(), offsetof(xfs_refc_block_t, bb_crc));
+    return disk_write(ag_block_offset(ag_id, bno), b, ag_blocksize());
+}
+
+// Index of the child that may hold key (the first key is only a lower bound)
+static int refc_child(xfs_refc_block_t *b, uint32_t key) {
+    xfs_refc_key_t *k = refc_keys(b);
+    int lo = 1, hi = b->bb_numrecs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (k[mid].startblock <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// Find the last record starting at or before key in the subtree at bno (1 found, 0 none, -1 error)
+static int refc_lookup_le(int ag_id, uint32_t bno, uint32_t key, xfs_refcount_rec_t *out) {
+    xfs_refc_block_t *b = refc_read(ag_id, bno);
+    if (b == NULL) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (b->bb_level == 0) {
+        xfs_refcount_rec_t *r = refc_recs(b);
+        for (int i = b->bb_numrecs - 1; i >= 0; i--) {
+            if (r[i].rc_startblock <= key) {
+                *out = r[i];
+                ret = 1;
+                break;
+            }
+        }
+    } else {
+        // A child whose key is stale may hold only larger records: fall back leftwards
+        xfs_refc_key_t *k = refc_keys(b);
+        for (int i = refc_child(b, key); i >= 0 && ret == 0; i--) {
+            ret = refc_lookup_le(ag_id, k[i].ptr, key, out);
+        }
+    }
+    free(b);
+    return ret;
+}
+
+// Find the first record starting at or after key in the subtree at bno (1 found, 0 none, -1 error)
+static int refc_lookup_ge(int ag_id, uint32_t bno, uint32_t key, xfs_refcount_rec_t *out) {
+    xfs_refc_block_t *b = refc_read(ag_id, bno);
+    if (b == NULL) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (b->bb_level == 0) {
+        xfs_refcount_rec_t *r = refc_recs(b);
+        for (int i = 0; i < b->bb_numrecs; i++) {
+            if (r[i].rc_startblock >= key) {
+                *out = r[i];
+                ret = 1;
+                break;
+            }
+        }
+    } else {
+        xfs_refc_key_t *k = refc_keys(b);
+        for (int i = refc_child(b, key); i < b->bb_numrecs && ret == 0; i++) {
+            ret = refc_lookup_ge(ag_id, k[i].ptr, key, out);
+        }
+    }
+    free(b);
+    return ret;
+}
+
+// Insert rec into the subtree at bno. If the block splits, *split_bno and
+// *split_key describe its new right sibling (*split_bno is 0 otherwise).
+static int refc_insert(int ag_id, uint32_t bno, const xfs_refcount_rec_t *rec,
+                       uint32_t *split_bno, uint32_t *split_key) {
+    *split_bno = 0;
+    xfs_refc_block_t *b = refc_read(ag_id, bno);
+    if (b == NULL) {
+        return -1;
+    }
+
+    int n = b->bb_numrecs;
+    int level = b->bb_level;
+    if (level == 0) {
+        xfs_refcount_rec_t *r = refc_recs(b);
+        int pos = n;
+        while (pos > 0 && r[pos - 1].rc_startblock > rec->rc_startblock) {
+            pos--;
+        }
+        memmove(&r[pos + 1], &r[pos], (n - pos) * sizeof(xfs_refcount_rec_t));
+        r[pos] = *rec;
+    } else {
+        xfs_refc_key_t *k = refc_keys(b);
+        int i = refc_child(b, rec->rc_startblock);
+        uint32_t child_split, child_key;
+        if (refc_insert(ag_id, k[i].ptr, rec, &child_split, &child_key) != 0) {
+            free(b);
+            return -1;
+        }
+        if (child_split == 0) {
+            free(b);
+            return 0; // This block is unchanged
+        }
+        memmove(&k[i + 2], &k[i + 1], (n - i - 1) * sizeof(xfs_refc_key_t));
+        k[i + 1].startblock = child_key;
+        k[i + 1].ptr = child_split;
+    }
+    b->bb_numrecs = ++n;
+
+    // Overfull: the upper half moves to a new right sibling
+    if (n > refc_maxrecs(level)) {
+        uint32_t new_bno = (uint32_t)xfs_alloc_ag_block(ag_id);
+        xfs_refc_block_t *nb = new_bno != 0 ? refc_alloc_buf() : NULL;
+        if (nb == NULL) {
+            free(b);
+            return -1;
+        }
+        size_t esz = level ? sizeof(xfs_refc_key_t) : sizeof(xfs_refcount_rec_t);
+        int keep = n / 2;
+        nb->bb_magic = XFS_REFC_MAGIC;
+        nb->bb_level = (uint16_t)level;
+        nb->bb_numrecs = (uint16_t)(n - keep);
+        memcpy(nb + 1, (char *)(b + 1) + keep * esz, (n - keep) * esz);
+        b->bb_numrecs = (uint16_t)keep;
+        *split_key = level ? refc_keys(nb)[0].startblock : refc_recs(nb)[0].rc_startblock;
+        *split_bno = new_bno;
+        int ret = refc_write(ag_id, new_bno, nb);
+        free(nb);
+        if (ret != 0) {
+            free(b);
+            return -1;
+        }
+    }
+
+    int ret = refc_write(ag_id, bno, b);
+    free(b);
+    return ret;
+}
+
+// Delete the record starting at key from the subtree at bno. *empty is set
+// when the block is left with no entries; the caller then frees it.
+static int refc_delete(int ag_id, uint32_t bno, uint32_t key, int *empty) {
+    *empty = 0;
+    xfs_refc_block_t *b = refc_read(ag_id, bno);
+    if (b == NULL) {
+        return -1;
+    }
+
+    int n = b->bb_numrecs;
+    if (b->bb_level == 0) {
+        xfs_refcount_rec_t *r = refc_recs(b);
+        int i = 0;
+        while (i < n && r[i].rc_startblock != key) {
+            i++;
+        }
+        if (i == n) {
+            free(b);
+            return -1; // No such record
+        }
+        memmove(&r[i], &r[i + 1], (n - i - 1) * sizeof(xfs_refcount_rec_t));
+    } else {
+        xfs_refc_key_t *k = refc_keys(b);
+        int i = refc_child(b, key);
+        int child_empty;
+        if (refc_delete(ag_id, k[i].ptr, key, &child_empty) != 0) {
+            free(b);
+            return -1;
+        }
+        if (!child_empty) {
+            free(b);
+            return 0; // This block is unchanged
+        }
+        xfs_free_ag_block(ag_id, k[i].ptr);
+        memmove(&k[i], &k[i + 1], (n - i - 1) * sizeof(xfs_refc_key_t));
+    }
+    b->bb_numrecs = --n;
+
+    int ret = 0;
+    if (n == 0) {
+        *empty = 1;
+    } else {
+        ret = refc_write(ag_id, bno, b);
+    }
+    free(b);
+    return ret;
+}
+
+// Find the last record starting at or before key (1 found, 0 none, -1 error)
+static int refc_find_le(int ag_id, xfs_agf_t *agf, uint32_t key, xfs_refcount_rec_t *out) {
+    return agf->agf_refcount_root ? refc_lookup_le(ag_id, agf->agf_refcount_root, key, out) : 0;
+}
+
+// Find the first record starting at or after key (1 found, 0 none, -1 error)
+static int refc_find_ge(int ag_id, xfs_agf_t *agf, uint32_t key, xfs_refcount_rec_t *out) {
+    return agf->agf_refcount_root ? refc_lookup_ge(ag_id, agf->agf_refcount_root, key, out) : 0;
+}
+
+// Insert a record, creating the tree or growing a new root as needed
+static int refc_add(int ag_id, xfs_agf_t *agf, const xfs_refcount_rec_t *rec) {
+    if (agf->agf_refcount_root == 0) {
+        uint32_t bno = (uint32_t)xfs_alloc_ag_block(ag_id);
+        xfs_refc_block_t *b = bno != 0 ? refc_alloc_buf() : NULL;
+        if (b == NULL) {
+            return -1;
+        }
+        b->bb_magic = XFS_REFC_MAGIC;
+        b->bb_numrecs = 1;
+        refc_recs(b)[0] = *rec;
+        int ret = refc_write(ag_id, bno, b);
+        free(b);
+        if (ret != 0) {
+            return -1;
+        }
+        agf->agf_refcount_root = bno;
+        agf->agf_refcount_level = 1;
+        return xfs_alloc_log_agf(ag_id);
+    }
+
+    uint32_t split_bno, split_key;
+    if (refc_insert(ag_id, agf->agf_refcount_root, rec, &split_bno, &split_key) != 0) {
+        return -1;
+    }
+    if (split_bno == 0) {
+        return 0;
+    }
+
+    // The root split: a new root points at both halves
+    uint32_t bno = (uint32_t)xfs_alloc_ag_block(ag_id);
+    xfs_refc_block_t *b = bno != 0 ? refc_alloc_buf() : NULL;
+    if (b == NULL) {
+        return -1;
+    }
+    b->bb_magic = XFS_REFC_MAGIC;
+    b->bb_level = (uint16_t)agf->agf_refcount_level;
+    b->bb_numrecs = 2;
+    refc_keys(b)[0].startblock = 0;
+    refc_keys(b)[0].ptr = agf->agf_refcount_root;
+    refc_keys(b)[1].startblock = split_key;
+    refc_keys(b)[1].ptr = split_bno;
+    int ret = refc_write(ag_id, bno, b);
+    free(b);
+    if (ret != 0) {
+        return -1;
+    }
+    agf->agf_refcount_root = bno;
+    agf->agf_refcount_level++;
+    return xfs_alloc_log_agf(ag_id);
+}
+
+// Delete the record starting at key, freeing an emptied root and collapsing single-child roots
+static int refc_remove(int ag_id, xfs_agf_t *agf, uint32_t key) {
+    if (agf->agf_refcount_root == 0) {
+        return -1;
+    }
+
+    int empty;
+    if (refc_delete(ag_id, agf->agf_refcount_root, key, &empty) != 0) {
+        return -1;
+    }
+
+    int changed = 0;
+    if (empty) {
+        xfs_free_ag_block(ag_id, agf->agf_refcount_root);
+        agf->agf_refcount_root = 0;
+        agf->agf_refcount_level = 0;
+        changed = 1;
+    }
+    while (agf->agf_refcount_level > 1) {
+        xfs_refc_block_t *b = refc_read(ag_id, agf->agf_refcount_root);
+        if (b == NULL) {
+            return -1;
+        }
+        uint32_t child = b->bb_numrecs == 1 ? refc_keys(b)[0].ptr : 0;
+        free(b);
+        if (child == 0) {
+            break;
+        }
+        xfs_free_ag_block(ag_id, agf->agf_refcount_root);
+        agf->agf_refcount_root = child;
+        agf->agf_refcount_level--;
+        changed = 1;
+    }
+    return changed ? xfs_alloc_log_agf(ag_id) : 0;
+}
+
+// Append a run to a record list, merging it into the previous run when they
+// continue each other with the same count; runs with one owner get no record
+static void refc_push(xfs_refcount_rec_t *recs, int *n, uint32_t start, uint32_t len, int64_t refcount) {
+    if (len == 0 || refcount < 2) {
+        return;
+    }
+    if (*n > 0) {
+        xfs_refcount_rec_t *prev = &recs[*n - 1];
+        if (prev->rc_startblock + prev->rc_blockcount == start && prev->rc_refcount == (uint32_t)refcount) {
+            prev->rc_blockcount += len;
+            return;
+        }
+    }
+    recs[*n].rc_startblock = start;
+    recs[*n].rc_blockcount = len;
+    recs[*n].rc_refcount = (uint32_t)refcount;
+    (*n)++;
+}
+
+// Add delta owners to every block of [agbno, agbno + len) (caller holds the AG lock)
+static int refc_adjust(int ag_id, xfs_agf_t *agf, uint32_t agbno, uint32_t len, int delta) {
+    uint32_t end = agbno + len;
+    xfs_refcount_rec_t *old = NULL;
+    int nold = 0, cap = 0;
+    int ret = 0;
+
+    // Collect the records overlapping the range, in order
+    xfs_refcount_rec_t r;
+    uint32_t key = agbno;
+    int found = refc_find_le(ag_id, agf, agbno, &r);
+    if (found == 0) {
+        found = refc_find_ge(ag_id, agf, agbno, &r);
+    }
+    for (;;) {
+        if (found < 0) {
+            free(old);
+            return -1;
+        }
+        if (found == 0 || r.rc_startblock >= end) {
+            break;
+        }
+        if (r.rc_startblock + r.rc_blockcount > agbno) {
+            if (nold == cap) {
+                cap = cap ? cap * 2 : 8;
+                xfs_refcount_rec_t *p = (xfs_refcount_rec_t *)realloc(old, cap * sizeof(xfs_refcount_rec_t));
+                if (p == NULL) {
+                    free(old);
+                    return -1;
+                }
+                old = p;
+            }
+            old[nold++] = r;
+        }
+        key = r.rc_startblock >= key ? r.rc_startblock + 1 : key;
+        found = refc_find_ge(ag_id, agf, key, &r);
+    }
+
+    // Lay out the new records: untouched remainders keep their count, the
+    // range itself gains delta (blocks without a record have one owner)
+    xfs_refcount_rec_t *neu = (xfs_refcount_rec_t *)malloc((2 * nold + 3) * sizeof(xfs_refcount_rec_t));
+    if (neu == NULL) {
+        free(old);
+        return -1;
+    }
+    int nnew = 0;
+    uint32_t pos = agbno;
+    for (int i = 0; i < nold; i++) {
+        uint32_t o_end = old[i].rc_startblock + old[i].rc_blockcount;
+        uint32_t s = old[i].rc_startblock > agbno ? old[i].rc_startblock : agbno;
+        uint32_t e = o_end < end ? o_end : end;
+        if (old[i].rc_startblock < agbno) {
+            refc_push(neu, &nnew, old[i].rc_startblock, agbno - old[i].rc_startblock, old[i].rc_refcount);
+        }
+        refc_push(neu, &nnew, pos, s - pos, 1 + delta);
+        refc_push(neu, &nnew, s, e - s, (int64_t)old[i].rc_refcount + delta);
+        if (o_end > end) {
+            refc_push(neu, &nnew, end, o_end - end, old[i].rc_refcount);
+        }
+        pos = e;
+    }
+    refc_push(neu, &nnew, pos, end - pos, 1 + delta);
+
+    for (int i = 0; i < nold && ret == 0; i++) {
+        ret = refc_remove(ag_id, agf, old[i].rc_startblock);
+    }
+
+    // Absorb neighbours just outside the range that continue a run with the same count
+    if (ret == 0 && nnew > 0) {
+        xfs_refcount_rec_t *first = &neu[0];
+        xfs_refcount_rec_t *last = &neu[nnew - 1];
+        if (first->rc_startblock > 0 && refc_find_le(ag_id, agf, first->rc_startblock - 1, &r) == 1 &&
+            r.rc_startblock + r.rc_blockcount == first->rc_startblock && r.rc_refcount == first->rc_refcount) {
+            ret = refc_remove(ag_id, agf, r.rc_startblock);
+            first->rc_startblock = r.rc_startblock;
+            first->rc_blockcount += r.rc_blockcount;
+        }
+        uint32_t last_end = last->rc_startblock + last->rc_blockcount;
+        if (ret == 0 && refc_find_ge(ag_id, agf, last_end, &r) == 1 &&
+            r.rc_startblock == last_end && r.rc_refcount == last->rc_refcount) {
+            ret = refc_remove(ag_id, agf, r.rc_startblock);
+            last->rc_blockcount += r.rc_blockcount;
+        }
+    }
+
+    for (int i = 0; i < nnew && ret == 0; i++) {
+        ret = refc_add(ag_id, agf, &neu[i]);
+    }
+
+    free(neu);
+    free(old);
+    return ret;
+}
+
+// Log one refcount update item covering a batch of extents
+static int refc_log_update(int ag_id, const xfs_agext_t *ext, int count, int delta) {
+    size_t len = sizeof(xfs_cui_log_t) + count * sizeof(xfs_agext_t);
+    char *item = (char *)malloc(len);
+    if (item == NULL) {
+        return -1;
+    }
+
+    xfs_cui_log_t hdr = { XFS_LI_CUI, 0, delta, (uint32_t)ag_id, (uint32_t)count };
+    memcpy(item, &hdr, sizeof(hdr));
+    memcpy(item + sizeof(hdr), ext, count * sizeof(xfs_agext_t));
+    int ret = trans_add_item(item, (int)len);
+    free(item);
+    return ret;
+}
+
+// Find the first shared run in [agbno, agbno + len) of an AG whose lock is held
+int xfs_refcount_find_shared_locked(int ag_id, uint32_t agbno, uint32_t len, uint32_t *fbno, uint32_t *flen) {
+    xfs_agf_t *agf = xfs_alloc_get_agf(ag_id);
+    if (agf == NULL) {
+        return -1;
+    }
+    if (agf->agf_refcount_root == 0 || len == 0) {
+        return 0;
+    }
+
+    uint32_t end = agbno + len;
+    xfs_refcount_rec_t r;
+    int found = refc_find_le(ag_id, agf, agbno, &r);
+    if (found == 0 || (found == 1 && r.rc_startblock + r.rc_blockcount <= agbno)) {
+        found = refc_find_ge(ag_id, agf, agbno, &r);
+    }
+    if (found != 1 || r.rc_startblock >= end) {
+        return found < 0 ? -1 : 0;
+    }
+
+    uint32_t r_end = r.rc_startblock + r.rc_blockcount;
+    *fbno = r.rc_startblock > agbno ? r.rc_startblock : agbno;
+    *flen = (r_end < end ? r_end : end) - *fbno;
+    return 1;
+}
+
+// Find the first shared run in [agbno, agbno + len) of an AG
+int xfs_refcount_find_shared(int ag_id, uint32_t agbno, uint32_t len, uint32_t *fbno, uint32_t *flen) {
+    if (ag_lock(ag_id) != 0) {
+        return -1;
+    }
+    int ret = xfs_refcount_find_shared_locked(ag_id, agbno, len, fbno, flen);
+    ag_unlock(ag_id);
+    return ret;
+}
+
+// Add an owner to each extent of one AG under one AG lock hold and one log item
+int xfs_refcount_increase(int ag_id, const xfs_agext_t *ext, int count) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (ag_lock(ag_id) != 0) {
+        return -1;
+    }
+
+    xfs_agf_t *agf = xfs_alloc_get_agf(ag_id);
+    int ret = agf != NULL ? 0 : -1;
+    for (int i = 0; i < count && ret == 0; i++) {
+        ret = refc_adjust(ag_id, agf, ext[i].agbno, ext[i].len, 1);
+    }
+    if (ret == 0) {
+        ret = refc_log_update(ag_id, ext, count, 1);
+    }
+
+    ag_unlock(ag_id);
+    return ret;
+}
+
+// Append an extent to a grown array
+static int refc_append_ext(xfs_agext_t **arr, int *n, int *cap, uint32_t agbno, uint32_t len) {
+    if (*n == *cap) {
+        int new_cap = *cap ? *cap * 2 : 16;
+        xfs_agext_t *p = (xfs_agext_t *)realloc(*arr, new_cap * sizeof(xfs_agext_t));
+        if (p == NULL) {
+            return -1;
+        }
+        *arr = p;
+        *cap = new_cap;
+    }
+    (*arr)[*n].agbno = agbno;
+    (*arr)[*n].len = len;
+    (*n)++;
+    return 0;
+}
+
+// Drop an owner from each extent of an AG whose lock is held; blocks with a
+// single owner are appended to *unshared for the caller to free
+int xfs_refcount_decrease_locked(int ag_id, const xfs_agext_t *ext, int count,
+                                 xfs_agext_t **unshared, int *nunshared) {
+    xfs_agf_t *agf = xfs_alloc_get_agf(ag_id);
+    if (agf == NULL) {
+        return -1;
+    }
+
+    int ucap = *nunshared;
+    xfs_agext_t *shared = NULL;
+    int nshared = 0, scap = 0;
+    int ret = 0;
+
+    for (int i = 0; i < count && ret == 0; i++) {
+        uint32_t pos = ext[i].agbno;
+        uint32_t end = ext[i].agbno + ext[i].len;
+        while (pos < end && ret == 0) {
+            uint32_t fbno, flen;
+            int found = xfs_refcount_find_shared_locked(ag_id, pos, end - pos, &fbno, &flen);
+            if (found < 0) {
+                ret = -1;
+                break;
+            }
+            if (found == 0) {
+                ret = refc_append_ext(unshared, nunshared, &ucap, pos, end - pos);
+                break;
+            }
+            if (fbno > pos) {
+                ret = refc_append_ext(unshared, nunshared, &ucap, pos, fbno - pos);
+            }
+            if (ret == 0) {
+                ret = refc_adjust(ag_id, agf, fbno, flen, -1);
+            }
+            if (ret == 0) {
+                ret = refc_append_ext(&shared, &nshared, &scap, fbno, flen);
+            }
+            pos = fbno + flen;
+        }
+    }
+
+    if (ret == 0 && nshared > 0) {
+        ret = refc_log_update(ag_id, shared, nshared, -1);
+    }
+    free(shared);
+    return ret;
+}
+
+// Drop the owner xfs_refcount_increase added to each extent of one AG;
+// blocks left with one owner stay allocated
+int xfs_refcount_decrease(int ag_id, const xfs_agext_t *ext, int count) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (ag_lock(ag_id) != 0) {
+        return -1;
+    }
+
+    xfs_agext_t *unshared = NULL;
+    int nunshared = 0;
+    int ret = xfs_refcount_decrease_locked(ag_id, ext, count, &unshared, &nunshared);
+    free(unshared);
+
+    ag_unlock(ag_id);
+    return ret;
+}
+
+// Walk the subtree at bno, counting records and the blocks they cover
+static int refc_count_subtree(int ag_id, uint32_t bno, uint64_t *records, uint64_t *blocks) {
+    xfs_refc_block_t *b = refc_read(ag_id, bno);
+    if (b == NULL) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < b->bb_numrecs && ret == 0; i++) {
+        if (b->bb_level == 0) {
+            (*records)++;
+            *blocks += refc_recs(b)[i].rc_blockcount;
+        } else {
+            ret = refc_count_subtree(ag_id, refc_keys(b)[i].ptr, records, blocks);
+        }
+    }
+    free(b);
+    return ret;
+}
+
+// Count an AG's refcount records and the blocks they cover
+int xfs_refcount_count(int ag_id, uint64_t *records, uint64_t *shared_blocks) {
+    *records = 0;
+    *shared_blocks = 0;
+    if (ag_lock(ag_id) != 0) {
+        return -1;
+    }
+
+    xfs_agf_t *agf = xfs_alloc_get_agf(ag_id);
+    int ret = agf != NULL ? 0 : -1;
+    if (ret == 0 && agf->agf_refcount_root != 0) {
+        ret = refc_count_subtree(ag_id, agf->agf_refcount_root, records, shared_blocks);
+    }
+
+    ag_unlock(ag_id);
+    return ret;
+}
@@ -0,0 +1,356 @@
+#include "../include/xfs_ring.h"
+#include "../include/xfs_io.h"
+#include "../include/xfs_trans.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Submission/completion rings in the style of io_uring. One thread owns a
+// ring: it fills entries from the submission queue and submits them, and
+// reaps the completion queue. A pool of workers claims submitted entries
+// and runs them with the synchronous file API, so a single submitter can
+// keep as many operations in flight as the ring holds. An fsync does not
+// hold a worker while the log flushes: it queues an asynchronous barrier
+// and the log worker posts its completion.
+//
+// Linked entries form a chain that one worker runs in order. The
+// completion queue is twice the submission queue, and entries are only
+// handed out while their completions are sure to fit, so it never
+// overflows.
+
+// A chain of linked entries claimed by a worker
+typedef struct ring_req {
+    xfs_ring_t *ring;
+    int count;
+    int next;               // Entry to run next
+    int failed;             // An entry failed: cancel the rest
+    int inode_num;          // Inode of the chain's most recent create
+    struct ring_req *next_ready;
+    xfs_sqe_t sqes[];       // Copied out of the submission queue
+} ring_req_t;
+
+struct xfs_ring {
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+    xfs_sqe_t *sqes;
+    xfs_cqe_t *cqes;
+    unsigned int sq_prepared;   // Entries handed out by get_sqe (submitter only)
+    unsigned int sq_tail;       // Entries submitted (under lock)
+    unsigned int sq_head;       // Entries claimed by workers (under lock)
+    unsigned int cq_tail;       // Completions posted (under lock)
+    unsigned int cq_head;       // Completions seen (submitter only)
+    ring_req_t *ready_head;     // Chains to resume after an fsync (under lock)
+    ring_req_t *ready_tail;
+    int waiting;                // Threads waiting for a completion (under lock)
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   // Workers wait for submissions
+    pthread_cond_t cq_cond;     // The submitter waits for completions
+    pthread_t *workers;
+    int nworkers;
+};
+
+// Post a completion (caller holds the ring lock)
+static void ring_post_locked(xfs_ring_t *ring, uint64_t user_data, int res) {
+    xfs_cqe_t *cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    __atomic_store_n(&ring->cq_tail, ring->cq_tail + 1, __ATOMIC_RELEASE);
+    if (ring->waiting > 0) {
+        pthread_cond_broadcast(&ring->cq_cond);
+    }
+}
+
+static void ring_post(xfs_ring_t *ring, uint64_t user_data, int res) {
+    pthread_mutex_lock(&ring->lock);
+    ring_post_locked(ring, user_data, res);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Claim the chain at the head of the submission queue (caller holds the ring lock)
+static ring_req_t *ring_claim_locked(xfs_ring_t *ring) {
+    unsigned int mask = ring->sq_entries - 1;
+    unsigned int head = ring->sq_head;
+    int count = 1;
+    while ((ring->sqes[(head + count - 1) & mask].flags & XFS_SQE_LINK) && head + count != ring->sq_tail) {
+        count++;
+    }
+
+    ring_req_t *req = (ring_req_t *)malloc(sizeof(ring_req_t) + count * sizeof(xfs_sqe_t));
+    if (req == NULL) {
+        for (int i = 0; i < count; i++) {
+            ring_post_locked(ring, ring->sqes[(head + i) & mask].user_data, -1);
+        }
+    } else {
+        req->ring = ring;
+        req->count = count;
+        req->next = 0;
+        req->failed = 0;
+        req->inode_num = 0;
+        req->next_ready = NULL;
+        for (int i = 0; i < count; i++) {
+            req->sqes[i] = ring->sqes[(head + i) & mask];
+        }
+    }
+    __atomic_store_n(&ring->sq_head, head + count, __ATOMIC_RELEASE);
+    return req;
+}
+
+// Run one entry with the synchronous API
+static int ring_execute(ring_req_t *req, xfs_sqe_t *sqe) {
+    int ino = sqe->inode_num == XFS_RING_PREV_INODE ? req->inode_num : sqe->inode_num;
+
+    switch (sqe->opcode) {
+        case XFS_RING_OP_NOP:
+            return 0;
+        case XFS_RING_OP_READ: {
+            xfs_inode_t *inode = get_inode_ptr(ino);
+            return inode ? xfs_sim_read(inode, sqe->buf, sqe->len, sqe->offset) : -1;
+        }
+        case XFS_RING_OP_WRITE: {
+            xfs_inode_t *inode = get_inode_ptr(ino);
+            return inode ? xfs_sim_write(inode, sqe->buf, sqe->len, sqe->offset) : -1;
+        }
+        case XFS_RING_OP_CREATE: {
+            int ret = xfs_create_named_file((const char *)sqe->buf);
+            if (ret <= 0) {
+                return -1;
+            }
+            req->inode_num = ret;
+            return ret;
+        }
+        default:
+            return -1;
+    }
+}
+
+// The log is flushed past an fsync, or shut down before it: complete it and
+// resume its chain, which is canceled if the fsync failed
+static void ring_fsync_done(void *arg, int error) {
+    ring_req_t *req = (ring_req_t *)arg;
+    xfs_ring_t *ring = req->ring;
+    int more = req->next < req->count;
+
+    if (error) {
+        req->failed = 1;
+    }
+    pthread_mutex_lock(&ring->lock);
+    ring_post_locked(ring, req->sqes[req->next - 1].user_data, error);
+    if (more) {
+        if (ring->ready_tail == NULL) {
+            ring->ready_head = req;
+        } else {
+            ring->ready_tail->next_ready = req;
+        }
+        ring->ready_tail = req;
+        pthread_cond_signal(&ring->work_cond);
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    if (!more) {
+        free(req);
+    }
+}
+
+// Run a chain until it ends or parks on an fsync
+static void ring_run(ring_req_t *req) {
+    xfs_ring_t *ring = req->ring;
+
+    while (req->next < req->count) {
+        xfs_sqe_t *sqe = &req->sqes[req->next++];
+        if (req->failed) {
+            ring_post(ring, sqe->user_data, XFS_RING_CANCELED);
+            continue;
+        }
+
+        int res;
+        if (sqe->opcode == XFS_RING_OP_FSYNC) {
+            if (trans_commit_barrier_async(ring_fsync_done, req) == 0) {
+                return;  // ring_fsync_done() completes it
+            }
+            res = -1;
+        } else {
+            res = ring_execute(req, sqe);
+        }
+        if (res < 0) {
+            req->failed = 1;
+        }
+        ring_post(ring, sqe->user_data, res);
+    }
+    free(req);
+}
+
+static void *ring_worker(void *arg) {
+    xfs_ring_t *ring = (xfs_ring_t *)arg;
+
+    pthread_mutex_lock(&ring->lock);
+    for (;;) {
+        while (!ring->stopping && ring->ready_head == NULL && ring->sq_head == ring->sq_tail) {
+            pthread_cond_wait(&ring->work_cond, &ring->lock);
+        }
+
+        ring_req_t *req;
+        if (ring->ready_head != NULL) {
+            req = ring->ready_head;
+            ring->ready_head = req->next_ready;
+            if (ring->ready_head == NULL) {
+                ring->ready_tail = NULL;
+            }
+            req->next_ready = NULL;
+        } else if (ring->sq_head != ring->sq_tail) {
+            req = ring_claim_locked(ring);
+        } else {
+            break;  // Stopping with nothing left to run
+        }
+        pthread_mutex_unlock(&ring->lock);
+
+        if (req != NULL) {
+            ring_run(req);
+        }
+        pthread_mutex_lock(&ring->lock);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+// Create a ring with room for entries submissions and a pool of workers threads to run them
+xfs_ring_t *xfs_ring_create(unsigned int entries, int workers) {
+    if (entries == 0 || entries > (1u << 20) || workers < 1) {
+        return NULL;
+    }
+
+    xfs_ring_t *ring = (xfs_ring_t *)calloc(1, sizeof(xfs_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->sq_entries = 1;
+    while (ring->sq_entries < entries) {
+        ring->sq_entries <<= 1;
+    }
+    ring->cq_entries = ring->sq_entries * 2;
+    ring->sqes = (xfs_sqe_t *)calloc(ring->sq_entries, sizeof(xfs_sqe_t));
+    ring->cqes = (xfs_cqe_t *)calloc(ring->cq_entries, sizeof(xfs_cqe_t));
+    ring->workers = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    if (ring->sqes == NULL || ring->cqes == NULL || ring->workers == NULL) {
+        free(ring->sqes);
+        free(ring->cqes);
+        free(ring->workers);
+        free(ring);
+        return NULL;
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->work_cond, NULL);
+    pthread_cond_init(&ring->cq_cond, NULL);
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&ring->workers[i], NULL, ring_worker, ring) != 0) {
+            break;
+        }
+        ring->nworkers++;
+    }
+    if (ring->nworkers == 0) {
+        xfs_ring_destroy(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+// Wait for every submitted entry to complete, stop the workers and free the ring
+void xfs_ring_destroy(xfs_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    ring->waiting++;
+    while (ring->nworkers > 0 && ring->cq_tail != ring->sq_tail) {
+        pthread_cond_wait(&ring->cq_cond, &ring->lock);
+    }
+    ring->waiting--;
+    ring->stopping = 1;
+    pthread_cond_broadcast(&ring->work_cond);
+    pthread_mutex_unlock(&ring->lock);
+
+    for (int i = 0; i < ring->nworkers; i++) {
+        pthread_join(ring->workers[i], NULL);
+    }
+    pthread_cond_destroy(&ring->cq_cond);
+    pthread_cond_destroy(&ring->work_cond);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->workers);
+    free(ring->cqes);
+    free(ring->sqes);
+    free(ring);
+}
+
+// Next free submission entry, or NULL if the ring is full
+xfs_sqe_t *xfs_ring_get_sqe(xfs_ring_t *ring) {
+    if (ring->sq_prepared - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries ||
+        ring->sq_prepared - ring->cq_head >= ring->cq_entries) {
+        return NULL;
+    }
+
+    xfs_sqe_t *sqe = &ring->sqes[ring->sq_prepared & (ring->sq_entries - 1)];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_prepared++;
+    return sqe;
+}
+
+// Hand every entry taken since the last submit to the workers; returns how many
+int xfs_ring_submit(xfs_ring_t *ring) {
+    pthread_mutex_lock(&ring->lock);
+    int count = (int)(ring->sq_prepared - ring->sq_tail);
+    if (count > 0) {
+        ring->sq_tail = ring->sq_prepared;
+        if (count == 1) {
+            pthread_cond_signal(&ring->work_cond);
+        } else {
+            pthread_cond_broadcast(&ring->work_cond);
+        }
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return count;
+}
+
+// Oldest unseen completion, or NULL if there is none
+xfs_cqe_t *xfs_ring_peek_cqe(xfs_ring_t *ring) {
+    if (ring->cq_head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[ring->cq_head & (ring->cq_entries - 1)];
+}
+
+// Wait for a completion (0), or return -1 if nothing is in flight
+int xfs_ring_wait_cqe(xfs_ring_t *ring, xfs_cqe_t **cqe) {
+    *cqe = xfs_ring_peek_cqe(ring);
+    if (*cqe != NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->sq_tail == ring->cq_head) {
+        pthread_mutex_unlock(&ring->lock);
+        return -1;
+    }
+    ring->waiting++;
+    while (ring->cq_tail == ring->cq_head) {
+        pthread_cond_wait(&ring->cq_cond, &ring->lock);
+    }
+    ring->waiting--;
+    pthread_mutex_unlock(&ring->lock);
+
+    *cqe = xfs_ring_peek_cqe(ring);
+    return 0;
+}
+
+// Release a completion returned by peek or wait
+void xfs_ring_cqe_seen(xfs_ring_t *ring, xfs_cqe_t *cqe) {
+    (void)cqe;
+    __atomic_store_n(&ring->cq_head, ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Entries taken from the ring whose completions have not been seen
+unsigned int xfs_ring_inflight(xfs_ring_t *ring) {
+    return ring->sq_prepared - ring->cq_head;
+}
@@ -0,0 +1,205 @@
+#include "../include/xfs_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Counters are sharded so concurrent threads rarely share a cache line.
+// Each thread is assigned a shard on first use; updates are relaxed atomics
+// (a shard may be shared once there are more threads than shards) and the
+// shards are folded together only when the stats are read.
+#define XFS_STATS_SHARDS 64
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[XFS_STATS_BUCKETS];
+} xfs_stat_hist_t;
+
+typedef struct {
+    xfs_stat_hist_t hist[XFS_STAT_MAX];
+} __attribute__((aligned(64))) xfs_stats_shard_t;
+
+static xfs_stats_shard_t stats_shards[XFS_STATS_SHARDS];
+static unsigned int stats_next_shard = 0;
+static __thread int stats_shard_id = -1;
+
+static const char *stat_names[XFS_STAT_MAX] = {
+    "alloc",
+    "free",
+    "log_enqueue",
+    "log_flush",
+    "barrier_wait",
+    "read",
+    "write",
+    "ag_lock_wait",
+    "extent_lookup",
+    "log_space_wait"
+};
+
+// Monotonic timestamp in nanoseconds
+uint64_t xfs_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static xfs_stats_shard_t *stats_shard(void) {
+    if (stats_shard_id < 0) {
+        stats_shard_id = __atomic_fetch_add(&stats_next_shard, 1, __ATOMIC_RELAXED) % XFS_STATS_SHARDS;
+    }
+    return &stats_shards[stats_shard_id];
+}
+
+static int stats_bucket(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+    int b = 64 - __builtin_clzll(ns);
+    return b < XFS_STATS_BUCKETS ? b : XFS_STATS_BUCKETS - 1;
+}
+
+// Record one event with an explicit latency in nanoseconds
+void xfs_stats_record_ns(xfs_stat_id_t id, uint64_t ns) {
+    xfs_stat_hist_t *h = &stats_shard()->hist[id];
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&h->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // max was reloaded by the failed exchange
+    }
+}
+
+// Record one event whose latency is (now - start_ns)
+void xfs_stats_record(xfs_stat_id_t id, uint64_t start_ns) {
+    xfs_stats_record_ns(id, xfs_stats_now() - start_ns);
+}
+
+// Fold all shards of one stat into a single histogram
+static void stats_fold(xfs_stat_id_t id, xfs_stat_hist_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int s = 0; s < XFS_STATS_SHARDS; s++) {
+        xfs_stat_hist_t *h = &stats_shards[s].hist[id];
+        out->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        out->sum_ns += __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+        if (max > out->max_ns) {
+            out->max_ns = max;
+        }
+        for (int b = 0; b < XFS_STATS_BUCKETS; b++) {
+            out->buckets[b] += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Upper bound (ns) of the bucket holding the given percentile, capped at the max
+static uint64_t stats_percentile(const xfs_stat_hist_t *h, double pct) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(h->count * pct);
+    uint64_t seen = 0;
+    for (int b = 0; b < XFS_STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > target) {
+            uint64_t upper = b == 0 ? 0 : (1ull << b) - 1;
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// Print a summary table of all counters
+void xfs_stats_print(void) {
+    printf("\n--- STATISTICS ---\n");
+    printf("%-14s %12s %12s %12s %12s %12s\n", "op", "count", "avg(ns)", "p50(ns)", "p99(ns)", "max(ns)");
+    for (int i = 0; i < XFS_STAT_MAX; i++) {
+        xfs_stat_hist_t h;
+        stats_fold((xfs_stat_id_t)i, &h);
+        printf("%-14s %12llu %12llu %12llu %12llu %12llu\n",
+               stat_names[i],
+               (unsigned long long)h.count,
+               (unsigned long long)(h.count ? h.sum_ns / h.count : 0),
+               (unsigned long long)stats_percentile(&h, 0.50),
+               (unsigned long long)stats_percentile(&h, 0.99),
+               (unsigned long long)h.max_ns);
+    }
+    printf("------------------\n");
+}
+
+static void stats_dump_json(FILE *f) {
+    fprintf(f, "{\n  \"stats\": {\n");
+    for (int i = 0; i < XFS_STAT_MAX; i++) {
+        xfs_stat_hist_t h;
+        stats_fold((xfs_stat_id_t)i, &h);
+        fprintf(f, "    \"%s\": {\"count\": %llu, \"sum_ns\": %llu, \"max_ns\": %llu, "
+                   "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"buckets\": [",
+                stat_names[i],
+                (unsigned long long)h.count,
+                (unsigned long long)h.sum_ns,
+                (unsigned long long)h.max_ns,
+                (unsigned long long)stats_percentile(&h, 0.50),
+                (unsigned long long)stats_percentile(&h, 0.99),
+                (unsigned long long)stats_percentile(&h, 0.999));
+        for (int b = 0; b < XFS_STATS_BUCKETS; b++) {
+            fprintf(f, "%llu%s", (unsigned long long)h.buckets[b], b + 1 < XFS_STATS_BUCKETS ? ", " : "");
+        }
+        fprintf(f, "]}%s\n", i + 1 < XFS_STAT_MAX ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+}
+
+static void stats_dump_prom(FILE *f) {
+    fprintf(f, "# HELP xfs_sim_op_latency_seconds Latency of simulator hot-path operations.\n");
+    fprintf(f, "# TYPE xfs_sim_op_latency_seconds histogram\n");
+    for (int i = 0; i < XFS_STAT_MAX; i++) {
+        xfs_stat_hist_t h;
+        stats_fold((xfs_stat_id_t)i, &h);
+        uint64_t cumulative = 0;
+        for (int b = 0; b < XFS_STATS_BUCKETS - 1; b++) {
+            cumulative += h.buckets[b];
+            // Bucket b holds latencies below 2^b ns
+            fprintf(f, "xfs_sim_op_latency_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n",
+                    stat_names[i], (double)(1ull << b) / 1e9, (unsigned long long)cumulative);
+        }
+        fprintf(f, "xfs_sim_op_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n",
+                stat_names[i], (unsigned long long)h.count);
+        fprintf(f, "xfs_sim_op_latency_seconds_sum{op=\"%s\"} %.9f\n", stat_names[i], h.sum_ns / 1e9);
+        fprintf(f, "xfs_sim_op_latency_seconds_count{op=\"%s\"} %llu\n", stat_names[i], (unsigned long long)h.count);
+    }
+}
+
+// Write all counters and histograms to a file as JSON or Prometheus text
+int xfs_stats_dump(const char *path, int format) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+
+    if (format == XFS_STATS_FMT_PROM) {
+        stats_dump_prom(f);
+    } else {
+        stats_dump_json(f);
+    }
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// Zero all counters and histograms
+void xfs_stats_reset(void) {
+    for (int s = 0; s < XFS_STATS_SHARDS; s++) {
+        for (int i = 0; i < XFS_STAT_MAX; i++) {
+            xfs_stat_hist_t *h = &stats_shards[s].hist[i];
+            __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&h->sum_ns, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&h->max_ns, 0, __ATOMIC_RELAXED);
+            for (int b = 0; b < XFS_STATS_BUCKETS; b++) {
+                __atomic_store_n(&h->buckets[b], 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
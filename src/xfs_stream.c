@@ -0,0 +1,261 @@
+#include "../include/xfs_stream.h"
+#include "../include/xfs_io.h"
+#include "../include/xfs_ag.h"
+#include "../include/xfs_inode.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A streamed transfer moves a file through two chunk buffers, so memory use
+// does not depend on the file size. A helper thread does the simulator I/O
+// while the caller runs the callback on the other buffer: for a read the
+// helper fills buffers and the caller drains them, for a write the caller
+// fills and the helper writes. The helper is a thread of its own rather than
+// a pool task because a write waits for the log, which the pool flushes.
+//
+// Chunks start on multiples of the chunk size. A read chunk also ends where
+// the extent mapping its start ends, so each chunk is one contiguous range
+// of the disk (or one hole).
+
+typedef struct {
+    void *buf;
+    size_t len;
+    uint64_t offset;
+} stream_slot_t;
+
+typedef struct {
+    xfs_inode_t *inode;
+    uint64_t offset;
+    uint64_t end;
+    size_t chunk;
+    uint32_t bsize;
+    stream_slot_t slots[2];
+    unsigned int head;    // Slots drained
+    unsigned int tail;    // Slots filled
+    int eof;              // The producer has filled its last slot
+    int stop;             // Either side stopped the transfer
+    int error;            // The transfer failed
+    uint64_t written;     // Bytes the helper wrote
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} stream_t;
+
+static int stream_init(stream_t *s, xfs_inode_t *inode, uint64_t offset, uint64_t len, size_t chunk) {
+    memset(s, 0, sizeof(*s));
+    s->bsize = ag_blocksize();
+    if (inode == NULL || s->bsize == 0 || chunk > XFS_STREAM_MAX_CHUNK) {
+        return -1;
+    }
+    if (chunk == 0) {
+        chunk = XFS_STREAM_CHUNK;
+    }
+    s->inode = inode;
+    s->offset = offset;
+    s->end = len > UINT64_MAX - offset ? UINT64_MAX : offset + len;
+    s->chunk = (chunk + s->bsize - 1) / s->bsize * s->bsize;
+    for (int i = 0; i < 2; i++) {
+        s->slots[i].buf = malloc(s->chunk);
+        if (s->slots[i].buf == NULL) {
+            free(s->slots[0].buf);
+            return -1;
+        }
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    return 0;
+}
+
+static void stream_destroy(stream_t *s) {
+    free(s->slots[0].buf);
+    free(s->slots[1].buf);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+}
+
+// End of the chunk starting at pos
+static uint64_t stream_chunk_end(stream_t *s, uint64_t pos, int clip_extent) {
+    uint64_t cend = (pos / s->chunk + 1) * s->chunk;
+    if (cend > s->end || cend < pos) {
+        cend = s->end;
+    }
+    if (clip_extent) {
+        xfs_ilock(s->inode, XFS_ILOCK_SHARED);
+        xfs_extent_t *ext = find_extent_for_offset(s->inode, pos / s->bsize);
+        if (ext != NULL) {
+            uint64_t ext_end = (ext->start_off + ext->block_count) * s->bsize;
+            if (ext_end < cend) {
+                cend = ext_end;
+            }
+        }
+        xfs_iunlock(s->inode, XFS_ILOCK_SHARED);
+    }
+    return cend;
+}
+
+// Wait for a slot to fill; NULL once the transfer stopped
+static stream_slot_t *stream_get_empty(stream_t *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->tail - s->head == 2 && !s->stop) {
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    stream_slot_t *slot = s->stop ? NULL : &s->slots[s->tail & 1];
+    pthread_mutex_unlock(&s->lock);
+    return slot;
+}
+
+// Wait for a filled slot; NULL at the end of the transfer or once it stopped
+static stream_slot_t *stream_get_full(stream_t *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->tail == s->head && !s->eof && !s->stop) {
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    stream_slot_t *slot = s->tail != s->head && !s->stop ? &s->slots[s->head & 1] : NULL;
+    pthread_mutex_unlock(&s->lock);
+    return slot;
+}
+
+// Advance head or tail past the slot just drained or filled
+static void stream_advance(stream_t *s, unsigned int *pos) {
+    pthread_mutex_lock(&s->lock);
+    (*pos)++;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Mark the end of the producer's data, or stop the transfer (failed or not)
+static void stream_finish(stream_t *s, int stop, int error) {
+    pthread_mutex_lock(&s->lock);
+    s->eof = 1;
+    s->stop |= stop;
+    s->error |= error;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Read helper: fill slots from the file until the end of the range or EOF
+static void *stream_reader(void *arg) {
+    stream_t *s = (stream_t *)arg;
+    uint64_t pos = s->offset;
+    while (pos < s->end) {
+        stream_slot_t *slot = stream_get_empty(s);
+        if (slot == NULL) {
+            return NULL;
+        }
+        int n = xfs_sim_read(s->inode, slot->buf, stream_chunk_end(s, pos, 1) - pos, pos);
+        if (n < 0) {
+            stream_finish(s, 1, 1);
+            return NULL;
+        }
+        if (n == 0) {
+            break;  // End of file
+        }
+        slot->len = (size_t)n;
+        slot->offset = pos;
+        stream_advance(s, &s->tail);
+        pos += (uint64_t)n;
+    }
+    stream_finish(s, 0, 0);
+    return NULL;
+}
+
+// Write helper: write filled slots in order
+static void *stream_writer(void *arg) {
+    stream_t *s = (stream_t *)arg;
+    stream_slot_t *slot;
+    while ((slot = stream_get_full(s)) != NULL) {
+        int n = xfs_sim_write(s->inode, slot->buf, slot->len, slot->offset);
+        if (n < 0 || (size_t)n != slot->len) {
+            stream_finish(s, 1, 1);
+            return NULL;
+        }
+        s->written += (uint64_t)n;
+        stream_advance(s, &s->head);
+    }
+    return NULL;
+}
+
+// Pass up to len bytes of a file starting at offset to fn; returns the bytes fn consumed, or -1
+int64_t xfs_stream_read(xfs_inode_t *inode, uint64_t offset, uint64_t len, size_t chunk,
+                        xfs_stream_fn fn, void *arg) {
+    stream_t s;
+    if (fn == NULL || stream_init(&s, inode, offset, len, chunk) != 0) {
+        return -1;
+    }
+
+    xfs_ilock(inode, XFS_ILOCK_SHARED);
+    if (s.end > inode->di_size) {
+        s.end = inode->di_size;
+    }
+    xfs_iunlock(inode, XFS_ILOCK_SHARED);
+
+    pthread_t helper;
+    if (pthread_create(&helper, NULL, stream_reader, &s) != 0) {
+        stream_destroy(&s);
+        return -1;
+    }
+
+    int64_t consumed = 0;
+    stream_slot_t *slot;
+    while ((slot = stream_get_full(&s)) != NULL) {
+        ssize_t n = fn(slot->buf, slot->len, slot->offset, arg);
+        if (n < 0 || (size_t)n < slot->len) {
+            consumed += n > 0 ? n : 0;
+            stream_finish(&s, 1, n < 0);
+            break;
+        }
+        consumed += n;
+        stream_advance(&s, &s.head);
+    }
+
+    pthread_join(helper, NULL);
+    int error = s.error;
+    stream_destroy(&s);
+    return error ? -1 : consumed;
+}
+
+// Write up to len bytes at offset, produced by fn; returns the bytes written, or -1
+int64_t xfs_stream_write(xfs_inode_t *inode, uint64_t offset, uint64_t len, size_t chunk,
+                         xfs_stream_fn fn, void *arg) {
+    stream_t s;
+    if (fn == NULL || stream_init(&s, inode, offset, len, chunk) != 0) {
+        return -1;
+    }
+
+    pthread_t helper;
+    if (pthread_create(&helper, NULL, stream_writer, &s) != 0) {
+        stream_destroy(&s);
+        return -1;
+    }
+
+    uint64_t pos = s.offset;
+    int error = 0;
+    while (pos < s.end) {
+        stream_slot_t *slot = stream_get_empty(&s);
+        if (slot == NULL) {
+            break;  // The helper failed
+        }
+        size_t want = (size_t)(stream_chunk_end(&s, pos, 0) - pos);
+        ssize_t n = fn(slot->buf, want, pos, arg);
+        if (n < 0) {
+            error = 1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        slot->len = (size_t)n;
+        slot->offset = pos;
+        stream_advance(&s, &s.tail);
+        pos += (uint64_t)n;
+        if ((size_t)n < want) {
+            break;
+        }
+    }
+    stream_finish(&s, error, error);
+
+    pthread_join(helper, NULL);
+    error = s.error;
+    uint64_t written = s.written;
+    stream_destroy(&s);
+    return error ? -1 : (int64_t)written;
+}
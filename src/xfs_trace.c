@@ -0,0 +1,236 @@
+#include "../include/xfs_trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Each thread writes into its own single-producer ring, so emitting an
+// event never takes a lock or touches a shared cache line. The ring
+// overwrites its oldest records when full (flight recorder). Readers copy
+// a ring and then re-read its head to discard any records the producer may
+// have overwritten during the copy.
+#define XFS_TRACE_RING_SIZE 4096  // Records per thread, power of two
+
+typedef struct xfs_trace_ring {
+    uint64_t head;                   // Next record index (monotonic)
+    uint32_t tid;
+    int active;                      // Owned by a live thread
+    struct xfs_trace_ring *next;     // Registry link
+    xfs_trace_record_t records[XFS_TRACE_RING_SIZE];
+} xfs_trace_ring_t;
+
+volatile int xfs_trace_on = 0;
+static uint64_t trace_session_start = 0;  // Events before this are from an older session
+
+static xfs_trace_ring_t *trace_rings = NULL;
+static pthread_mutex_t trace_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_ring_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static uint32_t trace_next_tid = 1;
+static __thread xfs_trace_ring_t *trace_ring = NULL;
+
+static const char *trace_event_names[XFS_TRACE_MAX] = {
+    "write_start",
+    "write_alloc",
+    "write_alloc_fail",
+    "write_barrier",
+    "write_done",
+    "write_error",
+    "read_start",
+    "read_done",
+    "read_error",
+    "log_flush",
+    "log_barrier",
+    "create",
+    "fsr",
+    "free_batch",
+    "unmap",
+    "unlink",
+    "falloc",
+    "convert",
+    "reflink",
+    "cow"
+};
+
+// Format for each event's arguments
+static const char *trace_event_fmt[XFS_TRACE_MAX] = {
+    "ino=%llu offset=%llu size=%llu blocks=%llu",
+    "ino=%llu ag=%llu lblk=%llu pblk=%llu",
+    "ino=%llu ag=%llu lblk=%llu",
+    "ino=%llu wait_ns=%llu",
+    "ino=%llu offset=%llu bytes=%llu",
+    "ino=%llu lblk=%llu disk_offset=%llu",
+    "ino=%llu offset=%llu size=%llu",
+    "ino=%llu offset=%llu bytes=%llu",
+    "ino=%llu disk_offset=%llu",
+    "len=%llu barrier=%llu",
+    "flush_ns=%llu",
+    "ino=%llu",
+    "ino=%llu extents=%llu->%llu blocks=%llu",
+    "ag=%llu extents=%llu blocks=%llu busy_lsn=%llu",
+    "ino=%llu lblk=%llu-%llu blocks=%llu",
+    "ino=%llu",
+    "ino=%llu offset=%llu len=%llu blocks=%llu",
+    "ino=%llu lblk=%llu-%llu extents=%llu",
+    "ino=%llu dst=%llu extents=%llu blocks=%llu",
+    "ino=%llu lblk=%llu pblk=%llu blocks=%llu"
+};
+
+// Hand the ring back to the registry when its thread exits
+static void trace_ring_release(void *arg) {
+    xfs_trace_ring_t *ring = (xfs_trace_ring_t *)arg;
+    __atomic_store_n(&ring->active, 0, __ATOMIC_RELEASE);
+}
+
+static void trace_key_init(void) {
+    pthread_key_create(&trace_ring_key, trace_ring_release);
+}
+
+// Attach a ring to the calling thread, reusing one left by an exited thread
+static xfs_trace_ring_t *trace_ring_get(void) {
+    pthread_once(&trace_key_once, trace_key_init);
+
+    pthread_mutex_lock(&trace_registry_lock);
+    xfs_trace_ring_t *ring = trace_rings;
+    while (ring != NULL && __atomic_load_n(&ring->active, __ATOMIC_ACQUIRE)) {
+        ring = ring->next;
+    }
+
+    if (ring == NULL) {
+        ring = (xfs_trace_ring_t *)calloc(1, sizeof(xfs_trace_ring_t));
+        if (ring == NULL) {
+            pthread_mutex_unlock(&trace_registry_lock);
+            return NULL;
+        }
+        ring->next = trace_rings;
+        trace_rings = ring;
+    }
+
+    ring->tid = trace_next_tid++;
+    ring->active = 1;
+    pthread_mutex_unlock(&trace_registry_lock);
+
+    pthread_setspecific(trace_ring_key, ring);
+    return ring;
+}
+
+// Append an event to the calling thread's ring buffer
+void xfs_trace_emit(xfs_trace_event_t event, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3) {
+    xfs_trace_ring_t *ring = trace_ring;
+    if (ring == NULL) {
+        ring = trace_ring = trace_ring_get();
+        if (ring == NULL) {
+            return;
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t head = ring->head;
+    xfs_trace_record_t *rec = &ring->records[head & (XFS_TRACE_RING_SIZE - 1)];
+    rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    rec->event = event;
+    rec->tid = ring->tid;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    rec->args[3] = a3;
+
+    // Publish the record
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Start a new trace session; events from earlier sessions are discarded
+void xfs_trace_start(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    __atomic_store_n(&trace_session_start, (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec, __ATOMIC_RELEASE);
+    xfs_trace_on = 1;
+}
+
+// Stop recording events (buffers are kept for dumping)
+void xfs_trace_stop(void) {
+    xfs_trace_on = 0;
+}
+
+static int trace_cmp_ts(const void *a, const void *b) {
+    const xfs_trace_record_t *x = (const xfs_trace_record_t *)a;
+    const xfs_trace_record_t *y = (const xfs_trace_record_t *)b;
+    return (x->ts_ns > y->ts_ns) - (x->ts_ns < y->ts_ns);
+}
+
+// Copy the valid records of one ring into out; returns the number copied
+static size_t trace_ring_snapshot(xfs_trace_ring_t *ring, xfs_trace_record_t *out) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > XFS_TRACE_RING_SIZE ? head - XFS_TRACE_RING_SIZE : 0;
+
+    for (uint64_t i = first; i < head; i++) {
+        out[i - first] = ring->records[i & (XFS_TRACE_RING_SIZE - 1)];
+    }
+
+    // Anything the producer lapped while we copied is unreliable
+    uint64_t head_after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t valid_from = head_after > XFS_TRACE_RING_SIZE ? head_after - XFS_TRACE_RING_SIZE : 0;
+    if (valid_from <= first) {
+        return head - first;
+    }
+    if (valid_from >= head) {
+        return 0;
+    }
+    size_t skip = valid_from - first;
+    memmove(out, out + skip, (head - valid_from) * sizeof(xfs_trace_record_t));
+    return head - valid_from;
+}
+
+// Decode all buffered events in timestamp order; returns the number written
+int xfs_trace_dump(FILE *out) {
+    pthread_mutex_lock(&trace_registry_lock);
+
+    size_t nrings = 0;
+    for (xfs_trace_ring_t *ring = trace_rings; ring != NULL; ring = ring->next) {
+        nrings++;
+    }
+
+    xfs_trace_record_t *all = (xfs_trace_record_t *)malloc(
+        (nrings ? nrings : 1) * XFS_TRACE_RING_SIZE * sizeof(xfs_trace_record_t));
+    if (all == NULL) {
+        pthread_mutex_unlock(&trace_registry_lock);
+        return -1;
+    }
+
+    size_t count = 0;
+    for (xfs_trace_ring_t *ring = trace_rings; ring != NULL; ring = ring->next) {
+        count += trace_ring_snapshot(ring, all + count);
+    }
+    pthread_mutex_unlock(&trace_registry_lock);
+
+    // Drop events recorded before the current session started
+    uint64_t session_start = __atomic_load_n(&trace_session_start, __ATOMIC_ACQUIRE);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (all[i].ts_ns >= session_start) {
+            all[kept++] = all[i];
+        }
+    }
+    count = kept;
+
+    qsort(all, count, sizeof(xfs_trace_record_t), trace_cmp_ts);
+
+    uint64_t base = count ? all[0].ts_ns : 0;
+    for (size_t i = 0; i < count; i++) {
+        xfs_trace_record_t *rec = &all[i];
+        if (rec->event >= XFS_TRACE_MAX) {
+            continue;
+        }
+        fprintf(out, "%12.3f us  tid=%-3u %-16s ",
+                (rec->ts_ns - base) / 1000.0, rec->tid, trace_event_names[rec->event]);
+        fprintf(out, trace_event_fmt[rec->event],
+                (unsigned long long)rec->args[0], (unsigned long long)rec->args[1],
+                (unsigned long long)rec->args[2], (unsigned long long)rec->args[3]);
+        fprintf(out, "\n");
+    }
+
+    free(all);
+    return (int)count;
+}
@@ -1,5 +1,9 @@
 #include "../include/xfs_trans.h"
 #include "../include/xfs_types.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_trace.h"
+#include "../include/xfs_cksum.h"
+#include "../include/xfs_workq.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,23 +16,112 @@ typedef struct barrier_sync {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int signaled;
+    int error;      // -1 if the log was shut down before the barrier was written
 } barrier_sync_t;
 
-// Transaction log queue node
-typedef struct log_queue_node {
+// A metadata object with logged changes. It is pinned while a change to it
+// sits in the CIL or in a checkpoint that has not been written, and stays in
+// the AIL from the first checkpoint write until it is written back in place.
+// Writeback is a timing model: callers update metadata in place before
+// logging it, so an AIL push only waits out the write latency and moves the
+// tail; it writes nothing.
+typedef struct log_obj {
+    uint64_t key;                 // 0 = anonymous: each change is its own object
+    int pins;                     // Changes not yet written to the log
+    int in_ail;
+    int writing;                  // Being written back by an AIL push
+    struct log_vec *cil_vec;      // Its change in the current CIL, if any
+    uint64_t ail_lsn;             // LSN of the newest change written to the log
+    uint64_t ail_pos;             // Log position of the checkpoint holding that change
+    struct log_obj *ail_prev;
+    struct log_obj *ail_next;
+    struct log_obj *hash_next;
+} log_obj_t;
+
+// One change in the CIL or a checkpoint
+typedef struct log_vec {
+    log_obj_t *obj;
     void *data;
     size_t len;
+    size_t res;      // Log space reserved for it
+    uint64_t lsn;    // Log sequence number of the change
+    uint32_t crc;    // CRC32C of the record: the item, then its LSN and length
+    struct log_vec *next;
+} log_vec_t;
+
+// Transaction log queue node: a checkpoint of CIL changes or a barrier
+typedef struct log_queue_node {
+    log_vec_t *vecs;  // Changes of a checkpoint, in LSN order
+    int count;
+    size_t bytes;     // Log space the checkpoint takes, record header included
+    uint64_t lsn;    // Log sequence number; nodes are flushed in LSN order
     int is_barrier;  // 1 if this is a barrier transaction, 0 otherwise
     barrier_sync_t *barrier_sync;  // Sync structure for barrier synchronization
+    void (*barrier_done)(void *arg, int error);  // Completion callback of an asynchronous barrier
+    void *barrier_arg;
     struct log_queue_node *next;
 } log_queue_node_t;
 
+// Log space taken by each change and by each checkpoint record
+#define LOG_ITEM_HDR      16
+#define LOG_RECORD_HDR    512
+#define LOG_MIN_SIZE      (64 * 1024)
+#define LOG_DEFAULT_SIZE  (2 * 1024 * 1024)
+
+// Objects written back per simulated metadata write
+#define AIL_PUSH_BATCH    32
+
+#define LOG_OBJ_BUCKETS   1024
+
 static log_queue_node_t *log_head = NULL;
 static log_queue_node_t *log_tail = NULL;
+static int log_queue_len = 0;  // Changes in queued checkpoints (under log_mutex)
+static uint64_t log_last_lsn = 0;     // LSN of the most recently queued item (under log_mutex)
+static uint64_t log_flushed_lsn = 0;  // Every item up to this LSN has been flushed
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_wait_cond = PTHREAD_COND_INITIALIZER;  // Log space freed, or a flush or push stopped
 static int log_worker_running = 0;
-static pthread_t log_worker_thread;
+static int log_flush_queued = 0;     // The flush task is queued (under log_mutex)
+static int log_flush_running = 0;    // A thread is writing the queue (under log_mutex)
+static xfs_work_t log_flush_work;
+static unsigned int log_flush_delay_us = 100000;  // Simulated log I/O latency per write
+
+// Committed Item List: changes not yet in a checkpoint (under log_mutex)
+static log_vec_t *cil_head = NULL;
+static log_vec_t *cil_tail = NULL;
+static int cil_count = 0;
+static uint64_t cil_bytes = 0;
+
+// Active Item List: objects written to the log but not back in place, in LSN order (under log_mutex)
+static log_obj_t *ail_head = NULL;
+static log_obj_t *ail_tail = NULL;
+static int ail_count = 0;
+static int ail_push_queued = 0;
+static int ail_push_running = 0;
+static xfs_work_t ail_push_work;
+static unsigned int ail_writeback_delay_us = 1000;  // Simulated metadata write latency per batch
+
+static log_obj_t *log_obj_hash[LOG_OBJ_BUCKETS];
+
+// Log space, in bytes written since mount (under log_mutex): the grant head
+// counts every reservation, the write head every written checkpoint, and the
+// tail is the checkpoint of the oldest object still in the AIL
+static uint64_t log_size = LOG_DEFAULT_SIZE;
+static uint64_t log_cil_push = 0;    // 0 = an eighth of the log
+static int log_ail_push_pct = 75;
+static uint64_t log_grant_pos = 0;
+static uint64_t log_write_pos = 0;
+static int log_space_waiters = 0;
+
+// Folds summary counters into each checkpoint as it closes (under log_mutex)
+static void (*log_checkpoint_hook)(void) = NULL;
+static int log_in_hook = 0;
+
+static uint64_t log_checkpoints = 0;
+static uint64_t log_checkpoint_items = 0;
+static uint64_t log_relogged = 0;
+static uint64_t log_written_back = 0;
+static uint64_t log_space_waits = 0;
 
 // Initialize a barrier sync structure
 static barrier_sync_t* barrier_sync_init(void) {
@@ -49,6 +142,7 @@ static barrier_sync_t* barrier_sync_init(void) {
     }
 
     sync->signaled = 0;
+    sync->error = 0;
 
     return sync;
 }
@@ -64,14 +158,15 @@ static void barrier_sync_destroy(barrier_sync_t* sync) {
     free(sync);
 }
 
-// Signal a barrier sync
-static void barrier_sync_signal(barrier_sync_t* sync) {
+// Signal a barrier sync with the barrier's status
+static void barrier_sync_signal(barrier_sync_t* sync, int error) {
     if (sync == NULL) {
         return;
     }
 
     pthread_mutex_lock(&sync->mutex);
     sync->signaled = 1;
+    sync->error = error;
     pthread_cond_broadcast(&sync->cond);
     pthread_mutex_unlock(&sync->mutex);
 }
@@ -89,99 +184,608 @@ static void barrier_sync_wait(barrier_sync_t* sync) {
     pthread_mutex_unlock(&sync->mutex);
 }
 
-// Log worker function - processes the log queue
-static void *log_worker(void *arg) {
-    log_queue_node_t *current;
+// Finish a log record's checksum from the CRC of its item
+static uint32_t log_record_cksum(uint32_t item_crc, uint64_t lsn, uint64_t len) {
+    uint64_t hdr[2] = { lsn, len };
+    return ~xfs_crc32c(item_crc, hdr, sizeof(hdr));
+}
 
-    while (1) {
-        // Wait for work
-        pthread_mutex_lock(&log_mutex);
-        while (log_head == NULL && log_worker_running) {
-            pthread_cond_wait(&log_cond, &log_mutex);
+static void log_flush(void *arg);
+static void ail_push(void *arg);
+
+// Queue the flush task if there is work and no thread is on it (caller holds log_mutex)
+static void log_kick_locked(void) {
+    if (log_worker_running && !log_flush_queued && !log_flush_running && log_head != NULL) {
+        log_flush_queued = 1;
+        if (xfs_workq_queue(&log_flush_work, XFS_WORK_LOG_FLUSH, log_flush, NULL) != 0) {
+            log_flush_queued = 0;
         }
+    }
+}
 
-        if (!log_worker_running) {
-            pthread_mutex_unlock(&log_mutex);
-            break;
+// CIL size that triggers a checkpoint (caller holds log_mutex)
+static uint64_t log_cil_push_bytes(void) {
+    if (log_cil_push == 0 || log_cil_push > log_size / 2) {
+        return log_size / 8;
+    }
+    return log_cil_push;
+}
+
+// Bytes between the log tail and the grant head (caller holds log_mutex)
+static uint64_t log_used_locked(void) {
+    uint64_t tail = ail_head != NULL ? ail_head->ail_pos : log_write_pos;
+    return log_grant_pos - tail;
+}
+
+static log_obj_t **log_obj_bucket(uint64_t key) {
+    return &log_obj_hash[(key * 0x9E3779B97F4A7C15ull) >> 54];
+}
+
+static log_obj_t *log_obj_lookup(uint64_t key) {
+    log_obj_t *obj = *log_obj_bucket(key);
+    while (obj != NULL && obj->key != key) {
+        obj = obj->hash_next;
+    }
+    return obj;
+}
+
+// Free an object once nothing refers to it (caller holds log_mutex)
+static void log_obj_put(log_obj_t *obj) {
+    if (obj->pins > 0 || obj->in_ail || obj->writing) {
+        return;
+    }
+    if (obj->key != 0) {
+        log_obj_t **pp = log_obj_bucket(obj->key);
+        while (*pp != obj) {
+            pp = &(*pp)->hash_next;
+        }
+        *pp = obj->hash_next;
+    }
+    free(obj);
+}
+
+static void ail_remove(log_obj_t *obj) {
+    if (obj->ail_prev != NULL) {
+        obj->ail_prev->ail_next = obj->ail_next;
+    } else {
+        ail_head = obj->ail_next;
+    }
+    if (obj->ail_next != NULL) {
+        obj->ail_next->ail_prev = obj->ail_prev;
+    } else {
+        ail_tail = obj->ail_prev;
+    }
+    obj->in_ail = 0;
+    ail_count--;
+}
+
+// Move an object to the head end of the AIL after a checkpoint with its newest change was written
+static void ail_move(log_obj_t *obj, uint64_t lsn, uint64_t pos) {
+    if (obj->in_ail) {
+        ail_remove(obj);
+    }
+    obj->ail_lsn = lsn;
+    obj->ail_pos = pos;
+    obj->ail_next = NULL;
+    obj->ail_prev = ail_tail;
+    if (ail_tail != NULL) {
+        ail_tail->ail_next = obj;
+    } else {
+        ail_head = obj;
+    }
+    ail_tail = obj;
+    obj->in_ail = 1;
+    ail_count++;
+}
+
+// Whether the AIL should be pushed: a reservation is waiting, or the log is
+// over the push threshold (start) or still above it by less than a
+// checkpoint (continue) (caller holds log_mutex)
+static int ail_push_needed(int start) {
+    if (ail_head == NULL) {
+        return 0;
+    }
+    if (log_space_waiters > 0) {
+        return 1;
+    }
+    uint64_t threshold = log_size * (uint64_t)log_ail_push_pct / 100;
+    if (!start) {
+        uint64_t room = log_cil_push_bytes();
+        threshold = threshold > room ? threshold - room : 0;
+    }
+    return log_used_locked() > threshold;
+}
+
+// Queue the AIL push task if the log is filling up (caller holds log_mutex)
+static void ail_kick_locked(void) {
+    if (log_worker_running && !ail_push_queued && !ail_push_running && ail_push_needed(1)) {
+        ail_push_queued = 1;
+        if (xfs_workq_queue(&ail_push_work, XFS_WORK_AIL_PUSH, ail_push, NULL) != 0) {
+            ail_push_queued = 0;
+        }
+    }
+}
+
+// Close the CIL into a checkpoint and queue it for the log (caller holds log_mutex)
+static void log_push_cil_locked(void) {
+    // The hook's changes ride in the checkpoint being closed; an empty CIL closes nothing
+    if (log_checkpoint_hook != NULL && !log_in_hook && cil_head != NULL) {
+        log_in_hook = 1;
+        log_checkpoint_hook();
+        log_in_hook = 0;
+    }
+    if (cil_head == NULL) {
+        return;
+    }
+    log_queue_node_t *node = (log_queue_node_t *)malloc(sizeof(log_queue_node_t));
+    if (node == NULL) {
+        return;  // Stays in the CIL until the next push
+    }
+
+    node->vecs = cil_head;
+    node->count = cil_count;
+    node->bytes = cil_bytes;
+    node->lsn = log_last_lsn;
+    node->is_barrier = 0;
+    node->barrier_sync = NULL;
+    node->barrier_done = NULL;
+    node->barrier_arg = NULL;
+    node->next = NULL;
+    for (log_vec_t *v = cil_head; v != NULL; v = v->next) {
+        v->obj->cil_vec = NULL;
+    }
+    cil_head = cil_tail = NULL;
+    cil_count = 0;
+    cil_bytes = 0;
+
+    if (log_tail == NULL) {
+        log_head = log_tail = node;
+    } else {
+        log_tail->next = node;
+        log_tail = node;
+    }
+    log_queue_len += node->count;
+    log_kick_locked();
+}
+
+// A checkpoint reached the log: its objects move to the AIL (caller holds log_mutex)
+static void log_checkpoint_done(log_queue_node_t *ckpt) {
+    uint64_t pos = log_write_pos;
+    log_write_pos += ckpt->bytes;
+    log_checkpoints++;
+    log_checkpoint_items += ckpt->count;
+
+    log_vec_t *v = ckpt->vecs;
+    while (v != NULL) {
+        log_vec_t *next = v->next;
+        v->obj->pins--;
+        ail_move(v->obj, v->lsn, pos);
+        free(v->data);
+        free(v);
+        v = next;
+    }
+    ckpt->vecs = NULL;
+}
+
+// Write queued checkpoints and barriers in LSN order until the queue is empty
+// (caller holds log_mutex and has set log_flush_running; drops it while writing)
+static void log_flush_locked(void) {
+    while (log_head != NULL && log_worker_running) {
+        log_queue_node_t *current = log_head;
+        log_head = current->next;
+        if (log_head == NULL) {
+            log_tail = NULL;
         }
+        log_queue_len -= current->count;
+        unsigned int delay_us = log_flush_delay_us;
+        pthread_mutex_unlock(&log_mutex);
 
-        // Get the next item in the queue
-        current = log_head;
-        if (current != NULL) {
-            log_head = current->next;
-            if (log_head == NULL) {
-                log_tail = NULL;
+        uint64_t flush_start = xfs_stats_now();
+        if (!current->is_barrier) {
+            // Verify each record before it is written, as a log write verifier would
+            for (log_vec_t *v = current->vecs; v != NULL; v = v->next) {
+                if (log_record_cksum(xfs_crc32c(XFS_CRC_SEED, v->data, v->len), v->lsn, v->len) != v->crc) {
+                    xfs_cksum_report_failure();
+                }
             }
+
+            // Simulate writing the checkpoint to disk in one log write
+            trace_xfs(XFS_TRACE_LOG_FLUSH, current->bytes, 0, 0, 0);
+            if (delay_us > 0) {
+                usleep(delay_us);  // Simulate I/O delay (100ms by default)
+            }
+        }
+
+        pthread_mutex_lock(&log_mutex);
+        if (!current->is_barrier) {
+            log_checkpoint_done(current);
         }
+        __atomic_store_n(&log_flushed_lsn, current->lsn, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&log_wait_cond);
+        ail_kick_locked();
         pthread_mutex_unlock(&log_mutex);
 
-        if (current != NULL) {
-            // Simulate writing to disk (this is where the actual "log flush" would happen)
-            printf("[System] Flushing transaction to log\n");
-            usleep(100000);  // Simulate I/O delay (100ms)
+        // If this is a barrier transaction, signal the waiting thread
+        if (current->is_barrier && current->barrier_sync) {
+            trace_xfs(XFS_TRACE_LOG_BARRIER, xfs_stats_now() - flush_start, 0, 0, 0);
+            barrier_sync_signal(current->barrier_sync, 0);
+        }
+        if (current->is_barrier && current->barrier_done) {
+            current->barrier_done(current->barrier_arg, 0);
+        }
+        if (!current->is_barrier) {
+            xfs_stats_record(XFS_STAT_LOG_FLUSH, flush_start);
+        }
+        free(current);
+
+        pthread_mutex_lock(&log_mutex);
+    }
+}
+
+// Flush task - writes the queue on the background pool unless another
+// thread already is; at most one is queued at a time
+static void log_flush(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&log_mutex);
+    log_flush_queued = 0;
+    if (!log_flush_running) {
+        log_flush_running = 1;
+        log_flush_locked();
+        log_flush_running = 0;
+        pthread_cond_broadcast(&log_wait_cond);
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
 
-            // If this is a barrier transaction, signal the waiting thread
-            if (current->is_barrier && current->barrier_sync) {
-                printf("[System] Log Flushed - Signaling barrier\n");
-                barrier_sync_signal(current->barrier_sync);
+// Write back unpinned AIL objects, oldest first, while the AIL needs pushing
+// (modelled: the metadata is already in place, so a batch only costs the
+// writeback delay).
+// Pinned objects are skipped; one still in the CIL forces a checkpoint so it
+// can be written back later. Returns the number written back
+// (caller holds log_mutex and has set ail_push_running; drops it while writing)
+static int ail_push_locked(void) {
+    log_obj_t *batch[AIL_PUSH_BATCH];
+    uint64_t batch_lsn[AIL_PUSH_BATCH];
+    int total = 0;
+
+    while (log_worker_running && ail_push_needed(0)) {
+        int n = 0;
+        int forced = 0;
+        for (log_obj_t *obj = ail_head; obj != NULL && n < AIL_PUSH_BATCH; obj = obj->ail_next) {
+            if (obj->writing) {
+                continue;
             }
+            if (obj->pins > 0) {
+                if (obj->cil_vec != NULL && !forced) {
+                    log_push_cil_locked();
+                    forced = 1;
+                }
+                continue;
+            }
+            obj->writing = 1;
+            batch_lsn[n] = obj->ail_lsn;
+            batch[n++] = obj;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        unsigned int delay_us = ail_writeback_delay_us;
+        pthread_mutex_unlock(&log_mutex);
+        if (delay_us > 0) {
+            usleep(delay_us);  // Model the latency of writing the batch back in place
+        }
+        pthread_mutex_lock(&log_mutex);
 
-            // Free the transaction data
-            if (current->data) {
-                free(current->data);
+        for (int i = 0; i < n; i++) {
+            log_obj_t *obj = batch[i];
+            obj->writing = 0;
+            // A newer change written meanwhile keeps it in the AIL
+            if (obj->in_ail && obj->ail_lsn == batch_lsn[i]) {
+                ail_remove(obj);
+                log_written_back++;
             }
-            free(current);
+            log_obj_put(obj);
         }
+        total += n;
+        pthread_cond_broadcast(&log_wait_cond);
     }
+    return total;
+}
+
+// AIL push task - moves the log tail on the background pool unless another
+// thread already is; at most one is queued at a time
+static void ail_push(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&log_mutex);
+    ail_push_queued = 0;
+    if (!ail_push_running) {
+        ail_push_running = 1;
+        ail_push_locked();
+        ail_push_running = 0;
+        pthread_cond_broadcast(&log_wait_cond);
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
 
-    return NULL;
+// Wait for log space to be freed, doing the flush or push that frees it if no
+// thread is on it, so a reservation made on the pool never waits on queued
+// pool work (caller holds log_mutex)
+static void log_space_wait_locked(void) {
+    log_space_waiters++;
+    log_push_cil_locked();
+    if (log_worker_running && !log_flush_running && log_head != NULL) {
+        log_flush_running = 1;
+        log_flush_locked();
+        log_flush_running = 0;
+        pthread_cond_broadcast(&log_wait_cond);
+    } else if (log_worker_running && !ail_push_running && ail_head != NULL) {
+        ail_push_running = 1;
+        int written = ail_push_locked();
+        ail_push_running = 0;
+        pthread_cond_broadcast(&log_wait_cond);
+        if (written == 0) {
+            pthread_cond_wait(&log_wait_cond, &log_mutex);
+        }
+    } else {
+        pthread_cond_wait(&log_wait_cond, &log_mutex);
+    }
+    log_space_waiters--;
 }
 
-// Initialize the transaction system and log flushing thread
+// Initialize the transaction system; log flushes and AIL pushes run on the background pool
 int trans_init(void) {
+    if (xfs_workq_threads() == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&log_mutex);
     log_worker_running = 1;
-    
-    if (pthread_create(&log_worker_thread, NULL, log_worker, NULL) != 0) {
-        log_worker_running = 0;
+    log_kick_locked();
+    ail_kick_locked();
+    pthread_mutex_unlock(&log_mutex);
+    return 0;
+}
+
+// Set the simulated log flush latency per log write (microseconds)
+void trans_set_flush_delay(unsigned int usec) {
+    pthread_mutex_lock(&log_mutex);
+    log_flush_delay_us = usec;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// Set the log size in bytes
+int trans_set_log_size(uint64_t bytes) {
+    if (bytes < LOG_MIN_SIZE) {
         return -1;
     }
-    
+    pthread_mutex_lock(&log_mutex);
+    log_size = bytes;
+    pthread_cond_broadcast(&log_wait_cond);
+    ail_kick_locked();
+    pthread_mutex_unlock(&log_mutex);
     return 0;
 }
 
-// Add a metadata change to the in-memory log queue
-int trans_add_item(void* data, int len) {
-    log_queue_node_t *node = (log_queue_node_t *)malloc(sizeof(log_queue_node_t));
-    if (node == NULL) {
+// Set the CIL size that closes a checkpoint
+int trans_set_cil_push(uint64_t bytes) {
+    pthread_mutex_lock(&log_mutex);
+    if (bytes > log_size / 2) {
+        pthread_mutex_unlock(&log_mutex);
         return -1;
     }
+    log_cil_push = bytes;
+    if (cil_bytes >= log_cil_push_bytes()) {
+        log_push_cil_locked();
+    }
+    pthread_mutex_unlock(&log_mutex);
+    return 0;
+}
 
-    node->data = malloc(len);
-    if (node->data == NULL) {
-        free(node);
+// Set how full the log gets before the AIL is pushed
+int trans_set_ail_push(int pct) {
+    if (pct < 1 || pct > 100) {
         return -1;
     }
+    pthread_mutex_lock(&log_mutex);
+    log_ail_push_pct = pct;
+    ail_kick_locked();
+    pthread_mutex_unlock(&log_mutex);
+    return 0;
+}
+
+// Set the simulated metadata writeback latency per AIL push batch (microseconds)
+void trans_set_writeback_delay(unsigned int usec) {
+    pthread_mutex_lock(&log_mutex);
+    ail_writeback_delay_us = usec;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// Put a change into the CIL, replacing the object's change already there
+// (caller holds log_mutex and has reserved need bytes). o is the object if
+// it exists; what is used of the preallocated copy, vec and obj is taken and
+// the rest is left for the caller to free.
+static void log_cil_insert_locked(uint64_t key, log_obj_t *o, void **copy, log_vec_t **vec, log_obj_t **obj,
+                                  int len, uint32_t item_crc, uint64_t need) {
+    if (o == NULL) {
+        o = *obj;
+        *obj = NULL;
+        memset(o, 0, sizeof(*o));
+        o->key = key;
+        if (key != 0) {
+            log_obj_t **bucket = log_obj_bucket(key);
+            o->hash_next = *bucket;
+            *bucket = o;
+        }
+    }
 
-    memcpy(node->data, data, len);
-    node->len = len;
-    node->is_barrier = 0;
-    node->barrier_sync = NULL;
+    uint64_t lsn = ++log_last_lsn;
+    log_vec_t *v = o->cil_vec;
+    if (v != NULL) {
+        // Relogged: the checkpoint carries only the newest copy
+        void *old = v->data;
+        v->data = *copy;
+        *copy = old;
+        v->res = v->res > (size_t)len + LOG_ITEM_HDR ? v->res : (size_t)len + LOG_ITEM_HDR;
+        log_relogged++;
+    } else {
+        v = *vec;
+        *vec = NULL;
+        v->obj = o;
+        v->data = *copy;
+        *copy = NULL;
+        v->res = (size_t)len + LOG_ITEM_HDR;
+        v->next = NULL;
+        if (cil_tail == NULL) {
+            cil_head = cil_tail = v;
+        } else {
+            cil_tail->next = v;
+            cil_tail = v;
+        }
+        cil_count++;
+        o->cil_vec = v;
+        o->pins++;
+    }
+    v->len = len;
+    v->lsn = lsn;
+    v->crc = log_record_cksum(item_crc, lsn, len);
+
+    log_grant_pos += need;
+    cil_bytes += need;
+}
+
+// Add a change to a metadata object to the CIL
+int trans_add_object(uint64_t key, void *data, int len) {
+    uint64_t start_ns = xfs_stats_now();
+    uint64_t wait_start = 0;
+
+    if ((uint64_t)len + LOG_ITEM_HDR + LOG_RECORD_HDR > LOG_MIN_SIZE) {
+        return -1;  // Could never fit in the log
+    }
+
+    void *copy = malloc(len);
+    log_vec_t *vec = (log_vec_t *)malloc(sizeof(log_vec_t));
+    log_obj_t *obj = (log_obj_t *)malloc(sizeof(log_obj_t));
+    if (copy == NULL || vec == NULL || obj == NULL) {
+        free(copy);
+        free(vec);
+        free(obj);
+        return -1;
+    }
+    memcpy(copy, data, len);
+    uint32_t item_crc = xfs_crc32c(XFS_CRC_SEED, copy, len);  // Outside the log lock
+
+    pthread_mutex_lock(&log_mutex);
+
+    // Reserve log space: a change to an object already in the CIL replaces
+    // the old one and only needs room for the growth
+    log_obj_t *o;
+    uint64_t need;
+    for (;;) {
+        o = key != 0 ? log_obj_lookup(key) : NULL;
+        log_vec_t *v = o != NULL ? o->cil_vec : NULL;
+        need = (uint64_t)len + LOG_ITEM_HDR;
+        if (v != NULL) {
+            need = need > v->res ? need - v->res : 0;
+        }
+        if (cil_head == NULL) {
+            need += LOG_RECORD_HDR;
+        }
+        if (log_used_locked() + need <= log_size) {
+            break;
+        }
+        if (wait_start == 0) {
+            wait_start = xfs_stats_now();
+            log_space_waits++;
+        }
+        log_space_wait_locked();
+    }
+
+    log_cil_insert_locked(key, o, &copy, &vec, &obj, len, item_crc, need);
+    if (cil_bytes >= log_cil_push_bytes()) {
+        log_push_cil_locked();
+    }
+    ail_kick_locked();
+    pthread_mutex_unlock(&log_mutex);
+
+    free(copy);
+    free(vec);
+    free(obj);
+    if (wait_start != 0) {
+        xfs_stats_record(XFS_STAT_LOG_SPACE_WAIT, wait_start);
+    }
+    xfs_stats_record(XFS_STAT_LOG_ENQUEUE, start_ns);
+    return 0;
+}
+
+// From a checkpoint hook: add a change to the checkpoint being closed (no wait for log space)
+int trans_hook_add_object(uint64_t key, void *data, int len) {
+    if (!log_in_hook || (uint64_t)len + LOG_ITEM_HDR + LOG_RECORD_HDR > LOG_MIN_SIZE) {
+        return -1;
+    }
+    void *copy = malloc(len);
+    log_vec_t *vec = (log_vec_t *)malloc(sizeof(log_vec_t));
+    log_obj_t *obj = (log_obj_t *)malloc(sizeof(log_obj_t));
+    if (copy == NULL || vec == NULL || obj == NULL) {
+        free(copy);
+        free(vec);
+        free(obj);
+        return -1;
+    }
+    memcpy(copy, data, len);
+
+    // The hook's records are small; the log may run over by them until the tail moves
+    log_obj_t *o = log_obj_lookup(key);
+    uint64_t need = (uint64_t)len + LOG_ITEM_HDR;
+    if (o != NULL && o->cil_vec != NULL) {
+        need = need > o->cil_vec->res ? need - o->cil_vec->res : 0;
+    }
+    if (cil_head == NULL) {
+        need += LOG_RECORD_HDR;
+    }
+    log_cil_insert_locked(key, o, &copy, &vec, &obj, len, xfs_crc32c(XFS_CRC_SEED, copy, len), need);
+
+    free(copy);
+    free(vec);
+    free(obj);
+    return 0;
+}
+
+// Run fn (NULL = nothing) as each non-empty checkpoint closes; it may add changes with trans_hook_add_object()
+void trans_set_checkpoint_hook(void (*fn)(void)) {
+    pthread_mutex_lock(&log_mutex);
+    log_checkpoint_hook = fn;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// Add a metadata change to the CIL
+int trans_add_item(void* data, int len) {
+    return trans_add_object(0, data, len);
+}
+
+// Queue a barrier node behind a checkpoint of everything logged so far
+static void log_queue_barrier(log_queue_node_t *node) {
+    node->vecs = NULL;
+    node->count = 0;
+    node->bytes = 0;
+    node->is_barrier = 1;
     node->next = NULL;
 
     pthread_mutex_lock(&log_mutex);
+    log_push_cil_locked();
+    node->lsn = log_last_lsn;  // Completes once everything queued before it is flushed
     if (log_tail == NULL) {
         log_head = log_tail = node;
     } else {
         log_tail->next = node;
         log_tail = node;
     }
-    pthread_cond_signal(&log_cond);
+    log_kick_locked();
     pthread_mutex_unlock(&log_mutex);
-
-    return 0;
 }
 
-// Commit a transaction barrier - blocks until the log is flushed
+// Commit a transaction barrier - blocks until the log is flushed; fails if
+// the log is shut down first
 int trans_commit_barrier(void) {
     log_queue_node_t *node = (log_queue_node_t *)malloc(sizeof(log_queue_node_t));
     if (node == NULL) {
@@ -194,61 +798,139 @@ int trans_commit_barrier(void) {
         return -1;
     }
 
-    node->data = NULL;
-    node->len = 0;
-    node->is_barrier = 1;
     node->barrier_sync = barrier_sync;
-    node->next = NULL;
-
-    pthread_mutex_lock(&log_mutex);
-    if (log_tail == NULL) {
-        log_head = log_tail = node;
-    } else {
-        log_tail->next = node;
-        log_tail = node;
-    }
-    pthread_cond_signal(&log_cond);
-    pthread_mutex_unlock(&log_mutex);
+    node->barrier_done = NULL;
+    node->barrier_arg = NULL;
+    log_queue_barrier(node);
 
     // Wait for the barrier to be processed
+    uint64_t wait_start = xfs_stats_now();
     barrier_sync_wait(barrier_sync);
+    xfs_stats_record(XFS_STAT_BARRIER_WAIT, wait_start);
+    int ret = barrier_sync->error;
     barrier_sync_destroy(barrier_sync);
 
+    return ret;
+}
+
+// Commit a transaction barrier without waiting; done(arg, 0) runs on the log
+// worker once the log is flushed, or done(arg, -1) if it is shut down first
+int trans_commit_barrier_async(void (*done)(void *arg, int error), void *arg) {
+    log_queue_node_t *node = (log_queue_node_t *)malloc(sizeof(log_queue_node_t));
+    if (node == NULL) {
+        return -1;
+    }
+
+    node->barrier_sync = NULL;
+    node->barrier_done = done;
+    node->barrier_arg = arg;
+    log_queue_barrier(node);
     return 0;
 }
 
-// Count the number of items in the log queue
+// LSN of the most recently queued log item
+uint64_t trans_last_lsn(void) {
+    pthread_mutex_lock(&log_mutex);
+    uint64_t lsn = log_last_lsn;
+    pthread_mutex_unlock(&log_mutex);
+    return lsn;
+}
+
+// LSN up to which every log item has been flushed
+uint64_t trans_flushed_lsn(void) {
+    return __atomic_load_n(&log_flushed_lsn, __ATOMIC_ACQUIRE);
+}
+
+// Get the number of changes not yet written to the log
 int get_log_queue_length(void) {
-    int count = 0;
     pthread_mutex_lock(&log_mutex);
-    log_queue_node_t *current = log_head;
-    while (current != NULL) {
-        count++;
-        current = current->next;
-    }
+    int count = log_queue_len + cil_count;
     pthread_mutex_unlock(&log_mutex);
     return count;
 }
 
+// Copy the log space state and counters
+void trans_get_log_stats(trans_log_stats_t *stats) {
+    pthread_mutex_lock(&log_mutex);
+    stats->log_size = log_size;
+    stats->cil_push = log_cil_push_bytes();
+    stats->ail_push_pct = log_ail_push_pct;
+    stats->used = log_used_locked();
+    stats->cil_items = cil_count;
+    stats->cil_bytes = cil_bytes;
+    stats->queued_items = log_queue_len;
+    stats->ail_items = ail_count;
+    stats->tail_lsn = ail_head != NULL ? ail_head->ail_lsn : __atomic_load_n(&log_flushed_lsn, __ATOMIC_ACQUIRE);
+    stats->head_lsn = log_last_lsn;
+    stats->checkpoints = log_checkpoints;
+    stats->checkpoint_items = log_checkpoint_items;
+    stats->relogged = log_relogged;
+    stats->written_back = log_written_back;
+    stats->space_waits = log_space_waits;
+    pthread_mutex_unlock(&log_mutex);
+}
+
 // Clean up the transaction system
 void trans_destroy(void) {
+    // Stop the flush and push tasks after the write they are doing
     pthread_mutex_lock(&log_mutex);
     log_worker_running = 0;
-    pthread_cond_signal(&log_cond);
-    pthread_mutex_unlock(&log_mutex);
-
-    pthread_join(log_worker_thread, NULL);
+    while (log_flush_queued || log_flush_running || ail_push_queued || ail_push_running) {
+        pthread_cond_wait(&log_wait_cond, &log_mutex);
+    }
 
-    // Clean up any remaining items in the queue
+    // Drop what was never written, then the AIL; the metadata itself was
+    // already updated in place. Barriers still queued fail once log_mutex is
+    // dropped, as their waiters and callbacks may take other locks.
+    log_vec_t *v = cil_head;
     log_queue_node_t *current = log_head;
-    while (current != NULL) {
+    log_queue_node_t *barriers = NULL;
+    for (;;) {
+        while (v != NULL) {
+            log_vec_t *next = v->next;
+            v->obj->cil_vec = NULL;
+            v->obj->pins--;
+            log_obj_put(v->obj);
+            free(v->data);
+            free(v);
+            v = next;
+        }
+        if (current == NULL) {
+            break;
+        }
         log_queue_node_t *next = current->next;
-        if (current->data) {
-            free(current->data);
+        v = current->vecs;
+        if (current->is_barrier) {
+            current->next = barriers;
+            barriers = current;
+        } else {
+            free(current);
         }
-        free(current);
         current = next;
     }
+    while (ail_head != NULL) {
+        log_obj_t *obj = ail_head;
+        ail_remove(obj);
+        log_obj_put(obj);
+    }
 
     log_head = log_tail = NULL;
-}
\ No newline at end of file
+    log_queue_len = 0;
+    cil_head = cil_tail = NULL;
+    cil_count = 0;
+    cil_bytes = 0;
+    log_grant_pos = log_write_pos = 0;
+    pthread_mutex_unlock(&log_mutex);
+
+    while (barriers != NULL) {
+        log_queue_node_t *next = barriers->next;
+        if (barriers->barrier_sync) {
+            barrier_sync_signal(barriers->barrier_sync, -1);
+        }
+        if (barriers->barrier_done) {
+            barriers->barrier_done(barriers->barrier_arg, -1);
+        }
+        free(barriers);
+        barriers = next;
+    }
+}
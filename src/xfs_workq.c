@@ -0,0 +1,367 @@
+#include "../include/xfs_workq.h"
+#include "../include/xfs_stats.h"
+#include "../include/xfs_numa.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Work-stealing pool for background work. Each worker owns a deque: it
+// pushes the tasks it queues itself and pops them newest first, and an
+// idle worker steals the oldest task of another deque. Tasks queued from
+// outside the pool are dealt round-robin across the deques, so a burst
+// spreads over every worker and idle ones pick up what busy ones have not
+// reached. Waiting for a group runs queued tasks meanwhile, so a task may
+// wait for work it queued without tying up the pool.
+//
+// With NUMA affinity on, worker i is pinned to node i % nodes. Tasks queued
+// from outside the pool are dealt across the workers of the caller's node,
+// and idle workers steal from their own node before going remote.
+
+// A worker's deque: the owner works at the bottom, thieves at the top
+typedef struct {
+    pthread_mutex_t lock;
+    xfs_work_t **slots;
+    unsigned int cap;       // Power of two
+    unsigned int top;       // Oldest task
+    unsigned int bottom;    // One past the newest task
+} __attribute__((aligned(64))) workq_deque_t;
+
+static workq_deque_t deques[XFS_WORKQ_MAX_THREADS];
+static pthread_once_t deques_once = PTHREAD_ONCE_INIT;
+static pthread_t workers[XFS_WORKQ_MAX_THREADS];
+
+static int pool_threads = 0;          // Workers that should run (under pool_lock, read atomically)
+static int pool_deques = 0;           // Deques that may hold tasks; never shrinks
+static int pool_idle = 0;             // Workers waiting for work (under pool_lock)
+static unsigned int pool_queued = 0;  // Tasks in all deques
+static unsigned int pool_next = 0;    // Deque for the next task queued from outside the pool
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_resize_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work_cond = PTHREAD_COND_INITIALIZER;  // Work was queued
+static pthread_cond_t pool_done_cond = PTHREAD_COND_INITIALIZER;  // A grouped task finished
+static __thread int workq_self = -1;  // Deque of the current worker thread
+
+static xfs_workq_stats_t work_stats[XFS_WORK_MAX];
+static const char *work_names[XFS_WORK_MAX] = { "log_flush", "ag_init", "free", "ail_push" };
+
+static void workq_init_deques(void) {
+    for (int i = 0; i < XFS_WORKQ_MAX_THREADS; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+    }
+}
+
+static int deque_push(workq_deque_t *d, xfs_work_t *work) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom - d->top == d->cap) {
+        unsigned int new_cap = d->cap ? d->cap * 2 : 64;
+        xfs_work_t **slots = (xfs_work_t **)malloc(new_cap * sizeof(xfs_work_t *));
+        if (slots == NULL) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (unsigned int i = d->top; i != d->bottom; i++) {
+            slots[i & (new_cap - 1)] = d->slots[i & (d->cap - 1)];
+        }
+        free(d->slots);
+        d->slots = slots;
+        d->cap = new_cap;
+    }
+    d->slots[d->bottom++ & (d->cap - 1)] = work;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// Newest task of a deque (the owner's end)
+static xfs_work_t *deque_pop(workq_deque_t *d) {
+    xfs_work_t *work = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top) {
+        work = d->slots[--d->bottom & (d->cap - 1)];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return work;
+}
+
+// Oldest task of a deque (the thieves' end)
+static xfs_work_t *deque_steal(workq_deque_t *d) {
+    xfs_work_t *work = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top) {
+        work = d->slots[d->top++ & (d->cap - 1)];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return work;
+}
+
+// Take a task: the caller's own newest, else another deque's oldest
+static xfs_work_t *workq_take(int self, int *stolen) {
+    if (__atomic_load_n(&pool_queued, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+
+    xfs_work_t *work = NULL;
+    if (self >= 0) {
+        work = deque_pop(&deques[self]);
+    }
+    *stolen = 0;
+    if (work == NULL) {
+        int n = __atomic_load_n(&pool_deques, __ATOMIC_ACQUIRE);
+        int start = self >= 0 ? self + 1 : 0;
+        int nodes = xfs_numa_get_affinity() ? xfs_numa_nodes() : 1;
+        int node = self >= 0 ? self % nodes : (nodes > 1 ? xfs_numa_current_node() : 0);
+        for (int pass = 0; pass < (nodes > 1 ? 2 : 1) && work == NULL; pass++) {
+            for (int i = 0; i < n && work == NULL; i++) {
+                int victim = (start + i) % n;
+                if (victim != self && (victim % nodes == node) == (pass == 0)) {
+                    work = deque_steal(&deques[victim]);
+                }
+            }
+        }
+        *stolen = work != NULL;
+    }
+    if (work != NULL) {
+        __atomic_sub_fetch(&pool_queued, 1, __ATOMIC_RELAXED);
+    }
+    return work;
+}
+
+static void stats_max(uint64_t *max, uint64_t v) {
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (v > cur && !__atomic_compare_exchange_n(max, &cur, v, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Run a task; it may be queued again (or freed) as soon as fn returns, so nothing reads it after
+static void workq_run(xfs_work_t *work, int stolen) {
+    xfs_work_type_t type = work->type;
+    xfs_work_group_t *group = work->group;
+    uint64_t start_ns = xfs_stats_now();
+    uint64_t wait_ns = start_ns - work->queued_ns;
+
+    work->fn(work->arg);
+
+    xfs_workq_stats_t *s = &work_stats[type];
+    __atomic_add_fetch(&s->run, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->stolen, (uint64_t)stolen, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->run_ns, xfs_stats_now() - start_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->wait_ns, wait_ns, __ATOMIC_RELAXED);
+    stats_max(&s->max_wait_ns, wait_ns);
+
+    if (group != NULL && __atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&pool_lock);
+        pthread_cond_broadcast(&pool_done_cond);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+static void *workq_worker(void *arg) {
+    int id = (int)(intptr_t)arg;
+    workq_self = id;
+    unsigned int epoch = 0;
+    int pinned = 0;
+
+    for (;;) {
+        if (id >= __atomic_load_n(&pool_threads, __ATOMIC_ACQUIRE)) {
+            break;  // The pool shrank
+        }
+
+        // Follow the NUMA affinity setting: pin to this worker's node, or unpin
+        if (xfs_numa_epoch() != epoch) {
+            epoch = xfs_numa_epoch();
+            if (xfs_numa_get_affinity()) {
+                pinned = xfs_numa_bind_thread(id % xfs_numa_nodes()) == 0;
+            } else if (pinned) {
+                xfs_numa_bind_thread(-1);
+                pinned = 0;
+            }
+        }
+
+        int stolen;
+        xfs_work_t *work = workq_take(id, &stolen);
+        if (work != NULL) {
+            workq_run(work, stolen);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        pool_idle++;
+        while (__atomic_load_n(&pool_queued, __ATOMIC_ACQUIRE) == 0 && id < pool_threads) {
+            pthread_cond_wait(&pool_work_cond, &pool_lock);
+        }
+        pool_idle--;
+        pthread_mutex_unlock(&pool_lock);
+    }
+
+    // Anything left in this deque is stolen by the remaining workers
+    pthread_mutex_lock(&pool_lock);
+    pthread_cond_broadcast(&pool_work_cond);
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+// Resize the pool (0 = one thread per online CPU, at least two); queued work is kept
+int xfs_workq_set_threads(int nthreads) {
+    if (nthreads <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 2 ? (int)ncpu : 2;
+    }
+    if (nthreads > XFS_WORKQ_MAX_THREADS) {
+        nthreads = XFS_WORKQ_MAX_THREADS;
+    }
+    pthread_once(&deques_once, workq_init_deques);
+
+    pthread_mutex_lock(&pool_resize_lock);
+    pthread_mutex_lock(&pool_lock);
+    int old = pool_threads;
+    __atomic_store_n(&pool_threads, nthreads, __ATOMIC_RELEASE);
+    if (nthreads > pool_deques) {
+        __atomic_store_n(&pool_deques, nthreads, __ATOMIC_RELEASE);
+    }
+    pthread_cond_broadcast(&pool_work_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = nthreads; i < old; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    int ret = 0;
+    for (int i = old; i < nthreads; i++) {
+        if (pthread_create(&workers[i], NULL, workq_worker, (void *)(intptr_t)i) != 0) {
+            __atomic_store_n(&pool_threads, i, __ATOMIC_RELEASE);
+            ret = i > 0 ? 0 : -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_resize_lock);
+    return ret;
+}
+
+// Number of worker threads (starting the pool if needed)
+int xfs_workq_threads(void) {
+    if (__atomic_load_n(&pool_threads, __ATOMIC_ACQUIRE) == 0) {
+        xfs_workq_set_threads(0);
+    }
+    return __atomic_load_n(&pool_threads, __ATOMIC_ACQUIRE);
+}
+
+static int workq_push(xfs_work_t *work, xfs_work_group_t *group, xfs_work_type_t type,
+                      void (*fn)(void *arg), void *arg) {
+    int nthreads = xfs_workq_threads();
+    if (nthreads == 0) {
+        return -1;
+    }
+
+    work->fn = fn;
+    work->arg = arg;
+    work->type = type;
+    work->group = group;
+    work->queued_ns = xfs_stats_now();
+
+    // A worker keeps its own tasks; others are dealt round-robin, across the
+    // workers of the caller's node when NUMA affinity is on
+    int d = workq_self;
+    if (d < 0 || d >= nthreads) {
+        unsigned int next = __atomic_fetch_add(&pool_next, 1, __ATOMIC_RELAXED);
+        int nodes = xfs_numa_get_affinity() ? xfs_numa_nodes() : 1;
+        int node = nodes > 1 ? xfs_numa_current_node() : 0;
+        int local = node < nthreads ? (nthreads - node + nodes - 1) / nodes : 0;  // Workers node, node + nodes, ...
+        d = local > 0 ? node + (int)(next % (unsigned int)local) * nodes : (int)(next % (unsigned int)nthreads);
+    }
+    if (deque_push(&deques[d], work) != 0) {
+        return -1;
+    }
+    __atomic_add_fetch(&work_stats[type].queued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool_queued, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&pool_lock);
+    if (pool_idle > 0) {
+        pthread_cond_signal(&pool_work_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return 0;
+}
+
+// Run fn(arg) on the pool
+int xfs_workq_queue(xfs_work_t *work, xfs_work_type_t type, void (*fn)(void *arg), void *arg) {
+    return workq_push(work, NULL, type, fn, arg);
+}
+
+// Start an empty group
+void xfs_work_group_init(xfs_work_group_t *group) {
+    group->pending = 0;
+}
+
+// Run fn(arg) on the pool as part of group
+int xfs_workq_queue_group(xfs_work_group_t *group, xfs_work_t *work, xfs_work_type_t type,
+                          void (*fn)(void *arg), void *arg) {
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    if (workq_push(work, group, type, fn, arg) != 0) {
+        __atomic_sub_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+// Wait for every task of group, running queued tasks meanwhile
+void xfs_work_group_wait(xfs_work_group_t *group) {
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        int stolen;
+        xfs_work_t *work = workq_take(workq_self, &stolen);
+        if (work != NULL) {
+            workq_run(work, stolen);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        if (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+            pthread_cond_wait(&pool_done_cond, &pool_lock);
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+// Copy the counters of one kind of work
+void xfs_workq_get_stats(xfs_work_type_t type, xfs_workq_stats_t *stats) {
+    xfs_workq_stats_t *s = &work_stats[type];
+    stats->queued = __atomic_load_n(&s->queued, __ATOMIC_RELAXED);
+    stats->run = __atomic_load_n(&s->run, __ATOMIC_RELAXED);
+    stats->stolen = __atomic_load_n(&s->stolen, __ATOMIC_RELAXED);
+    stats->run_ns = __atomic_load_n(&s->run_ns, __ATOMIC_RELAXED);
+    stats->wait_ns = __atomic_load_n(&s->wait_ns, __ATOMIC_RELAXED);
+    stats->max_wait_ns = __atomic_load_n(&s->max_wait_ns, __ATOMIC_RELAXED);
+}
+
+// Print the counters of every kind of work
+void xfs_workq_print_stats(void) {
+    printf("\n--- BACKGROUND WORK (%d threads) ---\n", __atomic_load_n(&pool_threads, __ATOMIC_ACQUIRE));
+    printf("%-10s %10s %10s %10s %12s %12s %12s\n",
+           "type", "queued", "run", "stolen", "avg_run(ns)", "avg_wait(ns)", "max_wait(ns)");
+    for (int i = 0; i < XFS_WORK_MAX; i++) {
+        xfs_workq_stats_t s;
+        xfs_workq_get_stats((xfs_work_type_t)i, &s);
+        printf("%-10s %10llu %10llu %10llu %12llu %12llu %12llu\n",
+               work_names[i],
+               (unsigned long long)s.queued,
+               (unsigned long long)s.run,
+               (unsigned long long)s.stolen,
+               (unsigned long long)(s.run ? s.run_ns / s.run : 0),
+               (unsigned long long)(s.run ? s.wait_ns / s.run : 0),
+               (unsigned long long)s.max_wait_ns);
+    }
+    printf("------------------\n");
+}
+
+// Zero the counters
+void xfs_workq_reset_stats(void) {
+    for (int i = 0; i < XFS_WORK_MAX; i++) {
+        xfs_workq_stats_t *s = &work_stats[i];
+        __atomic_store_n(&s->queued, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->run, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->stolen, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->run_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->wait_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->max_wait_ns, 0, __ATOMIC_RELAXED);
+    }
+}